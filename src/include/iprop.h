@@ -179,6 +179,12 @@ struct kdb_last_t {
 };
 typedef struct kdb_last_t kdb_last_t;
 
+struct kdb_incr_wait_t {
+	kdb_last_t last;
+	uint32_t timeout;
+};
+typedef struct kdb_incr_wait_t kdb_incr_wait_t;
+
 struct kdb_incr_result_t {
 	kdb_last_t lastentry;
 	kdb_ulog_t updates;
@@ -208,6 +214,12 @@ extern  kdb_fullresync_result_t * iprop_full_resync_1_svc(void *, struct svc_req
 #define IPROP_FULL_RESYNC_EXT 3
 extern	kdb_fullresync_result_t * iprop_full_resync_ext_1(uint32_t *, CLIENT *);
 extern	kdb_fullresync_result_t * iprop_full_resync_ext_1_svc(uint32_t *, struct svc_req *);
+#define IPROP_GET_UPDATES_WAIT 4
+extern  kdb_incr_result_t * iprop_get_updates_wait_1(kdb_incr_wait_t *, CLIENT *);
+extern  kdb_incr_result_t * iprop_get_updates_wait_1_svc(kdb_incr_wait_t *, struct svc_req *);
+#define IPROP_FULL_RESYNC_STREAM 5
+extern  kdb_fullresync_result_t * iprop_full_resync_stream_1(uint32_t *, CLIENT *);
+extern  kdb_fullresync_result_t * iprop_full_resync_stream_1_svc(uint32_t *, struct svc_req *);
 extern int krb5_iprop_prog_1_freeresult (SVCXPRT *, xdrproc_t, caddr_t);
 
 #else /* K&R C */
@@ -223,6 +235,12 @@ extern  kdb_fullresync_result_t * iprop_full_resync_1_svc();
 #define IPROP_FULL_RESYNC_EXT 3
 extern  kdb_fullresync_result_t * iprop_full_resync_ext_1(uint32_t *, CLIENT *);
 extern  kdb_fullresync_result_t * iprop_full_resync_ext_1_svc(uint32_t *, struct svc_req *);
+#define IPROP_GET_UPDATES_WAIT 4
+extern  kdb_incr_result_t * iprop_get_updates_wait_1();
+extern  kdb_incr_result_t * iprop_get_updates_wait_1_svc();
+#define IPROP_FULL_RESYNC_STREAM 5
+extern  kdb_fullresync_result_t * iprop_full_resync_stream_1();
+extern  kdb_fullresync_result_t * iprop_full_resync_stream_1_svc();
 extern int krb5_iprop_prog_1_freeresult ();
 #endif /* K&R C */
 
@@ -244,6 +262,7 @@ extern  bool_t xdr_kdb_incr_update_t (XDR *, kdb_incr_update_t*);
 extern  bool_t xdr_kdb_ulog_t (XDR *, kdb_ulog_t*);
 extern  bool_t xdr_update_status_t (XDR *, update_status_t*);
 extern  bool_t xdr_kdb_last_t (XDR *, kdb_last_t*);
+extern  bool_t xdr_kdb_incr_wait_t (XDR *, kdb_incr_wait_t*);
 extern  bool_t xdr_kdb_incr_result_t (XDR *, kdb_incr_result_t*);
 extern  bool_t xdr_kdb_fullresync_result_t (XDR *, kdb_fullresync_result_t*);
 
@@ -263,6 +282,7 @@ extern bool_t xdr_kdb_incr_update_t ();
 extern bool_t xdr_kdb_ulog_t ();
 extern bool_t xdr_update_status_t ();
 extern bool_t xdr_kdb_last_t ();
+extern bool_t xdr_kdb_incr_wait_t ();
 extern bool_t xdr_kdb_incr_result_t ();
 extern bool_t xdr_kdb_fullresync_result_t ();
 
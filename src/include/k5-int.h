@@ -223,13 +223,21 @@ typedef INT64_TYPE krb5_int64;
 #define KRB5_CONF_IPROP_PORT                  "iprop_port"
 #define KRB5_CONF_IPROP_SLAVE_POLL            "iprop_slave_poll"
 #define KRB5_CONF_IPROP_LOGFILE               "iprop_logfile"
+#define KRB5_CONF_IPROP_ULOG_SYNC_WINDOW      "iprop_ulog_sync_window"
 #define KRB5_CONF_K5LOGIN_AUTHORITATIVE       "k5login_authoritative"
 #define KRB5_CONF_K5LOGIN_DIRECTORY           "k5login_directory"
 #define KRB5_CONF_KADMIND_PORT                "kadmind_port"
 #define KRB5_CONF_KRB524_SERVER               "krb524_server"
 #define KRB5_CONF_KDC                         "kdc"
 #define KRB5_CONF_KDCDEFAULTS                 "kdcdefaults"
+#define KRB5_CONF_KDC_KEY_CACHE_SIZE          "kdc_key_cache_size"
+#define KRB5_CONF_KDC_LOOKASIDE_MAX_ENTRIES   "kdc_lookaside_max_entries"
+#define KRB5_CONF_KDC_LOOKASIDE_MAX_SIZE      "kdc_lookaside_max_size"
 #define KRB5_CONF_KDC_PORTS                   "kdc_ports"
+#define KRB5_CONF_KDC_PRINCIPAL_CACHE_LIFETIME "kdc_principal_cache_lifetime"
+#define KRB5_CONF_KDC_PRINCIPAL_CACHE_SIZE    "kdc_principal_cache_size"
+#define KRB5_CONF_KDC_REUSEPORT               "kdc_reuseport"
+#define KRB5_CONF_KDC_SHARED_LOOKASIDE        "kdc_shared_lookaside"
 #define KRB5_CONF_KDC_TCP_PORTS               "kdc_tcp_ports"
 #define KRB5_CONF_MAX_DGRAM_REPLY_SIZE        "kdc_max_dgram_reply_size"
 #define KRB5_CONF_KDC_DEFAULT_OPTIONS         "kdc_default_options"
@@ -541,17 +549,28 @@ krb5_os_hostaddr(krb5_context, const char *, krb5_address ***);
 krb5_error_code
 krb5int_get_domain_realm_mapping(krb5_context , const char *, char ***);
 
+/* Number of derived keys cached in each krb5_key. */
+#define DERIVED_KEY_CACHE_SIZE 16
+
 struct derived_key {
-    krb5_data constant;
+    krb5_data constant;         /* NULL data if the slot is unused */
     krb5_key dkey;
-    struct derived_key *next;
+};
+
+/* A small hash table of keys derived from a krb5_key, indexed by the
+ * derivation constant. */
+struct derived_key_cache {
+    struct derived_key slots[DERIVED_KEY_CACHE_SIZE];
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
 };
 
 /* Internal structure of an opaque key identifier */
 struct krb5_key_st {
     krb5_keyblock keyblock;
     int refcount;
-    struct derived_key *derived;
+    struct derived_key_cache *derived;  /* NULL until a key is derived */
     /*
      * Cache of data private to the cipher implementation, which we
      * don't want to have to recompute for every operation.  This may
@@ -1547,6 +1566,13 @@ encode_krb5_priv(const krb5_priv *rep, krb5_data **code);
 krb5_error_code
 encode_krb5_enc_priv_part(const krb5_priv_enc_part *rep, krb5_data **code);
 
+/* Encode rep with headroom bytes before the encoding and tailroom bytes after
+ * it, so that it can be encrypted in place. */
+krb5_error_code
+encode_krb5_enc_priv_part_room(const krb5_priv_enc_part *rep,
+                               unsigned int headroom, unsigned int tailroom,
+                               krb5_data **code);
+
 krb5_error_code
 encode_krb5_cred(const krb5_cred *rep, krb5_data **code);
 krb5_error_code
@@ -2271,6 +2297,10 @@ extern krb5_error_code krb5int_translate_gai_error(int);
 extern krb5_error_code
 krb5int_c_mandatory_cksumtype(krb5_context, krb5_enctype, krb5_cksumtype *);
 
+void
+krb5int_c_derived_key_stats(krb5_key key, unsigned long *hits,
+                            unsigned long *misses, unsigned long *evictions);
+
 /*
  * Referral definitions, debugging hooks, and subfunctions.
  */
@@ -2345,6 +2375,10 @@ krb5_error_code krb5_kdc_rep_decrypt_proc(krb5_context, const krb5_keyblock *,
 krb5_error_code KRB5_CALLCONV krb5_decrypt_tkt_part(krb5_context,
                                                     const krb5_keyblock *,
                                                     krb5_ticket * );
+krb5_error_code KRB5_CALLCONV krb5_decrypt_tkt_part_k(krb5_context, krb5_key,
+                                                      krb5_ticket *);
+krb5_error_code KRB5_CALLCONV krb5_encrypt_tkt_part_k(krb5_context, krb5_key,
+                                                      krb5_ticket *);
 
 krb5_error_code krb5_get_cred_via_tkt(krb5_context, krb5_creds *, krb5_flags,
                                       krb5_address *const *, krb5_creds *,
@@ -2445,6 +2479,10 @@ krb5_error_code krb5_auth_con_setpermetypes(krb5_context, krb5_auth_context,
 krb5_error_code krb5_auth_con_getpermetypes(krb5_context, krb5_auth_context,
                                             krb5_enctype **);
 
+krb5_error_code KRB5_CALLCONV
+krb5_auth_con_setuseruserkey_k(krb5_context context,
+                               krb5_auth_context auth_context, krb5_key key);
+
 krb5_error_code krb5_auth_con_get_subkey_enctype(krb5_context context,
                                                  krb5_auth_context,
                                                  krb5_enctype *);
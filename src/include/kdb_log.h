@@ -79,6 +79,9 @@ extern krb5_error_code ulog_finish_update(krb5_context context,
                                           kdb_incr_update_t *upd);
 extern krb5_error_code ulog_get_entries(krb5_context context, kdb_last_t last,
                                         kdb_incr_result_t *ulog_handle);
+extern krb5_error_code ulog_get_entries_immediate(krb5_context context,
+                                                  kdb_last_t last,
+                                                  kdb_incr_result_t *ulog_handle);
 
 extern krb5_error_code
 ulog_replay(krb5_context context, kdb_incr_result_t *incr_ret, char **db_args);
@@ -91,11 +94,19 @@ extern krb5_error_code
 ulog_conv_2dbentry(krb5_context context, krb5_db_entry **entry,
                    kdb_incr_update_t *update);
 
+extern krb5_error_code
+ulog_conv_merge(krb5_context context, krb5_db_entry *entry,
+                kdb_incr_update_t *update);
+
 extern void ulog_free_entries(kdb_incr_update_t *updates, int no_of_updates);
 extern krb5_error_code ulog_set_role(krb5_context ctx, iprop_role role);
 
 extern krb5_error_code ulog_lock(krb5_context ctx, int mode);
 
+extern krb5_error_code ulog_set_sync_window(krb5_context context,
+                                            uint32_t window);
+extern krb5_error_code ulog_sync_pending(krb5_context context);
+
 typedef struct kdb_hlog {
     uint32_t        kdb_hmagic;     /* Log header magic # */
     uint16_t        db_version_num; /* Kerberos database version no. */
@@ -122,6 +133,10 @@ typedef struct _kdb_log_context {
     kdb_hlog_t      *ulog;
     uint32_t        ulogentries;
     int             ulogfd;
+    uint32_t        sync_window;    /* Group commit window in ms, or 0 */
+    uint32_t        pending;        /* # of committed updates not synced */
+    kdb_sno_t       pending_sno;    /* First serial # not synced */
+    kdbe_time_t     pending_time;   /* Time of first update not synced */
 } kdb_log_context;
 
 #ifdef  __cplusplus
@@ -43,8 +43,10 @@ void init_addr(krb5_fulladdr *, struct sockaddr *);
 verto_ctx *loop_init(verto_ev_type types);
 krb5_error_code loop_add_udp_port(int port);
 krb5_error_code loop_add_tcp_port(int port);
+krb5_error_code loop_set_reuseport(int value);
 krb5_error_code loop_add_rpc_service(int port, u_long prognum, u_long versnum,
                                      void (*dispatch)());
+void loop_set_rpc_close_hook(void (*hook)(int fd));
 krb5_error_code loop_setup_routing_socket(verto_ctx *ctx, void *handle,
                                           const char *progname);
 krb5_error_code loop_setup_network(verto_ctx *ctx, void *handle,
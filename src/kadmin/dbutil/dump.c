@@ -29,6 +29,8 @@
  */
 
 #include <stdio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <k5-int.h>
 #include <kadm5/admin.h>
 #include <kadm5/server_internal.h>
@@ -74,6 +76,9 @@ struct dump_args {
     char                **names;
     int                 nnames;
     int                 flags;
+    krb5_ui_4           nrecords;       /* binary format: records written */
+    krb5_ui_4           crc;            /* binary format: CRC-32 so far */
+    krb5_error_code     error;          /* binary format: policy dump error */
 };
 
 static krb5_error_code dump_k5beta_iterator (krb5_pointer,
@@ -94,6 +99,9 @@ static krb5_error_code dump_ov_princ (krb5_pointer,
                                       krb5_db_entry *);
 static void dump_k5beta7_policy (void *, osa_policy_ent_t);
 static void dump_r1_8_policy (void *, osa_policy_ent_t);
+static krb5_error_code dump_binary_princ (krb5_pointer,
+                                          krb5_db_entry *);
+static void dump_binary_policy (void *, osa_policy_ent_t);
 
 typedef krb5_error_code (*dump_func)(krb5_pointer,
                                      krb5_db_entry *);
@@ -194,6 +202,16 @@ dump_version ipropx_1_version = {
     dump_r1_8_policy,
     process_r1_8_record,
 };
+/* Records are loaded by restore_binary_dump(), not one at a time. */
+dump_version binary_version = {
+    "Kerberos version 5 binary format",
+    "kdb5_util binary_dump version 1",
+    0,
+    0,
+    dump_binary_princ,
+    dump_binary_policy,
+    NULL,
+};
 
 /* External data */
 extern char             *current_dbname;
@@ -257,6 +275,10 @@ static const char null_mprinc_name[] = "kdb5_dump@MISSING";
 #define dbunlockerr_fmt   _("%s: cannot unlock database %s (%s)\n")
 #define dbcreaterr_fmt    _("%s: cannot create database %s (%s)\n")
 #define dfile_err_fmt     _("%s: cannot open %s (%s)\n")
+#define read_bprinc       _("principal record")
+#define read_bpolicy      _("policy record")
+#define btype_err_fmt     _("%s(%d): unknown record type %d\n")
+#define bdump_bad_fmt     _("%s: binary dump %s is truncated or damaged\n")
 
 static const char oldoption[] = "-old";
 static const char b6option[] = "-b6";
@@ -267,6 +289,7 @@ static const char updateoption[] = "-update";
 static const char hashoption[] = "-hash";
 static const char ovoption[] = "-ov";
 static const char r13option[] = "-r13";
+static const char binaryoption[] = "-b";
 static const char dump_tmptrail[] = "~";
 
 /*
@@ -948,6 +971,213 @@ void dump_r1_8_policy(void *data, osa_policy_ent_t entry)
             entry->pw_failcnt_interval, entry->pw_lockout_duration);
 }
 
+/*
+ * Binary dump format.  After the text header line, the dump is a sequence of
+ * records, each a 4-byte type and a 4-byte body length followed by the body.
+ * All integers are 32-bit big-endian, and byte strings are a length followed
+ * by the bytes, so keys and tagged data are copied rather than hex-encoded.
+ * The last record is BDUMP_END, giving the number of records before it and a
+ * CRC-32 of their bytes, so that a truncated or damaged dump is rejected.
+ */
+#define BDUMP_PRINC     1
+#define BDUMP_POLICY    2
+#define BDUMP_END       3
+#define BDUMP_HDRLEN    8
+#define BDUMP_MAXREC    (16 * 1024 * 1024)
+
+/* Continue the CRC-32 crc (as computed by zlib) over len bytes of data. */
+static krb5_ui_4
+bdump_crc32(krb5_ui_4 crc, const unsigned char *data, size_t len)
+{
+    static krb5_ui_4 table[256];
+    krb5_ui_4 c;
+    int i, j;
+
+    if (table[1] == 0) {
+        for (i = 0; i < 256; i++) {
+            c = i;
+            for (j = 0; j < 8; j++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    crc = ~crc & 0xffffffff;
+    while (len-- > 0)
+        crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc & 0xffffffff;
+}
+
+static void
+bdump_put32(struct k5buf *buf, krb5_ui_4 val)
+{
+    unsigned char b[4];
+
+    store_32_be(val, b);
+    krb5int_buf_add_len(buf, (char *)b, 4);
+}
+
+static void
+bdump_put_data(struct k5buf *buf, const void *data, size_t len)
+{
+    bdump_put32(buf, len);
+    krb5int_buf_add_len(buf, data, len);
+}
+
+/* Start a record in buf, leaving room for the type and length. */
+static void
+bdump_start(struct k5buf *buf)
+{
+    krb5int_buf_init_dynamic(buf);
+    bdump_put32(buf, 0);
+    bdump_put32(buf, 0);
+}
+
+/* Fill in the type and length of the record in buf and write it out. */
+static krb5_error_code
+bdump_write(struct dump_args *arg, krb5_ui_4 type, struct k5buf *buf)
+{
+    unsigned char *rec = (unsigned char *)krb5int_buf_data(buf);
+    size_t len = krb5int_buf_len(buf);
+
+    if (rec == NULL)
+        return ENOMEM;
+    store_32_be(type, rec);
+    store_32_be(len - BDUMP_HDRLEN, rec + 4);
+    arg->crc = bdump_crc32(arg->crc, rec, len);
+    arg->nrecords++;
+    if (fwrite(rec, 1, len, arg->ofile) != len)
+        return errno;
+    return 0;
+}
+
+/*
+ * dump_binary_princ()  - Output a principal record in binary format.
+ */
+static krb5_error_code
+dump_binary_princ(krb5_pointer ptr, krb5_db_entry *entry)
+{
+    struct dump_args *arg = ptr;
+    krb5_error_code retval;
+    char *name = NULL;
+    krb5_tl_data *tlp;
+    krb5_key_data *kdata;
+    struct k5buf buf;
+    krb5_ui_4 count;
+    int omit_nra = (arg->flags & FLAG_OMIT_NRA), i, j;
+
+    retval = krb5_unparse_name(arg->kcontext, entry->princ, &name);
+    if (retval) {
+        fprintf(stderr, pname_unp_err,
+                arg->programname, error_message(retval));
+        return retval;
+    }
+
+    if (mkey_convert) {
+        retval = master_key_convert(arg->kcontext, entry);
+        if (retval) {
+            com_err(arg->programname, retval, remaster_err_fmt, name);
+            goto cleanup;
+        }
+    }
+
+    if (arg->nnames && !name_matches(name, arg))
+        goto cleanup;
+
+    bdump_start(&buf);
+    bdump_put32(&buf, entry->attributes);
+    bdump_put32(&buf, entry->max_life);
+    bdump_put32(&buf, entry->max_renewable_life);
+    bdump_put32(&buf, entry->expiration);
+    bdump_put32(&buf, entry->pw_expiration);
+    bdump_put32(&buf, omit_nra ? 0 : entry->last_success);
+    bdump_put32(&buf, omit_nra ? 0 : entry->last_failed);
+    bdump_put32(&buf, omit_nra ? 0 : entry->fail_auth_count);
+    bdump_put32(&buf, entry->len);
+    bdump_put_data(&buf, name, strlen(name));
+
+    for (count = 0, tlp = entry->tl_data; tlp; tlp = tlp->tl_data_next)
+        count++;
+    bdump_put32(&buf, count);
+    for (tlp = entry->tl_data; tlp; tlp = tlp->tl_data_next) {
+        bdump_put32(&buf, tlp->tl_data_type);
+        bdump_put_data(&buf, tlp->tl_data_contents, tlp->tl_data_length);
+    }
+
+    bdump_put32(&buf, entry->n_key_data);
+    for (i = 0; i < entry->n_key_data; i++) {
+        kdata = &entry->key_data[i];
+        bdump_put32(&buf, kdata->key_data_ver);
+        bdump_put32(&buf, kdata->key_data_kvno);
+        for (j = 0; j < kdata->key_data_ver; j++) {
+            bdump_put32(&buf, kdata->key_data_type[j]);
+            bdump_put_data(&buf, kdata->key_data_contents[j],
+                           kdata->key_data_length[j]);
+        }
+    }
+
+    bdump_put_data(&buf, entry->e_data, entry->e_length);
+
+    retval = bdump_write(arg, BDUMP_PRINC, &buf);
+    krb5int_free_buf(&buf);
+    if (!retval && (arg->flags & FLAG_VERBOSE))
+        fprintf(stderr, "%s\n", name);
+
+cleanup:
+    free(name);
+    return retval;
+}
+
+static void
+dump_binary_policy(void *data, osa_policy_ent_t entry)
+{
+    struct dump_args *arg = data;
+    struct k5buf buf;
+    krb5_error_code retval;
+
+    bdump_start(&buf);
+    bdump_put_data(&buf, entry->name, strlen(entry->name));
+    bdump_put32(&buf, entry->pw_min_life);
+    bdump_put32(&buf, entry->pw_max_life);
+    bdump_put32(&buf, entry->pw_min_length);
+    bdump_put32(&buf, entry->pw_min_classes);
+    bdump_put32(&buf, entry->pw_history_num);
+    bdump_put32(&buf, entry->policy_refcnt);
+    bdump_put32(&buf, entry->pw_max_fail);
+    bdump_put32(&buf, entry->pw_failcnt_interval);
+    bdump_put32(&buf, entry->pw_lockout_duration);
+    retval = bdump_write(arg, BDUMP_POLICY, &buf);
+    krb5int_free_buf(&buf);
+    if (retval && !arg->error)
+        arg->error = retval;
+}
+
+/* Write the end record of a binary dump. */
+static krb5_error_code
+dump_binary_end(struct dump_args *arg)
+{
+    unsigned char rec[BDUMP_HDRLEN + 8];
+
+    if (arg->error)
+        return arg->error;
+    store_32_be(BDUMP_END, rec);
+    store_32_be(8, rec + 4);
+    store_32_be(arg->nrecords, rec + 8);
+    store_32_be(arg->crc, rec + 12);
+    if (fwrite(rec, 1, sizeof(rec), arg->ofile) != sizeof(rec))
+        return errno;
+    return 0;
+}
+
+/* Return true if line is the header line of a binary dump. */
+static int
+is_binary_header(const char *line)
+{
+    size_t len = strlen(binary_version.header);
+
+    return strncmp(line, binary_version.header, len) == 0 &&
+        (line[len] == ' ' || line[len] == '\n');
+}
+
 static void print_key_data(FILE *f, krb5_key_data *key_data)
 {
     int c;
@@ -1058,7 +1288,7 @@ static krb5_error_code dump_ov_princ(krb5_pointer ptr, krb5_db_entry *kdb)
 
 /*
  * usage is:
- *      dump_db [-old] [-b6] [-b7] [-ov] [-r13] [-verbose] [-mkey_convert]
+ *      dump_db [-old] [-b6] [-b7] [-ov] [-r13] [-b] [-verbose] [-mkey_convert]
  *              [-new_mkey_file mkey_file] [-rev] [-recurse]
  *              [filename [principals...]]
  */
@@ -1078,6 +1308,7 @@ dump_db(argc, argv)
     bool_t              dump_sno = FALSE;
     kdb_log_context     *log_ctx;
     unsigned int        ipropx_version = IPROPX_VERSION_0;
+    int                 binary = 0;
 
     /*
      * Parse the arguments.
@@ -1105,6 +1336,8 @@ dump_db(argc, argv)
             dump = &ov_version;
         else if (!strcmp(argv[aindex], r13option))
             dump = &r1_3_version;
+        else if (!strcmp(argv[aindex], binaryoption))
+            binary = 1;
         else if (!strncmp(argv[aindex], ipropoption, sizeof(ipropoption) - 1)) {
             if (log_ctx && log_ctx->iproprole) {
                 /* Note: ipropx_version is the maximum version acceptable */
@@ -1141,6 +1374,9 @@ dump_db(argc, argv)
         else
             break;
     }
+    /* The binary format carries everything an iprop dump needs. */
+    if (binary)
+        dump = &binary_version;
 
     arglist.names = (char **) NULL;
     arglist.nnames = 0;
@@ -1271,6 +1507,9 @@ dump_db(argc, argv)
         arglist.programname = progname;
         arglist.ofile = f;
         arglist.kcontext = util_context;
+        arglist.nrecords = 0;
+        arglist.crc = 0;
+        arglist.error = 0;
         fprintf(arglist.ofile, "%s", dump->header);
 
         if (dump_sno) {
@@ -1285,7 +1524,7 @@ dump_db(argc, argv)
                 goto unlock_and_return;
             }
 
-            if (ipropx_version)
+            if (ipropx_version || dump == &binary_version)
                 fprintf(f, " %u", IPROPX_VERSION);
             fprintf(f, " %u", log_ctx->ulog->kdb_last_sno);
             fprintf(f, " %u", log_ctx->ulog->kdb_last_time.seconds);
@@ -1312,6 +1551,17 @@ dump_db(argc, argv)
                     error_message(kret));
             exit_status++;
         }
+        if (dump == &binary_version && !exit_status &&
+            (kret = dump_binary_end(&arglist))) {
+            fprintf(stderr, dumprec_err, progname, dump->name,
+                    error_message(kret));
+            exit_status++;
+        }
+        if (fflush(f) != 0 || ferror(f)) {
+            fprintf(stderr, dumprec_err, progname, dump->name,
+                    error_message(errno));
+            exit_status++;
+        }
         if (ofile && f != stdout && !exit_status) {
             if (locked) {
                 (void) krb5_lock_file(util_context, fileno(f), KRB5_LOCKMODE_UNLOCK);
@@ -1485,6 +1735,32 @@ update_tl_data(kcontext, dbentp, mod_name, mod_date, last_pwd_change)
 }
 #endif
 
+/*
+ * Set the mask fields of dbentry implied by its kadm5 data in tl.
+ */
+static void
+set_kadm_data_mask(krb5_db_entry *dbentry, krb5_tl_data *tl)
+{
+    XDR xdrs;
+    osa_princ_ent_rec osa_princ_ent;
+
+    /* Assuming aux_attributes will always be there */
+    dbentry->mask |= KADM5_AUX_ATTRIBUTES;
+
+    /* test for an actual policy reference */
+    memset(&osa_princ_ent, 0, sizeof(osa_princ_ent));
+    xdrmem_create(&xdrs, (char *)tl->tl_data_contents,
+                  tl->tl_data_length, XDR_DECODE);
+    if (xdr_osa_princ_ent_rec(&xdrs, &osa_princ_ent) &&
+        (osa_princ_ent.aux_attributes & KADM5_POLICY) &&
+        osa_princ_ent.policy != NULL) {
+
+        dbentry->mask |= KADM5_POLICY;
+        kdb_free_entry(NULL, NULL, &osa_princ_ent);
+    }
+    xdr_destroy(&xdrs);
+}
+
 /*
  * process_k5beta_record()      - Handle a dump record in old format.
  *
@@ -1924,29 +2200,8 @@ process_k5beta6_record(fname, kcontext, filep, flags, linenop)
                                     break;
                                 }
                                 /* test to set mask fields */
-                                if (t1 == KRB5_TL_KADM_DATA) {
-                                    XDR xdrs;
-                                    osa_princ_ent_rec osa_princ_ent;
-
-                                    /*
-                                     * Assuming aux_attributes will always be
-                                     * there
-                                     */
-                                    dbentry->mask |= KADM5_AUX_ATTRIBUTES;
-
-                                    /* test for an actual policy reference */
-                                    memset(&osa_princ_ent, 0, sizeof(osa_princ_ent));
-                                    xdrmem_create(&xdrs, (char *)tl->tl_data_contents,
-                                                  tl->tl_data_length, XDR_DECODE);
-                                    if (xdr_osa_princ_ent_rec(&xdrs, &osa_princ_ent) &&
-                                        (osa_princ_ent.aux_attributes & KADM5_POLICY) &&
-                                        osa_princ_ent.policy != NULL) {
-
-                                        dbentry->mask |= KADM5_POLICY;
-                                        kdb_free_entry(NULL, NULL, &osa_princ_ent);
-                                    }
-                                    xdr_destroy(&xdrs);
-                                }
+                                if (t1 == KRB5_TL_KADM_DATA)
+                                    set_kadm_data_mask(dbentry, tl);
                             }
                             else {
                                 /* Should be a null field */
@@ -2286,6 +2541,399 @@ process_r1_8_record(fname, kcontext, filep, flags, linenop)
     return 0;
 }
 
+/* A position within the body of a binary dump record. */
+struct bdump_cursor {
+    const unsigned char *ptr;
+    size_t len;
+    int bad;
+};
+
+/* Reader for the records of a binary dump, from a mapping or a stream. */
+struct bdump_reader {
+    FILE *f;
+    const unsigned char *map;   /* mapped records, or NULL to read f */
+    size_t maplen;
+    size_t off;
+    unsigned char *buf;
+    size_t bufsize;
+    int verified;               /* records already checked against trailer */
+    krb5_ui_4 nrecords;
+    krb5_ui_4 crc;
+};
+
+static krb5_ui_4
+bdump_get32(struct bdump_cursor *c)
+{
+    krb5_ui_4 val;
+
+    if (c->len < 4) {
+        c->bad = 1;
+        return 0;
+    }
+    val = load_32_be(c->ptr);
+    c->ptr += 4;
+    c->len -= 4;
+    return val;
+}
+
+/*
+ * Return a null-terminated copy of a byte string of at most maxlen bytes, and
+ * its length in *len_out.  An empty string yields NULL, as in the text
+ * formats.
+ */
+static void *
+bdump_get_data(struct bdump_cursor *c, size_t maxlen, size_t *len_out)
+{
+    size_t len = bdump_get32(c);
+    unsigned char *data;
+
+    *len_out = 0;
+    if (c->bad || len > c->len || len > maxlen) {
+        c->bad = 1;
+        return NULL;
+    }
+    if (len == 0)
+        return NULL;
+    data = malloc(len + 1);
+    if (data == NULL) {
+        c->bad = 1;
+        return NULL;
+    }
+    memcpy(data, c->ptr, len);
+    data[len] = '\0';
+    c->ptr += len;
+    c->len -= len;
+    *len_out = len;
+    return data;
+}
+
+/*
+ * Fetch the next record from r into *type and *c.  Returns 0 on success and
+ * -1 if the dump ends or a length is out of range.
+ */
+static int
+bdump_next(struct bdump_reader *r, krb5_ui_4 *type, struct bdump_cursor *c)
+{
+    const unsigned char *rec;
+    unsigned char *newbuf;
+    krb5_ui_4 len;
+
+    if (r->map != NULL) {
+        if (r->maplen - r->off < BDUMP_HDRLEN)
+            return -1;
+        rec = r->map + r->off;
+        len = load_32_be(rec + 4);
+        if (len > r->maplen - r->off - BDUMP_HDRLEN)
+            return -1;
+        r->off += BDUMP_HDRLEN + len;
+    } else {
+        if (r->buf == NULL) {
+            r->buf = malloc(BUFSIZ);
+            if (r->buf == NULL)
+                return -1;
+            r->bufsize = BUFSIZ;
+        }
+        if (fread(r->buf, 1, BDUMP_HDRLEN, r->f) != BDUMP_HDRLEN)
+            return -1;
+        len = load_32_be(r->buf + 4);
+        if (len > BDUMP_MAXREC)
+            return -1;
+        if (BDUMP_HDRLEN + len > r->bufsize) {
+            newbuf = realloc(r->buf, BDUMP_HDRLEN + len);
+            if (newbuf == NULL)
+                return -1;
+            r->buf = newbuf;
+            r->bufsize = BDUMP_HDRLEN + len;
+        }
+        if (fread(r->buf + BDUMP_HDRLEN, 1, len, r->f) != len)
+            return -1;
+        rec = r->buf;
+    }
+
+    *type = load_32_be(rec);
+    c->ptr = rec + BDUMP_HDRLEN;
+    c->len = len;
+    c->bad = 0;
+    if (*type != BDUMP_END) {
+        if (!r->verified)
+            r->crc = bdump_crc32(r->crc, rec, BDUMP_HDRLEN + len);
+        r->nrecords++;
+    }
+    return 0;
+}
+
+/*
+ * Check the end record in c against the records read before it, and make
+ * sure nothing follows it.  Returns 0 if the dump is intact.
+ */
+static int
+bdump_check_end(struct bdump_reader *r, struct bdump_cursor *c)
+{
+    krb5_ui_4 count, crc;
+
+    count = bdump_get32(c);
+    crc = bdump_get32(c);
+    if (c->bad || c->len != 0 || count != r->nrecords)
+        return -1;
+    if (!r->verified && crc != r->crc)
+        return -1;
+    if (r->map != NULL)
+        return (r->off == r->maplen) ? 0 : -1;
+    return (getc(r->f) == EOF) ? 0 : -1;
+}
+
+/*
+ * load_binary_princ()  - Store the principal in a binary dump record.
+ *
+ * Returns 0 for success and 1 for failure.
+ */
+static int
+load_binary_princ(char *fname, krb5_context kcontext, struct bdump_cursor *c,
+                  int flags, int recno)
+{
+    krb5_db_entry *dbentry;
+    krb5_tl_data **tlp, *tl;
+    krb5_key_data *kdata;
+    krb5_error_code kret;
+    char *name;
+    size_t len;
+    krb5_ui_4 count, i;
+    int j, retval = 1;
+
+    dbentry = krb5_db_alloc(kcontext, NULL, sizeof(*dbentry));
+    if (dbentry == NULL)
+        return 1;
+    memset(dbentry, 0, sizeof(*dbentry));
+
+    dbentry->attributes = bdump_get32(c);
+    dbentry->max_life = bdump_get32(c);
+    dbentry->max_renewable_life = bdump_get32(c);
+    dbentry->expiration = bdump_get32(c);
+    dbentry->pw_expiration = bdump_get32(c);
+    dbentry->last_success = bdump_get32(c);
+    dbentry->last_failed = bdump_get32(c);
+    dbentry->fail_auth_count = bdump_get32(c);
+    dbentry->len = bdump_get32(c);
+    name = bdump_get_data(c, c->len, &len);
+    if (name == NULL || strlen(name) != len)
+        c->bad = 1;
+
+    /* Each tagged data item and key takes at least eight bytes. */
+    count = bdump_get32(c);
+    if (count > c->len / 8 || count > 0x7fff)
+        c->bad = 1;
+    tlp = &dbentry->tl_data;
+    for (i = 0; i < count && !c->bad; i++) {
+        tl = calloc(1, sizeof(*tl));
+        if (tl == NULL) {
+            c->bad = 1;
+            break;
+        }
+        *tlp = tl;
+        tlp = &tl->tl_data_next;
+        dbentry->n_tl_data++;
+        tl->tl_data_type = bdump_get32(c);
+        tl->tl_data_contents = bdump_get_data(c, 0xffff, &len);
+        tl->tl_data_length = len;
+    }
+
+    count = bdump_get32(c);
+    if (count > c->len / 8 || count > 0x7fff)
+        c->bad = 1;
+    if (!c->bad && count > 0) {
+        dbentry->key_data = calloc(count, sizeof(krb5_key_data));
+        if (dbentry->key_data == NULL)
+            c->bad = 1;
+        else
+            dbentry->n_key_data = count;
+    }
+    for (i = 0; i < count && !c->bad; i++) {
+        kdata = &dbentry->key_data[i];
+        kdata->key_data_ver = bdump_get32(c);
+        kdata->key_data_kvno = bdump_get32(c);
+        if (kdata->key_data_ver < 0 ||
+            kdata->key_data_ver > KRB5_KDB_V1_KEY_DATA_ARRAY) {
+            c->bad = 1;
+            break;
+        }
+        for (j = 0; j < kdata->key_data_ver; j++) {
+            kdata->key_data_type[j] = bdump_get32(c);
+            kdata->key_data_contents[j] = bdump_get_data(c, 0xffff, &len);
+            kdata->key_data_length[j] = len;
+        }
+    }
+
+    dbentry->e_data = bdump_get_data(c, 0xffff, &len);
+    dbentry->e_length = len;
+
+    if (c->bad || c->len != 0) {
+        fprintf(stderr, read_err_fmt, fname, recno, read_bprinc);
+        goto cleanup;
+    }
+
+    kret = krb5_parse_name(kcontext, name, &dbentry->princ);
+    if (kret) {
+        fprintf(stderr, parse_err_fmt, fname, recno, name,
+                error_message(kret));
+        goto cleanup;
+    }
+
+    dbentry->mask = KADM5_LOAD | KADM5_PRINCIPAL | KADM5_ATTRIBUTES |
+        KADM5_MAX_LIFE | KADM5_MAX_RLIFE | KADM5_PRINC_EXPIRE_TIME |
+        KADM5_LAST_SUCCESS | KADM5_LAST_FAILED | KADM5_FAIL_AUTH_COUNT;
+    if (dbentry->n_tl_data)
+        dbentry->mask |= KADM5_TL_DATA;
+    if (dbentry->n_key_data)
+        dbentry->mask |= KADM5_KEY_DATA;
+    for (tl = dbentry->tl_data; tl; tl = tl->tl_data_next) {
+        if (tl->tl_data_type == KRB5_TL_KADM_DATA && tl->tl_data_length)
+            set_kadm_data_mask(dbentry, tl);
+    }
+
+    kret = krb5_db_put_principal(kcontext, dbentry);
+    if (kret) {
+        fprintf(stderr, store_err_fmt, fname, recno, name,
+                error_message(kret));
+        goto cleanup;
+    }
+    if (flags & FLAG_VERBOSE)
+        fprintf(stderr, add_princ_fmt, name);
+    retval = 0;
+
+cleanup:
+    free(name);
+    krb5_db_free_principal(kcontext, dbentry);
+    return retval;
+}
+
+/*
+ * load_binary_policy() - Store the policy in a binary dump record.
+ *
+ * Returns 0 for success and 1 for failure.
+ */
+static int
+load_binary_policy(char *fname, krb5_context kcontext,
+                   struct bdump_cursor *c, int flags, int recno)
+{
+    osa_policy_ent_rec rec;
+    size_t len;
+    int ret, retval = 1;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.name = bdump_get_data(c, 1024, &len);
+    rec.pw_min_life = bdump_get32(c);
+    rec.pw_max_life = bdump_get32(c);
+    rec.pw_min_length = bdump_get32(c);
+    rec.pw_min_classes = bdump_get32(c);
+    rec.pw_history_num = bdump_get32(c);
+    rec.policy_refcnt = bdump_get32(c);
+    rec.pw_max_fail = bdump_get32(c);
+    rec.pw_failcnt_interval = bdump_get32(c);
+    rec.pw_lockout_duration = bdump_get32(c);
+    if (c->bad || c->len != 0 || rec.name == NULL ||
+        strlen(rec.name) != len) {
+        fprintf(stderr, read_err_fmt, fname, recno, read_bpolicy);
+        goto cleanup;
+    }
+
+    if ((ret = krb5_db_create_policy(kcontext, &rec))) {
+        if ((ret = krb5_db_put_policy(kcontext, &rec))) {
+            fprintf(stderr, _("cannot create policy in record %d: %s\n"),
+                    recno, error_message(ret));
+            goto cleanup;
+        }
+    }
+    if (flags & FLAG_VERBOSE)
+        fprintf(stderr, _("created policy %s\n"), rec.name);
+    retval = 0;
+
+cleanup:
+    free(rec.name);
+    return retval;
+}
+
+/*
+ * restore_binary_dump()        - Restore the database from a binary dump.
+ *
+ * f is positioned just after the header line.  A regular file is mapped and
+ * checked against its end record before any of it is loaded, so a damaged
+ * dump never reaches the database even with -update.  Otherwise the records
+ * are read one at a time and the end record is checked last, which still
+ * keeps a bad dump from being promoted.
+ */
+static int
+restore_binary_dump(char *programname, krb5_context kcontext, char *dumpfile,
+                    FILE *f, int flags)
+{
+    struct bdump_reader r;
+    struct bdump_cursor c;
+    struct stat st;
+    krb5_ui_4 type;
+    void *map = NULL;
+    size_t maplen = 0;
+    long off;
+    int error = 0;
+
+    memset(&r, 0, sizeof(r));
+    r.f = f;
+    off = ftell(f);
+    if (off >= 0 && fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > off) {
+        maplen = st.st_size;
+        map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        if (map == MAP_FAILED)
+            map = NULL;
+    }
+
+    if (map != NULL) {
+        r.map = (unsigned char *)map + off;
+        r.maplen = maplen - off;
+        while (bdump_next(&r, &type, &c) == 0 && type != BDUMP_END)
+            ;
+        if (r.off == 0 || type != BDUMP_END || bdump_check_end(&r, &c)) {
+            fprintf(stderr, bdump_bad_fmt, programname, dumpfile);
+            error = 1;
+            goto cleanup;
+        }
+        r.off = 0;
+        r.nrecords = 0;
+        r.verified = 1;
+    }
+
+    for (;;) {
+        if (bdump_next(&r, &type, &c)) {
+            fprintf(stderr, bdump_bad_fmt, programname, dumpfile);
+            error = 1;
+            break;
+        }
+        if (type == BDUMP_PRINC) {
+            error = load_binary_princ(dumpfile, kcontext, &c, flags,
+                                      r.nrecords);
+        } else if (type == BDUMP_POLICY) {
+            error = load_binary_policy(dumpfile, kcontext, &c, flags,
+                                       r.nrecords);
+        } else if (type == BDUMP_END) {
+            if (bdump_check_end(&r, &c)) {
+                fprintf(stderr, bdump_bad_fmt, programname, dumpfile);
+                error = 1;
+            }
+            break;
+        } else {
+            fprintf(stderr, btype_err_fmt, dumpfile, (int)r.nrecords,
+                    (int)type);
+            error = 1;
+        }
+        if (error)
+            break;
+    }
+
+cleanup:
+    if (map != NULL)
+        munmap(map, maplen);
+    free(r.buf);
+    return error;
+}
+
 /*
  * restore_dump()       - Restore the database from any version dump file.
  */
@@ -2301,6 +2949,9 @@ restore_dump(programname, kcontext, dumpfile, f, flags, dump)
     int         error;
     int         lineno;
 
+    if (dump == &binary_version)
+        return restore_binary_dump(programname, kcontext, dumpfile, f, flags);
+
     error = 0;
     lineno = 1;
 
@@ -2322,7 +2973,7 @@ restore_dump(programname, kcontext, dumpfile, f, flags, dump)
 }
 
 /*
- * Usage: load_db [-old] [-ov] [-b6] [-b7] [-r13] [-verbose]
+ * Usage: load_db [-old] [-ov] [-b6] [-b7] [-r13] [-b] [-verbose]
  *                [-update] [-hash] filename
  */
 void
@@ -2346,7 +2997,10 @@ load_db(argc, argv)
     char                iheader[MAX_HEADER];
     kdb_log_context     *log_ctx;
     krb5_boolean        add_update = TRUE;
-    uint32_t            caller, last_sno, last_seconds, last_useconds;
+    uint32_t            caller, last_sno = 0, last_seconds = 0;
+    uint32_t            last_useconds = 0;
+    int                 reset_ulog = 0;
+    int                 binary = 0;
 
     /*
      * Parse the arguments.
@@ -2370,6 +3024,8 @@ load_db(argc, argv)
             load = &ov_version;
         else if (!strcmp(argv[aindex], r13option))
             load = &r1_3_version;
+        else if (!strcmp(argv[aindex], binaryoption))
+            binary = 1;
         else if (!strcmp(argv[aindex], ipropoption)) {
             if (log_ctx && log_ctx->iproprole) {
                 load = &iprop_version;
@@ -2396,7 +3052,11 @@ load_db(argc, argv)
         usage();
         return;
     }
+    if (binary)
+        load = &binary_version;
     dumpfile = argv[aindex];
+    if (!strcmp(dumpfile, "-"))
+        dumpfile = NULL;
 
     /*
      * Initialize the Kerberos context and error tables.
@@ -2442,11 +3102,15 @@ load_db(argc, argv)
      * were told.
      */
     fgets(buf, sizeof(buf), f);
+    /* An iprop load may be given a binary dump made with -i. */
+    if (load == &iprop_version && is_binary_header(buf))
+        load = &binary_version;
     if (load) {
         /* only check what we know; some headers only contain a prefix */
         /* NB: this should work for ipropx even though load is iprop */
         if (strncmp(buf, load->header, strlen(load->header)) != 0) {
-            fprintf(stderr, head_bad_fmt, progname, dumpfile);
+            fprintf(stderr, head_bad_fmt, progname,
+                    (dumpfile) ? dumpfile : stdin_name);
             exit_status++;
             if (dumpfile) fclose(f);
             return;
@@ -2463,16 +3127,30 @@ load_db(argc, argv)
             load = &r1_3_version;
         else if (strcmp(buf, r1_8_version.header) == 0)
             load = &r1_8_version;
+        else if (is_binary_header(buf))
+            load = &binary_version;
         else if (strncmp(buf, ov_version.header,
                          strlen(ov_version.header)) == 0)
             load = &ov_version;
         else {
-            fprintf(stderr, head_bad_fmt, progname, dumpfile);
+            fprintf(stderr, head_bad_fmt, progname,
+                    (dumpfile) ? dumpfile : stdin_name);
             exit_status++;
             if (dumpfile) fclose(f);
             return;
         }
     }
+    /*
+     * A text dump has no end marker, so one cut short on a pipe would look
+     * complete.  Only accept a binary dump, whose end record is checked
+     * before the new database is made live, from standard input.
+     */
+    if (!dumpfile && load != &binary_version) {
+        fprintf(stderr, _("%s: only a binary dump can be loaded from "
+                          "standard input\n"), progname);
+        exit_status++;
+        return;
+    }
     if (load->updateonly && !(flags & FLAG_UPDATE)) {
         fprintf(stderr, _("%s: dump version %s can only be loaded with the "
                           "-update flag\n"), progname, load->name);
@@ -2553,47 +3231,54 @@ load_db(argc, argv)
          *      we could easily exceed # of update entries
          *      we could implicity delete db entries during a replace
          *      no advantage in incr updates when entire db is replaced
+         *
+         * The header is only reinitialized once the new database is live.
+         * A dump read from a pipe may be cut short; until then the old
+         * database and its serial number must stay together, or the slave
+         * would believe it holds updates it never received.
          */
         if (!(flags & FLAG_UPDATE)) {
-            memset(log_ctx->ulog, 0, sizeof (kdb_hlog_t));
-
-            log_ctx->ulog->kdb_hmagic = KDB_ULOG_HDR_MAGIC;
-            log_ctx->ulog->db_version_num = KDB_VERSION;
-            log_ctx->ulog->kdb_state = KDB_STABLE;
-            log_ctx->ulog->kdb_block = ULOG_BLOCK;
-
+            reset_ulog = 1;
             log_ctx->iproprole = IPROP_NULL;
 
             if (!add_update) {
                 unsigned int ipropx_version = IPROPX_VERSION_0;
 
-                if (!strncmp(buf, "ipropx ", sizeof("ipropx ") - 1))
-                    sscanf(buf, "%s %u %u %u %u", iheader,
-                           &ipropx_version, &last_sno,
-                           &last_seconds, &last_useconds);
-                else
-                    sscanf(buf, "%s %u %u %u", iheader, &last_sno,
-                           &last_seconds, &last_useconds);
-
-                switch (ipropx_version) {
-                case IPROPX_VERSION_0:
-                    load = &iprop_version;
-                    break;
-                case IPROPX_VERSION_1:
-                    load = &ipropx_1_version;
-                    break;
-                default:
-                    fprintf(stderr, _("%s: Unknown iprop dump version %d\n"),
-                            progname, ipropx_version);
-                    exit_status++;
-                    goto error;
+                if (load == &binary_version) {
+                    /* The binary header always carries the iprop version. */
+                    if (sscanf(buf + strlen(load->header), "%u %u %u %u",
+                               &ipropx_version, &last_sno, &last_seconds,
+                               &last_useconds) != 4) {
+                        fprintf(stderr, _("%s: binary dump has no iprop "
+                                          "serial number\n"), progname);
+                        exit_status++;
+                        goto error;
+                    }
+                } else {
+                    if (!strncmp(buf, "ipropx ", sizeof("ipropx ") - 1))
+                        sscanf(buf, "%s %u %u %u %u", iheader,
+                               &ipropx_version, &last_sno,
+                               &last_seconds, &last_useconds);
+                    else
+                        sscanf(buf, "%s %u %u %u", iheader, &last_sno,
+                               &last_seconds, &last_useconds);
+
+                    switch (ipropx_version) {
+                    case IPROPX_VERSION_0:
+                        load = &iprop_version;
+                        break;
+                    case IPROPX_VERSION_1:
+                        load = &ipropx_1_version;
+                        break;
+                    default:
+                        fprintf(stderr,
+                                _("%s: Unknown iprop dump version %d\n"),
+                                progname, ipropx_version);
+                        exit_status++;
+                        goto error;
+                    }
                 }
 
-                log_ctx->ulog->kdb_last_sno = last_sno;
-                log_ctx->ulog->kdb_last_time.seconds =
-                    last_seconds;
-                log_ctx->ulog->kdb_last_time.useconds =
-                    last_useconds;
             }
         }
     }
@@ -2641,6 +3326,19 @@ load_db(argc, argv)
         }
     }
 
+    /* Give the update log the serial number of the database now live. */
+    if (exit_status == 0 && reset_ulog) {
+        memset(log_ctx->ulog, 0, sizeof (kdb_hlog_t));
+
+        log_ctx->ulog->kdb_hmagic = KDB_ULOG_HDR_MAGIC;
+        log_ctx->ulog->db_version_num = KDB_VERSION;
+        log_ctx->ulog->kdb_state = KDB_STABLE;
+        log_ctx->ulog->kdb_block = ULOG_BLOCK;
+        log_ctx->ulog->kdb_last_sno = last_sno;
+        log_ctx->ulog->kdb_last_time.seconds = last_seconds;
+        log_ctx->ulog->kdb_last_time.useconds = last_useconds;
+    }
+
 error:
     /*
      * If not an update: if there was an error, destroy the temp database,
@@ -84,10 +84,10 @@ void usage()
               "\tcreate  [-s]\n"
               "\tdestroy [-f]\n"
               "\tstash   [-f keyfile]\n"
-              "\tdump    [-old|-ov|-b6|-b7|-r13] [-verbose]\n"
+              "\tdump    [-old|-ov|-b6|-b7|-r13|-b] [-verbose]\n"
               "\t        [-mkey_convert] [-new_mkey_file mkey_file]\n"
               "\t        [-rev] [-recurse] [filename [princs...]]\n"
-              "\tload    [-old|-ov|-b6|-b7|-r13] [-verbose] [-update] "
+              "\tload    [-old|-ov|-b6|-b7|-r13|-b] [-verbose] [-update] "
               "filename\n"
               "\tark     [-e etype_list] principal\n"
               "\tadd_mkey [-e etype] [-s]\n"
@@ -505,7 +505,9 @@ static int open_db_and_mkey()
     if (global_params.iprop_enabled) {
         if (ulog_map(util_context, global_params.iprop_logfile,
                      global_params.iprop_ulogsize, FKCOMMAND,
-                     db5util_db_args)) {
+                     db5util_db_args) ||
+            ulog_set_sync_window(util_context,
+                                 global_params.iprop_ulog_sync_window)) {
             fprintf(stderr, _("%s: Could not map log\n"), progname);
             exit_status++;
             return(1);
@@ -14,7 +14,7 @@
 #include <sys/resource.h> /* rlimit */
 #include <syslog.h>
 
-#include "k5-platform.h"
+#include "k5-int.h"
 #include <kadm5/admin.h>
 #include <kadm5/kadm_rpc.h>
 #include <kadm5/server_internal.h>
@@ -125,17 +125,196 @@ buf_to_string(gss_buffer_desc *b)
     return s;
 }
 
-kdb_incr_result_t *
-iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
+/*
+ * A long-poll call waiting for the update log to advance past the
+ * slave's last entry.  Its reply is sent later from the verto loop by
+ * check_held_calls(), on the transport it arrived on.
+ */
+struct held_call {
+    struct held_call *next;
+    SVCXPRT *xprt;
+    int fd;
+    kdb_last_t last;
+    time_t deadline;
+    char *client_name;
+    char *service_name;
+    char addr[33];
+};
+
+/* How often to look for update log changes while calls are held. */
+#define HELD_CALL_INTERVAL 100	/* milliseconds */
+
+static struct held_call *held_calls;
+static verto_ctx *held_vctx;
+static verto_ev *held_ev;
+
+static void
+free_held_call(struct held_call *h)
+{
+    free(h->client_name);
+    free(h->service_name);
+    free(h);
+}
+
+/* Forget any call held on fd, which can no longer be answered. */
+static void
+drop_held_call(int fd)
+{
+    struct held_call **hp, *h;
+
+    for (hp = &held_calls; (h = *hp) != NULL; hp = &h->next) {
+	if (h->fd == fd) {
+	    *hp = h->next;
+	    free_held_call(h);
+	    return;
+	}
+    }
+}
+
+static void
+log_updates(char *whoami, kdb_last_t *arg, kdb_incr_result_t *ret, int kret,
+	    const char *client_name, const char *service_name,
+	    const char *addr)
+{
+    char obuf[256] = {0};
+
+    if (ret->ret == UPDATE_OK) {
+	(void) snprintf(obuf, sizeof (obuf),
+			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=%lu"),
+			replystr(ret->ret),
+			(unsigned long)arg->last_sno,
+			(unsigned long)ret->lastentry.last_sno);
+    } else {
+	(void) snprintf(obuf, sizeof (obuf),
+			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=N/A"),
+			replystr(ret->ret),
+			(unsigned long)arg->last_sno);
+    }
+
+    krb5_klog_syslog(LOG_NOTICE,
+		     _("Request: %s, %s, %s, client=%s, service=%s, addr=%s"),
+		     whoami,
+		     obuf,
+		     ((kret == 0) ? "success" : error_message(kret)),
+		     client_name, service_name, addr);
+}
+
+/*
+ * Answer each held call whose slave is now behind the update log, or
+ * whose timeout has expired.
+ */
+static void
+check_held_calls(verto_ctx *vctx, verto_ev *ev)
+{
+    kadm5_server_handle_t handle = global_server_handle;
+    kdb_hlog_t *ulog = handle->context->kdblog_context->ulog;
+    struct held_call **hp, *h;
+    kdb_incr_result_t ret;
+    char *whoami = "iprop_get_updates_wait_1";
+    time_t now = time(NULL);
+    int kret;
+
+    hp = &held_calls;
+    while ((h = *hp) != NULL) {
+	if (ulog->kdb_last_sno == h->last.last_sno && now < h->deadline) {
+	    hp = &h->next;
+	    continue;
+	}
+
+	memset(&ret, 0, sizeof(ret));
+	kret = ulog_get_entries_immediate(handle->context, h->last, &ret);
+	if (ret.ret == UPDATE_NIL && now < h->deadline) {
+	    hp = &h->next;
+	    continue;
+	}
+
+	*hp = h->next;
+	if (!svc_sendreply(h->xprt, xdr_kdb_incr_result_t, (caddr_t)&ret)) {
+	    krb5_klog_syslog(LOG_ERR,
+			     _("RPC svc_sendreply failed (%s)"),
+			     whoami);
+	}
+	log_updates(whoami, &h->last, &ret, kret, h->client_name,
+		    h->service_name, h->addr);
+	if (nofork)
+	    debprret(whoami, ret.ret, ret.lastentry.last_sno);
+	if (ret.ret == UPDATE_OK)
+	    ulog_free_entries(ret.updates.kdb_ulog_t_val,
+			      ret.updates.kdb_ulog_t_len);
+	free_held_call(h);
+    }
+
+    if (held_calls == NULL) {
+	verto_del(held_ev);
+	held_ev = NULL;
+    }
+}
+
+/*
+ * Hold the call in rqstp until the update log advances past last, or
+ * for timeout seconds.  Takes ownership of client_name and service_name
+ * on success.
+ */
+static int
+hold_call(struct svc_req *rqstp, kdb_last_t *last, uint32_t timeout,
+	  char *client_name, char *service_name)
+{
+    struct held_call *h;
+
+    if (held_vctx == NULL)
+	return EINVAL;
+
+    h = calloc(1, sizeof(*h));
+    if (h == NULL)
+	return ENOMEM;
+    if (held_ev == NULL) {
+	held_ev = verto_add_timeout(held_vctx, VERTO_EV_FLAG_PERSIST,
+				    check_held_calls, HELD_CALL_INTERVAL);
+	if (held_ev == NULL) {
+	    free(h);
+	    return ENOMEM;
+	}
+    }
+
+    h->xprt = rqstp->rq_xprt;
+    h->fd = rqstp->rq_xprt->xp_sock;
+    h->last = *last;
+    h->deadline = time(NULL) + timeout;
+    h->client_name = client_name;
+    h->service_name = service_name;
+    strlcpy(h->addr, client_addr(rqstp), sizeof(h->addr));
+    h->next = held_calls;
+    held_calls = h;
+    return 0;
+}
+
+/*
+ * Run held long-poll calls from ctx, and drop them when their RPC
+ * connections close.
+ */
+void
+iprop_set_loop(verto_ctx *ctx)
+{
+    held_vctx = ctx;
+    loop_set_rpc_close_hook(drop_held_call);
+}
+
+/*
+ * Fetch updates after *arg for the caller.  If timeout is nonzero and
+ * there are none, hold the call and return NULL; the reply is sent
+ * when updates arrive or the timeout expires.
+ */
+static kdb_incr_result_t *
+get_updates(kdb_last_t *arg, uint32_t timeout, struct svc_req *rqstp,
+	    char *whoami)
 {
     static kdb_incr_result_t ret;
-    char *whoami = "iprop_get_updates_1";
     int kret;
     kadm5_server_handle_t handle = global_server_handle;
     char *client_name = 0, *service_name = 0;
-    char obuf[256] = {0};
 
     /* default return code */
+    memset(&ret, 0, sizeof(ret));
     ret.ret = UPDATE_ERROR;
 
     DPRINT(("%s: start, last_sno=%lu\n", whoami,
@@ -185,28 +364,24 @@ iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
 	goto out;
     }
 
-    kret = ulog_get_entries(handle->context, *arg, &ret);
-
-    if (ret.ret == UPDATE_OK) {
-	(void) snprintf(obuf, sizeof (obuf),
-			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=%lu"),
-			replystr(ret.ret),
-			(unsigned long)arg->last_sno,
-			(unsigned long)ret.lastentry.last_sno);
+    if (timeout == 0) {
+	kret = ulog_get_entries(handle->context, *arg, &ret);
     } else {
-	(void) snprintf(obuf, sizeof (obuf),
-			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=N/A"),
-			replystr(ret.ret),
-			(unsigned long)arg->last_sno);
+	kret = ulog_get_entries_immediate(handle->context, *arg, &ret);
+	if (ret.ret == UPDATE_NIL) {
+	    kret = hold_call(rqstp, arg, timeout, client_name, service_name);
+	    if (kret == 0) {
+		DPRINT(("%s: holding for %lu secs\n", whoami,
+			(unsigned long) timeout));
+		return (NULL);
+	    }
+	    /* Have the slave back off rather than ask again at once. */
+	    ret.ret = UPDATE_BUSY;
+	}
     }
 
-    krb5_klog_syslog(LOG_NOTICE,
-		     _("Request: %s, %s, %s, client=%s, service=%s, addr=%s"),
-		     whoami,
-		     obuf,
-		     ((kret == 0) ? "success" : error_message(kret)),
-		     client_name, service_name,
-		     client_addr(rqstp));
+    log_updates(whoami, arg, &ret, kret, client_name, service_name,
+		client_addr(rqstp));
 
 out:
     if (nofork)
@@ -216,6 +391,19 @@ out:
     return (&ret);
 }
 
+kdb_incr_result_t *
+iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
+{
+    return get_updates(arg, 0, rqstp, "iprop_get_updates_1");
+}
+
+kdb_incr_result_t *
+iprop_get_updates_wait_1_svc(kdb_incr_wait_t *arg, struct svc_req *rqstp)
+{
+    return get_updates(&arg->last, arg->timeout, rqstp,
+		       "iprop_get_updates_wait_1");
+}
+
 
 /*
  * Given a client princ (foo/fqdn@R), copy (in arg cl) the fqdn substring.
@@ -242,12 +430,18 @@ getclhoststr(char *clprinc, char *cl, size_t len)
     return (NULL);
 }
 
+/*
+ * If stream is set, kprop runs the dump itself and sends it to the slave
+ * as it is generated, instead of sending a dump file written first.
+ */
 static kdb_fullresync_result_t *
-ipropx_resync(uint32_t vers, struct svc_req *rqstp)
+ipropx_resync(uint32_t vers, int stream, struct svc_req *rqstp)
 {
     static kdb_fullresync_result_t ret;
     char *tmpf = 0;
     char *ubuf = 0;
+    char *av[10];
+    int ac;
     char clhost[MAXHOSTNAMELEN] = {0};
     int pret, fret;
     kadm5_server_handle_t handle = global_server_handle;
@@ -333,10 +527,20 @@ ipropx_resync(uint32_t vers, struct svc_req *rqstp)
      * note the -i; modified version of kdb5_util dump format
      * to include sno (serial number). This argument is now
      * versioned (-i0 for legacy dump format, -i1 for ipropx
-     * version 1 format, etc)
+     * version 1 format, etc).  When streaming, ubuf is just
+     * the -i argument, which kprop passes on to kdb5_util; kprop
+     * always streams the binary dump format, which a slave that
+     * asks for a streamed resync can load.
      */
-    if (asprintf(&ubuf, "%s dump -i%d %s </dev/null 2>&1",
-		 KPROPD_DEFAULT_KDB5_UTIL, vers, tmpf) < 0) {
+    if (stream) {
+	if (asprintf(&ubuf, "-i%d", vers) < 0) {
+	    krb5_klog_syslog(LOG_ERR,
+			     _("%s: cannot construct kprop dump argument; out of memory"),
+			     whoami);
+	    goto out;
+	}
+    } else if (asprintf(&ubuf, "%s dump -i%d %s </dev/null 2>&1",
+			KPROPD_DEFAULT_KDB5_UTIL, vers, tmpf) < 0) {
 	krb5_klog_syslog(LOG_ERR,
 			 _("%s: cannot construct kdb5 util dump string too long; out of memory"),
 			 whoami);
@@ -363,36 +567,48 @@ ipropx_resync(uint32_t vers, struct svc_req *rqstp)
 	goto out;
 
     case 0: /* child */
-	DPRINT(("%s: run `%s' ...\n", whoami, ubuf));
 	(void) signal(SIGCHLD, SIG_DFL);
-	/* run kdb5_util(1M) dump for IProp */
-	/* XXX popen can return NULL; is pclose(NULL) okay?  */
-	pret = pclose(popen(ubuf, "w"));
-	DPRINT(("%s: pclose=%d\n", whoami, pret));
-	if (pret != 0) {
-	    /* XXX popen/pclose may not set errno
-	       properly, and the error could be from the
-	       subprocess anyways.  */
-	    if (nofork) {
-		perror(whoami);
+	ac = 0;
+	av[ac++] = "kprop";
+	if (stream) {
+	    av[ac++] = "-D";
+	    av[ac++] = ubuf;
+	    /* kprop spools the dump next to this name. */
+	    av[ac++] = "-f";
+	    av[ac++] = tmpf;
+	} else {
+	    DPRINT(("%s: run `%s' ...\n", whoami, ubuf));
+	    /* run kdb5_util(1M) dump for IProp */
+	    /* XXX popen can return NULL; is pclose(NULL) okay?  */
+	    pret = pclose(popen(ubuf, "w"));
+	    DPRINT(("%s: pclose=%d\n", whoami, pret));
+	    if (pret != 0) {
+		/* XXX popen/pclose may not set errno
+		   properly, and the error could be from the
+		   subprocess anyways.  */
+		if (nofork) {
+		    perror(whoami);
+		}
+		krb5_klog_syslog(LOG_ERR,
+				 _("%s: pclose(popen) failed: %s"),
+				 whoami,
+				 error_message(errno));
+		_exit(1);
 	    }
-	    krb5_klog_syslog(LOG_ERR,
-			     _("%s: pclose(popen) failed: %s"),
-			     whoami,
-			     error_message(errno));
-	    _exit(1);
+	    av[ac++] = "-f";
+	    av[ac++] = tmpf;
 	}
-
-	DPRINT(("%s: exec `kprop -f %s %s' ...\n",
-		whoami, tmpf, clhost));
 	/* XXX Yuck!  */
-	if (getenv("KPROP_PORT"))
-	    pret = execl(KPROPD_DEFAULT_KPROP, "kprop", "-f", tmpf,
-			 "-P", getenv("KPROP_PORT"),
-			 clhost, NULL);
-	else
-	    pret = execl(KPROPD_DEFAULT_KPROP, "kprop", "-f", tmpf,
-			 clhost, NULL);
+	if (getenv("KPROP_PORT")) {
+	    av[ac++] = "-P";
+	    av[ac++] = getenv("KPROP_PORT");
+	}
+	av[ac++] = clhost;
+	av[ac] = NULL;
+
+	DPRINT(("%s: exec `kprop %s %s %s' ...\n",
+		whoami, av[1], av[2], clhost));
+	pret = execv(KPROPD_DEFAULT_KPROP, av);
 	if (pret == -1) {
 	    if (nofork) {
 		perror(whoami);
@@ -435,13 +651,19 @@ out:
 kdb_fullresync_result_t *
 iprop_full_resync_1_svc(/* LINTED */ void *argp, struct svc_req *rqstp)
 {
-    return ipropx_resync(IPROPX_VERSION_0, rqstp);
+    return ipropx_resync(IPROPX_VERSION_0, 0, rqstp);
 }
 
 kdb_fullresync_result_t *
 iprop_full_resync_ext_1_svc(uint32_t *argp, struct svc_req *rqstp)
 {
-    return ipropx_resync(*argp, rqstp);
+    return ipropx_resync(*argp, 0, rqstp);
+}
+
+kdb_fullresync_result_t *
+iprop_full_resync_stream_1_svc(uint32_t *argp, struct svc_req *rqstp)
+{
+    return ipropx_resync(*argp, 1, rqstp);
 }
 
 static int
@@ -525,6 +747,7 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 {
     union {
 	kdb_last_t iprop_get_updates_1_arg;
+	kdb_incr_wait_t iprop_get_updates_wait_1_arg;
     } argument;
     char *result;
     bool_t (*_xdr_argument)(), (*_xdr_result)();
@@ -540,6 +763,9 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	return;
     }
 
+    /* A slave waits for its reply before making another call. */
+    drop_held_call(transp->xp_sock);
+
     switch (rqstp->rq_proc) {
     case NULLPROC:
 	(void) svc_sendreply(transp, xdr_void,
@@ -564,6 +790,18 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	local = (char *(*)()) iprop_full_resync_ext_1_svc;
 	break;
 
+    case IPROP_GET_UPDATES_WAIT:
+	_xdr_argument = xdr_kdb_incr_wait_t;
+	_xdr_result = xdr_kdb_incr_result_t;
+	local = (char *(*)()) iprop_get_updates_wait_1_svc;
+	break;
+
+    case IPROP_FULL_RESYNC_STREAM:
+	_xdr_argument = xdr_u_int32;
+	_xdr_result = xdr_kdb_fullresync_result_t;
+	local = (char *(*)()) iprop_full_resync_stream_1_svc;
+	break;
+
     default:
 	krb5_klog_syslog(LOG_ERR,
 			 _("RPC unknown request: %d (%s)"),
@@ -596,7 +834,8 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	exit(1);
     }
 
-    if (rqstp->rq_proc == IPROP_GET_UPDATES) {
+    if ((rqstp->rq_proc == IPROP_GET_UPDATES ||
+	 rqstp->rq_proc == IPROP_GET_UPDATES_WAIT) && result != NULL) {
 	/* LINTED */
 	kdb_incr_result_t *r = (kdb_incr_result_t *)result;
 
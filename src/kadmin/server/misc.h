@@ -65,6 +65,9 @@ void log_badauth(OM_uint32 major, OM_uint32 minor,
 void
 krb5_iprop_prog_1(struct svc_req *rqstp, SVCXPRT *transp);
 
+void
+iprop_set_loop(verto_ctx *ctx);
+
 kadm5_ret_t
 kiprop_get_adm_host_srv_name(krb5_context,
                              const char *,
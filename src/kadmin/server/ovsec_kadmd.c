@@ -201,6 +201,16 @@ static krb5_context context;
 
 static krb5_context hctx;
 
+/*
+ * Sync update log entries left pending by group commit, so that they reach
+ * the disk within the window even when no further updates follow them.
+ */
+static void
+sync_ulog(verto_ctx *vctx, verto_ev *ev)
+{
+    (void) ulog_sync_pending(hctx);
+}
+
 int nofork = 0;
 
 int main(int argc, char *argv[])
@@ -560,6 +570,24 @@ kterr:
             exit(1);
         }
 
+        ret = ulog_set_sync_window(hctx, params.iprop_ulog_sync_window);
+        if (ret == 0 && params.iprop_ulog_sync_window > 0 &&
+            verto_add_timeout(ctx, VERTO_EV_FLAG_PERSIST, sync_ulog,
+                              params.iprop_ulog_sync_window) == NULL)
+            ret = ENOMEM;
+        if (ret) {
+            fprintf(stderr,
+                    _("%s: %s while setting up update log group commit\n"),
+                    whoami, error_message(ret));
+            krb5_klog_syslog(LOG_ERR,
+                             _("%s while setting up update log group "
+                               "commit"), error_message(ret));
+            loop_free(ctx);
+            krb5_klog_close(context);
+            exit(1);
+        }
+
+        iprop_set_loop(ctx);
 
         if (nofork)
             fprintf(stderr,
@@ -41,6 +41,7 @@ struct dispatch_state {
     void *arg;
     krb5_data *request;
     int is_tcp;
+    krb5_ui_8 start;
 };
 
 static void
@@ -81,6 +82,7 @@ finish_dispatch_cache(void *arg, krb5_error_code code, krb5_data *response)
         kdc_insert_lookaside(state->request, response);
 #endif
 
+    kdc_stats_end(KDC_STAGE_AS_TOTAL, state->start);
     finish_dispatch(state, code, response);
 }
 
@@ -94,6 +96,7 @@ dispatch(void *cb, struct sockaddr *local_saddr,
     krb5_int32 now, now_usec;
     krb5_data *response = NULL;
     struct dispatch_state *state;
+    krb5_ui_8 t;
 
     state = k5alloc(sizeof(*state), &retval);
     if (state == NULL) {
@@ -104,6 +107,7 @@ dispatch(void *cb, struct sockaddr *local_saddr,
     state->arg = arg;
     state->request = pkt;
     state->is_tcp = is_tcp;
+    state->start = kdc_stats_start();
 
     /* decode incoming packet, and dispatch */
 
@@ -118,6 +122,7 @@ dispatch(void *cb, struct sockaddr *local_saddr,
                           from->address->contents, buf, sizeof (buf));
         if (name == 0)
             name = "[unknown address type]";
+        kdc_stats_request(KDC_REQ_REPEATED);
         if (response)
             krb5_klog_syslog(LOG_INFO,
                              "DISPATCH: repeated (retransmitted?) request "
@@ -159,9 +164,15 @@ dispatch(void *cb, struct sockaddr *local_saddr,
     /* try TGS_REQ first; they are more common! */
 
     if (krb5_is_tgs_req(pkt)) {
+        kdc_stats_request(KDC_REQ_TGS);
         retval = process_tgs_req(pkt, from, &response);
+        kdc_stats_end(KDC_STAGE_TGS_TOTAL, state->start);
     } else if (krb5_is_as_req(pkt)) {
-        if (!(retval = decode_krb5_as_req(pkt, &as_req))) {
+        kdc_stats_request(KDC_REQ_AS);
+        t = kdc_stats_start();
+        retval = decode_krb5_as_req(pkt, &as_req);
+        kdc_stats_end(KDC_STAGE_DECODE, t);
+        if (!retval) {
             /*
              * setup_server_realm() sets up the global realm-specific data
              * pointer.
@@ -175,8 +186,10 @@ dispatch(void *cb, struct sockaddr *local_saddr,
             else
                 krb5_free_kdc_req(kdc_context, as_req);
         }
-    } else
+    } else {
+        kdc_stats_request(KDC_REQ_OTHER);
         retval = KRB5KRB_AP_ERR_MSG_TYPE;
+    }
 
     finish_dispatch(state, retval, response);
 }
@@ -97,6 +97,7 @@ struct as_req_state {
     krb5_enc_tkt_part enc_tkt_reply;
     krb5_enc_kdc_rep_part reply_encpart;
     krb5_ticket ticket_reply;
+    krb5_key server_key;
     krb5_keyblock server_keyblock;
     krb5_keyblock client_keyblock;
     krb5_db_entry *client;
@@ -119,6 +120,7 @@ struct as_req_state {
     const krb5_fulladdr *from;
 
     krb5_error_code preauth_err;
+    krb5_ui_8 preauth_start;
 };
 
 static void
@@ -134,6 +136,7 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
     krb5_enctype useenctype;
     loop_respond_fn oldrespond;
     void *oldarg;
+    krb5_ui_8 t;
 
     assert(state);
     oldrespond = state->respond;
@@ -169,13 +172,15 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
      *
      *  server_keyblock is later used to generate auth data signatures
      */
-    if ((errcode = krb5_dbe_decrypt_key_data(kdc_context, NULL,
-                                             server_key,
-                                             &state->server_keyblock,
-                                             NULL))) {
+    if ((errcode = kdc_get_key(kdc_context, state->server, server_key,
+                               &state->server_key))) {
         state->status = "DECRYPT_SERVER_KEY";
         goto egress;
     }
+    if ((errcode = krb5_copy_keyblock_contents(kdc_context,
+                                               &state->server_key->keyblock,
+                                               &state->server_keyblock)))
+        goto egress;
 
     /*
      * Find the appropriate client key.  We search in the order specified
@@ -201,10 +206,11 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
     state->rock.client_key = client_key;
 
     /* convert client.key_data into a real key */
-    if ((errcode = krb5_dbe_decrypt_key_data(kdc_context, NULL,
-                                             client_key,
-                                             &state->client_keyblock,
-                                             NULL))) {
+    t = kdc_stats_start();
+    errcode = krb5_dbe_decrypt_key_data(kdc_context, NULL, client_key,
+                                        &state->client_keyblock, NULL);
+    kdc_stats_end(KDC_STAGE_KEY_DECRYPT, t);
+    if (errcode) {
         state->status = "DECRYPT_CLIENT_KEY";
         goto egress;
     }
@@ -265,8 +271,10 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
         goto egress;
     }
 
-    errcode = krb5_encrypt_tkt_part(kdc_context, &state->server_keyblock,
-                                    &state->ticket_reply);
+    t = kdc_stats_start();
+    errcode = krb5_encrypt_tkt_part_k(kdc_context, state->server_key,
+                                      &state->ticket_reply);
+    kdc_stats_end(KDC_STAGE_TKT_ENCRYPT, t);
     if (errcode) {
         state->status = "ENCRYPTING_TICKET";
         goto egress;
@@ -299,10 +307,12 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
         goto egress;
     }
 
+    t = kdc_stats_start();
     errcode = krb5_encode_kdc_rep(kdc_context, KRB5_AS_REP,
                                   &state->reply_encpart, 0,
                                   as_encrypting_key,
                                   &state->reply, &response);
+    kdc_stats_end(KDC_STAGE_REPLY_ENCODE, t);
     state->reply.enc_part.kvno = client_key->key_data_kvno;
     if (errcode) {
         state->status = "ENCODE_KDC_REP";
@@ -359,6 +369,7 @@ egress:
     if (state->enc_tkt_reply.authorization_data != NULL)
         krb5_free_authdata(kdc_context,
                            state->enc_tkt_reply.authorization_data);
+    krb5_k_free_key(kdc_context, state->server_key);
     if (state->server_keyblock.contents != NULL)
         krb5_free_keyblock_contents(kdc_context, &state->server_keyblock);
     if (state->client_keyblock.contents != NULL)
@@ -406,6 +417,8 @@ finish_preauth(void *arg, krb5_error_code code)
     struct as_req_state *state = arg;
     krb5_error_code real_code = code;
 
+    if (state->preauth_start != 0)
+        kdc_stats_end(KDC_STAGE_PREAUTH, state->preauth_start);
     if (code) {
         if (vague_errors)
             code = KRB5KRB_ERR_GENERIC;
@@ -537,8 +550,8 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
     if (include_pac_p(kdc_context, state->request)) {
         setflag(state->c_flags, KRB5_KDB_FLAG_INCLUDE_PAC);
     }
-    errcode = krb5_db_get_principal(kdc_context, state->request->client,
-                                    state->c_flags, &state->client);
+    errcode = kdc_get_principal(kdc_context, state->request->client,
+                                state->c_flags, &state->client);
     if (errcode == KRB5_KDB_NOENTRY) {
         state->status = "CLIENT_NOT_FOUND";
         if (vague_errors)
@@ -580,8 +593,8 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
     if (isflagset(state->request->kdc_options, KDC_OPT_CANONICALIZE)) {
         setflag(s_flags, KRB5_KDB_FLAG_CANONICALIZE);
     }
-    errcode = krb5_db_get_principal(kdc_context, state->request->server,
-                                    s_flags, &state->server);
+    errcode = kdc_get_principal(kdc_context, state->request->server,
+                                s_flags, &state->server);
     if (errcode == KRB5_KDB_NOENTRY) {
         state->status = "SERVER_NOT_FOUND";
         errcode = KRB5KDC_ERR_S_PRINCIPAL_UNKNOWN;
@@ -745,6 +758,7 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
      * Check the preauthentication if it is there.
      */
     if (state->request->padata) {
+        state->preauth_start = kdc_stats_start();
         check_padata(kdc_context, &state->rock, state->req_pkt,
                      state->request, &state->enc_tkt_reply, &state->pa_context,
                      &state->e_data, &state->typed_e_data, finish_preauth,
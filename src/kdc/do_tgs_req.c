@@ -96,6 +96,7 @@ process_tgs_req(krb5_data *pkt, const krb5_fulladdr *from,
     int newtransited = 0;
     krb5_error_code retval = 0;
     krb5_keyblock encrypting_key;
+    krb5_key server_tkt_key = NULL;
     krb5_timestamp kdc_time, authtime = 0;
     krb5_keyblock session_key;
     krb5_timestamp rtime;
@@ -121,6 +122,7 @@ process_tgs_req(krb5_data *pkt, const krb5_fulladdr *from,
     krb5_principal krbtgt_princ;
     krb5_kvno ticket_kvno = 0;
     struct kdc_request_state *state = NULL;
+    krb5_ui_8 t;
     krb5_pa_data *pa_tgs_req; /*points into request*/
     krb5_data scratch;
     krb5_pa_data **e_data = NULL;
@@ -131,7 +133,9 @@ process_tgs_req(krb5_data *pkt, const krb5_fulladdr *from,
 
     session_key.contents = NULL;
 
+    t = kdc_stats_start();
     retval = decode_krb5_tgs_req(pkt, &request);
+    kdc_stats_end(KDC_STAGE_DECODE, t);
     if (retval)
         return retval;
     if (request->msg_type != KRB5_TGS_REQ) {
@@ -146,8 +150,10 @@ process_tgs_req(krb5_data *pkt, const krb5_fulladdr *from,
         krb5_free_kdc_req(kdc_context, request);
         return retval;
     }
+    t = kdc_stats_start();
     errcode = kdc_process_tgs_req(request, from, pkt, &header_ticket,
                                   &krbtgt, &tgskey, &subkey, &pa_tgs_req);
+    kdc_stats_end(KDC_STAGE_PREAUTH, t);
     if (header_ticket && header_ticket->enc_part2 &&
         (errcode2 = krb5_unparse_name(kdc_context,
                                       header_ticket->enc_part2->client,
@@ -213,8 +219,8 @@ ref_tgt_again:
     }
     limit_string(sname);
 
-    errcode = krb5_db_get_principal(kdc_context, request->server,
-                                    s_flags, &server);
+    errcode = kdc_get_principal(kdc_context, request->server,
+                                s_flags, &server);
     if (errcode && errcode != KRB5_KDB_NOENTRY) {
         status = "LOOKING_UP_SERVER";
         goto cleanup;
@@ -624,12 +630,12 @@ tgt_again:
          * Convert server.key into a real key
          * (it may be encrypted in the database)
          */
-        if ((errcode = krb5_dbe_decrypt_key_data(kdc_context, NULL,
-                                                 server_key, &encrypting_key,
-                                                 NULL))) {
+        if ((errcode = kdc_get_key(kdc_context, server, server_key,
+                                   &server_tkt_key))) {
             status = "DECRYPT_SERVER_KEY";
             goto cleanup;
         }
+        encrypting_key = server_tkt_key->keyblock;
     }
 
     if (isflagset(c_flags, KRB5_KDB_FLAG_CONSTRAINED_DELEGATION)) {
@@ -657,8 +663,8 @@ tgt_again:
 
             assert(client == NULL); /* should not have been set already */
 
-            errcode = krb5_db_get_principal(kdc_context, subject_tkt->client,
-                                            c_flags, &client);
+            errcode = kdc_get_principal(kdc_context, subject_tkt->client,
+                                        c_flags, &client);
         }
     }
 
@@ -810,10 +816,15 @@ tgt_again:
         ticket_kvno = server_key->key_data_kvno;
     }
 
-    errcode = krb5_encrypt_tkt_part(kdc_context, &encrypting_key,
-                                    &ticket_reply);
-    if (!isflagset(request->kdc_options, KDC_OPT_ENC_TKT_IN_SKEY))
-        krb5_free_keyblock_contents(kdc_context, &encrypting_key);
+    t = kdc_stats_start();
+    if (server_tkt_key != NULL) {
+        errcode = krb5_encrypt_tkt_part_k(kdc_context, server_tkt_key,
+                                          &ticket_reply);
+    } else {
+        errcode = krb5_encrypt_tkt_part(kdc_context, &encrypting_key,
+                                        &ticket_reply);
+    }
+    kdc_stats_end(KDC_STAGE_TKT_ENCRYPT, t);
     if (errcode) {
         status = "TKT_ENCRYPT";
         goto cleanup;
@@ -885,10 +896,12 @@ tgt_again:
         goto cleanup;
     }
 
+    t = kdc_stats_start();
     errcode = krb5_encode_kdc_rep(kdc_context, KRB5_TGS_REP, &reply_encpart,
                                   subkey ? 1 : 0,
                                   reply_key,
                                   &reply, response);
+    kdc_stats_end(KDC_STAGE_REPLY_ENCODE, t);
     if (errcode) {
         status = "ENCODE_KDC_REP";
     } else {
@@ -963,6 +976,7 @@ cleanup:
         krb5_free_keyblock(kdc_context, subkey);
     if (tgskey != NULL)
         krb5_free_keyblock(kdc_context, tgskey);
+    krb5_k_free_key(kdc_context, server_tkt_key);
     if (reply.padata)
         krb5_free_pa_data(kdc_context, reply.padata);
     if (reply_encpart.enc_padata)
@@ -1077,7 +1091,7 @@ find_alternate_tgs(krb5_kdc_req *request, krb5_db_entry **server_ptr)
         tmp = *krb5_princ_realm(kdc_context, *pl2);
         krb5_princ_set_realm(kdc_context, *pl2,
                              krb5_princ_realm(kdc_context, tgs_server));
-        retval = krb5_db_get_principal(kdc_context, *pl2, 0, &server);
+        retval = kdc_get_principal(kdc_context, *pl2, 0, &server);
         krb5_princ_set_realm(kdc_context, *pl2, &tmp);
         if (retval == KRB5_KDB_NOENTRY)
             continue;
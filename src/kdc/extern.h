@@ -48,6 +48,9 @@ typedef struct __kdc_realm_data {
      */
     char *              realm_stash;    /* Stash file name for realm        */
     char *              realm_mpname;   /* Master principal name for realm  */
+    char **             realm_db_args;  /* Database module arguments        */
+    struct princ_cache *realm_princ_cache; /* Cached principal entries  */
+    struct key_cache *  realm_key_cache; /* Cached server keys          */
     krb5_principal      realm_mprinc;   /* Master principal for realm       */
     /*
      * Note realm_mkey is mkey read from stash or keyboard and may not be the
@@ -77,6 +80,8 @@ extern int              kdc_numrealms;
 extern kdc_realm_t      *kdc_active_realm;
 
 kdc_realm_t *find_realm_data (char *, krb5_ui_4);
+void kdc_free_princ_cache(kdc_realm_t *rdp);
+void kdc_free_key_cache(kdc_realm_t *rdp);
 
 /*
  * Replace previously used global variables with the active (e.g. request's)
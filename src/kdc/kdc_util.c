@@ -74,8 +74,7 @@ static krb5_error_code kdc_rd_ap_req(krb5_ap_req *apreq,
                                      krb5_keyblock **tgskey,
                                      krb5_ticket **ticket);
 static krb5_error_code find_server_key(krb5_db_entry *, krb5_enctype,
-                                       krb5_kvno, krb5_keyblock **,
-                                       krb5_kvno *);
+                                       krb5_kvno, krb5_key *, krb5_kvno *);
 
 /*
  * concatenate first two authdata arrays, returning an allocated replacement.
@@ -373,6 +372,7 @@ kdc_rd_ap_req(krb5_ap_req *apreq, krb5_auth_context auth_context,
     krb5_enctype        search_enctype = apreq->ticket->enc_part.enctype;
     krb5_boolean        match_enctype = 1;
     krb5_kvno           kvno;
+    krb5_key            key = NULL;
     size_t              tries = 3;
 
     /*
@@ -395,16 +395,21 @@ kdc_rd_ap_req(krb5_ap_req *apreq, krb5_auth_context auth_context,
     *tgskey = NULL;
     kvno = apreq->ticket->enc_part.kvno;
     do {
-        krb5_free_keyblock(kdc_context, *tgskey);
-        retval = find_server_key(*server, search_enctype, kvno, tgskey, &kvno);
+        krb5_k_free_key(kdc_context, key);
+        key = NULL;
+        retval = find_server_key(*server, search_enctype, kvno, &key, &kvno);
         if (retval)
             continue;
 
-        /* Make the TGS key available to krb5_rd_req_decoded_anyflag() */
-        retval = krb5_auth_con_setuseruserkey(kdc_context, auth_context,
-                                              *tgskey);
+        /*
+         * Make the TGS key available to krb5_rd_req_decoded_anyflag().  The
+         * key handle may come from the key cache, which lets the ticket
+         * decryption reuse its derived keys.
+         */
+        retval = krb5_auth_con_setuseruserkey_k(kdc_context, auth_context,
+                                                key);
         if (retval)
-            return retval;
+            goto cleanup;
 
         retval = krb5_rd_req_decoded_anyflag(kdc_context, &auth_context, apreq,
                                              apreq->ticket->server,
@@ -413,6 +418,11 @@ kdc_rd_ap_req(krb5_ap_req *apreq, krb5_auth_context auth_context,
     } while (retval && apreq->ticket->enc_part.kvno == 0 && kvno-- > 1 &&
              --tries > 0);
 
+    if (retval == 0)
+        retval = krb5_k_key_keyblock(kdc_context, key, tgskey);
+
+cleanup:
+    krb5_k_free_key(kdc_context, key);
     return retval;
 }
 
@@ -433,6 +443,7 @@ kdc_get_server_key(krb5_ticket *ticket, unsigned int flags,
     krb5_db_entry       * server = NULL;
     krb5_enctype          search_enctype = -1;
     krb5_kvno             search_kvno = -1;
+    krb5_key              k;
 
     if (match_enctype)
         search_enctype = ticket->enc_part.enctype;
@@ -441,8 +452,8 @@ kdc_get_server_key(krb5_ticket *ticket, unsigned int flags,
 
     *server_ptr = NULL;
 
-    retval = krb5_db_get_principal(kdc_context, ticket->server, flags,
-                                   &server);
+    retval = kdc_get_principal(kdc_context, ticket->server, flags,
+                               &server);
     if (retval == KRB5_KDB_NOENTRY) {
         char *sname;
         if (!krb5_unparse_name(kdc_context, ticket->server, &sname)) {
@@ -461,7 +472,11 @@ kdc_get_server_key(krb5_ticket *ticket, unsigned int flags,
     }
 
     if (key) {
-        retval = find_server_key(server, search_enctype, search_kvno, key, kvno);
+        retval = find_server_key(server, search_enctype, search_kvno, &k, kvno);
+        if (retval)
+            goto errout;
+        retval = krb5_k_key_keyblock(kdc_context, k, key);
+        krb5_k_free_key(kdc_context, k);
         if (retval)
             goto errout;
     }
@@ -476,16 +491,18 @@ errout:
 
 /*
  * A utility function to get the right key from a KDB entry.  Used in handling
- * of kvno 0 TGTs, for example.
+ * of kvno 0 TGTs, for example.  The key is obtained through the key cache;
+ * release it with krb5_k_free_key().
  */
 static
 krb5_error_code
 find_server_key(krb5_db_entry *server, krb5_enctype enctype, krb5_kvno kvno,
-                krb5_keyblock **key_out, krb5_kvno *kvno_out)
+                krb5_key *key_out, krb5_kvno *kvno_out)
 {
     krb5_error_code       retval;
     krb5_key_data       * server_key;
-    krb5_keyblock       * key;
+    krb5_key              key = NULL, newkey;
+    krb5_keyblock         kb;
 
     *key_out = NULL;
     retval = krb5_dbe_find_enctype(kdc_context, server, enctype, -1,
@@ -494,30 +511,34 @@ find_server_key(krb5_db_entry *server, krb5_enctype enctype, krb5_kvno kvno,
         return retval;
     if (!server_key)
         return KRB5KDC_ERR_S_PRINCIPAL_UNKNOWN;
-    if ((key = (krb5_keyblock *)malloc(sizeof *key)) == NULL)
-        return ENOMEM;
-    retval = krb5_dbe_decrypt_key_data(kdc_context, NULL, server_key,
-                                       key, NULL);
+    retval = kdc_get_key(kdc_context, server, server_key, &key);
     if (retval)
         goto errout;
-    if (enctype != -1) {
+    if (enctype != -1 && enctype != key->keyblock.enctype) {
         krb5_boolean similar;
-        retval = krb5_c_enctype_compare(kdc_context, enctype, key->enctype,
-                                        &similar);
+        retval = krb5_c_enctype_compare(kdc_context, enctype,
+                                        key->keyblock.enctype, &similar);
         if (retval)
             goto errout;
         if (!similar) {
             retval = KRB5_KDB_NO_PERMITTED_KEY;
             goto errout;
         }
-        key->enctype = enctype;
+        /* Make a private key with the requested enctype. */
+        kb = key->keyblock;
+        kb.enctype = enctype;
+        retval = krb5_k_create_key(kdc_context, &kb, &newkey);
+        if (retval)
+            goto errout;
+        krb5_k_free_key(kdc_context, key);
+        key = newkey;
     }
     *key_out = key;
     key = NULL;
     if (kvno_out)
         *kvno_out = server_key->key_data_kvno;
 errout:
-    krb5_free_keyblock(kdc_context, key);
+    krb5_k_free_key(kdc_context, key);
     return retval;
 }
 
@@ -2124,8 +2145,8 @@ kdc_process_s4u2self_req(krb5_context context,
         krb5_db_entry no_server;
         krb5_pa_data **e_data = NULL;
 
-        code = krb5_db_get_principal(context, (*s4u_x509_user)->user_id.user,
-                                     KRB5_KDB_FLAG_INCLUDE_PAC, &princ);
+        code = kdc_get_principal(context, (*s4u_x509_user)->user_id.user,
+                                 KRB5_KDB_FLAG_INCLUDE_PAC, &princ);
         if (code == KRB5_KDB_NOENTRY) {
             *status = "UNKNOWN_S4U2SELF_PRINCIPAL";
             return KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN;
@@ -2276,6 +2297,7 @@ log_as_req(const krb5_fulladdr *from,
     char ktypestr[128];
     const char *cname2 = cname ? cname : "<unknown client>";
     const char *sname2 = sname ? sname : "<unknown server>";
+    krb5_ui_8 t = kdc_stats_start();
 
     fromstring = inet_ntop(ADDRTYPE2FAMILY (from->address->addrtype),
                            from->address->contents,
@@ -2301,6 +2323,8 @@ log_as_req(const krb5_fulladdr *from,
     }
     krb5_db_audit_as_req(kdc_context, request, client, server, authtime,
                          errcode);
+    kdc_stats_result(KDC_REQ_AS, errcode);
+    kdc_stats_end(KDC_STAGE_LOG, t);
 #if 0
     /* Sun (OpenSolaris) version would probably something like this.
        The client and server names passed can be null, unlike in the
@@ -2327,6 +2351,7 @@ log_tgs_req(const krb5_fulladdr *from,
     const char *fromstring = 0;
     char fromstringbuf[70];
     char rep_etypestr[128];
+    krb5_ui_8 t = kdc_stats_start();
 
     fromstring = inet_ntop(ADDRTYPE2FAMILY(from->address->addrtype),
                            from->address->contents,
@@ -2372,6 +2397,8 @@ log_tgs_req(const krb5_fulladdr *from,
 
     /* OpenSolaris: audit_krb5kdc_tgs_req(...)  or
        audit_krb5kdc_tgs_req_2ndtktmm(...) */
+    kdc_stats_result(KDC_REQ_TGS, errcode);
+    kdc_stats_end(KDC_STAGE_LOG, t);
 }
 
 void
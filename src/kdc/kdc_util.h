@@ -230,12 +230,51 @@ handle_authdata (krb5_context context,
                  krb5_enc_tkt_part *enc_tkt_request,
                  krb5_enc_tkt_part *enc_tkt_reply);
 
+/* key_cache.c */
+void kdc_init_key_cache(krb5_int32 nslots);
+krb5_error_code kdc_get_key(krb5_context context, krb5_db_entry *entry,
+                            krb5_key_data *kd, krb5_key *key_out);
+
+/* princ_cache.c */
+void kdc_init_princ_cache(krb5_int32 nslots, krb5_deltat lifetime);
+krb5_error_code kdc_get_principal(krb5_context context,
+                                  krb5_const_principal search_for,
+                                  unsigned int flags, krb5_db_entry **entry);
+
 /* replay.c */
+void kdc_init_lookaside(size_t max_entries, size_t max_size);
+krb5_error_code kdc_init_shared_lookaside(krb5_context);
 krb5_boolean kdc_check_lookaside (krb5_data *, krb5_data **);
 void kdc_insert_lookaside (krb5_data *, krb5_data *);
 void kdc_remove_lookaside (krb5_context kcontext, krb5_data *);
 void kdc_free_lookaside(krb5_context);
 
+/* stats.c */
+enum kdc_stage {
+    KDC_STAGE_DECODE,
+    KDC_STAGE_DB_LOOKUP,
+    KDC_STAGE_PREAUTH,
+    KDC_STAGE_KEY_DECRYPT,
+    KDC_STAGE_TKT_ENCRYPT,
+    KDC_STAGE_REPLY_ENCODE,
+    KDC_STAGE_LOG,
+    KDC_STAGE_AS_TOTAL,
+    KDC_STAGE_TGS_TOTAL,
+    KDC_NUM_STAGES
+};
+enum kdc_req_type {
+    KDC_REQ_AS,
+    KDC_REQ_TGS,
+    KDC_REQ_REPEATED,
+    KDC_REQ_OTHER,
+    KDC_NUM_REQ_TYPES
+};
+krb5_ui_8 kdc_stats_start(void);
+void kdc_stats_end(enum kdc_stage stage, krb5_ui_8 start);
+void kdc_stats_request(enum kdc_req_type type);
+void kdc_stats_result(enum kdc_req_type type, krb5_error_code code);
+void kdc_stats_dump(void);
+
 /* kdc_util.c */
 void reset_for_hangup(void);
 
@@ -0,0 +1,251 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/key_cache.c - Cache of decrypted server keys for the KDC */
+/*
+ * Copyright (C) 2011 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Export of this software from the United States of America may
+ *   require a specific license from the United States Government.
+ *   It is the responsibility of any person or organization contemplating
+ *   export to obtain such a license before exporting.
+ *
+ * WITHIN THAT CONSTRAINT, permission to use, copy, modify, and
+ * distribute this software and its documentation for any purpose and
+ * without fee is hereby granted, provided that the above copyright
+ * notice appear in all copies and that both that copyright notice and
+ * this permission notice appear in supporting documentation, and that
+ * the name of M.I.T. not be used in advertising or publicity pertaining
+ * to distribution of the software without specific, written prior
+ * permission.  Furthermore if you modify this software you must label
+ * your software as modified software and not distribute it in such a
+ * fashion that it might be confused with the original M.I.T. software.
+ * M.I.T. makes no representations about the suitability of
+ * this software for any purpose.  It is provided "as is" without express
+ * or implied warranty.
+ */
+
+/*
+ * The key cache holds the decrypted keys of recently used server principals
+ * (the TGS principal and hot services) as krb5_key handles, which live as long
+ * as they stay in the cache.  Reusing a handle avoids decrypting the key with
+ * the master key for every request, and keeps the derived keys and cipher
+ * state cached inside the handle warm across requests.
+ *
+ * The cache is a direct-mapped table keyed by principal, kvno, and enctype.
+ * A slot also remembers the encrypted key contents it was made from, and is
+ * only used if they match the database entry, so a key changed without a new
+ * kvno is never served stale.  Keys leaving the cache are released with
+ * krb5_k_free_key(), which zeroizes them once the last reference is gone.
+ */
+
+#include "k5-int.h"
+#include "kdc_util.h"
+#include "extern.h"
+#include "adm_proto.h"
+#include <syslog.h>
+
+#define DEFAULT_CACHE_SLOTS     64
+
+struct key_slot {
+    krb5_principal princ;       /* NULL if the slot is unused */
+    krb5_int16 kvno;
+    krb5_int16 enctype;
+    krb5_data enc_contents;     /* Encrypted key data the key came from */
+    krb5_key key;
+};
+
+struct key_cache {
+    struct key_slot *slots;
+    unsigned long hits;
+    unsigned long misses;
+
+    /* Derived key cache counts of keys which have left the cache */
+    unsigned long dkey_hits;
+    unsigned long dkey_misses;
+};
+
+static unsigned int cache_slots = DEFAULT_CACHE_SLOTS;
+
+/* Set the number of slots in each realm's key cache.  A size of zero disables
+ * the cache; a negative size selects the default. */
+void
+kdc_init_key_cache(krb5_int32 nslots)
+{
+    cache_slots = (nslots >= 0) ? nslots : DEFAULT_CACHE_SLOTS;
+}
+
+/* FNV-1a hash of the kvno, enctype, and encrypted contents of kd. */
+static unsigned int
+hash_key_data(const krb5_key_data *kd)
+{
+    unsigned int h = 2166136261U;
+    unsigned int i;
+
+    h = (h ^ (unsigned int)kd->key_data_kvno) * 16777619U;
+    h = (h ^ (unsigned int)kd->key_data_type[0]) * 16777619U;
+    for (i = 0; i < kd->key_data_length[0]; i++)
+        h = (h ^ kd->key_data_contents[0][i]) * 16777619U;
+    return h;
+}
+
+static void
+clear_slot(krb5_context context, struct key_cache *cache,
+           struct key_slot *slot)
+{
+    unsigned long hits, misses, evictions;
+
+    if (slot->key != NULL) {
+        krb5int_c_derived_key_stats(slot->key, &hits, &misses, &evictions);
+        cache->dkey_hits += hits;
+        cache->dkey_misses += misses;
+    }
+    krb5_free_principal(context, slot->princ);
+    krb5_free_data_contents(context, &slot->enc_contents);
+    krb5_k_free_key(context, slot->key);
+    slot->princ = NULL;
+    slot->key = NULL;
+}
+
+static krb5_boolean
+slot_matches(krb5_context context, const struct key_slot *slot,
+             krb5_const_principal princ, const krb5_key_data *kd)
+{
+    return slot->princ != NULL && slot->kvno == kd->key_data_kvno &&
+        slot->enctype == kd->key_data_type[0] &&
+        slot->enc_contents.length == kd->key_data_length[0] &&
+        memcmp(slot->enc_contents.data, kd->key_data_contents[0],
+               kd->key_data_length[0]) == 0 &&
+        krb5_principal_compare(context, slot->princ, princ);
+}
+
+/* Decrypt kd into a new krb5_key. */
+static krb5_error_code
+decrypt_key(krb5_context context, const krb5_key_data *kd, krb5_key *key_out)
+{
+    krb5_error_code ret;
+    krb5_keyblock kb;
+
+    ret = krb5_dbe_decrypt_key_data(context, NULL, kd, &kb, NULL);
+    if (ret)
+        return ret;
+    ret = krb5_k_create_key(context, &kb, key_out);
+    krb5_free_keyblock_contents(context, &kb);
+    return ret;
+}
+
+/* Return the active realm's cache, creating it if necessary, or NULL if the
+ * cache is disabled or cannot be created. */
+static struct key_cache *
+get_cache(void)
+{
+    struct key_cache *cache = kdc_active_realm->realm_key_cache;
+
+    if (cache != NULL || cache_slots == 0)
+        return cache;
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL)
+        return NULL;
+    cache->slots = calloc(cache_slots, sizeof(*cache->slots));
+    if (cache->slots == NULL) {
+        free(cache);
+        return NULL;
+    }
+    kdc_active_realm->realm_key_cache = cache;
+    return cache;
+}
+
+static krb5_error_code
+get_key(krb5_context context, krb5_db_entry *entry, krb5_key_data *kd,
+        krb5_key *key_out)
+{
+    krb5_error_code ret;
+    struct key_cache *cache;
+    struct key_slot *slot;
+    krb5_key key;
+
+    *key_out = NULL;
+    cache = get_cache();
+    if (cache == NULL || kd->key_data_length[0] == 0)
+        return decrypt_key(context, kd, key_out);
+
+    slot = &cache->slots[hash_key_data(kd) % cache_slots];
+    if (slot_matches(context, slot, entry->princ, kd)) {
+        cache->hits++;
+        krb5_k_reference_key(context, slot->key);
+        *key_out = slot->key;
+        return 0;
+    }
+    cache->misses++;
+
+    ret = decrypt_key(context, kd, &key);
+    if (ret)
+        return ret;
+
+    /* Remember the key, replacing whatever was in the slot. */
+    if (slot->princ != NULL)
+        clear_slot(context, cache, slot);
+    if (krb5_copy_principal(context, entry->princ, &slot->princ) != 0)
+        goto done;
+    slot->enc_contents.data = k5alloc(kd->key_data_length[0], &ret);
+    if (slot->enc_contents.data == NULL) {
+        clear_slot(context, cache, slot);
+        goto done;
+    }
+    memcpy(slot->enc_contents.data, kd->key_data_contents[0],
+           kd->key_data_length[0]);
+    slot->enc_contents.length = kd->key_data_length[0];
+    slot->kvno = kd->key_data_kvno;
+    slot->enctype = kd->key_data_type[0];
+    krb5_k_reference_key(context, key);
+    slot->key = key;
+
+done:
+    *key_out = key;
+    return 0;
+}
+
+/*
+ * Get a krb5_key for the key data kd of the database entry entry, using the
+ * active realm's key cache where possible.  The caller must release the result
+ * with krb5_k_free_key(), and must not modify it, since it may be shared with
+ * the cache.
+ */
+krb5_error_code
+kdc_get_key(krb5_context context, krb5_db_entry *entry, krb5_key_data *kd,
+            krb5_key *key_out)
+{
+    krb5_error_code ret;
+    krb5_ui_8 t = kdc_stats_start();
+
+    ret = get_key(context, entry, kd, key_out);
+    kdc_stats_end(KDC_STAGE_KEY_DECRYPT, t);
+    return ret;
+}
+
+/* Release the key cache of rdp, logging its statistics. */
+void
+kdc_free_key_cache(kdc_realm_t *rdp)
+{
+    struct key_cache *cache = rdp->realm_key_cache;
+    unsigned int i;
+
+    if (cache == NULL)
+        return;
+    if (cache->hits + cache->misses > 0) {
+        krb5_klog_syslog(LOG_INFO, _("key cache for %s: %lu hits, "
+                                     "%lu misses"),
+                         rdp->realm_name, cache->hits, cache->misses);
+    }
+    for (i = 0; i < cache_slots; i++) {
+        if (cache->slots[i].princ != NULL)
+            clear_slot(rdp->realm_context, cache, &cache->slots[i]);
+    }
+    if (cache->dkey_hits + cache->dkey_misses > 0) {
+        krb5_klog_syslog(LOG_INFO, _("derived key cache for %s: %lu hits, "
+                                     "%lu misses"), rdp->realm_name,
+                         cache->dkey_hits, cache->dkey_misses);
+    }
+    free(cache->slots);
+    free(cache);
+    rdp->realm_key_cache = NULL;
+}
@@ -86,11 +86,19 @@ static void finish_realms (void);
 
 static int nofork = 0;
 static int workers = 0;
+static krb5_boolean worker_reuseport = FALSE;
+static krb5_boolean shared_lookaside = FALSE;
+static krb5_int32 lookaside_max_entries = 0;
+static krb5_int32 lookaside_max_size = 0;
+static krb5_int32 princ_cache_size = -1;
+static krb5_deltat princ_cache_lifetime = 0;
+static krb5_int32 key_cache_size = -1;
 static int time_offset = 0;
 static const char *pid_file = NULL;
 static int rkey_init_done = 0;
 static volatile int signal_received = 0;
 static volatile int sighup_received = 0;
+static volatile int sigusr1_received = 0;
 
 #define KRB5_KDC_MAX_REALMS     32
 
@@ -156,10 +164,17 @@ setup_server_realm(krb5_principal sprinc)
 static void
 finish_realm(kdc_realm_t *rdp)
 {
+    int i;
+
     if (rdp->realm_name)
         free(rdp->realm_name);
     if (rdp->realm_mpname)
         free(rdp->realm_mpname);
+    if (rdp->realm_db_args) {
+        for (i = 0; rdp->realm_db_args[i] != NULL; i++)
+            free(rdp->realm_db_args[i]);
+        free(rdp->realm_db_args);
+    }
     if (rdp->realm_stash)
         free(rdp->realm_stash);
     if (rdp->realm_ports)
@@ -180,6 +195,8 @@ finish_realm(kdc_realm_t *rdp)
             memset(rdp->realm_mkey.contents, 0, rdp->realm_mkey.length);
             free(rdp->realm_mkey.contents);
         }
+        kdc_free_key_cache(rdp);
+        kdc_free_princ_cache(rdp);
         krb5_db_fini(rdp->realm_context);
         if (rdp->realm_tgsprinc)
             krb5_free_principal(rdp->realm_context, rdp->realm_tgsprinc);
@@ -189,6 +206,32 @@ finish_realm(kdc_realm_t *rdp)
     free(rdp);
 }
 
+/* Make a null-terminated copy of db_args (which may be NULL) in *out. */
+static krb5_error_code
+copy_db_args(char **db_args, char ***out)
+{
+    char **copy;
+    int i, n = 0;
+
+    *out = NULL;
+    while (db_args != NULL && db_args[n] != NULL)
+        n++;
+    copy = calloc(n + 1, sizeof(*copy));
+    if (copy == NULL)
+        return ENOMEM;
+    for (i = 0; i < n; i++) {
+        copy[i] = strdup(db_args[i]);
+        if (copy[i] == NULL) {
+            while (--i >= 0)
+                free(copy[i]);
+            free(copy);
+            return ENOMEM;
+        }
+    }
+    *out = copy;
+    return 0;
+}
+
 static krb5_error_code
 handle_referral_params(krb5_realm_params *rparams,
                        char *no_refrls, char *host_based_srvcs,
@@ -396,6 +439,12 @@ init_realm(kdc_realm_t *rdp, char *realm, char *def_mpname,
         goto whoops;
     }
 
+    /* Remember the database arguments so that worker processes can reopen
+     * the database. */
+    kret = copy_db_args(db_args, &rdp->realm_db_args);
+    if (kret)
+        goto whoops;
+
     /* first open the database  before doing anything */
     kdb_open_flags = KRB5_KDB_OPEN_RW | KRB5_KDB_SRV_TYPE_KDC;
     if ((kret = krb5_db_open(rdp->realm_context, db_args, kdb_open_flags))) {
@@ -479,6 +528,44 @@ whoops:
     return(kret);
 }
 
+/*
+ * Reopen the database of each realm in a newly forked worker process.  The
+ * rest of the realm data (contexts, keytabs, master keys, plugin state) was
+ * set up once by the supervisor and is shared with the workers copy-on-write,
+ * but database handles may hold per-process state such as network
+ * connections, so each worker needs its own.
+ */
+static krb5_error_code
+reopen_realm_databases()
+{
+    krb5_error_code ret;
+    kdc_realm_t *rdp;
+    int i;
+
+    for (i = 0; i < kdc_numrealms; i++) {
+        rdp = kdc_realmlist[i];
+        kdc_free_princ_cache(rdp);
+        (void)krb5_db_fini(rdp->realm_context);
+        ret = krb5_db_open(rdp->realm_context, rdp->realm_db_args,
+                           KRB5_KDB_OPEN_RW | KRB5_KDB_SRV_TYPE_KDC);
+        if (ret) {
+            kdc_err(rdp->realm_context, ret,
+                    _("while reopening database for realm %s"),
+                    rdp->realm_name);
+            return ret;
+        }
+        ret = krb5_db_fetch_mkey_list(rdp->realm_context, rdp->realm_mprinc,
+                                      &rdp->realm_mkey);
+        if (ret) {
+            kdc_err(rdp->realm_context, ret,
+                    _("while fetching master keys list for realm %s"),
+                    rdp->realm_name);
+            return ret;
+        }
+    }
+    return 0;
+}
+
 static krb5_sigtype
 on_monitor_signal(int signo)
 {
@@ -503,6 +590,33 @@ on_monitor_sighup(int signo)
 #endif
 }
 
+static krb5_sigtype
+on_monitor_sigusr1(int signo)
+{
+    sigusr1_received = 1;
+
+#ifdef POSIX_SIGTYPE
+    return;
+#else
+    return(0);
+#endif
+}
+
+/* Write the request statistics to the log when SIGUSR1 is received. */
+static void
+dump_stats(verto_ctx *ctx, verto_ev *ev)
+{
+    kdc_stats_dump();
+}
+
+static krb5_error_code
+setup_stats_signal(verto_ctx *ctx)
+{
+    if (!verto_add_signal(ctx, VERTO_EV_FLAG_PERSIST, dump_stats, SIGUSR1))
+        return ENOMEM;
+    return 0;
+}
+
 /*
  * Kill the worker subprocesses given by pids[0..bound-1], skipping any which
  * are set to -1, and wait for them to exit (so that we know the ports are no
@@ -558,11 +672,14 @@ create_workers(verto_ctx *ctx, int num)
     (void) sigaction(SIGQUIT, &s_action, (struct sigaction *) NULL);
     s_action.sa_handler = on_monitor_sighup;
     (void) sigaction(SIGHUP, &s_action, (struct sigaction *) NULL);
+    s_action.sa_handler = on_monitor_sigusr1;
+    (void) sigaction(SIGUSR1, &s_action, (struct sigaction *) NULL);
 #else  /* POSIX_SIGNALS */
     signal(SIGINT, on_monitor_signal);
     signal(SIGTERM, on_monitor_signal);
     signal(SIGQUIT, on_monitor_signal);
     signal(SIGHUP, on_monitor_sighup);
+    signal(SIGUSR1, on_monitor_sigusr1);
 #endif /* POSIX_SIGNALS */
 
     /* Create child worker processes; return in each child. */
@@ -579,6 +696,8 @@ create_workers(verto_ctx *ctx, int num)
                 return ENOMEM;
             }
             retval = loop_setup_signals(ctx, NULL, reset_for_hangup);
+            if (!retval)
+                retval = setup_stats_signal(ctx);
             if (retval) {
                 krb5_klog_syslog(LOG_ERR, _("Unable to initialize signal "
                                             "handlers in pid %d"), pid);
@@ -633,6 +752,15 @@ create_workers(verto_ctx *ctx, int num)
                     kill(pids[i], SIGHUP);
             }
         }
+
+        /* Likewise for USR1, which asks for a statistics dump. */
+        if (sigusr1_received) {
+            sigusr1_received = 0;
+            for (i = 0; i < num; i++) {
+                if (pids[i] != -1)
+                    kill(pids[i], SIGUSR1);
+            }
+        }
     }
     if (signal_received)
         krb5_klog_syslog(LOG_INFO, _("signal %d received in supervisor"),
@@ -698,6 +826,29 @@ initialize_realms(krb5_context kcontext, int argc, char **argv)
         hierarchy[1] = KRB5_CONF_KDC_TCP_PORTS;
         if (krb5_aprof_get_string(aprof, hierarchy, TRUE, &default_tcp_ports))
             default_tcp_ports = 0;
+        hierarchy[1] = KRB5_CONF_KDC_REUSEPORT;
+        if (krb5_aprof_get_boolean(aprof, hierarchy, TRUE, &worker_reuseport))
+            worker_reuseport = FALSE;
+        hierarchy[1] = KRB5_CONF_KDC_SHARED_LOOKASIDE;
+        if (krb5_aprof_get_boolean(aprof, hierarchy, TRUE, &shared_lookaside))
+            shared_lookaside = FALSE;
+        hierarchy[1] = KRB5_CONF_KDC_KEY_CACHE_SIZE;
+        if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &key_cache_size))
+            key_cache_size = -1;
+        hierarchy[1] = KRB5_CONF_KDC_LOOKASIDE_MAX_ENTRIES;
+        if (krb5_aprof_get_int32(aprof, hierarchy, TRUE,
+                                 &lookaside_max_entries))
+            lookaside_max_entries = 0;
+        hierarchy[1] = KRB5_CONF_KDC_LOOKASIDE_MAX_SIZE;
+        if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &lookaside_max_size))
+            lookaside_max_size = 0;
+        hierarchy[1] = KRB5_CONF_KDC_PRINCIPAL_CACHE_SIZE;
+        if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &princ_cache_size))
+            princ_cache_size = -1;
+        hierarchy[1] = KRB5_CONF_KDC_PRINCIPAL_CACHE_LIFETIME;
+        if (krb5_aprof_get_deltat(aprof, hierarchy, TRUE,
+                                  &princ_cache_lifetime))
+            princ_cache_lifetime = 0;
         hierarchy[1] = KRB5_CONF_MAX_DGRAM_REPLY_SIZE;
         if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &max_dgram_reply_size))
             max_dgram_reply_size = MAX_DGRAM_SIZE;
@@ -1006,6 +1157,13 @@ int main(int argc, char **argv)
      */
     initialize_realms(kcontext, argc, argv);
 
+#ifndef NOCACHE
+    kdc_init_lookaside(lookaside_max_entries > 0 ? lookaside_max_entries : 0,
+                       lookaside_max_size > 0 ? lookaside_max_size : 0);
+#endif
+    kdc_init_princ_cache(princ_cache_size, princ_cache_lifetime);
+    kdc_init_key_cache(key_cache_size);
+
     ctx = loop_init(VERTO_EV_TYPE_NONE);
     if (!ctx) {
         kdc_err(kcontext, ENOMEM, _("while creating main loop"));
@@ -1069,13 +1227,27 @@ int main(int argc, char **argv)
             return 1;
         }
         retval = loop_setup_signals(ctx, NULL, reset_for_hangup);
+        if (!retval)
+            retval = setup_stats_signal(ctx);
         if (retval) {
             kdc_err(kcontext, retval, _("while initializing signal handlers"));
             finish_realms();
             return 1;
         }
     }
-    if ((retval = loop_setup_network(ctx, NULL, kdc_progname))) {
+    /*
+     * If worker processes will listen with SO_REUSEPORT, each worker sets up
+     * its own listener sockets after it is created, so that the kernel can
+     * distribute incoming requests among them.
+     */
+    if (workers > 0 && worker_reuseport) {
+        retval = loop_set_reuseport(1);
+        if (retval) {
+            kdc_err(kcontext, retval, _("while enabling SO_REUSEPORT"));
+            finish_realms();
+            return 1;
+        }
+    } else if ((retval = loop_setup_network(ctx, NULL, kdc_progname))) {
     net_init_error:
         kdc_err(kcontext, retval, _("while initializing network"));
         finish_realms();
@@ -1094,15 +1266,40 @@ int main(int argc, char **argv)
             return 1;
         }
     }
+#ifndef NOCACHE
+    /* Let the workers recognize each other's retransmitted requests. */
+    if (workers > 0 && shared_lookaside) {
+        retval = kdc_init_shared_lookaside(kcontext);
+        if (retval) {
+            kdc_err(kcontext, retval,
+                    _("while creating shared lookaside cache"));
+            finish_realms();
+            return 1;
+        }
+    }
+#endif
     if (workers > 0) {
-        finish_realms();
         retval = create_workers(ctx, workers);
         if (retval) {
             kdc_err(kcontext, errno, _("creating worker processes"));
             return 1;
         }
-        /* We get here only in a worker child process; re-initialize realms. */
-        initialize_realms(kcontext, argc, argv);
+        /* We get here only in a worker child process; the realms were
+         * inherited from the supervisor, but need their own database
+         * handles. */
+        retval = reopen_realm_databases();
+        if (retval) {
+            finish_realms();
+            return 1;
+        }
+        if (worker_reuseport) {
+            retval = loop_setup_network(ctx, NULL, kdc_progname);
+            if (retval) {
+                kdc_err(kcontext, retval, _("while initializing network"));
+                finish_realms();
+                return 1;
+            }
+        }
     }
     krb5_klog_syslog(LOG_INFO, _("commencing operation"));
     if (nofork)
@@ -1113,13 +1310,17 @@ int main(int argc, char **argv)
     krb5_klog_syslog(LOG_INFO, _("shutting down"));
     unload_preauth_plugins(kcontext);
     unload_authdata_plugins(kcontext);
+#ifndef NOCACHE
+    kdc_free_lookaside(kcontext);
+#endif
+    for (i = 0; i < kdc_numrealms; i++) {
+        kdc_free_key_cache(kdc_realmlist[i]);
+        kdc_free_princ_cache(kdc_realmlist[i]);
+    }
     krb5_klog_close(kdc_context);
     finish_realms();
     if (kdc_realmlist)
         free(kdc_realmlist);
-#ifndef NOCACHE
-    kdc_free_lookaside(kcontext);
-#endif
     krb5_free_context(kcontext);
     return errout;
 }
@@ -0,0 +1,313 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/princ_cache.c - Cache of principal entries for the KDC */
+/*
+ * Copyright (C) 2011 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Export of this software from the United States of America may
+ *   require a specific license from the United States Government.
+ *   It is the responsibility of any person or organization contemplating
+ *   export to obtain such a license before exporting.
+ *
+ * WITHIN THAT CONSTRAINT, permission to use, copy, modify, and
+ * distribute this software and its documentation for any purpose and
+ * without fee is hereby granted, provided that the above copyright
+ * notice appear in all copies and that both that copyright notice and
+ * this permission notice appear in supporting documentation, and that
+ * the name of M.I.T. not be used in advertising or publicity pertaining
+ * to distribution of the software without specific, written prior
+ * permission.  Furthermore if you modify this software you must label
+ * your software as modified software and not distribute it in such a
+ * fashion that it might be confused with the original M.I.T. software.
+ * M.I.T. makes no representations about the suitability of
+ * this software for any purpose.  It is provided "as is" without express
+ * or implied warranty.
+ */
+
+/*
+ * The principal cache holds recently fetched database entries for each realm,
+ * so that hot principals such as the TGS principal do not have to be locked,
+ * looked up, and decoded for every request.  The cache is a direct-mapped
+ * table keyed by the search principal and lookup flags.
+ *
+ * Entries expire after a configured lifetime, and the whole cache is flushed
+ * whenever the database age reported by krb5_db_get_age() changes.  The db2
+ * module advances the age on every modification (including incremental
+ * propagation updates and lockout writes), even several times within a
+ * second.  Other modules may report the age with a resolution of one second,
+ * so the cache is bypassed entirely while the age is the current time, so that
+ * a modification made in the same second as a lookup is never missed.
+ */
+
+#include "k5-int.h"
+#include "kdc_util.h"
+#include "extern.h"
+#include "adm_proto.h"
+#include <syslog.h>
+
+#define DEFAULT_CACHE_SLOTS     256
+#define DEFAULT_CACHE_LIFETIME  60
+
+struct cache_slot {
+    krb5_principal search;      /* NULL if the slot is unused */
+    unsigned int flags;
+    krb5_timestamp timein;
+    krb5_db_entry *entry;
+};
+
+struct princ_cache {
+    struct cache_slot *slots;
+    time_t db_age;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long flushes;
+};
+
+static unsigned int cache_slots = DEFAULT_CACHE_SLOTS;
+static krb5_deltat cache_lifetime = DEFAULT_CACHE_LIFETIME;
+
+/* Set the number of slots in each realm's principal cache, and the lifetime
+ * of cached entries.  A size of zero disables the cache; a negative size or
+ * non-positive lifetime selects the default. */
+void
+kdc_init_princ_cache(krb5_int32 nslots, krb5_deltat lifetime)
+{
+    cache_slots = (nslots >= 0) ? nslots : DEFAULT_CACHE_SLOTS;
+    cache_lifetime = (lifetime > 0) ? lifetime : DEFAULT_CACHE_LIFETIME;
+}
+
+/* FNV-1a hash of the realm and components of princ. */
+static unsigned int
+hash_principal(krb5_const_principal princ)
+{
+    unsigned int h = 2166136261U;
+    const krb5_data *d;
+    krb5_int32 i;
+    unsigned int j;
+
+    for (i = -1; i < princ->length; i++) {
+        d = (i < 0) ? &princ->realm : &princ->data[i];
+        for (j = 0; j < d->length; j++)
+            h = (h ^ (unsigned char)d->data[j]) * 16777619U;
+        h = (h ^ 0xff) * 16777619U;
+    }
+    return h;
+}
+
+static void
+clear_slot(krb5_context context, struct cache_slot *slot)
+{
+    krb5_free_principal(context, slot->search);
+    krb5_db_free_principal(context, slot->entry);
+    slot->search = NULL;
+    slot->entry = NULL;
+}
+
+static void
+flush_cache(krb5_context context, struct princ_cache *cache)
+{
+    unsigned int i;
+
+    for (i = 0; i < cache_slots; i++) {
+        if (cache->slots[i].search != NULL)
+            clear_slot(context, &cache->slots[i]);
+    }
+}
+
+/*
+ * Make a copy of a database entry.  The copy is allocated the same way as the
+ * entries returned by the db2 and LDAP modules, so it can be released with
+ * krb5_db_free_principal().
+ */
+static krb5_error_code
+copy_entry(krb5_context context, const krb5_db_entry *in, krb5_db_entry **out)
+{
+    krb5_error_code ret;
+    krb5_db_entry *entry;
+    krb5_tl_data *tl, **tlp;
+    krb5_key_data *kd;
+    int i, j;
+
+    *out = NULL;
+    entry = k5alloc(sizeof(*entry), &ret);
+    if (entry == NULL)
+        return ret;
+    *entry = *in;
+    entry->e_data = NULL;
+    entry->princ = NULL;
+    entry->tl_data = NULL;
+    entry->key_data = NULL;
+    entry->n_key_data = 0;
+
+    if (in->e_data != NULL && in->e_length > 0) {
+        entry->e_data = k5alloc(in->e_length, &ret);
+        if (entry->e_data == NULL)
+            goto error;
+        memcpy(entry->e_data, in->e_data, in->e_length);
+    }
+
+    ret = krb5_copy_principal(context, in->princ, &entry->princ);
+    if (ret)
+        goto error;
+
+    tlp = &entry->tl_data;
+    for (tl = in->tl_data; tl != NULL; tl = tl->tl_data_next) {
+        *tlp = k5alloc(sizeof(**tlp), &ret);
+        if (*tlp == NULL)
+            goto error;
+        (*tlp)->tl_data_type = tl->tl_data_type;
+        (*tlp)->tl_data_length = tl->tl_data_length;
+        (*tlp)->tl_data_contents = k5alloc(tl->tl_data_length, &ret);
+        if ((*tlp)->tl_data_contents == NULL)
+            goto error;
+        memcpy((*tlp)->tl_data_contents, tl->tl_data_contents,
+               tl->tl_data_length);
+        tlp = &(*tlp)->tl_data_next;
+    }
+
+    if (in->n_key_data > 0) {
+        entry->key_data = k5alloc(in->n_key_data * sizeof(*kd), &ret);
+        if (entry->key_data == NULL)
+            goto error;
+        entry->n_key_data = in->n_key_data;
+        for (i = 0; i < in->n_key_data; i++) {
+            kd = &entry->key_data[i];
+            *kd = in->key_data[i];
+            kd->key_data_contents[0] = kd->key_data_contents[1] = NULL;
+            kd->key_data_length[0] = kd->key_data_length[1] = 0;
+        }
+        for (i = 0; i < in->n_key_data; i++) {
+            kd = &entry->key_data[i];
+            for (j = 0; j < kd->key_data_ver; j++) {
+                if (in->key_data[i].key_data_length[j] == 0)
+                    continue;
+                kd->key_data_contents[j] =
+                    k5alloc(in->key_data[i].key_data_length[j], &ret);
+                if (kd->key_data_contents[j] == NULL)
+                    goto error;
+                kd->key_data_length[j] = in->key_data[i].key_data_length[j];
+                memcpy(kd->key_data_contents[j],
+                       in->key_data[i].key_data_contents[j],
+                       kd->key_data_length[j]);
+            }
+        }
+    }
+
+    *out = entry;
+    return 0;
+
+error:
+    krb5_db_free_principal(context, entry);
+    return ret;
+}
+
+/* Return the active realm's cache, creating it if necessary, or NULL if the
+ * cache is disabled or cannot be created. */
+static struct princ_cache *
+get_cache(void)
+{
+    struct princ_cache *cache = kdc_active_realm->realm_princ_cache;
+
+    if (cache != NULL || cache_slots == 0)
+        return cache;
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL)
+        return NULL;
+    cache->slots = calloc(cache_slots, sizeof(*cache->slots));
+    if (cache->slots == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->db_age = -1;
+    kdc_active_realm->realm_princ_cache = cache;
+    return cache;
+}
+
+static krb5_error_code
+get_principal(krb5_context context, krb5_const_principal search_for,
+              unsigned int flags, krb5_db_entry **entry)
+{
+    krb5_error_code ret;
+    struct princ_cache *cache;
+    struct cache_slot *slot;
+    krb5_timestamp now;
+    time_t age;
+
+    *entry = NULL;
+    cache = get_cache();
+    if (cache == NULL || krb5_db_get_age(context, NULL, &age) != 0 ||
+        krb5_timeofday(context, &now) != 0 || age < 0 || age == now)
+        return krb5_db_get_principal(context, search_for, flags, entry);
+
+    if (age != cache->db_age) {
+        if (cache->db_age != -1)
+            cache->flushes++;
+        flush_cache(context, cache);
+        cache->db_age = age;
+    }
+
+    slot = &cache->slots[hash_principal(search_for) % cache_slots];
+    if (slot->search != NULL && slot->flags == flags &&
+        slot->search->type == search_for->type &&
+        krb5_principal_compare(context, slot->search, search_for) &&
+        now - slot->timein < cache_lifetime) {
+        cache->hits++;
+        return copy_entry(context, slot->entry, entry);
+    }
+    cache->misses++;
+
+    ret = krb5_db_get_principal(context, search_for, flags, entry);
+    if (ret)
+        return ret;
+
+    /* Remember a copy of the entry, replacing whatever was in the slot. */
+    if (slot->search != NULL)
+        clear_slot(context, slot);
+    if (krb5_copy_principal(context, search_for, &slot->search) != 0)
+        return 0;
+    if (copy_entry(context, *entry, &slot->entry) != 0) {
+        clear_slot(context, slot);
+        return 0;
+    }
+    slot->flags = flags;
+    slot->timein = now;
+    return 0;
+}
+
+/*
+ * Look up search_for in the database of the active realm, as
+ * krb5_db_get_principal() would, using the realm's principal cache where
+ * possible.  The caller must free the result with krb5_db_free_principal().
+ */
+krb5_error_code
+kdc_get_principal(krb5_context context, krb5_const_principal search_for,
+                  unsigned int flags, krb5_db_entry **entry)
+{
+    krb5_error_code ret;
+    krb5_ui_8 t = kdc_stats_start();
+
+    ret = get_principal(context, search_for, flags, entry);
+    kdc_stats_end(KDC_STAGE_DB_LOOKUP, t);
+    return ret;
+}
+
+/* Release the principal cache of rdp, logging its statistics.  This must be
+ * done before the realm's database is closed. */
+void
+kdc_free_princ_cache(kdc_realm_t *rdp)
+{
+    struct princ_cache *cache = rdp->realm_princ_cache;
+
+    if (cache == NULL)
+        return;
+    if (cache->hits + cache->misses > 0) {
+        krb5_klog_syslog(LOG_INFO, _("principal cache for %s: %lu hits, "
+                                     "%lu misses, %lu flushes"),
+                         rdp->realm_name, cache->hits, cache->misses,
+                         cache->flushes);
+    }
+    flush_cache(rdp->realm_context, cache);
+    free(cache->slots);
+    free(cache);
+    rdp->realm_princ_cache = NULL;
+}
@@ -27,55 +27,456 @@
 #include "k5-int.h"
 #include "kdc_util.h"
 #include "extern.h"
+#include "adm_proto.h"
+#include <syslog.h>
+#include <sys/mman.h>
 
 #ifndef NOCACHE
 
-typedef struct _krb5_kdc_replay_ent {
-    struct _krb5_kdc_replay_ent *next;
+/*
+ * A lookaside cache shared between worker processes needs process-shared
+ * mutexes and anonymous shared memory.
+ */
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+#if defined(ENABLE_THREADS) && defined(HAVE_PTHREAD) &&                 \
+    defined(_POSIX_THREAD_PROCESS_SHARED) &&                            \
+    _POSIX_THREAD_PROCESS_SHARED > 0 && defined(MAP_ANON)
+#define SHARED_LOOKASIDE
+#endif
+
+/*
+ * The lookaside cache is a hash table of entries keyed by a hash of the
+ * request packet.  All entries are also kept on a doubly-linked list in
+ * least-recently-used order, so that the oldest entries can be expired or
+ * evicted in constant time when the cache exceeds its configured limits.  The
+ * request and reply packets are stored in the same allocation as the entry.
+ */
+struct entry {
+    struct entry *bucket_next;
+    struct entry **bucket_prevp;
+    struct entry *lru_next;
+    struct entry *lru_prev;
+    unsigned int hash;
     int num_hits;
     krb5_int32 timein;
-    krb5_data *req_packet;
-    krb5_data *reply_packet;
-} krb5_kdc_replay_ent;
+    krb5_data req_packet;
+    krb5_data reply_packet;
+};
 
-static krb5_kdc_replay_ent root_ptr = {0};
+#define STALE_TIME      2*60            /* two minutes */
+#define STALE(ptr, now) (abs((ptr)->timein - (now)) >= STALE_TIME)
 
-static int hits = 0;
-static int calls = 0;
-static int max_hits_per_entry = 0;
-static int num_entries = 0;
+#define DEFAULT_MAX_ENTRIES     16384
+#define DEFAULT_MAX_SIZE        (10 * 1024 * 1024)
 
-#define STALE_TIME      2*60            /* two minutes */
-#define STALE(ptr) (abs((ptr)->timein - timenow) >= STALE_TIME)
+static struct entry **buckets;
+static unsigned int nbuckets;
+static struct entry *lru_head, *lru_tail;
+static size_t max_entries = DEFAULT_MAX_ENTRIES;
+static size_t max_size = DEFAULT_MAX_SIZE;
+static size_t num_entries, total_size;
+static krb5_ui_4 seed;
 
-#define MATCH(ptr) (((ptr)->req_packet->length == inpkt->length) &&     \
-                    !memcmp((ptr)->req_packet->data, inpkt->data,       \
-                            inpkt->length))
-/* XXX
-   Todo:  quench the size of the queue...
-*/
+static struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long expirations;
+    unsigned long shared_hits;
+    int max_hits_per_entry;
+} stats;
 
-/* Removes the most recent cache entry for a given packet. */
-void
-kdc_remove_lookaside(krb5_context kcontext, krb5_data *inpkt)
+#define ENTRY_SIZE(ptr) (sizeof(*(ptr)) + (ptr)->req_packet.length +   \
+                         (ptr)->reply_packet.length)
+
+/* MurmurHash3 (32-bit x86 variant), keyed with a random seed so that clients
+ * cannot choose requests which collide. */
+static unsigned int
+murmurhash3(krb5_ui_4 hseed, const krb5_data *data)
 {
-    register krb5_kdc_replay_ent *eptr, *last;
+    const krb5_ui_4 c1 = 0xcc9e2d51, c2 = 0x1b873593;
+    const unsigned char *p = (const unsigned char *)data->data;
+    krb5_ui_4 h = hseed, k;
+    size_t i, nblocks = data->length / 4;
+
+    for (i = 0; i < nblocks; i++) {
+        k = load_32_le(p + i * 4);
+        k *= c1;
+        k = (k << 15) | (k >> 17);
+        k *= c2;
+        h ^= k;
+        h = (h << 13) | (h >> 19);
+        h = h * 5 + 0xe6546b64;
+    }
+
+    p += nblocks * 4;
+    k = 0;
+    switch (data->length & 3) {
+    case 3:
+        k ^= p[2] << 16;
+    case 2:
+        k ^= p[1] << 8;
+    case 1:
+        k ^= p[0];
+        k *= c1;
+        k = (k << 15) | (k >> 17);
+        k *= c2;
+        h ^= k;
+    }
 
-    if (!root_ptr.next)
+    h ^= data->length;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Set up the hash table if we haven't already.  Return FALSE (leaving the
+ * cache disabled) if we can't get memory. */
+static krb5_boolean
+init_table()
+{
+    krb5_data d;
+
+    if (buckets != NULL)
+        return TRUE;
+
+    /* Size the table for a load factor of at most 1 when full. */
+    for (nbuckets = 256; nbuckets < max_entries && nbuckets < (1U << 24);
+         nbuckets <<= 1);
+    buckets = calloc(nbuckets, sizeof(*buckets));
+    if (buckets == NULL)
+        return FALSE;
+    d = make_data(&seed, sizeof(seed));
+    (void)krb5_c_random_make_octets(kdc_context, &d);
+    return TRUE;
+}
+
+/* Unlink and free an entry. */
+static void
+discard_entry(struct entry *entry)
+{
+    *entry->bucket_prevp = entry->bucket_next;
+    if (entry->bucket_next != NULL)
+        entry->bucket_next->bucket_prevp = entry->bucket_prevp;
+
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+
+    stats.max_hits_per_entry = max(stats.max_hits_per_entry,
+                                   entry->num_hits);
+    num_entries--;
+    total_size -= ENTRY_SIZE(entry);
+    free(entry);
+}
+
+/* Move an entry to the most-recently-used end of the list. */
+static void
+touch_entry(struct entry *entry)
+{
+    if (lru_head == entry)
         return;
+    entry->lru_prev->lru_next = entry->lru_next;
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    lru_head->lru_prev = entry;
+    lru_head = entry;
+}
 
-    for (last = &root_ptr, eptr = root_ptr.next;
-         eptr;
-         last = eptr, eptr = eptr->next) {
-        if (!MATCH(eptr))
-            continue;
+/* Return the entry matching inpkt with hash value h, or NULL. */
+static struct entry *
+find_entry(const krb5_data *inpkt, unsigned int h)
+{
+    struct entry *entry;
 
-        last->next = eptr->next;
-        krb5_free_data(kcontext, eptr->req_packet);
-        krb5_free_data(kcontext, eptr->reply_packet);
-        free(eptr);
+    for (entry = buckets[h & (nbuckets - 1)]; entry != NULL;
+         entry = entry->bucket_next) {
+        if (entry->hash == h && data_eq(entry->req_packet, *inpkt))
+            return entry;
+    }
+    return NULL;
+}
+
+/* Expire stale entries from the least-recently-used end of the list. */
+static void
+expire_entries(krb5_int32 timenow)
+{
+    while (lru_tail != NULL && STALE(lru_tail, timenow)) {
+        discard_entry(lru_tail);
+        stats.expirations++;
+    }
+}
+
+#ifdef SHARED_LOOKASIDE
+
+/*
+ * The shared lookaside cache lives in an anonymous shared memory segment
+ * created before the worker processes are forked, so that a retransmitted
+ * request is recognized by whichever worker receives it.  The segment is a
+ * set-associative table of fixed-size slots, and each set is protected by
+ * its own process-shared mutex.  Entries which do not fit in a slot are kept
+ * in the private cache of the worker which created them.
+ */
+
+#define SHARED_WAYS             8
+#define SHARED_SLOT_DATA        4000
+
+struct shared_slot {
+    unsigned int hash;
+    krb5_int32 timein;
+    krb5_int32 lastused;
+    int num_hits;
+    unsigned int req_len;       /* zero if the slot is unused */
+    unsigned int reply_len;
+    char data[SHARED_SLOT_DATA];
+};
+
+struct shared_set {
+    pthread_mutex_t lock;
+    struct shared_slot slots[SHARED_WAYS];
+};
+
+static struct shared_set *shared_sets;
+static unsigned int shared_nsets;
+static size_t shared_len;
+static krb5_ui_4 shared_seed;
+
+/* Lock and return the set for inpkt, placing its hash value in *h_out. */
+static struct shared_set *
+lock_shared_set(const krb5_data *inpkt, unsigned int *h_out)
+{
+    struct shared_set *set;
+
+    *h_out = murmurhash3(shared_seed, inpkt);
+    set = &shared_sets[*h_out & (shared_nsets - 1)];
+    return (pthread_mutex_lock(&set->lock) == 0) ? set : NULL;
+}
+
+/* Return the slot in set matching inpkt with hash value h, or NULL. */
+static struct shared_slot *
+find_shared_slot(struct shared_set *set, const krb5_data *inpkt,
+                 unsigned int h)
+{
+    struct shared_slot *slot;
+    int i;
+
+    for (i = 0; i < SHARED_WAYS; i++) {
+        slot = &set->slots[i];
+        if (slot->req_len == inpkt->length && slot->hash == h &&
+            memcmp(slot->data, inpkt->data, inpkt->length) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+/* Choose a slot in set to hold a new entry: an unused slot if there is one,
+ * then a stale one, then the least recently used one. */
+static struct shared_slot *
+choose_shared_slot(struct shared_set *set, krb5_int32 timenow)
+{
+    struct shared_slot *slot, *lru = NULL;
+    int i;
+
+    for (i = 0; i < SHARED_WAYS; i++) {
+        slot = &set->slots[i];
+        if (slot->req_len == 0)
+            return slot;
+        if (STALE(slot, timenow)) {
+            stats.expirations++;
+            return slot;
+        }
+        if (lru == NULL || slot->lastused < lru->lastused)
+            lru = slot;
+    }
+    stats.evictions++;
+    return lru;
+}
+
+/* Look up inpkt in the shared cache, with the same result convention as
+ * kdc_check_lookaside(). */
+static krb5_boolean
+check_shared(const krb5_data *inpkt, krb5_int32 timenow, krb5_data **outpkt)
+{
+    struct shared_set *set;
+    struct shared_slot *slot;
+    krb5_data reply;
+    krb5_boolean found = FALSE;
+    unsigned int h;
+
+    set = lock_shared_set(inpkt, &h);
+    if (set == NULL)
+        return FALSE;
+    slot = find_shared_slot(set, inpkt, h);
+    if (slot != NULL) {
+        slot->num_hits++;
+        slot->lastused = timenow;
+        stats.shared_hits++;
+        if (slot->reply_len == 0) {
+            found = TRUE;
+        } else {
+            reply = make_data(slot->data + slot->req_len, slot->reply_len);
+            found = (krb5_copy_data(kdc_context, &reply, outpkt) == 0);
+        }
+    }
+    pthread_mutex_unlock(&set->lock);
+    return found;
+}
+
+/* Store a request and reply in the shared cache.  Return FALSE if they are
+ * too large for a slot. */
+static krb5_boolean
+insert_shared(const krb5_data *inpkt, const krb5_data *outpkt,
+              krb5_int32 timenow)
+{
+    struct shared_set *set;
+    struct shared_slot *slot;
+    size_t replen = (outpkt != NULL) ? outpkt->length : 0;
+    unsigned int h;
+
+    if (inpkt->length == 0 || inpkt->length + replen > SHARED_SLOT_DATA)
+        return FALSE;
+    set = lock_shared_set(inpkt, &h);
+    if (set == NULL)
+        return FALSE;
+
+    /* Another worker may have inserted the same request. */
+    slot = find_shared_slot(set, inpkt, h);
+    if (slot == NULL)
+        slot = choose_shared_slot(set, timenow);
+    if (slot->req_len != 0)
+        stats.max_hits_per_entry = max(stats.max_hits_per_entry,
+                                       slot->num_hits);
+
+    slot->hash = h;
+    slot->timein = slot->lastused = timenow;
+    slot->num_hits = 0;
+    slot->req_len = inpkt->length;
+    memcpy(slot->data, inpkt->data, inpkt->length);
+    slot->reply_len = replen;
+    if (replen > 0)
+        memcpy(slot->data + inpkt->length, outpkt->data, replen);
+    pthread_mutex_unlock(&set->lock);
+    return TRUE;
+}
+
+/* Remove the shared cache entry for inpkt, if there is one. */
+static void
+remove_shared(const krb5_data *inpkt)
+{
+    struct shared_set *set;
+    struct shared_slot *slot;
+    unsigned int h;
+
+    set = lock_shared_set(inpkt, &h);
+    if (set == NULL)
         return;
+    slot = find_shared_slot(set, inpkt, h);
+    if (slot != NULL) {
+        stats.max_hits_per_entry = max(stats.max_hits_per_entry,
+                                       slot->num_hits);
+        slot->req_len = 0;
     }
+    pthread_mutex_unlock(&set->lock);
+}
+
+/*
+ * Create the shared lookaside cache, sized according to the limits set by
+ * kdc_init_lookaside().  This must be called before the worker processes are
+ * created.
+ */
+krb5_error_code
+kdc_init_shared_lookaside(krb5_context context)
+{
+    pthread_mutexattr_t attr;
+    struct shared_set *sets;
+    size_t nslots;
+    unsigned int i;
+    krb5_data d;
+    void *ptr;
+    int ret;
+
+    nslots = min(max_entries, max_size / sizeof(struct shared_slot));
+    for (shared_nsets = 1; shared_nsets * 2 * SHARED_WAYS <= nslots &&
+             shared_nsets < (1U << 20); shared_nsets <<= 1);
+    shared_len = shared_nsets * sizeof(struct shared_set);
+
+    ptr = mmap(NULL, shared_len, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANON, -1, 0);
+    if (ptr == MAP_FAILED)
+        return errno;
+    sets = ptr;
+
+    ret = pthread_mutexattr_init(&attr);
+    if (ret)
+        goto cleanup;
+    ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    for (i = 0; ret == 0 && i < shared_nsets; i++)
+        ret = pthread_mutex_init(&sets[i].lock, &attr);
+    (void)pthread_mutexattr_destroy(&attr);
+    if (ret)
+        goto cleanup;
+
+    d = make_data(&shared_seed, sizeof(shared_seed));
+    ret = krb5_c_random_make_octets(context, &d);
+    if (ret)
+        goto cleanup;
+
+    shared_sets = sets;
+    return 0;
+
+cleanup:
+    munmap(ptr, shared_len);
+    return ret;
+}
+
+#else /* SHARED_LOOKASIDE */
+
+krb5_error_code
+kdc_init_shared_lookaside(krb5_context context)
+{
+    return ENOSYS;
+}
+
+#endif /* SHARED_LOOKASIDE */
+
+/* Set the entry and size limits of the lookaside cache.  A limit of zero
+ * selects the default. */
+void
+kdc_init_lookaside(size_t entries, size_t size)
+{
+    max_entries = (entries > 0) ? entries : DEFAULT_MAX_ENTRIES;
+    max_size = (size > 0) ? size : DEFAULT_MAX_SIZE;
+}
+
+/* Removes the most recent cache entry for a given packet. */
+void
+kdc_remove_lookaside(krb5_context kcontext, krb5_data *inpkt)
+{
+    struct entry *entry;
+
+#ifdef SHARED_LOOKASIDE
+    if (shared_sets != NULL)
+        remove_shared(inpkt);
+#endif
+    if (buckets == NULL)
+        return;
+    entry = find_entry(inpkt, murmurhash3(seed, inpkt));
+    if (entry != NULL)
+        discard_entry(entry);
 }
 
 /* return TRUE if outpkt is filled in with a packet to reply with,
@@ -85,47 +486,36 @@ krb5_boolean
 kdc_check_lookaside(krb5_data *inpkt, krb5_data **outpkt)
 {
     krb5_int32 timenow;
-    register krb5_kdc_replay_ent *eptr, *last, *hold;
+    struct entry *entry;
 
+    *outpkt = NULL;
     if (krb5_timeofday(kdc_context, &timenow))
         return FALSE;
 
-    calls++;
-
-    /* search for a replay entry in the queue, possibly removing
-       stale entries while we're here */
-
-    if (root_ptr.next) {
-        for (last = &root_ptr, eptr = root_ptr.next;
-             eptr;
-             eptr = eptr->next) {
-            if (MATCH(eptr)) {
-                eptr->num_hits++;
-                hits++;
-
-                if (krb5_copy_data(kdc_context, eptr->reply_packet, outpkt))
-                    return FALSE;
-                else
-                    return TRUE;
-                /* return here, don't bother flushing even if it is stale.
-                   if we just matched, we may get another retransmit... */
-            }
-            if (STALE(eptr)) {
-                /* flush it and collect stats */
-                max_hits_per_entry = max(max_hits_per_entry, eptr->num_hits);
-                krb5_free_data(kdc_context, eptr->req_packet);
-                krb5_free_data(kdc_context, eptr->reply_packet);
-                hold = eptr;
-                last->next = eptr->next;
-                eptr = last;
-                free(hold);
-            } else {
-                /* this isn't it, just move along */
-                last = eptr;
-            }
+    entry = NULL;
+    if (buckets != NULL) {
+        expire_entries(timenow);
+        entry = find_entry(inpkt, murmurhash3(seed, inpkt));
+    }
+    if (entry == NULL) {
+#ifdef SHARED_LOOKASIDE
+        if (shared_sets != NULL && check_shared(inpkt, timenow, outpkt)) {
+            stats.hits++;
+            return TRUE;
         }
+#endif
+        stats.misses++;
+        return FALSE;
     }
-    return FALSE;
+
+    /* Don't bother flushing the entry even if it is stale; if we just
+     * matched, we may get another retransmit. */
+    entry->num_hits++;
+    stats.hits++;
+    touch_entry(entry);
+    if (entry->reply_packet.length == 0)
+        return TRUE;
+    return (krb5_copy_data(kdc_context, &entry->reply_packet, outpkt) == 0);
 }
 
 /* insert a request & reply into the lookaside queue.  assumes it's not
@@ -134,53 +524,87 @@ kdc_check_lookaside(krb5_data *inpkt, krb5_data **outpkt)
 void
 kdc_insert_lookaside(krb5_data *inpkt, krb5_data *outpkt)
 {
-    register krb5_kdc_replay_ent *eptr;
+    struct entry *entry, **bucket;
     krb5_int32 timenow;
+    size_t replen = (outpkt != NULL) ? outpkt->length : 0;
+    size_t esize = sizeof(*entry) + inpkt->length + replen;
+    char *p;
 
     if (krb5_timeofday(kdc_context, &timenow))
         return;
-
-    /* this is a new entry */
-    eptr = (krb5_kdc_replay_ent *)calloc(1, sizeof(*eptr));
-    if (!eptr)
+#ifdef SHARED_LOOKASIDE
+    if (shared_sets != NULL && insert_shared(inpkt, outpkt, timenow))
         return;
-    eptr->timein = timenow;
-    /*
-     * This is going to hurt a lot malloc()-wise due to the need to
-     * allocate memory for the krb5_data and krb5_address elements.
-     * ARGH!
-     */
-    if (krb5_copy_data(kdc_context, inpkt, &eptr->req_packet)) {
-        free(eptr);
+#endif
+    if (!init_table() || esize > max_size)
         return;
+
+    /* Make room by evicting the least recently used entries. */
+    expire_entries(timenow);
+    while (lru_tail != NULL &&
+           (num_entries >= max_entries || total_size + esize > max_size)) {
+        discard_entry(lru_tail);
+        stats.evictions++;
     }
-    if (krb5_copy_data(kdc_context, outpkt, &eptr->reply_packet)) {
-        krb5_free_data(kdc_context, eptr->req_packet);
-        free(eptr);
+
+    /* this is a new entry */
+    entry = malloc(esize);
+    if (entry == NULL)
         return;
-    }
-    eptr->next = root_ptr.next;
-    root_ptr.next = eptr;
+    p = (char *)(entry + 1);
+    entry->num_hits = 0;
+    entry->timein = timenow;
+    entry->hash = murmurhash3(seed, inpkt);
+    entry->req_packet = make_data(p, inpkt->length);
+    memcpy(p, inpkt->data, inpkt->length);
+    entry->reply_packet = make_data(p + inpkt->length, replen);
+    if (replen > 0)
+        memcpy(p + inpkt->length, outpkt->data, replen);
+
+    bucket = &buckets[entry->hash & (nbuckets - 1)];
+    entry->bucket_next = *bucket;
+    entry->bucket_prevp = bucket;
+    if (*bucket != NULL)
+        (*bucket)->bucket_prevp = &entry->bucket_next;
+    *bucket = entry;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head != NULL)
+        lru_head->lru_prev = entry;
+    else
+        lru_tail = entry;
+    lru_head = entry;
+
     num_entries++;
-    return;
+    total_size += esize;
 }
 
 /* frees memory associated with the lookaside queue for memory profiling */
 void
 kdc_free_lookaside(krb5_context kcontext)
 {
-    register krb5_kdc_replay_ent *eptr, *last, *hold;
-    if (root_ptr.next) {
-        for (last = &root_ptr, eptr = root_ptr.next;
-             eptr; eptr = eptr->next) {
-            krb5_free_data(kcontext, eptr->req_packet);
-            krb5_free_data(kcontext, eptr->reply_packet);
-            hold = eptr;
-            last->next = eptr->next;
-            eptr = last;
-            free(hold);
+    while (lru_head != NULL)
+        discard_entry(lru_head);
+    if (stats.hits + stats.misses > 0) {
+        krb5_klog_syslog(LOG_INFO, _("lookaside cache: %lu hits, %lu misses, "
+                                     "%lu evictions, %lu expirations, "
+                                     "at most %d hits per entry"),
+                         stats.hits, stats.misses, stats.evictions,
+                         stats.expirations, stats.max_hits_per_entry);
+    }
+#ifdef SHARED_LOOKASIDE
+    if (shared_sets != NULL) {
+        if (stats.shared_hits > 0) {
+            krb5_klog_syslog(LOG_INFO, _("lookaside cache: %lu hits in "
+                                         "shared memory"), stats.shared_hits);
         }
+        munmap(shared_sets, shared_len);
+        shared_sets = NULL;
     }
+#endif
+    free(buckets);
+    buckets = NULL;
 }
 
 #endif /* NOCACHE */
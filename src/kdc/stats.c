@@ -0,0 +1,174 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/stats.c - Request and latency statistics for the KDC */
+/*
+ * Copyright (C) 2011 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Export of this software from the United States of America may
+ *   require a specific license from the United States Government.
+ *   It is the responsibility of any person or organization contemplating
+ *   export to obtain such a license before exporting.
+ *
+ * WITHIN THAT CONSTRAINT, permission to use, copy, modify, and
+ * distribute this software and its documentation for any purpose and
+ * without fee is hereby granted, provided that the above copyright
+ * notice appear in all copies and that both that copyright notice and
+ * this permission notice appear in supporting documentation, and that
+ * the name of M.I.T. not be used in advertising or publicity pertaining
+ * to distribution of the software without specific, written prior
+ * permission.  Furthermore if you modify this software you must label
+ * your software as modified software and not distribute it in such a
+ * fashion that it might be confused with the original M.I.T. software.
+ * M.I.T. makes no representations about the suitability of
+ * this software for any purpose.  It is provided "as is" without express
+ * or implied warranty.
+ */
+
+/*
+ * The KDC times the main stages of request processing (decoding, database
+ * lookups, preauthentication, key decryption, ticket encryption, reply
+ * encoding, and logging) as well as whole AS and TGS requests, and keeps a
+ * histogram of the times for each.  The histograms have one bucket per power
+ * of two microseconds, which makes recording cheap and is precise enough to
+ * tell percentiles apart by order of magnitude.  It also counts requests by
+ * type and by the protocol error code of the result.  kdc_stats_dump() writes
+ * a summary to the KDC log; the KDC calls it on SIGUSR1.
+ *
+ * The statistics are per process; each worker process keeps its own.
+ */
+
+#include "k5-int.h"
+#include "kdc_util.h"
+#include "extern.h"
+#include "adm_proto.h"
+#include <syslog.h>
+#include <sys/time.h>
+
+#define NBUCKETS 32             /* Bucket i counts times below 2^i us */
+#define NCODES 129              /* Protocol error codes 0-127, then other */
+
+struct stage_stats {
+    unsigned long buckets[NBUCKETS];
+    unsigned long count;
+    krb5_ui_8 total;
+    krb5_ui_8 max;
+};
+
+static struct stage_stats stages[KDC_NUM_STAGES];
+static unsigned long requests[KDC_NUM_REQ_TYPES];
+static unsigned long results[KDC_NUM_REQ_TYPES][NCODES];
+
+static const char *const stage_names[KDC_NUM_STAGES] = {
+    "decode", "db lookup", "preauth", "key decrypt", "ticket encrypt",
+    "reply encode", "log", "AS_REQ total", "TGS_REQ total"
+};
+
+static const char *const req_type_names[KDC_NUM_REQ_TYPES] = {
+    "AS_REQ", "TGS_REQ", "retransmitted", "other"
+};
+
+/* Return the current time in microseconds, for use with kdc_stats_end(). */
+krb5_ui_8
+kdc_stats_start(void)
+{
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) != 0)
+        return 0;
+    return (krb5_ui_8)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Record the time elapsed since start, obtained from kdc_stats_start(), as a
+ * sample for stage. */
+void
+kdc_stats_end(enum kdc_stage stage, krb5_ui_8 start)
+{
+    struct stage_stats *st = &stages[stage];
+    krb5_ui_8 now = kdc_stats_start(), elapsed;
+    int b;
+
+    if (start == 0 || now < start)
+        return;
+    elapsed = now - start;
+    for (b = 0; b < NBUCKETS - 1 && (elapsed >> b) != 0; b++);
+    st->buckets[b]++;
+    st->count++;
+    st->total += elapsed;
+    if (elapsed > st->max)
+        st->max = elapsed;
+}
+
+/* Count a received request of the given type. */
+void
+kdc_stats_request(enum kdc_req_type type)
+{
+    requests[type]++;
+}
+
+/* Count the result of an AS or TGS request, given its error code (0 for a
+ * ticket issued). */
+void
+kdc_stats_result(enum kdc_req_type type, krb5_error_code code)
+{
+    if (code != 0)
+        code -= ERROR_TABLE_BASE_krb5;
+    if (code < 0 || code >= NCODES - 1)
+        code = NCODES - 1;
+    results[type][code]++;
+}
+
+/* Return an upper bound in microseconds of the time below which the fraction
+ * pct/100 of the samples in st fall. */
+static unsigned long
+percentile(const struct stage_stats *st, unsigned int pct)
+{
+    unsigned long want, seen = 0;
+    int b;
+
+    want = (st->count * pct + 99) / 100;
+    for (b = 0; b < NBUCKETS; b++) {
+        seen += st->buckets[b];
+        if (seen >= want && seen > 0)
+            break;
+    }
+    if (b >= NBUCKETS - 1 || ((krb5_ui_8)1 << b) - 1 > st->max)
+        return st->max;
+    return ((unsigned long)1 << b) - 1;
+}
+
+/* Write the statistics gathered so far to the KDC log. */
+void
+kdc_stats_dump(void)
+{
+    const struct stage_stats *st;
+    int i, c;
+
+    for (i = 0; i < KDC_NUM_REQ_TYPES; i++) {
+        if (requests[i] == 0)
+            continue;
+        krb5_klog_syslog(LOG_INFO, _("stats: %s: %lu requests"),
+                         req_type_names[i], requests[i]);
+        for (c = 0; c < NCODES; c++) {
+            if (results[i][c] == 0)
+                continue;
+            if (c == NCODES - 1) {
+                krb5_klog_syslog(LOG_INFO, _("stats: %s: %lu other errors"),
+                                 req_type_names[i], results[i][c]);
+            } else {
+                krb5_klog_syslog(LOG_INFO, _("stats: %s: %lu with code %d"),
+                                 req_type_names[i], results[i][c], c);
+            }
+        }
+    }
+    for (i = 0; i < KDC_NUM_STAGES; i++) {
+        st = &stages[i];
+        if (st->count == 0)
+            continue;
+        krb5_klog_syslog(LOG_INFO, _("stats: %s: %lu samples, mean %lu us, "
+                                     "p50 %lu us, p99 %lu us, max %lu us"),
+                         stage_names[i], st->count,
+                         (unsigned long)(st->total / st->count),
+                         percentile(st, 50), percentile(st, 99),
+                         (unsigned long)st->max);
+    }
+}
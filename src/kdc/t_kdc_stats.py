@@ -0,0 +1,36 @@
+#!/usr/bin/python
+from k5test import *
+import re, signal, time
+
+realm = K5Realm(create_host=False)
+realm.run_as_client([kvno, realm.user_princ])
+realm.run_as_client([kvno, 'nonexistent'], expected_code=1)
+
+# SIGUSR1 makes the KDC write its statistics to the log.
+os.kill(realm._kdc_proc.pid, signal.SIGUSR1)
+logfile = os.path.join(realm.testdir, 'kdc.log')
+for i in range(50):
+    output = open(logfile).read()
+    if 'stats: TGS_REQ total' in output:
+        break
+    time.sleep(0.1)
+else:
+    fail('KDC did not dump statistics')
+realm.stop()
+
+if not re.search(r'stats: AS_REQ: 1 requests', output):
+    fail('AS request count missing')
+if not re.search(r'stats: TGS_REQ: [1-9]\d* requests', output):
+    fail('TGS request count missing')
+if not re.search(r'stats: TGS_REQ: 1 with code 0', output):
+    fail('TGS success count missing')
+if not re.search(r'stats: TGS_REQ: [1-9]\d* with code 7', output):
+    fail('TGS error count missing')
+for stage in ('decode', 'db lookup', 'preauth', 'key decrypt',
+              'ticket encrypt', 'reply encode', 'log', 'AS_REQ total',
+              'TGS_REQ total'):
+    if not re.search(r'stats: %s: \d+ samples, mean \d+ us, p50 \d+ us, '
+                     r'p99 \d+ us, max \d+ us' % stage, output):
+        fail('Statistics missing for %s' % stage)
+
+success('KDC statistics')
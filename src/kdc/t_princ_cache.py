@@ -0,0 +1,58 @@
+#!/usr/bin/python
+from k5test import *
+import re, time
+
+# The principal cache is not used while the database age is the current
+# time, so move the age of the database into the past after each change.
+def set_db_age(realm, secs_ago):
+    t = time.time() - secs_ago
+    os.utime(os.path.join(realm.testdir, 'master-db.ok'), (t, t))
+
+realm = K5Realm(start_kdc=False, create_host=False, get_creds=False)
+for i in range(3):
+    realm.addprinc('svc%d' % i, 'pw')
+realm.addprinc('svc', 'pw')
+set_db_age(realm, 60)
+realm.start_kdc()
+
+# After the first request, the krbtgt entry comes from the cache.
+realm.kinit(realm.user_princ, password('user'))
+for i in range(3):
+    realm.run_as_client([kvno, 'svc%d@%s' % (i, realm.realm)])
+realm.run_as_client([kvno, 'svc@%s' % realm.realm])
+
+# A change to the service principal must be seen by the next request.
+realm.run_kadminl('cpw -randkey svc')
+set_db_age(realm, 50)
+realm.run_as_client([kdestroy])
+realm.kinit(realm.user_princ, password('user'))
+output = realm.run_as_client([kvno, 'svc@%s' % realm.realm])
+if 'kvno = 2' not in output:
+    fail('KDC used a stale cached principal entry')
+
+# The server key cache must not hand out the old key after a rekey.
+ktname = os.path.join(realm.testdir, 'svc.keytab')
+realm.run_kadminl('ktadd -k %s svc' % ktname)
+set_db_age(realm, 45)
+realm.run_as_client([kdestroy])
+realm.kinit(realm.user_princ, password('user'))
+realm.run_as_client([kvno, '-k', ktname, 'svc@%s' % realm.realm])
+
+# A disabled principal must be refused immediately.
+realm.run_kadminl('modprinc -allow_tix svc')
+set_db_age(realm, 40)
+realm.run_as_client([kdestroy])
+realm.kinit(realm.user_princ, password('user'))
+realm.run_as_client([kvno, 'svc@%s' % realm.realm], expected_code=1)
+realm.stop()
+
+output = open(os.path.join(realm.testdir, 'kdc.log')).read()
+if not re.search(r'principal cache for KRBTEST.COM: [1-9]\d* hits', output):
+    fail('Principal cache was not used')
+if not re.search(r'key cache for KRBTEST.COM: [1-9]\d* hits', output):
+    fail('Key cache was not used')
+if not re.search(r'derived key cache for KRBTEST.COM: [1-9]\d* hits',
+                 output):
+    fail('Derived keys of cached server keys were not reused')
+
+success('KDC principal and key caches')
@@ -1,8 +1,67 @@
 #!/usr/bin/python
 from k5test import *
+import re, socket, threading
 
 realm = K5Realm(start_kdc=False, create_host=False)
 realm.start_kdc(['-w', '3'])
 realm.kinit(realm.user_princ, password('user'))
 realm.klist(realm.user_princ)
+realm.stop()
+
+# With kdc_reuseport, each worker opens its own listener sockets and the
+# kernel spreads requests (from different client ports) across them.
+conf = {'all': {'kdcdefaults': {'kdc_reuseport': 'true'}}}
+realm = K5Realm(start_kdc=False, create_host=False, kdc_conf=conf)
+realm.start_kdc(['-w', '3'])
+for i in range(30):
+    realm.kinit(realm.user_princ, password('user'))
+realm.klist(realm.user_princ)
+pids = set()
+for line in open(os.path.join(realm.testdir, 'kdc.log')):
+    m = re.search(r'krb5kdc\[(\d+)\]\(info\): AS_REQ', line)
+    if m:
+        pids.add(m.group(1))
+if len(pids) < 2:
+    fail('AS requests were not spread across worker processes')
+realm.stop()
+
+# With kdc_shared_lookaside, a request retransmitted from a different
+# client port is recognized by whichever worker receives it.  Relay
+# client requests through a UDP proxy which sends each request to the
+# KDC from three different sockets.
+proxy = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+proxy.bind(('127.0.0.1', 0))
+proxy_port = proxy.getsockname()[1]
+def relay():
+    fwd = [socket.socket(socket.AF_INET, socket.SOCK_DGRAM) for i in range(3)]
+    while True:
+        req, addr = proxy.recvfrom(65536)
+        for s in fwd:
+            s.sendto(req, ('127.0.0.1', realm.portbase))
+            rep = s.recv(65536)
+        proxy.sendto(rep, addr)
+t = threading.Thread(target=relay)
+t.daemon = True
+t.start()
+
+conf = {'all': {'kdcdefaults': {'kdc_reuseport': 'true',
+                                'kdc_shared_lookaside': 'true'}}}
+krb5_conf = {'client': {'realms': {'$realm': {
+                'kdc': '127.0.0.1:%d' % proxy_port}}}}
+realm = K5Realm(start_kdc=False, create_host=False, get_creds=False,
+                kdc_conf=conf, krb5_conf=krb5_conf)
+realm.start_kdc(['-w', '3'])
+for i in range(10):
+    realm.kinit(realm.user_princ, password('user'))
+realm.klist(realm.user_princ)
+realm.stop()
+nreqs = nrepeats = 0
+for line in open(os.path.join(realm.testdir, 'kdc.log')):
+    if 'AS_REQ' in line:
+        nreqs += 1
+    if 'repeated (retransmitted?) request' in line:
+        nrepeats += 1
+if nreqs != 10 or nrepeats != 20:
+    fail('Retransmitted requests were not answered from shared cache')
+
 success('KDC worker processes')
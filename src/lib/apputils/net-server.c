@@ -23,6 +23,8 @@
  * or implied warranty.
  */
 
+#define _GNU_SOURCE /* For recvmmsg(), sendmmsg() */
+
 #include "k5-int.h"
 #include "adm_proto.h"
 #include <sys/ioctl.h>
@@ -69,6 +71,24 @@
 
 static int tcp_or_rpc_data_counter;
 static int max_tcp_or_rpc_data_connections = 45;
+static int reuseport = 0;
+static void (*rpc_close_hook)(int fd);
+
+/*
+ * If we can, drain several datagrams from a UDP socket with one recvmmsg()
+ * call, and send the replies which are ready by the end of the batch with
+ * one sendmmsg() call.
+ */
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && \
+    defined(CMSG_SPACE) && (defined(IP_PKTINFO) || defined(IPV6_PKTINFO))
+#define USE_UDP_BATCH
+#define UDP_BATCH_MAX 16
+
+/* udp_batch_sizes[n] counts the receive batches of n datagrams. */
+static unsigned long udp_batch_sizes[UDP_BATCH_MAX + 1];
+
+struct udp_batch;
+#endif
 
 /* Misc utility routines.  */
 static void
@@ -108,6 +128,14 @@ setreuseaddr(int sock, int value)
     return setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
 }
 
+#ifdef SO_REUSEPORT
+static int
+setreuseport(int sock, int value)
+{
+    return setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value));
+}
+#endif
+
 #if defined(IPV6_V6ONLY)
 static int
 setv6only(int sock, int value)
@@ -215,6 +243,11 @@ struct connection {
     /* RPC-specific fields */
     SVCXPRT *transp;
     int rpc_force_close;
+
+#ifdef USE_UDP_BATCH
+    /* Receive buffers (UDP), allocated on the first packet */
+    struct udp_batch *udp_batch;
+#endif
 };
 
 
@@ -266,12 +299,21 @@ static SET(verto_ev *) events;
 verto_ctx *
 loop_init(verto_ev_type types)
 {
+#ifdef INTERNAL_VERTO
+    verto_ctx *ctx;
+#endif
+
     types |= VERTO_EV_TYPE_IO;
     types |= VERTO_EV_TYPE_SIGNAL;
     types |= VERTO_EV_TYPE_TIMEOUT;
 
 #ifdef INTERNAL_VERTO
-    return verto_default_k5ev();
+    ctx = verto_default_k5ev();
+    if (ctx != NULL) {
+        krb5_klog_syslog(LOG_INFO, _("using %s event loop back end"),
+                         verto_k5ev_default_backend());
+    }
+    return ctx;
 #else
     return verto_default(NULL, types);
 #endif
@@ -370,6 +412,33 @@ loop_add_tcp_port(int port)
     return 0;
 }
 
+/*
+ * Set whether listener sockets are created with SO_REUSEPORT, allowing several
+ * processes to bind their own sockets to the same ports and have the kernel
+ * distribute incoming traffic among them.
+ */
+krb5_error_code
+loop_set_reuseport(int value)
+{
+#ifdef SO_REUSEPORT
+    reuseport = value;
+    return 0;
+#else
+    return value ? EINVAL : 0;
+#endif
+}
+
+/*
+ * Set a function to be called with the descriptor of each RPC connection
+ * which is closed, after its transport has been destroyed.  A service which
+ * defers replies uses this to forget calls it can no longer answer.
+ */
+void
+loop_set_rpc_close_hook(void (*hook)(int fd))
+{
+    rpc_close_hook = hook;
+}
+
 krb5_error_code
 loop_add_rpc_service(int port, u_long prognum,
                      u_long versnum, void (*dispatchfn)())
@@ -422,6 +491,9 @@ free_connection(struct connection *conn)
         free(conn->buffer);
     if (conn->type == CONN_RPC_LISTENER && conn->transp != NULL)
         svc_destroy(conn->transp);
+#ifdef USE_UDP_BATCH
+    free(conn->udp_batch);
+#endif
     free(conn);
 }
 
@@ -471,6 +543,8 @@ free_socket(verto_ctx *ctx, verto_ev *ev)
                                      fd);
                 }
             }
+            if (rpc_close_hook != NULL)
+                rpc_close_hook(fd);
             /* Fall through. */
         case CONN_TCP:
             tcp_or_rpc_data_counter--;
@@ -574,7 +648,8 @@ add_tcp_read_fd(struct socksetup *data, int sock)
 
 /*
  * Create a socket and bind it to addr.  Ensure the socket will work with
- * select().  Set the socket cloexec, reuseaddr, and if applicable v6-only.
+ * select().  Set the socket cloexec, reuseaddr, reuseport if requested, and
+ * if applicable v6-only.
  * Does not call listen().  Returns -1 on failure after logging an error.
  */
 static int
@@ -605,6 +680,13 @@ create_server_socket(struct socksetup *data, struct sockaddr *addr, int type)
                 _("Cannot enable SO_REUSEADDR on fd %d"), sock);
     }
 
+#ifdef SO_REUSEPORT
+    if (reuseport && setreuseport(sock, 1) < 0) {
+        com_err(data->prog, errno,
+                _("Cannot enable SO_REUSEPORT on fd %d"), sock);
+    }
+#endif
+
     if (addr->sa_family == AF_INET6) {
 #ifdef IPV6_V6ONLY
         if (setv6only(sock, 1))
@@ -1312,56 +1394,24 @@ union aux_addressing_info {
     int ipv6_ifindex;
 };
 
-static int
-recv_from_to(int s, void *buf, size_t len, int flags,
-             struct sockaddr *from, socklen_t *fromlen,
-             struct sockaddr *to, socklen_t *tolen,
-             union aux_addressing_info *auxaddr)
+#if (defined(IP_PKTINFO) || defined(IPV6_PKTINFO)) && defined(CMSG_SPACE)
+/*
+ * Extract the local address of a received datagram from the control data in
+ * msg, placing it in to and *tolen.  Set *tolen to 0 if no destination
+ * address information is present.
+ */
+static void
+get_pktinfo_addr(struct msghdr *msg, struct sockaddr *to, socklen_t *tolen,
+                 union aux_addressing_info *auxaddr)
 {
-#if (!defined(IP_PKTINFO) && !defined(IPV6_PKTINFO)) || !defined(CMSG_SPACE)
-    if (to && tolen) {
-        /* Clobber with something recognizeable in case we try to use
-           the address.  */
-        memset(to, 0x40, *tolen);
-        *tolen = 0;
-    }
-
-    return recvfrom(s, buf, len, flags, from, fromlen);
-#else
-    int r;
-    struct iovec iov;
-    char cmsg[CMSG_SPACE(sizeof(union pktinfo))];
     struct cmsghdr *cmsgptr;
-    struct msghdr msg;
-
-    if (!to || !tolen)
-        return recvfrom(s, buf, len, flags, from, fromlen);
-
-    /* Clobber with something recognizeable in case we can't extract
-       the address but try to use it anyways.  */
-    memset(to, 0x40, *tolen);
-
-    iov.iov_base = buf;
-    iov.iov_len = len;
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = from;
-    msg.msg_namelen = *fromlen;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = cmsg;
-    msg.msg_controllen = sizeof(cmsg);
-
-    r = recvmsg(s, &msg, flags);
-    if (r < 0)
-        return r;
-    *fromlen = msg.msg_namelen;
 
     /* On Darwin (and presumably all *BSD with KAME stacks),
        CMSG_FIRSTHDR doesn't check for a non-zero controllen.  RFC
        3542 recommends making this check, even though the (new) spec
        for CMSG_FIRSTHDR says it's supposed to do the check.  */
-    if (msg.msg_controllen) {
-        cmsgptr = CMSG_FIRSTHDR(&msg);
+    if (msg->msg_controllen) {
+        cmsgptr = CMSG_FIRSTHDR(msg);
         while (cmsgptr) {
 #ifdef IP_PKTINFO
             if (cmsgptr->cmsg_level == IPPROTO_IP
@@ -1373,7 +1423,7 @@ recv_from_to(int s, void *buf, size_t len, int flags,
                 ((struct sockaddr_in *)to)->sin_addr = pktinfo->ipi_addr;
                 ((struct sockaddr_in *)to)->sin_family = AF_INET;
                 *tolen = sizeof(struct sockaddr_in);
-                return r;
+                return;
             }
 #endif
 #if defined(IPV6_PKTINFO) && defined(HAVE_STRUCT_IN6_PKTINFO)
@@ -1387,60 +1437,42 @@ recv_from_to(int s, void *buf, size_t len, int flags,
                 ((struct sockaddr_in6 *)to)->sin6_family = AF_INET6;
                 *tolen = sizeof(struct sockaddr_in6);
                 auxaddr->ipv6_ifindex = pktinfo->ipi6_ifindex;
-                return r;
+                return;
             }
 #endif
-            cmsgptr = CMSG_NXTHDR(&msg, cmsgptr);
+            cmsgptr = CMSG_NXTHDR(msg, cmsgptr);
         }
     }
     /* No info about destination addr was available.  */
     *tolen = 0;
-    return r;
-#endif
 }
 
+/*
+ * Fill in the control data of msg (using cbuf, which must be
+ * CMSG_SPACE(sizeof(union pktinfo)) bytes long) to send from the local
+ * address from.  Return 0 on success or -1 if the reply should be sent
+ * without specifying a source address.
+ */
 static int
-send_to_from(int s, void *buf, size_t len, int flags,
-             const struct sockaddr *to, socklen_t tolen,
-             const struct sockaddr *from, socklen_t fromlen,
-             union aux_addressing_info *auxaddr)
+set_pktinfo_addr(struct msghdr *msg, char *cbuf, size_t cbuflen,
+                 const struct sockaddr *from, socklen_t fromlen,
+                 union aux_addressing_info *auxaddr)
 {
-#if (!defined(IP_PKTINFO) && !defined(IPV6_PKTINFO)) || !defined(CMSG_SPACE)
-    return sendto(s, buf, len, flags, to, tolen);
-#else
-    struct iovec iov;
-    struct msghdr msg;
     struct cmsghdr *cmsgptr;
-    char cbuf[CMSG_SPACE(sizeof(union pktinfo))];
 
-    if (from == 0 || fromlen == 0 || from->sa_family != to->sa_family) {
-    use_sendto:
-        return sendto(s, buf, len, flags, to, tolen);
-    }
-
-    iov.iov_base = buf;
-    iov.iov_len = len;
-    /* Truncation?  */
-    if (iov.iov_len != len)
-        return EINVAL;
-    memset(cbuf, 0, sizeof(cbuf));
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = (void *) to;
-    msg.msg_namelen = tolen;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = cbuf;
+    memset(cbuf, 0, cbuflen);
+    msg->msg_control = cbuf;
     /* CMSG_FIRSTHDR needs a non-zero controllen, or it'll return NULL
        on Linux.  */
-    msg.msg_controllen = sizeof(cbuf);
-    cmsgptr = CMSG_FIRSTHDR(&msg);
-    msg.msg_controllen = 0;
+    msg->msg_controllen = cbuflen;
+    cmsgptr = CMSG_FIRSTHDR(msg);
+    msg->msg_controllen = 0;
 
     switch (from->sa_family) {
 #if defined(IP_PKTINFO)
     case AF_INET:
         if (fromlen != sizeof(struct sockaddr_in))
-            goto use_sendto;
+            return -1;
         cmsgptr->cmsg_level = IPPROTO_IP;
         cmsgptr->cmsg_type = IP_PKTINFO;
         cmsgptr->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
@@ -1449,13 +1481,13 @@ send_to_from(int s, void *buf, size_t len, int flags,
             const struct sockaddr_in *from4 = (const struct sockaddr_in *)from;
             p->ipi_spec_dst = from4->sin_addr;
         }
-        msg.msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
-        break;
+        msg->msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
+        return 0;
 #endif
 #if defined(IPV6_PKTINFO) && defined(HAVE_STRUCT_IN6_PKTINFO)
     case AF_INET6:
         if (fromlen != sizeof(struct sockaddr_in6))
-            goto use_sendto;
+            return -1;
         cmsgptr->cmsg_level = IPPROTO_IPV6;
         cmsgptr->cmsg_type = IPV6_PKTINFO;
         cmsgptr->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
@@ -1476,12 +1508,93 @@ send_to_from(int s, void *buf, size_t len, int flags,
                 p->ipi6_ifindex = auxaddr->ipv6_ifindex;
             /* otherwise, already zero */
         }
-        msg.msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
-        break;
+        msg->msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
+        return 0;
 #endif
     default:
-        goto use_sendto;
+        return -1;
     }
+}
+#endif
+
+#ifndef USE_UDP_BATCH
+static int
+recv_from_to(int s, void *buf, size_t len, int flags,
+             struct sockaddr *from, socklen_t *fromlen,
+             struct sockaddr *to, socklen_t *tolen,
+             union aux_addressing_info *auxaddr)
+{
+#if (!defined(IP_PKTINFO) && !defined(IPV6_PKTINFO)) || !defined(CMSG_SPACE)
+    if (to && tolen) {
+        /* Clobber with something recognizeable in case we try to use
+           the address.  */
+        memset(to, 0x40, *tolen);
+        *tolen = 0;
+    }
+
+    return recvfrom(s, buf, len, flags, from, fromlen);
+#else
+    int r;
+    struct iovec iov;
+    char cmsg[CMSG_SPACE(sizeof(union pktinfo))];
+    struct msghdr msg;
+
+    if (!to || !tolen)
+        return recvfrom(s, buf, len, flags, from, fromlen);
+
+    /* Clobber with something recognizeable in case we can't extract
+       the address but try to use it anyways.  */
+    memset(to, 0x40, *tolen);
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = from;
+    msg.msg_namelen = *fromlen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg;
+    msg.msg_controllen = sizeof(cmsg);
+
+    r = recvmsg(s, &msg, flags);
+    if (r < 0)
+        return r;
+    *fromlen = msg.msg_namelen;
+    get_pktinfo_addr(&msg, to, tolen, auxaddr);
+    return r;
+#endif
+}
+#endif /* !USE_UDP_BATCH */
+
+static int
+send_to_from(int s, void *buf, size_t len, int flags,
+             const struct sockaddr *to, socklen_t tolen,
+             const struct sockaddr *from, socklen_t fromlen,
+             union aux_addressing_info *auxaddr)
+{
+#if (!defined(IP_PKTINFO) && !defined(IPV6_PKTINFO)) || !defined(CMSG_SPACE)
+    return sendto(s, buf, len, flags, to, tolen);
+#else
+    struct iovec iov;
+    struct msghdr msg;
+    char cbuf[CMSG_SPACE(sizeof(union pktinfo))];
+
+    if (from == 0 || fromlen == 0 || from->sa_family != to->sa_family)
+        return sendto(s, buf, len, flags, to, tolen);
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    /* Truncation?  */
+    if (iov.iov_len != len)
+        return EINVAL;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *) to;
+    msg.msg_namelen = tolen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (set_pktinfo_addr(&msg, cbuf, sizeof(cbuf), from, fromlen,
+                         auxaddr) != 0)
+        return sendto(s, buf, len, flags, to, tolen);
     return sendmsg(s, &msg, flags);
 #endif
 }
@@ -1498,21 +1611,48 @@ struct udp_dispatch_state {
     struct sockaddr_storage daddr;
     union aux_addressing_info auxaddr;
     krb5_data request;
-    char pktbuf[MAX_DGRAM_SIZE];
+#ifdef USE_UDP_BATCH
+    /* While in_batch is set, a reply is held in response until the end of
+     * the receive batch instead of being sent immediately. */
+    int in_batch;
+    int responded;
+    krb5_data *response;
+#endif
+    /* Allocated with the state, bufsize bytes long. */
+    char *pktbuf;
+    size_t bufsize;
 };
 
+/* Allocate a dispatch state with room for a bufsize-byte packet. */
+static struct udp_dispatch_state *
+new_udp_state(struct connection *conn, int port_fd, size_t bufsize)
+{
+    struct udp_dispatch_state *state;
+
+    state = malloc(sizeof(*state) + bufsize);
+    if (state == NULL)
+        return NULL;
+    state->pktbuf = (char *)(state + 1);
+    state->bufsize = bufsize;
+    state->handle = conn->handle;
+    state->prog = conn->prog;
+    state->port_fd = port_fd;
+    state->saddr_len = sizeof(state->saddr);
+    state->daddr_len = sizeof(state->daddr);
+    memset(&state->auxaddr, 0, sizeof(state->auxaddr));
+#ifdef USE_UDP_BATCH
+    state->in_batch = 0;
+    state->responded = 0;
+    state->response = NULL;
+#endif
+    return state;
+}
+
 static void
-process_packet_response(void *arg, krb5_error_code code, krb5_data *response)
+send_udp_reply(struct udp_dispatch_state *state, krb5_data *response)
 {
-    struct udp_dispatch_state *state = arg;
     int cc;
 
-    if (code)
-        com_err(state->prog ? state->prog : NULL, code,
-                _("while dispatching (udp)"));
-    if (code || response == NULL)
-        goto out;
-
     cc = send_to_from(state->port_fd, response->data,
                       (socklen_t) response->length, 0,
                       (struct sockaddr *)&state->saddr, state->saddr_len,
@@ -1540,63 +1680,46 @@ process_packet_response(void *arg, krb5_error_code code, krb5_data *response)
 
         com_err(state->prog, e, _("while sending reply to %s/%s from %s"),
                 saddrbuf, sportbuf, daddrbuf);
-        goto out;
+        return;
     }
     if ((size_t)cc != response->length) {
         com_err(state->prog, 0, _("short reply write %d vs %d\n"),
                 response->length, cc);
     }
-
-out:
-    krb5_free_data(get_context(state->handle), response);
-    free(state);
 }
 
 static void
-process_packet(verto_ctx *ctx, verto_ev *ev)
+process_packet_response(void *arg, krb5_error_code code, krb5_data *response)
 {
-    int cc;
-    struct connection *conn;
-    struct udp_dispatch_state *state;
-
-    conn = verto_get_private(ev);
+    struct udp_dispatch_state *state = arg;
 
-    state = malloc(sizeof(*state));
-    if (!state) {
-        com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+    if (code)
+        com_err(state->prog ? state->prog : NULL, code,
+                _("while dispatching (udp)"));
+#ifdef USE_UDP_BATCH
+    if (state->in_batch) {
+        /* Hold the reply for flush_udp_batch(). */
+        state->responded = 1;
+        if (code == 0) {
+            state->response = response;
+            return;
+        }
+        krb5_free_data(get_context(state->handle), response);
         return;
     }
+#endif
+    if (code == 0 && response != NULL)
+        send_udp_reply(state, response);
 
-    state->handle = conn->handle;
-    state->prog = conn->prog;
-    state->port_fd = verto_get_fd(ev);
-    assert(state->port_fd >= 0);
-
-    state->saddr_len = sizeof(state->saddr);
-    state->daddr_len = sizeof(state->daddr);
-    memset(&state->auxaddr, 0, sizeof(state->auxaddr));
-    cc = recv_from_to(state->port_fd, state->pktbuf, sizeof(state->pktbuf), 0,
-                      (struct sockaddr *)&state->saddr, &state->saddr_len,
-                      (struct sockaddr *)&state->daddr, &state->daddr_len,
-                      &state->auxaddr);
-    if (cc == -1) {
-        if (errno != EINTR && errno != EAGAIN
-            /*
-             * This is how Linux indicates that a previous transmission was
-             * refused, e.g., if the client timed out before getting the
-             * response packet.
-             */
-            && errno != ECONNREFUSED
-        )
-            com_err(conn->prog, errno, _("while receiving from network"));
-        free(state);
-        return;
-    }
-    if (!cc) { /* zero-length packet? */
-        free(state);
-        return;
-    }
+    krb5_free_data(get_context(state->handle), response);
+    free(state);
+}
 
+/* Dispatch the len-byte request which has been received into state. */
+static void
+dispatch_udp_request(verto_ctx *ctx, struct connection *conn,
+                     struct udp_dispatch_state *state, int len)
+{
 #if 0
     if (state->daddr_len > 0) {
         char addrbuf[100];
@@ -1621,7 +1744,7 @@ process_packet(verto_ctx *ctx, verto_ev *ev)
         /* On failure, keep going anyways. */
     }
 
-    state->request.length = cc;
+    state->request.length = len;
     state->request.data = state->pktbuf;
     state->faddr.address = &state->addr;
     init_addr(&state->faddr, ss2sa(&state->saddr));
@@ -1630,6 +1753,220 @@ process_packet(verto_ctx *ctx, verto_ev *ev)
              &state->request, 0, ctx, process_packet_response, state);
 }
 
+static void
+report_recv_error(struct connection *conn)
+{
+    if (errno != EINTR && errno != EAGAIN
+        /*
+         * This is how Linux indicates that a previous transmission was
+         * refused, e.g., if the client timed out before getting the
+         * response packet.
+         */
+        && errno != ECONNREFUSED
+    )
+        com_err(conn->prog, errno, _("while receiving from network"));
+}
+
+#ifdef USE_UDP_BATCH
+
+/*
+ * Send the replies which were produced while states[0..n-1] were being
+ * dispatched, using one sendmmsg() call, and free those states.  Requests
+ * which have not been answered yet will send their replies individually when
+ * they complete.
+ */
+static void
+flush_udp_batch(int port_fd, struct udp_dispatch_state **states, int n)
+{
+    struct udp_dispatch_state *state, *ready[UDP_BATCH_MAX];
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec iovs[UDP_BATCH_MAX];
+    struct msghdr *msg;
+    char cbufs[UDP_BATCH_MAX][CMSG_SPACE(sizeof(union pktinfo))];
+    int i, nready = 0, sent;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < n; i++) {
+        state = states[i];
+        state->in_batch = 0;
+        if (!state->responded)
+            continue;
+        if (state->response == NULL) {
+            free(state);
+            continue;
+        }
+        msg = &msgs[nready].msg_hdr;
+        iovs[nready].iov_base = state->response->data;
+        iovs[nready].iov_len = state->response->length;
+        msg->msg_name = &state->saddr;
+        msg->msg_namelen = state->saddr_len;
+        msg->msg_iov = &iovs[nready];
+        msg->msg_iovlen = 1;
+        if (state->daddr_len == 0 ||
+            ss2sa(&state->daddr)->sa_family != ss2sa(&state->saddr)->sa_family ||
+            set_pktinfo_addr(msg, cbufs[nready], sizeof(cbufs[nready]),
+                             ss2sa(&state->daddr), state->daddr_len,
+                             &state->auxaddr) != 0) {
+            msg->msg_control = NULL;
+            msg->msg_controllen = 0;
+        }
+        ready[nready++] = state;
+    }
+    if (nready == 0)
+        return;
+
+    sent = sendmmsg(port_fd, msgs, nready, 0);
+    for (i = 0; i < nready; i++) {
+        state = ready[i];
+        if (i < sent) {
+            if (msgs[i].msg_len != state->response->length) {
+                com_err(state->prog, 0, _("short reply write %d vs %d\n"),
+                        state->response->length, (int)msgs[i].msg_len);
+            }
+        } else {
+            /* Retry individually so that any error gets reported. */
+            send_udp_reply(state, state->response);
+        }
+        krb5_free_data(get_context(state->handle), state->response);
+        free(state);
+    }
+}
+
+/*
+ * The receive side of a UDP socket's batches.  recvmmsg() fills these
+ * buffers, and only the datagrams which arrive are copied into dispatch
+ * states, since a reply may complete after the next batch is received.
+ */
+struct udp_batch {
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec iovs[UDP_BATCH_MAX];
+    struct sockaddr_storage saddrs[UDP_BATCH_MAX];
+    char cbufs[UDP_BATCH_MAX][CMSG_SPACE(sizeof(union pktinfo))];
+    char pktbufs[UDP_BATCH_MAX][MAX_DGRAM_SIZE];
+};
+
+static void
+process_packet(verto_ctx *ctx, verto_ev *ev)
+{
+    struct connection *conn;
+    struct udp_batch *batch;
+    struct udp_dispatch_state *state, *states[UDP_BATCH_MAX];
+    struct msghdr *msg;
+    int i, n, nstates, port_fd;
+
+    conn = verto_get_private(ev);
+    port_fd = verto_get_fd(ev);
+    assert(port_fd >= 0);
+
+    if (conn->udp_batch == NULL) {
+        conn->udp_batch = malloc(sizeof(*conn->udp_batch));
+        if (conn->udp_batch == NULL) {
+            com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+            return;
+        }
+    }
+    batch = conn->udp_batch;
+
+    memset(batch->msgs, 0, sizeof(batch->msgs));
+    for (i = 0; i < UDP_BATCH_MAX; i++) {
+        batch->iovs[i].iov_base = batch->pktbufs[i];
+        batch->iovs[i].iov_len = sizeof(batch->pktbufs[i]);
+        msg = &batch->msgs[i].msg_hdr;
+        msg->msg_name = &batch->saddrs[i];
+        msg->msg_namelen = sizeof(batch->saddrs[i]);
+        msg->msg_iov = &batch->iovs[i];
+        msg->msg_iovlen = 1;
+        msg->msg_control = batch->cbufs[i];
+        msg->msg_controllen = sizeof(batch->cbufs[i]);
+    }
+
+    n = recvmmsg(port_fd, batch->msgs, UDP_BATCH_MAX, 0, NULL);
+    if (n == -1)
+        report_recv_error(conn);
+    if (n <= 0)
+        return;
+    udp_batch_sizes[n]++;
+
+    nstates = 0;
+    for (i = 0; i < n; i++) {
+        /* Zero-length packets have nothing to reply to. */
+        if (batch->msgs[i].msg_len == 0)
+            continue;
+        state = new_udp_state(conn, port_fd, batch->msgs[i].msg_len);
+        if (state == NULL) {
+            com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+            continue;
+        }
+        msg = &batch->msgs[i].msg_hdr;
+        memcpy(&state->saddr, &batch->saddrs[i], msg->msg_namelen);
+        state->saddr_len = msg->msg_namelen;
+        get_pktinfo_addr(msg, ss2sa(&state->daddr), &state->daddr_len,
+                         &state->auxaddr);
+        memcpy(state->pktbuf, batch->pktbufs[i], batch->msgs[i].msg_len);
+        state->in_batch = 1;
+        states[nstates++] = state;
+        dispatch_udp_request(ctx, conn, state, batch->msgs[i].msg_len);
+    }
+    flush_udp_batch(port_fd, states, nstates);
+}
+
+/* Log how many datagrams each recvmmsg() call picked up. */
+static void
+log_udp_batch_sizes()
+{
+    struct k5buf buf;
+    int i;
+
+    krb5int_buf_init_dynamic(&buf);
+    for (i = 1; i <= UDP_BATCH_MAX; i++) {
+        if (udp_batch_sizes[i] != 0)
+            krb5int_buf_add_fmt(&buf, " %d:%lu", i, udp_batch_sizes[i]);
+    }
+    if (krb5int_buf_len(&buf) > 0) {
+        krb5_klog_syslog(LOG_INFO, _("UDP receive batch sizes:%s"),
+                         krb5int_buf_data(&buf));
+    }
+    krb5int_free_buf(&buf);
+    memset(udp_batch_sizes, 0, sizeof(udp_batch_sizes));
+}
+
+#else /* !USE_UDP_BATCH */
+
+static void
+process_packet(verto_ctx *ctx, verto_ev *ev)
+{
+    int cc;
+    struct connection *conn;
+    struct udp_dispatch_state *state;
+
+    conn = verto_get_private(ev);
+
+    state = new_udp_state(conn, verto_get_fd(ev), MAX_DGRAM_SIZE);
+    if (!state) {
+        com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+        return;
+    }
+    assert(state->port_fd >= 0);
+
+    cc = recv_from_to(state->port_fd, state->pktbuf, state->bufsize, 0,
+                      (struct sockaddr *)&state->saddr, &state->saddr_len,
+                      (struct sockaddr *)&state->daddr, &state->daddr_len,
+                      &state->auxaddr);
+    if (cc == -1) {
+        report_recv_error(conn);
+        free(state);
+        return;
+    }
+    if (!cc) { /* zero-length packet? */
+        free(state);
+        return;
+    }
+
+    dispatch_udp_request(ctx, conn, state, cc);
+}
+
+#endif /* !USE_UDP_BATCH */
+
 static int
 kill_lru_tcp_or_rpc_connection(void *handle, verto_ev *newev)
 {
@@ -1951,6 +2288,9 @@ process_tcp_connection_write(verto_ctx *ctx, verto_ev *ev)
 void
 loop_free(verto_ctx *ctx)
 {
+#ifdef USE_UDP_BATCH
+    log_udp_batch_sizes();
+#endif
     verto_free(ctx);
     FREE_SET_DATA(events);
     FREE_SET_DATA(udp_port_data);
@@ -0,0 +1,433 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/builtin/aes/aesni.c - AES-NI implementation of AES */
+/*
+ * Copyright (C) 2011 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Export of this software from the United States of America may
+ *   require a specific license from the United States Government.
+ *   It is the responsibility of any person or organization contemplating
+ *   export to obtain such a license before exporting.
+ *
+ * WITHIN THAT CONSTRAINT, permission to use, copy, modify, and
+ * distribute this software and its documentation for any purpose and
+ * without fee is hereby granted, provided that the above copyright
+ * notice appear in all copies and that both that copyright notice and
+ * this permission notice appear in supporting documentation, and that
+ * the name of M.I.T. not be used in advertising or publicity pertaining
+ * to distribution of the software without specific, written prior
+ * permission.  Furthermore if you modify this software you must label
+ * your software as modified software and not distribute it in such a
+ * fashion that it might be confused with the original M.I.T. software.
+ * M.I.T. makes no representations about the suitability of
+ * this software for any purpose.  It is provided "as is" without express
+ * or implied warranty.
+ */
+
+/*
+ * Key expansion follows the Intel white paper "Intel Advanced Encryption
+ * Standard (AES) New Instructions Set".  The decryption key schedule is the
+ * one used by the equivalent inverse cipher: the encryption round keys in
+ * reverse order, with InvMixColumns applied to all but the first and last.
+ *
+ * The code is compiled with per-function target attributes rather than
+ * -maes, so that the rest of the library does not depend on the instruction
+ * set, and is only called after krb5int_aesni_available() has checked the
+ * processor.  Setting KRB5_NO_AESNI in the environment disables it, so that
+ * the table-based implementation can be tested on the same machine.
+ */
+
+#include "aesni.h"
+#include <stdlib.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                        \
+    (defined(__clang__) ||                                              \
+     (defined(__GNUC__) &&                                              \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+
+#include <cpuid.h>
+#include <wmmintrin.h>
+
+#define AESNI __attribute__((target("aes,sse2")))
+
+/* CPUID leaf 1 reports AES-NI support in bit 25 of ECX. */
+#define CPUID_AES (1U << 25)
+
+/* The number of blocks CBC decryption processes at once, to hide the latency
+ * of the AESDEC instruction. */
+#define DEC_BLOCKS 4
+
+#define MAX_ROUNDS 14
+
+int
+krb5int_aesni_available(void)
+{
+    static int available = -1;
+    unsigned int eax, ebx, ecx, edx;
+
+    if (available == -1) {
+        available = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+            (ecx & CPUID_AES) && getenv("KRB5_NO_AESNI") == NULL;
+    }
+    return available;
+}
+
+/* Return the next four words of the key schedule, given the previous four
+ * words and the words produced from the preceding ones by
+ * AESKEYGENASSIST. */
+static inline AESNI __m128i
+next_round_key(__m128i prev, __m128i assist)
+{
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 4));
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 4));
+    prev = _mm_xor_si128(prev, _mm_slli_si128(prev, 4));
+    return _mm_xor_si128(prev, assist);
+}
+
+/* AESKEYGENASSIST requires an immediate round constant. */
+#define EXPAND128(rk, i, rcon)                                          \
+    rk[i] = next_round_key(rk[i - 1],                                   \
+                           _mm_shuffle_epi32(                           \
+                               _mm_aeskeygenassist_si128(rk[i - 1], rcon), \
+                               0xff))
+#define EXPAND256(rk, i, rcon)                                          \
+    rk[i] = next_round_key(rk[i - 2],                                   \
+                           _mm_shuffle_epi32(                           \
+                               _mm_aeskeygenassist_si128(rk[i - 1], rcon), \
+                               0xff));                                  \
+    rk[i + 1] = next_round_key(rk[i - 1],                               \
+                               _mm_shuffle_epi32(                       \
+                                   _mm_aeskeygenassist_si128(rk[i], 0), \
+                                   0xaa))
+
+/* Expand key into rk, returning the number of rounds or 0 if klen is not
+ * supported. */
+static AESNI unsigned int
+expand_key(const unsigned char *key, unsigned int klen, __m128i *rk)
+{
+    if (klen == 16) {
+        rk[0] = _mm_loadu_si128((const __m128i *)key);
+        EXPAND128(rk, 1, 0x01);
+        EXPAND128(rk, 2, 0x02);
+        EXPAND128(rk, 3, 0x04);
+        EXPAND128(rk, 4, 0x08);
+        EXPAND128(rk, 5, 0x10);
+        EXPAND128(rk, 6, 0x20);
+        EXPAND128(rk, 7, 0x40);
+        EXPAND128(rk, 8, 0x80);
+        EXPAND128(rk, 9, 0x1b);
+        EXPAND128(rk, 10, 0x36);
+        return 10;
+    } else if (klen == 32) {
+        rk[0] = _mm_loadu_si128((const __m128i *)key);
+        rk[1] = _mm_loadu_si128((const __m128i *)(key + 16));
+        EXPAND256(rk, 2, 0x01);
+        EXPAND256(rk, 4, 0x02);
+        EXPAND256(rk, 6, 0x04);
+        EXPAND256(rk, 8, 0x08);
+        EXPAND256(rk, 10, 0x10);
+        EXPAND256(rk, 12, 0x20);
+        rk[14] = next_round_key(rk[12],
+                                _mm_shuffle_epi32(
+                                    _mm_aeskeygenassist_si128(rk[13], 0x40),
+                                    0xff));
+        return 14;
+    }
+    return 0;
+}
+
+static inline AESNI void
+store_schedule(aes_ctx *cx, const __m128i *rk, unsigned int nrounds)
+{
+    unsigned int i;
+
+    for (i = 0; i <= nrounds; i++)
+        _mm_storeu_si128((__m128i *)cx->k_sch + i, rk[i]);
+    cx->n_rnd = nrounds;
+    cx->n_blk = BLOCK_SIZE;
+}
+
+static inline AESNI unsigned int
+load_schedule(const aes_ctx *cx, __m128i *rk)
+{
+    unsigned int i;
+
+    for (i = 0; i <= cx->n_rnd; i++)
+        rk[i] = _mm_loadu_si128((const __m128i *)cx->k_sch + i);
+    return cx->n_rnd;
+}
+
+AESNI aes_rval
+krb5int_aesni_enc_key(const unsigned char in_key[], unsigned int klen,
+                      aes_ctx cx[1])
+{
+    __m128i rk[MAX_ROUNDS + 1];
+    unsigned int nrounds;
+
+    nrounds = expand_key(in_key, klen, rk);
+    if (nrounds == 0)
+        return aes_bad;
+    store_schedule(cx, rk, nrounds);
+    return aes_good;
+}
+
+AESNI aes_rval
+krb5int_aesni_dec_key(const unsigned char in_key[], unsigned int klen,
+                      aes_ctx cx[1])
+{
+    __m128i rk[MAX_ROUNDS + 1], drk[MAX_ROUNDS + 1];
+    unsigned int i, nrounds;
+
+    nrounds = expand_key(in_key, klen, rk);
+    if (nrounds == 0)
+        return aes_bad;
+    drk[0] = rk[nrounds];
+    for (i = 1; i < nrounds; i++)
+        drk[i] = _mm_aesimc_si128(rk[nrounds - i]);
+    drk[nrounds] = rk[0];
+    store_schedule(cx, drk, nrounds);
+    return aes_good;
+}
+
+static inline AESNI __m128i
+encrypt(__m128i b, const __m128i *rk, unsigned int nrounds)
+{
+    unsigned int r;
+
+    b = _mm_xor_si128(b, rk[0]);
+    for (r = 1; r < nrounds; r++)
+        b = _mm_aesenc_si128(b, rk[r]);
+    return _mm_aesenclast_si128(b, rk[nrounds]);
+}
+
+static inline AESNI __m128i
+decrypt(__m128i b, const __m128i *rk, unsigned int nrounds)
+{
+    unsigned int r;
+
+    b = _mm_xor_si128(b, rk[0]);
+    for (r = 1; r < nrounds; r++)
+        b = _mm_aesdec_si128(b, rk[r]);
+    return _mm_aesdeclast_si128(b, rk[nrounds]);
+}
+
+AESNI void
+krb5int_aesni_enc_blk(const unsigned char in_blk[], unsigned char out_blk[],
+                      const aes_ctx cx[1])
+{
+    __m128i rk[MAX_ROUNDS + 1];
+    unsigned int nrounds = load_schedule(cx, rk);
+
+    _mm_storeu_si128((__m128i *)out_blk,
+                     encrypt(_mm_loadu_si128((const __m128i *)in_blk), rk,
+                             nrounds));
+}
+
+AESNI void
+krb5int_aesni_dec_blk(const unsigned char in_blk[], unsigned char out_blk[],
+                      const aes_ctx cx[1])
+{
+    __m128i rk[MAX_ROUNDS + 1];
+    unsigned int nrounds = load_schedule(cx, rk);
+
+    _mm_storeu_si128((__m128i *)out_blk,
+                     decrypt(_mm_loadu_si128((const __m128i *)in_blk), rk,
+                             nrounds));
+}
+
+/* CBC encryption is inherently serial, so blocks are processed one at a
+ * time. */
+AESNI void
+krb5int_aesni_cbc_enc(const aes_ctx cx[1], unsigned char iv[],
+                      unsigned char *data, size_t nblocks)
+{
+    __m128i rk[MAX_ROUNDS + 1], b;
+    __m128i *p = (__m128i *)data;
+    unsigned int nrounds = load_schedule(cx, rk);
+
+    b = _mm_loadu_si128((const __m128i *)iv);
+    for (; nblocks > 0; nblocks--, p++) {
+        b = encrypt(_mm_xor_si128(b, _mm_loadu_si128(p)), rk, nrounds);
+        _mm_storeu_si128(p, b);
+    }
+    _mm_storeu_si128((__m128i *)iv, b);
+}
+
+/* CBC decryption of each block depends only on ciphertext, so several blocks
+ * are decrypted at once, interleaving their rounds. */
+AESNI void
+krb5int_aesni_cbc_dec(const aes_ctx cx[1], unsigned char iv[],
+                      unsigned char *data, size_t nblocks)
+{
+    __m128i rk[MAX_ROUNDS + 1], prev, c[DEC_BLOCKS], b[DEC_BLOCKS];
+    __m128i *p = (__m128i *)data;
+    unsigned int i, r, nrounds = load_schedule(cx, rk);
+
+    prev = _mm_loadu_si128((const __m128i *)iv);
+    for (; nblocks >= DEC_BLOCKS; nblocks -= DEC_BLOCKS, p += DEC_BLOCKS) {
+        for (i = 0; i < DEC_BLOCKS; i++) {
+            c[i] = _mm_loadu_si128(p + i);
+            b[i] = _mm_xor_si128(c[i], rk[0]);
+        }
+        for (r = 1; r < nrounds; r++) {
+            for (i = 0; i < DEC_BLOCKS; i++)
+                b[i] = _mm_aesdec_si128(b[i], rk[r]);
+        }
+        for (i = 0; i < DEC_BLOCKS; i++) {
+            b[i] = _mm_aesdeclast_si128(b[i], rk[nrounds]);
+            _mm_storeu_si128(p + i, _mm_xor_si128(b[i], prev));
+            prev = c[i];
+        }
+    }
+    for (; nblocks > 0; nblocks--, p++) {
+        c[0] = _mm_loadu_si128(p);
+        _mm_storeu_si128(p, _mm_xor_si128(decrypt(c[0], rk, nrounds), prev));
+        prev = c[0];
+    }
+    _mm_storeu_si128((__m128i *)iv, prev);
+}
+
+/*
+ * Encrypting the blocks of independent buffers side by side hides the latency
+ * of AESENC, which serial CBC encryption of one buffer cannot.  The four
+ * chains are kept in separate variables so that they stay in registers.
+ * Lanes beyond nlanes or without blocks encrypt a scratch block in place, and
+ * once the shortest buffer is done, the rest of each buffer is finished
+ * serially.
+ */
+AESNI void
+krb5int_aesni_cbc_enc_lanes(const aes_ctx cx[1], unsigned char *const *iv,
+                            unsigned char *const *data, const size_t *nblocks,
+                            unsigned int nlanes)
+{
+    __m128i rk[MAX_ROUNDS + 1], b0, b1, b2, b3, scratch[AESNI_LANES];
+    __m128i *p[AESNI_LANES];
+    unsigned int i, r, nrounds, nactive = 0;
+    size_t j, common = (size_t)-1, step[AESNI_LANES];
+
+    for (i = 0; i < nlanes; i++) {
+        if (nblocks[i] > 0)
+            nactive++;
+    }
+    if (nactive < 2) {
+        for (i = 0; i < nlanes; i++)
+            krb5int_aesni_cbc_enc(cx, iv[i], data[i], nblocks[i]);
+        return;
+    }
+
+    nrounds = load_schedule(cx, rk);
+    for (i = 0; i < AESNI_LANES; i++) {
+        if (i < nlanes && nblocks[i] > 0) {
+            p[i] = (__m128i *)data[i];
+            scratch[i] = _mm_loadu_si128((const __m128i *)iv[i]);
+            step[i] = 1;
+            if (nblocks[i] < common)
+                common = nblocks[i];
+        } else {
+            p[i] = &scratch[i];
+            scratch[i] = _mm_setzero_si128();
+            step[i] = 0;
+        }
+    }
+
+    b0 = scratch[0];
+    b1 = scratch[1];
+    b2 = scratch[2];
+    b3 = scratch[3];
+    for (j = 0; j < common; j++) {
+        b0 = _mm_xor_si128(_mm_xor_si128(b0, _mm_loadu_si128(p[0])), rk[0]);
+        b1 = _mm_xor_si128(_mm_xor_si128(b1, _mm_loadu_si128(p[1])), rk[0]);
+        b2 = _mm_xor_si128(_mm_xor_si128(b2, _mm_loadu_si128(p[2])), rk[0]);
+        b3 = _mm_xor_si128(_mm_xor_si128(b3, _mm_loadu_si128(p[3])), rk[0]);
+        for (r = 1; r < nrounds; r++) {
+            b0 = _mm_aesenc_si128(b0, rk[r]);
+            b1 = _mm_aesenc_si128(b1, rk[r]);
+            b2 = _mm_aesenc_si128(b2, rk[r]);
+            b3 = _mm_aesenc_si128(b3, rk[r]);
+        }
+        b0 = _mm_aesenclast_si128(b0, rk[nrounds]);
+        b1 = _mm_aesenclast_si128(b1, rk[nrounds]);
+        b2 = _mm_aesenclast_si128(b2, rk[nrounds]);
+        b3 = _mm_aesenclast_si128(b3, rk[nrounds]);
+        _mm_storeu_si128(p[0], b0);
+        _mm_storeu_si128(p[1], b1);
+        _mm_storeu_si128(p[2], b2);
+        _mm_storeu_si128(p[3], b3);
+        for (i = 0; i < AESNI_LANES; i++)
+            p[i] += step[i];
+    }
+    scratch[0] = b0;
+    scratch[1] = b1;
+    scratch[2] = b2;
+    scratch[3] = b3;
+
+    for (i = 0; i < nlanes; i++) {
+        if (nblocks[i] == 0)
+            continue;
+        _mm_storeu_si128((__m128i *)iv[i], scratch[i]);
+        if (nblocks[i] > common) {
+            krb5int_aesni_cbc_enc(cx, iv[i], (unsigned char *)p[i],
+                                  nblocks[i] - common);
+        }
+    }
+}
+
+#else /* not x86 or no compiler support */
+
+int
+krb5int_aesni_available(void)
+{
+    return 0;
+}
+
+aes_rval
+krb5int_aesni_enc_key(const unsigned char in_key[], unsigned int klen,
+                      aes_ctx cx[1])
+{
+    abort();
+}
+
+aes_rval
+krb5int_aesni_dec_key(const unsigned char in_key[], unsigned int klen,
+                      aes_ctx cx[1])
+{
+    abort();
+}
+
+void
+krb5int_aesni_enc_blk(const unsigned char in_blk[], unsigned char out_blk[],
+                      const aes_ctx cx[1])
+{
+    abort();
+}
+
+void
+krb5int_aesni_dec_blk(const unsigned char in_blk[], unsigned char out_blk[],
+                      const aes_ctx cx[1])
+{
+    abort();
+}
+
+void
+krb5int_aesni_cbc_enc(const aes_ctx cx[1], unsigned char iv[],
+                      unsigned char *data, size_t nblocks)
+{
+    abort();
+}
+
+void
+krb5int_aesni_cbc_dec(const aes_ctx cx[1], unsigned char iv[],
+                      unsigned char *data, size_t nblocks)
+{
+    abort();
+}
+
+void
+krb5int_aesni_cbc_enc_lanes(const aes_ctx cx[1], unsigned char *const *iv,
+                            unsigned char *const *data, const size_t *nblocks,
+                            unsigned int nlanes)
+{
+    abort();
+}
+
+#endif
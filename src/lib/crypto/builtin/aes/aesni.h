@@ -0,0 +1,71 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/builtin/aes/aesni.h - AES-NI implementation of AES */
+/*
+ * Copyright (C) 2011 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Export of this software from the United States of America may
+ *   require a specific license from the United States Government.
+ *   It is the responsibility of any person or organization contemplating
+ *   export to obtain such a license before exporting.
+ *
+ * WITHIN THAT CONSTRAINT, permission to use, copy, modify, and
+ * distribute this software and its documentation for any purpose and
+ * without fee is hereby granted, provided that the above copyright
+ * notice appear in all copies and that both that copyright notice and
+ * this permission notice appear in supporting documentation, and that
+ * the name of M.I.T. not be used in advertising or publicity pertaining
+ * to distribution of the software without specific, written prior
+ * permission.  Furthermore if you modify this software you must label
+ * your software as modified software and not distribute it in such a
+ * fashion that it might be confused with the original M.I.T. software.
+ * M.I.T. makes no representations about the suitability of
+ * this software for any purpose.  It is provided "as is" without express
+ * or implied warranty.
+ */
+
+/*
+ * AES using the AES-NI instructions of x86 processors.  These functions use
+ * the same aes_ctx structure as the table-based implementation, but store the
+ * round keys in a different format, so a context must only be used with the
+ * implementation which expanded its key.  Callers must check
+ * krb5int_aesni_available() before using any other function; if the compiler
+ * cannot generate AES-NI code, it always returns false.
+ */
+
+#ifndef AESNI_H
+#define AESNI_H
+
+#include <stddef.h>
+#include "aes.h"
+
+int krb5int_aesni_available(void);
+
+aes_rval krb5int_aesni_enc_key(const unsigned char in_key[], unsigned int klen,
+                               aes_ctx cx[1]);
+aes_rval krb5int_aesni_dec_key(const unsigned char in_key[], unsigned int klen,
+                               aes_ctx cx[1]);
+
+void krb5int_aesni_enc_blk(const unsigned char in_blk[],
+                           unsigned char out_blk[], const aes_ctx cx[1]);
+void krb5int_aesni_dec_blk(const unsigned char in_blk[],
+                           unsigned char out_blk[], const aes_ctx cx[1]);
+
+/* CBC-encrypt or decrypt nblocks blocks of data in place, updating iv to the
+ * last ciphertext block. */
+void krb5int_aesni_cbc_enc(const aes_ctx cx[1], unsigned char iv[],
+                           unsigned char *data, size_t nblocks);
+void krb5int_aesni_cbc_dec(const aes_ctx cx[1], unsigned char iv[],
+                           unsigned char *data, size_t nblocks);
+
+/* The most buffers krb5int_aesni_cbc_enc_lanes() can process at once. */
+#define AESNI_LANES 4
+
+/* CBC-encrypt nlanes independent buffers in place, interleaving their rounds.
+ * Buffer i holds nblocks[i] blocks at data[i] and chains from and updates
+ * iv[i].  (Decryption of a single buffer is already parallel.) */
+void krb5int_aesni_cbc_enc_lanes(const aes_ctx cx[1], unsigned char *const *iv,
+                                 unsigned char *const *data,
+                                 const size_t *nblocks, unsigned int nlanes);
+
+#endif /* AESNI_H */
@@ -26,15 +26,23 @@
 
 #include "crypto_int.h"
 #include "aes.h"
+#include "aesni.h"
 
 #define CHECK_SIZES 0
 
+/* The number of whole blocks gathered from the iov for each CBC call. */
+#define CBC_BATCH 16
+
+/* The number of messages the batch functions process side by side. */
+#define MAX_LANES AESNI_LANES
+
 /*
  * Private per-key data to cache after first generation.  We don't
  * want to mess with the imported AES implementation too much, so
  * we'll just use two copies of its context, one for encryption and
  * one for decryption, and use the #rounds field as a flag for whether
- * we've initialized each half.
+ * we've initialized each half.  If the processor supports AES-NI, the
+ * contexts hold key schedules in the format used by aesni.c instead.
  */
 struct aes_key_info_cache {
     aes_ctx enc_ctx, dec_ctx;
@@ -44,14 +52,18 @@ struct aes_key_info_cache {
 static inline void
 enc(unsigned char *out, const unsigned char *in, aes_ctx *ctx)
 {
-    if (aes_enc_blk(in, out, ctx) != aes_good)
+    if (krb5int_aesni_available())
+        krb5int_aesni_enc_blk(in, out, ctx);
+    else if (aes_enc_blk(in, out, ctx) != aes_good)
         abort();
 }
 
 static inline void
 dec(unsigned char *out, const unsigned char *in, aes_ctx *ctx)
 {
-    if (aes_dec_blk(in, out, ctx) != aes_good)
+    if (krb5int_aesni_available())
+        krb5int_aesni_dec_blk(in, out, ctx);
+    else if (aes_dec_blk(in, out, ctx) != aes_good)
         abort();
 }
 
@@ -80,175 +92,222 @@ xorblock(unsigned char *out, const unsigned char *in)
     }
 }
 
-krb5_error_code
-krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-                    size_t num_data)
+/* CBC-encrypt nblocks blocks of data in place, chaining from and updating
+ * iv. */
+static void
+cbc_enc(aes_ctx *ctx, unsigned char *iv, unsigned char *data, size_t nblocks)
 {
-    unsigned char tmp[BLOCK_SIZE], tmp2[BLOCK_SIZE];
-    int nblocks = 0, blockno;
-    size_t input_length, i;
-    struct iov_block_state input_pos, output_pos;
-
-    if (key->cache == NULL) {
-        key->cache = malloc(sizeof(struct aes_key_info_cache));
-        if (key->cache == NULL)
-            return ENOMEM;
-        CACHE(key)->enc_ctx.n_rnd = CACHE(key)->dec_ctx.n_rnd = 0;
+    if (krb5int_aesni_available()) {
+        krb5int_aesni_cbc_enc(ctx, iv, data, nblocks);
+        return;
     }
-    if (CACHE(key)->enc_ctx.n_rnd == 0) {
-        if (aes_enc_key(key->keyblock.contents, key->keyblock.length,
-                        &CACHE(key)->enc_ctx)
-            != aes_good)
-            abort();
+    for (; nblocks > 0; nblocks--, data += BLOCK_SIZE) {
+        xorblock(iv, data);
+        enc(data, iv, ctx);
+        memcpy(iv, data, BLOCK_SIZE);
     }
-    if (ivec != NULL)
-        memcpy(tmp, ivec->data, BLOCK_SIZE);
-    else
-        memset(tmp, 0, BLOCK_SIZE);
+}
 
-    for (i = 0, input_length = 0; i < num_data; i++) {
-        krb5_crypto_iov *iov = &data[i];
+/* CBC-decrypt nblocks blocks of data in place, chaining from and updating
+ * iv. */
+static void
+cbc_dec(aes_ctx *ctx, unsigned char *iv, unsigned char *data, size_t nblocks)
+{
+    unsigned char tmp[BLOCK_SIZE];
 
-        if (ENCRYPT_IOV(iov))
-            input_length += iov->data.length;
+    if (krb5int_aesni_available()) {
+        krb5int_aesni_cbc_dec(ctx, iv, data, nblocks);
+        return;
     }
+    for (; nblocks > 0; nblocks--, data += BLOCK_SIZE) {
+        memcpy(tmp, data, BLOCK_SIZE);
+        dec(data, data, ctx);
+        xorblock(data, iv);
+        memcpy(iv, tmp, BLOCK_SIZE);
+    }
+}
 
-    IOV_BLOCK_STATE_INIT(&input_pos);
-    IOV_BLOCK_STATE_INIT(&output_pos);
+/* Progress of one message through CTS encryption or decryption. */
+struct cts_msg {
+    krb5_crypto_iov *data;
+    size_t num_data;
+    size_t input_length;
+    int nblocks;
+    int blockno;                /* Blocks done by cbc_enc/dec_msgs() */
+    struct iov_block_state input_pos, output_pos;
+    unsigned char iv[BLOCK_SIZE];
+};
 
-    nblocks = (input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    if (nblocks == 1) {
-        krb5int_c_iov_get_block(tmp, BLOCK_SIZE, data, num_data, &input_pos);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
-        krb5int_c_iov_put_block(data, num_data, tmp2, BLOCK_SIZE, &output_pos);
-    } else if (nblocks > 1) {
-        unsigned char blockN2[BLOCK_SIZE];   /* second last */
-        unsigned char blockN1[BLOCK_SIZE];   /* last block */
+static void
+init_msg(struct cts_msg *m, const krb5_data *ivec, krb5_crypto_iov *data,
+         size_t num_data)
+{
+    size_t i;
 
-        for (blockno = 0; blockno < nblocks - 2; blockno++) {
-            unsigned char blockN[BLOCK_SIZE], *block;
+    m->data = data;
+    m->num_data = num_data;
+    for (i = 0, m->input_length = 0; i < num_data; i++) {
+        if (ENCRYPT_IOV(&data[i]))
+            m->input_length += data[i].data.length;
+    }
+    m->nblocks = (m->input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    m->blockno = 0;
+    IOV_BLOCK_STATE_INIT(&m->input_pos);
+    IOV_BLOCK_STATE_INIT(&m->output_pos);
+    if (ivec != NULL)
+        memcpy(m->iv, ivec->data, BLOCK_SIZE);
+    else
+        memset(m->iv, 0, BLOCK_SIZE);
+}
 
-            krb5int_c_iov_get_block_nocopy(blockN, BLOCK_SIZE,
-                                           data, num_data, &input_pos, &block);
-            xorblock(tmp, block);
-            enc(block, tmp, &CACHE(key)->enc_ctx);
-            krb5int_c_iov_put_block_nocopy(data, num_data, blockN, BLOCK_SIZE,
-                                           &output_pos, block);
+/* Gather up to CBC_BATCH of the blocks of m preceding its last two into buf,
+ * returning the number of blocks gathered. */
+static size_t
+get_batch(struct cts_msg *m, unsigned char *buf)
+{
+    int n = m->nblocks - 2 - m->blockno;
+
+    if (n <= 0)
+        return 0;
+    if (n > CBC_BATCH)
+        n = CBC_BATCH;
+    /* Copy the whole run at once; these blocks are all complete. */
+    krb5int_c_iov_get_block(buf, n * BLOCK_SIZE, m->data, m->num_data,
+                            &m->input_pos);
+    return n;
+}
+
+static void
+put_batch(struct cts_msg *m, unsigned char *buf, size_t n)
+{
+    if (n == 0)
+        return;
+    krb5int_c_iov_put_block(m->data, m->num_data, buf, n * BLOCK_SIZE,
+                            &m->output_pos);
+    m->blockno += n;
+}
 
-            /* Set up for next block.  */
-            memcpy(tmp, block, BLOCK_SIZE);
+/*
+ * CBC-encrypt or decrypt all but the last two blocks of each of the nmsgs
+ * (at most MAX_LANES) messages in msgs.  With AES-NI, the messages are
+ * encrypted side by side; decryption is already parallel within a message.
+ */
+static void
+cbc_msgs(aes_ctx *ctx, struct cts_msg *msgs, int nmsgs, krb5_boolean encrypt)
+{
+    unsigned char batch[MAX_LANES][CBC_BATCH * BLOCK_SIZE];
+    unsigned char *bufs[MAX_LANES], *ivs[MAX_LANES];
+    size_t n[MAX_LANES], total;
+    int i;
+
+    for (i = 0; i < nmsgs; i++) {
+        bufs[i] = batch[i];
+        ivs[i] = msgs[i].iv;
+    }
+    for (;;) {
+        for (i = 0, total = 0; i < nmsgs; i++) {
+            n[i] = get_batch(&msgs[i], batch[i]);
+            total += n[i];
+        }
+        if (total == 0)
+            break;
+        if (encrypt && nmsgs > 1 && krb5int_aesni_available()) {
+            krb5int_aesni_cbc_enc_lanes(ctx, ivs, bufs, n, nmsgs);
+        } else {
+            for (i = 0; i < nmsgs; i++) {
+                if (encrypt)
+                    cbc_enc(ctx, msgs[i].iv, batch[i], n[i]);
+                else
+                    cbc_dec(ctx, msgs[i].iv, batch[i], n[i]);
+            }
         }
+        for (i = 0; i < nmsgs; i++)
+            put_batch(&msgs[i], batch[i], n[i]);
+    }
+}
+
+/* Encrypt the last two blocks of m, or its only block, after cbc_msgs(). */
+static void
+enc_final(aes_ctx *ctx, struct cts_msg *m, const krb5_data *ivec)
+{
+    unsigned char tmp2[BLOCK_SIZE];
+    unsigned char *tmp = m->iv;
+
+    if (m->nblocks == 1) {
+        krb5int_c_iov_get_block(tmp, BLOCK_SIZE, m->data, m->num_data,
+                                &m->input_pos);
+        enc(tmp2, tmp, ctx);
+        krb5int_c_iov_put_block(m->data, m->num_data, tmp2, BLOCK_SIZE,
+                                &m->output_pos);
+    } else if (m->nblocks > 1) {
+        unsigned char blockN2[BLOCK_SIZE];   /* second last */
+        unsigned char blockN1[BLOCK_SIZE];   /* last block */
 
         /* Do final CTS step for last two blocks (the second of which
            may or may not be incomplete).  */
 
         /* First, get the last two blocks */
         memset(blockN1, 0, sizeof(blockN1)); /* pad last block with zeros */
-        krb5int_c_iov_get_block(blockN2, BLOCK_SIZE, data, num_data,
-                                &input_pos);
-        krb5int_c_iov_get_block(blockN1, BLOCK_SIZE, data, num_data,
-                                &input_pos);
+        krb5int_c_iov_get_block(blockN2, BLOCK_SIZE, m->data, m->num_data,
+                                &m->input_pos);
+        krb5int_c_iov_get_block(blockN1, BLOCK_SIZE, m->data, m->num_data,
+                                &m->input_pos);
 
         /* Encrypt second last block */
         xorblock(tmp, blockN2);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
+        enc(tmp2, tmp, ctx);
         memcpy(blockN2, tmp2, BLOCK_SIZE); /* blockN2 now contains first block */
         memcpy(tmp, tmp2, BLOCK_SIZE);
 
         /* Encrypt last block */
         xorblock(tmp, blockN1);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
+        enc(tmp2, tmp, ctx);
         memcpy(blockN1, tmp2, BLOCK_SIZE);
 
         /* Put the last two blocks back into the iovec (reverse order) */
-        krb5int_c_iov_put_block(data, num_data, blockN1, BLOCK_SIZE,
-                                &output_pos);
-        krb5int_c_iov_put_block(data, num_data, blockN2, BLOCK_SIZE,
-                                &output_pos);
+        krb5int_c_iov_put_block(m->data, m->num_data, blockN1, BLOCK_SIZE,
+                                &m->output_pos);
+        krb5int_c_iov_put_block(m->data, m->num_data, blockN2, BLOCK_SIZE,
+                                &m->output_pos);
 
         if (ivec != NULL)
             memcpy(ivec->data, blockN1, BLOCK_SIZE);
     }
-
-    return 0;
 }
 
-krb5_error_code
-krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
-                    size_t num_data)
+/* Decrypt the last two blocks of m, or its only block, after cbc_msgs(). */
+static void
+dec_final(aes_ctx *ctx, struct cts_msg *m, const krb5_data *ivec)
 {
-    unsigned char tmp[BLOCK_SIZE], tmp2[BLOCK_SIZE], tmp3[BLOCK_SIZE];
-    int nblocks = 0, blockno;
-    unsigned int i;
+    unsigned char tmp2[BLOCK_SIZE], tmp3[BLOCK_SIZE];
+    unsigned char *tmp = m->iv;
     size_t input_length;
-    struct iov_block_state input_pos, output_pos;
-
-    CHECK_SIZES;
-
-    if (key->cache == NULL) {
-        key->cache = malloc(sizeof(struct aes_key_info_cache));
-        if (key->cache == NULL)
-            return ENOMEM;
-        CACHE(key)->enc_ctx.n_rnd = CACHE(key)->dec_ctx.n_rnd = 0;
-    }
-    if (CACHE(key)->dec_ctx.n_rnd == 0) {
-        if (aes_dec_key(key->keyblock.contents, key->keyblock.length,
-                        &CACHE(key)->dec_ctx) != aes_good)
-            abort();
-    }
-
-    if (ivec != NULL)
-        memcpy(tmp, ivec->data, BLOCK_SIZE);
-    else
-        memset(tmp, 0, BLOCK_SIZE);
-
-    for (i = 0, input_length = 0; i < num_data; i++) {
-        krb5_crypto_iov *iov = &data[i];
-
-        if (ENCRYPT_IOV(iov))
-            input_length += iov->data.length;
-    }
 
-    IOV_BLOCK_STATE_INIT(&input_pos);
-    IOV_BLOCK_STATE_INIT(&output_pos);
-
-    nblocks = (input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    if (nblocks == 1) {
-        krb5int_c_iov_get_block(tmp, BLOCK_SIZE, data, num_data, &input_pos);
-        dec(tmp2, tmp, &CACHE(key)->dec_ctx);
-        krb5int_c_iov_put_block(data, num_data, tmp2, BLOCK_SIZE, &output_pos);
-    } else if (nblocks > 1) {
+    if (m->nblocks == 1) {
+        krb5int_c_iov_get_block(tmp, BLOCK_SIZE, m->data, m->num_data,
+                                &m->input_pos);
+        dec(tmp2, tmp, ctx);
+        krb5int_c_iov_put_block(m->data, m->num_data, tmp2, BLOCK_SIZE,
+                                &m->output_pos);
+    } else if (m->nblocks > 1) {
         unsigned char blockN2[BLOCK_SIZE];   /* second last */
         unsigned char blockN1[BLOCK_SIZE];   /* last block */
 
-        for (blockno = 0; blockno < nblocks - 2; blockno++) {
-            unsigned char blockN[BLOCK_SIZE], *block;
-
-            krb5int_c_iov_get_block_nocopy(blockN, BLOCK_SIZE,
-                                           data, num_data, &input_pos, &block);
-            memcpy(tmp2, block, BLOCK_SIZE);
-            dec(block, block, &CACHE(key)->dec_ctx);
-            xorblock(block, tmp);
-            memcpy(tmp, tmp2, BLOCK_SIZE);
-            krb5int_c_iov_put_block_nocopy(data, num_data, blockN, BLOCK_SIZE,
-                                           &output_pos, block);
-        }
-
         /* Do last two blocks, the second of which (next-to-last block
            of plaintext) may be incomplete.  */
 
         /* First, get the last two encrypted blocks */
         memset(blockN1, 0, sizeof(blockN1)); /* pad last block with zeros */
-        krb5int_c_iov_get_block(blockN2, BLOCK_SIZE, data, num_data,
-                                &input_pos);
-        krb5int_c_iov_get_block(blockN1, BLOCK_SIZE, data, num_data,
-                                &input_pos);
+        krb5int_c_iov_get_block(blockN2, BLOCK_SIZE, m->data, m->num_data,
+                                &m->input_pos);
+        krb5int_c_iov_get_block(blockN1, BLOCK_SIZE, m->data, m->num_data,
+                                &m->input_pos);
 
         if (ivec != NULL)
             memcpy(ivec->data, blockN2, BLOCK_SIZE);
 
         /* Decrypt second last block */
-        dec(tmp2, blockN2, &CACHE(key)->dec_ctx);
+        dec(tmp2, blockN2, ctx);
         /* Set tmp2 to last (possibly partial) plaintext block, and
            save it.  */
         xorblock(tmp2, blockN1);
@@ -256,22 +315,130 @@ krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
 
         /* Maybe keep the trailing part, and copy in the last
            ciphertext block.  */
-        input_length %= BLOCK_SIZE;
+        input_length = m->input_length % BLOCK_SIZE;
         memcpy(tmp2, blockN1, input_length ? input_length : BLOCK_SIZE);
-        dec(tmp3, tmp2, &CACHE(key)->dec_ctx);
+        dec(tmp3, tmp2, ctx);
         xorblock(tmp3, tmp);
         memcpy(blockN1, tmp3, BLOCK_SIZE);
 
         /* Put the last two blocks back into the iovec */
-        krb5int_c_iov_put_block(data, num_data, blockN1, BLOCK_SIZE,
-                                &output_pos);
-        krb5int_c_iov_put_block(data, num_data, blockN2, BLOCK_SIZE,
-                                &output_pos);
+        krb5int_c_iov_put_block(m->data, m->num_data, blockN1, BLOCK_SIZE,
+                                &m->output_pos);
+        krb5int_c_iov_put_block(m->data, m->num_data, blockN2, BLOCK_SIZE,
+                                &m->output_pos);
     }
+}
 
+/* Return the encryption or decryption context for key, expanding the key on
+ * first use. */
+static aes_ctx *
+get_ctx(krb5_key key, krb5_boolean encrypt)
+{
+    aes_ctx *ctx;
+    aes_rval ret;
+
+    if (key->cache == NULL) {
+        key->cache = malloc(sizeof(struct aes_key_info_cache));
+        if (key->cache == NULL)
+            return NULL;
+        CACHE(key)->enc_ctx.n_rnd = CACHE(key)->dec_ctx.n_rnd = 0;
+    }
+    ctx = encrypt ? &CACHE(key)->enc_ctx : &CACHE(key)->dec_ctx;
+    if (ctx->n_rnd == 0) {
+        if (krb5int_aesni_available() && encrypt)
+            ret = krb5int_aesni_enc_key(key->keyblock.contents,
+                                        key->keyblock.length, ctx);
+        else if (krb5int_aesni_available())
+            ret = krb5int_aesni_dec_key(key->keyblock.contents,
+                                        key->keyblock.length, ctx);
+        else if (encrypt)
+            ret = aes_enc_key(key->keyblock.contents, key->keyblock.length,
+                              ctx);
+        else
+            ret = aes_dec_key(key->keyblock.contents, key->keyblock.length,
+                              ctx);
+        if (ret != aes_good)
+            abort();
+    }
+    return ctx;
+}
+
+krb5_error_code
+krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+                    size_t num_data)
+{
+    struct cts_msg m;
+    aes_ctx *ctx;
+
+    ctx = get_ctx(key, TRUE);
+    if (ctx == NULL)
+        return ENOMEM;
+    init_msg(&m, ivec, data, num_data);
+    cbc_msgs(ctx, &m, 1, TRUE);
+    enc_final(ctx, &m, ivec);
+    return 0;
+}
+
+krb5_error_code
+krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+                    size_t num_data)
+{
+    struct cts_msg m;
+    aes_ctx *ctx;
+
+    CHECK_SIZES;
+
+    ctx = get_ctx(key, FALSE);
+    if (ctx == NULL)
+        return ENOMEM;
+    init_msg(&m, ivec, data, num_data);
+    cbc_msgs(ctx, &m, 1, FALSE);
+    dec_final(ctx, &m, ivec);
+    return 0;
+}
+
+/* Encrypt or decrypt count messages, MAX_LANES at a time. */
+static krb5_error_code
+crypt_batch(krb5_key key, krb5_crypto_iov **data, const size_t *num_data,
+            size_t count, krb5_boolean encrypt)
+{
+    struct cts_msg msgs[MAX_LANES];
+    aes_ctx *ctx;
+    size_t i;
+    int j, n;
+
+    ctx = get_ctx(key, encrypt);
+    if (ctx == NULL)
+        return ENOMEM;
+    for (i = 0; i < count; i += n) {
+        n = (count - i < MAX_LANES) ? count - i : MAX_LANES;
+        for (j = 0; j < n; j++)
+            init_msg(&msgs[j], NULL, data[i + j], num_data[i + j]);
+        cbc_msgs(ctx, msgs, n, encrypt);
+        for (j = 0; j < n; j++) {
+            if (encrypt)
+                enc_final(ctx, &msgs[j], NULL);
+            else
+                dec_final(ctx, &msgs[j], NULL);
+        }
+    }
     return 0;
 }
 
+static krb5_error_code
+aes_encrypt_batch(krb5_key key, krb5_crypto_iov **data,
+                  const size_t *num_data, size_t count)
+{
+    return crypt_batch(key, data, num_data, count, TRUE);
+}
+
+static krb5_error_code
+aes_decrypt_batch(krb5_key key, krb5_crypto_iov **data,
+                  const size_t *num_data, size_t count)
+{
+    return crypt_batch(key, data, num_data, count, FALSE);
+}
+
 static krb5_error_code
 aes_init_state(const krb5_keyblock *key, krb5_keyusage usage,
                krb5_data *state)
@@ -298,7 +465,9 @@ const struct krb5_enc_provider krb5int_enc_aes128 = {
     NULL,
     aes_init_state,
     krb5int_default_free_state,
-    aes_key_cleanup
+    aes_key_cleanup,
+    aes_encrypt_batch,
+    aes_decrypt_batch
 };
 
 const struct krb5_enc_provider krb5int_enc_aes256 = {
@@ -309,5 +478,7 @@ const struct krb5_enc_provider krb5int_enc_aes256 = {
     NULL,
     aes_init_state,
     krb5int_default_free_state,
-    aes_key_cleanup
+    aes_key_cleanup,
+    aes_encrypt_batch,
+    aes_decrypt_batch
 };
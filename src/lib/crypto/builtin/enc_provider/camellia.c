@@ -29,14 +29,16 @@
 
 #ifdef CAMELLIA
 
+/* The number of whole blocks gathered from the iov for each CBC call. */
+#define CBC_BATCH 16
+
 /*
- * Private per-key data to cache after first generation.  We don't want to mess
- * with the imported Cemallia implementation too much, so we'll just use two
- * copies of its context, one for encryption and one for decryption, and use
- * the #rounds field as a flag for whether we've initialized each half.
+ * Private per-key data to cache after first generation.  Camellia uses the
+ * same key schedule for encryption and decryption, so one context serves for
+ * both, and the keybitlen field is a flag for whether it has been initialized.
  */
 struct camellia_key_info_cache {
-    camellia_ctx enc_ctx, dec_ctx;
+    camellia_ctx ctx;
 };
 #define CACHE(X) ((struct camellia_key_info_cache *)((X)->cache))
 
@@ -79,26 +81,92 @@ xorblock(unsigned char *out, const unsigned char *in)
     }
 }
 
-static krb5_error_code
-krb5int_camellia_encrypt(krb5_key key, const krb5_data *ivec,
-                         krb5_crypto_iov *data, size_t num_data)
+/* CBC-encrypt nblocks blocks of data in place, chaining from and updating
+ * iv. */
+static void
+cbc_enc(camellia_ctx *ctx, unsigned char *iv, unsigned char *data,
+        size_t nblocks)
 {
-    unsigned char tmp[BLOCK_SIZE], tmp2[BLOCK_SIZE];
-    int nblocks = 0, blockno;
-    size_t input_length, i;
-    struct iov_block_state input_pos, output_pos;
+    for (; nblocks > 0; nblocks--, data += BLOCK_SIZE) {
+        xorblock(iv, data);
+        enc(data, iv, ctx);
+        memcpy(iv, data, BLOCK_SIZE);
+    }
+}
+
+/* CBC-decrypt nblocks blocks of data in place, chaining from and updating
+ * iv. */
+static void
+cbc_dec(camellia_ctx *ctx, unsigned char *iv, unsigned char *data,
+        size_t nblocks)
+{
+    unsigned char tmp[BLOCK_SIZE];
+
+    for (; nblocks > 0; nblocks--, data += BLOCK_SIZE) {
+        memcpy(tmp, data, BLOCK_SIZE);
+        dec(data, data, ctx);
+        xorblock(data, iv);
+        memcpy(iv, tmp, BLOCK_SIZE);
+    }
+}
 
+/*
+ * CBC-encrypt or decrypt the first nblocks whole blocks of data in place,
+ * CBC_BATCH blocks at a time, chaining from and updating iv and advancing
+ * input_pos and output_pos.
+ */
+static void
+cbc_iov(camellia_ctx *ctx, unsigned char *iv, krb5_crypto_iov *data,
+        size_t num_data, int nblocks, struct iov_block_state *input_pos,
+        struct iov_block_state *output_pos, krb5_boolean encrypt)
+{
+    unsigned char batch[CBC_BATCH * BLOCK_SIZE];
+    int n;
+
+    for (; nblocks > 0; nblocks -= n) {
+        n = (nblocks < CBC_BATCH) ? nblocks : CBC_BATCH;
+        krb5int_c_iov_get_block(batch, n * BLOCK_SIZE, data, num_data,
+                                input_pos);
+        if (encrypt)
+            cbc_enc(ctx, iv, batch, n);
+        else
+            cbc_dec(ctx, iv, batch, n);
+        krb5int_c_iov_put_block(data, num_data, batch, n * BLOCK_SIZE,
+                                output_pos);
+    }
+}
+
+/* Return the context for key, expanding the key on first use. */
+static camellia_ctx *
+get_ctx(krb5_key key)
+{
     if (key->cache == NULL) {
         key->cache = malloc(sizeof(struct camellia_key_info_cache));
         if (key->cache == NULL)
-            return ENOMEM;
-        CACHE(key)->enc_ctx.keybitlen = CACHE(key)->dec_ctx.keybitlen = 0;
+            return NULL;
+        CACHE(key)->ctx.keybitlen = 0;
     }
-    if (CACHE(key)->enc_ctx.keybitlen == 0) {
+    if (CACHE(key)->ctx.keybitlen == 0) {
         if (camellia_enc_key(key->keyblock.contents, key->keyblock.length,
-                             &CACHE(key)->enc_ctx) != camellia_good)
+                             &CACHE(key)->ctx) != camellia_good)
             abort();
     }
+    return &CACHE(key)->ctx;
+}
+
+static krb5_error_code
+krb5int_camellia_encrypt(krb5_key key, const krb5_data *ivec,
+                         krb5_crypto_iov *data, size_t num_data)
+{
+    unsigned char tmp[BLOCK_SIZE], tmp2[BLOCK_SIZE];
+    int nblocks = 0;
+    size_t input_length, i;
+    struct iov_block_state input_pos, output_pos;
+    camellia_ctx *ctx;
+
+    ctx = get_ctx(key);
+    if (ctx == NULL)
+        return ENOMEM;
     if (ivec != NULL)
         memcpy(tmp, ivec->data, BLOCK_SIZE);
     else
@@ -117,25 +185,14 @@ krb5int_camellia_encrypt(krb5_key key, const krb5_data *ivec,
     nblocks = (input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
     if (nblocks == 1) {
         krb5int_c_iov_get_block(tmp, BLOCK_SIZE, data, num_data, &input_pos);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
+        enc(tmp2, tmp, ctx);
         krb5int_c_iov_put_block(data, num_data, tmp2, BLOCK_SIZE, &output_pos);
     } else if (nblocks > 1) {
         unsigned char blockN2[BLOCK_SIZE];   /* second last */
         unsigned char blockN1[BLOCK_SIZE];   /* last block */
 
-        for (blockno = 0; blockno < nblocks - 2; blockno++) {
-            unsigned char blockN[BLOCK_SIZE], *block;
-
-            krb5int_c_iov_get_block_nocopy(blockN, BLOCK_SIZE,
-                                           data, num_data, &input_pos, &block);
-            xorblock(tmp, block);
-            enc(block, tmp, &CACHE(key)->enc_ctx);
-            krb5int_c_iov_put_block_nocopy(data, num_data, blockN, BLOCK_SIZE,
-                                           &output_pos, block);
-
-            /* Set up for next block.  */
-            memcpy(tmp, block, BLOCK_SIZE);
-        }
+        cbc_iov(ctx, tmp, data, num_data, nblocks - 2, &input_pos,
+                &output_pos, TRUE);
 
         /* Do final CTS step for last two blocks (the second of which
            may or may not be incomplete).  */
@@ -149,13 +206,13 @@ krb5int_camellia_encrypt(krb5_key key, const krb5_data *ivec,
 
         /* Encrypt second last block */
         xorblock(tmp, blockN2);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
+        enc(tmp2, tmp, ctx);
         memcpy(blockN2, tmp2, BLOCK_SIZE); /* blockN2 now contains first block */
         memcpy(tmp, tmp2, BLOCK_SIZE);
 
         /* Encrypt last block */
         xorblock(tmp, blockN1);
-        enc(tmp2, tmp, &CACHE(key)->enc_ctx);
+        enc(tmp2, tmp, ctx);
         memcpy(blockN1, tmp2, BLOCK_SIZE);
 
         /* Put the last two blocks back into the iovec (reverse order) */
@@ -176,22 +233,15 @@ krb5int_camellia_decrypt(krb5_key key, const krb5_data *ivec,
                          krb5_crypto_iov *data, size_t num_data)
 {
     unsigned char tmp[BLOCK_SIZE], tmp2[BLOCK_SIZE], tmp3[BLOCK_SIZE];
-    int nblocks = 0, blockno;
+    int nblocks = 0;
     unsigned int i;
     size_t input_length;
     struct iov_block_state input_pos, output_pos;
+    camellia_ctx *ctx;
 
-    if (key->cache == NULL) {
-        key->cache = malloc(sizeof(struct camellia_key_info_cache));
-        if (key->cache == NULL)
-            return ENOMEM;
-        CACHE(key)->enc_ctx.keybitlen = CACHE(key)->dec_ctx.keybitlen = 0;
-    }
-    if (CACHE(key)->dec_ctx.keybitlen == 0) {
-        if (camellia_dec_key(key->keyblock.contents, key->keyblock.length,
-                             &CACHE(key)->dec_ctx) != camellia_good)
-            abort();
-    }
+    ctx = get_ctx(key);
+    if (ctx == NULL)
+        return ENOMEM;
 
     if (ivec != NULL)
         memcpy(tmp, ivec->data, BLOCK_SIZE);
@@ -211,24 +261,14 @@ krb5int_camellia_decrypt(krb5_key key, const krb5_data *ivec,
     nblocks = (input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
     if (nblocks == 1) {
         krb5int_c_iov_get_block(tmp, BLOCK_SIZE, data, num_data, &input_pos);
-        dec(tmp2, tmp, &CACHE(key)->dec_ctx);
+        dec(tmp2, tmp, ctx);
         krb5int_c_iov_put_block(data, num_data, tmp2, BLOCK_SIZE, &output_pos);
     } else if (nblocks > 1) {
         unsigned char blockN2[BLOCK_SIZE];   /* second last */
         unsigned char blockN1[BLOCK_SIZE];   /* last block */
 
-        for (blockno = 0; blockno < nblocks - 2; blockno++) {
-            unsigned char blockN[BLOCK_SIZE], *block;
-
-            krb5int_c_iov_get_block_nocopy(blockN, BLOCK_SIZE,
-                                           data, num_data, &input_pos, &block);
-            memcpy(tmp2, block, BLOCK_SIZE);
-            dec(block, block, &CACHE(key)->dec_ctx);
-            xorblock(block, tmp);
-            memcpy(tmp, tmp2, BLOCK_SIZE);
-            krb5int_c_iov_put_block_nocopy(data, num_data, blockN, BLOCK_SIZE,
-                                           &output_pos, block);
-        }
+        cbc_iov(ctx, tmp, data, num_data, nblocks - 2, &input_pos,
+                &output_pos, FALSE);
 
         /* Do last two blocks, the second of which (next-to-last block
            of plaintext) may be incomplete.  */
@@ -244,7 +284,7 @@ krb5int_camellia_decrypt(krb5_key key, const krb5_data *ivec,
             memcpy(ivec->data, blockN2, BLOCK_SIZE);
 
         /* Decrypt second last block */
-        dec(tmp2, blockN2, &CACHE(key)->dec_ctx);
+        dec(tmp2, blockN2, ctx);
         /* Set tmp2 to last (possibly partial) plaintext block, and
            save it.  */
         xorblock(tmp2, blockN1);
@@ -254,7 +294,7 @@ krb5int_camellia_decrypt(krb5_key key, const krb5_data *ivec,
            ciphertext block.  */
         input_length %= BLOCK_SIZE;
         memcpy(tmp2, blockN1, input_length ? input_length : BLOCK_SIZE);
-        dec(tmp3, tmp2, &CACHE(key)->dec_ctx);
+        dec(tmp3, tmp2, ctx);
         xorblock(tmp3, tmp);
         memcpy(blockN1, tmp3, BLOCK_SIZE);
 
@@ -268,38 +308,50 @@ krb5int_camellia_decrypt(krb5_key key, const krb5_data *ivec,
     return 0;
 }
 
+/*
+ * Compute the CBC-MAC of the encrypted parts of data, using the cached key
+ * schedule and gathering CBC_BATCH blocks from the iov at a time.  A partial
+ * final block is padded with zeros.
+ */
 krb5_error_code
 krb5int_camellia_cbc_mac(krb5_key key, const krb5_crypto_iov *data,
                          size_t num_data, const krb5_data *iv,
                          krb5_data *output)
 {
-    camellia_ctx ctx;
-    unsigned char blockY[BLOCK_SIZE];
+    camellia_ctx *ctx;
+    unsigned char blockY[BLOCK_SIZE], batch[CBC_BATCH * BLOCK_SIZE];
+    unsigned char *block;
     struct iov_block_state iov_state;
+    size_t i, input_length, nblocks, n;
 
     if (output->length < BLOCK_SIZE)
         return KRB5_BAD_MSIZE;
 
-    if (camellia_enc_key(key->keyblock.contents,
-                         key->keyblock.length, &ctx) != camellia_good)
-        abort();
+    ctx = get_ctx(key);
+    if (ctx == NULL)
+        return ENOMEM;
 
     if (iv != NULL)
         memcpy(blockY, iv->data, BLOCK_SIZE);
     else
         memset(blockY, 0, BLOCK_SIZE);
 
-    IOV_BLOCK_STATE_INIT(&iov_state);
-    for (;;) {
-        unsigned char blockB[BLOCK_SIZE];
-
-        if (!krb5int_c_iov_get_block(blockB, BLOCK_SIZE, data, num_data,
-                                     &iov_state))
-            break;
+    for (i = 0, input_length = 0; i < num_data; i++) {
+        if (ENCRYPT_IOV(&data[i]))
+            input_length += data[i].data.length;
+    }
+    nblocks = (input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-        xorblock(blockB, blockY);
-        if (camellia_enc_blk(blockB, blockY, &ctx) != camellia_good)
-            abort();
+    IOV_BLOCK_STATE_INIT(&iov_state);
+    for (; nblocks > 0; nblocks -= n) {
+        n = (nblocks < CBC_BATCH) ? nblocks : CBC_BATCH;
+        krb5int_c_iov_get_block(batch, n * BLOCK_SIZE, data, num_data,
+                                &iov_state);
+        for (block = batch; block < batch + n * BLOCK_SIZE;
+             block += BLOCK_SIZE) {
+            xorblock(block, blockY);
+            enc(blockY, block, ctx);
+        }
     }
 
     output->length = BLOCK_SIZE;
@@ -320,6 +372,12 @@ camellia_init_state(const krb5_keyblock *key, krb5_keyusage usage,
     return 0;
 }
 
+static void
+camellia_key_cleanup(krb5_key key)
+{
+    zapfree(key->cache, sizeof(struct camellia_key_info_cache));
+}
+
 const struct krb5_enc_provider krb5int_enc_camellia128 = {
     16,
     16, 16,
@@ -328,6 +386,7 @@ const struct krb5_enc_provider krb5int_enc_camellia128 = {
     krb5int_camellia_cbc_mac,
     camellia_init_state,
     krb5int_default_free_state,
+    camellia_key_cleanup
 };
 
 const struct krb5_enc_provider krb5int_enc_camellia256 = {
@@ -337,7 +396,8 @@ const struct krb5_enc_provider krb5int_enc_camellia256 = {
     krb5int_camellia_decrypt,
     krb5int_camellia_cbc_mac,
     camellia_init_state,
-    krb5int_default_free_state
+    krb5int_default_free_state,
+    camellia_key_cleanup
 };
 
 #else /* CAMELLIA */
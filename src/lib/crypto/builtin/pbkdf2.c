@@ -24,8 +24,8 @@
  * or implied warranty.
  */
 
-#include <ctype.h>
 #include "crypto_int.h"
+#include "sha1/shs.h"
 
 /*
  * RFC 2898 specifies PBKDF2 in terms of an underlying pseudo-random
@@ -36,204 +36,194 @@
  * block size; the password is pre-hashed with unkeyed SHA1 if it is
  * longer than the block size.)
  *
- * For efficiency, it is better to generate the key from the password
- * once at the beginning, so we specify prf_fn in terms of a
- * krb5_key first argument.  That might not be convenient for a PRF
- * which uses the password in some other way, so this might need to be
- * adjusted in the future.
+ * Computing the PRF through krb5int_hmac() would hash the padded key
+ * twice and allocate buffers for every iteration.  Instead, the hash
+ * states after the inner and outer padded keys are computed once.  Every
+ * later PRF input is a single hash value, so each iteration then costs
+ * two compression function calls on blocks whose padding is set up in
+ * advance.
+ *
+ * The loop works for any hash with 64-byte blocks, big-endian 32-bit
+ * words, and a digest which fits in one block with its padding, which
+ * includes SHA-256 as well as SHA-1.
  */
 
-typedef krb5_error_code (*prf_fn)(krb5_key pass, krb5_data *salt,
-                                  krb5_data *out);
-
-/* Not exported, for now.  */
-static krb5_error_code
-krb5int_pbkdf2 (prf_fn prf, size_t hlen, krb5_key pass,
-                const krb5_data *salt, unsigned long count,
-                const krb5_data *output);
-
-static int debug_hmac = 0;
-
-static void printd (const char *descr, krb5_data *d) {
-    unsigned int i, j;
-    const int r = 16;
+#define HASH_BLOCKSIZE 64
+#define HASH_BLOCKWORDS (HASH_BLOCKSIZE / 4)
+#define MAX_HASH_WORDS 8
 
-    printf("%s:", descr);
+struct pbkdf2_hash {
+    unsigned int nwords;        /* Digest and state size in 32-bit words */
+    void (*init)(krb5_ui_4 *state);
+    void (*compress)(krb5_ui_4 *state, const krb5_ui_4 *block);
+};
 
-    for (i = 0; i < d->length; i += r) {
-        printf("\n  %04x: ", i);
-        for (j = i; j < i + r && j < d->length; j++)
-            printf(" %02x", 0xff & d->data[j]);
-        for (; j < i + r; j++)
-            printf("   ");
-        printf("   ");
-        for (j = i; j < i + r && j < d->length; j++) {
-            int c = 0xff & d->data[j];
-            printf("%c", isprint(c) ? c : '.');
-        }
-    }
-    printf("\n");
-}
-
-static krb5_error_code
-F(char *output, char *u_tmp1, char *u_tmp2, prf_fn prf, size_t hlen,
-  krb5_key pass, const krb5_data *salt, unsigned long count, int i)
+static void
+sha1_init(krb5_ui_4 *state)
 {
-    unsigned char ibytes[4];
-    size_t tlen;
-    unsigned int j, k;
-    krb5_data sdata;
-    krb5_data out;
-    krb5_error_code err;
+    SHS_INFO ctx;
 
-#if 0
-    printf("F(i=%d, count=%lu, pass=%d:%s)\n", i, count,
-           pass->length, pass->data);
-#endif
+    shsInit(&ctx);
+    memcpy(state, ctx.digest, sizeof(ctx.digest));
+}
 
-    /* Compute U_1.  */
-    store_32_be(i, ibytes);
+static const struct pbkdf2_hash sha1 = {
+    SHS_DIGESTSIZE / 4, sha1_init, SHSTransform
+};
 
-    tlen = salt->length;
-    memcpy(u_tmp2, salt->data, tlen);
-    memcpy(u_tmp2 + tlen, ibytes, 4);
-    tlen += 4;
-    sdata.data = u_tmp2;
-    sdata.length = tlen;
+static void
+load_block(krb5_ui_4 *block, const unsigned char *bytes)
+{
+    int i;
 
-#if 0
-    printd("initial salt", &sdata);
-#endif
+    for (i = 0; i < HASH_BLOCKWORDS; i++)
+        block[i] = load_32_be(bytes + i * 4);
+}
 
-    out.data = u_tmp1;
-    out.length = hlen;
+/* Hash len bytes of data starting from state, which has already absorbed one
+ * block, and apply the final padding.  The digest is left in state. */
+static void
+hash_final(const struct pbkdf2_hash *h, krb5_ui_4 *state,
+           const unsigned char *data, size_t len)
+{
+    unsigned char buf[2 * HASH_BLOCKSIZE];
+    krb5_ui_4 block[HASH_BLOCKWORDS];
+    krb5_ui_8 nbits = ((krb5_ui_8)len + HASH_BLOCKSIZE) * 8;
+    size_t n;
+
+    for (; len >= HASH_BLOCKSIZE; data += HASH_BLOCKSIZE,
+             len -= HASH_BLOCKSIZE) {
+        load_block(block, data);
+        h->compress(state, block);
+    }
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, data, len);
+    buf[len] = 0x80;
+    n = (len < HASH_BLOCKSIZE - 8) ? HASH_BLOCKSIZE : 2 * HASH_BLOCKSIZE;
+    store_64_be(nbits, buf + n - 8);
+    load_block(block, buf);
+    h->compress(state, block);
+    if (n > HASH_BLOCKSIZE) {
+        load_block(block, buf + HASH_BLOCKSIZE);
+        h->compress(state, block);
+    }
+}
 
-#if 0
-    printf("F: computing hmac #1 (U_1) with %s\n", pdata.contents);
-#endif
-    err = (*prf)(pass, &sdata, &out);
-    if (err)
-        return err;
-#if 0
-    printd("F: prf return value", &out);
-#endif
-    memcpy(output, u_tmp1, hlen);
+/* Compute the hash states after the HMAC inner and outer padded keys.  key
+ * must be no longer than the block size. */
+static void
+hmac_states(const struct pbkdf2_hash *h, const krb5_data *key,
+            krb5_ui_4 *istate, krb5_ui_4 *ostate)
+{
+    unsigned char pad[HASH_BLOCKSIZE];
+    krb5_ui_4 block[HASH_BLOCKWORDS];
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    memcpy(pad, key->data, key->length);
+    load_block(block, pad);
+    for (i = 0; i < HASH_BLOCKWORDS; i++)
+        block[i] ^= 0x36363636;
+    h->init(istate);
+    h->compress(istate, block);
+    for (i = 0; i < HASH_BLOCKWORDS; i++)
+        block[i] ^= 0x36363636 ^ 0x5c5c5c5c;
+    h->init(ostate);
+    h->compress(ostate, block);
+    zap(pad, sizeof(pad));
+    zap(block, sizeof(block));
+}
 
-    /* Compute U_2, .. U_c.  */
-    sdata.length = hlen;
+/*
+ * Compute the PBKDF2 block T_i into t, given the HMAC states and the salt
+ * with the block index appended.  block is a padded final block for a
+ * message consisting of one block plus one digest; only its first nwords
+ * words are changed.
+ */
+static void
+F(const struct pbkdf2_hash *h, const krb5_ui_4 *istate,
+  const krb5_ui_4 *ostate, const krb5_data *salt_i, unsigned long count,
+  krb5_ui_4 *block, krb5_ui_4 *t)
+{
+    krb5_ui_4 u[MAX_HASH_WORDS];
+    unsigned long j;
+    unsigned int k, nwords = h->nwords;
+
+    /* U_1 = PRF(P, S || INT(i)) */
+    memcpy(u, istate, nwords * 4);
+    hash_final(h, u, (unsigned char *)salt_i->data, salt_i->length);
+    memcpy(block, u, nwords * 4);
+    memcpy(u, ostate, nwords * 4);
+    h->compress(u, block);
+    memcpy(t, u, nwords * 4);
+
+    /* U_j = PRF(P, U_{j-1}); T_i = U_1 ^ U_2 ^ ... ^ U_c */
     for (j = 2; j <= count; j++) {
-#if 0
-        printf("F: computing hmac #%d (U_%d)\n", j, j);
-#endif
-        memcpy(u_tmp2, u_tmp1, hlen);
-        err = (*prf)(pass, &sdata, &out);
-        if (err)
-            return err;
-#if 0
-        printd("F: prf return value", &out);
-#endif
-        /* And xor them together.  */
-        for (k = 0; k < hlen; k++)
-            output[k] ^= u_tmp1[k];
-#if 0
-        printf("F: xor result:\n");
-        for (k = 0; k < hlen; k++)
-            printf(" %02x", 0xff & output[k]);
-        printf("\n");
-#endif
+        memcpy(block, u, nwords * 4);
+        memcpy(u, istate, nwords * 4);
+        h->compress(u, block);
+        memcpy(block, u, nwords * 4);
+        memcpy(u, ostate, nwords * 4);
+        h->compress(u, block);
+        for (k = 0; k < nwords; k++)
+            t[k] ^= u[k];
     }
-    return 0;
+    zap(u, sizeof(u));
 }
 
 static krb5_error_code
-krb5int_pbkdf2 (prf_fn prf, size_t hlen, krb5_key pass,
-                const krb5_data *salt, unsigned long count,
-                const krb5_data *output)
+pbkdf2(const struct pbkdf2_hash *h, const krb5_data *key,
+       const krb5_data *salt, unsigned long count, const krb5_data *output)
 {
-    int l, i;
-    char *utmp1, *utmp2;
-    char utmp3[20];             /* XXX length shouldn't be hardcoded! */
-
-    if (output->length == 0 || hlen == 0)
-        abort();
-    /* Step 1 & 2.  */
-    if (output->length / hlen > 0xffffffff)
+    krb5_ui_4 istate[MAX_HASH_WORDS], ostate[MAX_HASH_WORDS];
+    krb5_ui_4 block[HASH_BLOCKWORDS], t[MAX_HASH_WORDS];
+    unsigned char tbytes[MAX_HASH_WORDS * 4];
+    unsigned int k, hlen = h->nwords * 4;
+    size_t pos, n;
+    krb5_data salt_i;
+    krb5_ui_4 i;
+
+    if (output->length == 0)
         abort();
-    /* Step 2.  */
-    l = (output->length + hlen - 1) / hlen;
 
-    utmp1 = /*output + dklen; */ malloc(hlen);
-    if (utmp1 == NULL)
-        return ENOMEM;
-    utmp2 = /*utmp1 + hlen; */ malloc(salt->length + 4 + hlen);
-    if (utmp2 == NULL) {
-        free(utmp1);
+    salt_i.length = salt->length + 4;
+    salt_i.data = malloc(salt_i.length);
+    if (salt_i.data == NULL)
         return ENOMEM;
+    memcpy(salt_i.data, salt->data, salt->length);
+
+    hmac_states(h, key, istate, ostate);
+
+    /* Set up the padding for a one-digest message after a key block. */
+    memset(block, 0, sizeof(block));
+    block[h->nwords] = 0x80000000;
+    block[HASH_BLOCKWORDS - 1] = (HASH_BLOCKSIZE + hlen) * 8;
+
+    for (pos = 0, i = 1; pos < output->length; pos += n, i++) {
+        store_32_be(i, salt_i.data + salt->length);
+        F(h, istate, ostate, &salt_i, count, block, t);
+        for (k = 0; k < h->nwords; k++)
+            store_32_be(t[k], tbytes + k * 4);
+        n = output->length - pos;
+        if (n > hlen)
+            n = hlen;
+        memcpy(output->data + pos, tbytes, n);
     }
 
-    /* Step 3.  */
-    for (i = 1; i <= l; i++) {
-#if 0
-        int j;
-#endif
-        krb5_error_code err;
-        char *out;
-
-        if (i == l)
-            out = utmp3;
-        else
-            out = output->data + (i-1) * hlen;
-        err = F(out, utmp1, utmp2, prf, hlen, pass, salt, count, i);
-        if (err) {
-            free(utmp1);
-            free(utmp2);
-            return err;
-        }
-        if (i == l)
-            memcpy(output->data + (i-1) * hlen, utmp3,
-                   output->length - (i-1) * hlen);
-
-#if 0
-        printf("after F(%d), @%p:\n", i, output->data);
-        for (j = (i-1) * hlen; j < i * hlen; j++)
-            printf(" %02x", 0xff & output->data[j]);
-        printf ("\n");
-#endif
-    }
-    free(utmp1);
-    free(utmp2);
+    zap(istate, sizeof(istate));
+    zap(ostate, sizeof(ostate));
+    zap(block, sizeof(block));
+    zap(t, sizeof(t));
+    zap(tbytes, sizeof(tbytes));
+    free(salt_i.data);
     return 0;
 }
 
-/*
- * Implements the hmac-sha1 PRF.  pass has been pre-hashed (if
- * necessary) and converted to a key already; salt has had the block
- * index appended to the original salt.
- */
-static krb5_error_code
-hmac_sha1(krb5_key pass, krb5_data *salt, krb5_data *out)
-{
-    const struct krb5_hash_provider *h = &krb5int_hash_sha1;
-    krb5_error_code err;
-    krb5_crypto_iov iov;
-
-    if (debug_hmac)
-        printd(" hmac input", salt);
-    iov.flags = KRB5_CRYPTO_TYPE_DATA;
-    iov.data = *salt;
-    err = krb5int_hmac(h, pass, &iov, 1, out);
-    if (err == 0 && debug_hmac)
-        printd(" hmac output", out);
-    return err;
-}
-
 krb5_error_code
 krb5int_pbkdf2_hmac_sha1(const krb5_data *out, unsigned long count,
                          const krb5_data *pass, const krb5_data *salt)
 {
     const struct krb5_hash_provider *h = &krb5int_hash_sha1;
-    krb5_keyblock keyblock;
-    krb5_key key;
     char tmp[40];
     krb5_data d;
     krb5_crypto_iov iov;
@@ -247,19 +237,11 @@ krb5int_pbkdf2_hmac_sha1(const krb5_data *out, unsigned long count,
         err = h->hash(&iov, 1, &d);
         if (err)
             return err;
-        keyblock.length = d.length;
-        keyblock.contents = (krb5_octet *) d.data;
     } else {
-        keyblock.length = pass->length;
-        keyblock.contents = (krb5_octet *) pass->data;
+        d = *pass;
     }
-    keyblock.enctype = ENCTYPE_NULL;
-
-    err = krb5_k_create_key(NULL, &keyblock, &key);
-    if (err)
-        return err;
 
-    err = krb5int_pbkdf2(hmac_sha1, 20, key, salt, count, out);
-    krb5_k_free_key(NULL, key);
+    err = pbkdf2(&sha1, &d, salt, count, out);
+    zap(tmp, sizeof(tmp));
     return err;
 }
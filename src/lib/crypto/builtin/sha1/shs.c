@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #endif
 #include <string.h>
+#include <stdlib.h>
 
 /* The SHS f()-functions.  The f1 and f3 functions can be optimized to
    save one boolean operation each - thanks to Rich Schroeppel,
@@ -90,6 +91,225 @@ void shsInit(SHS_INFO *shsInfo)
     shsInfo->countLo = shsInfo->countHi = 0;
 }
 
+#if (defined(__x86_64__) || defined(__i386__)) &&                        \
+    (defined(__clang__) ||                                              \
+     (defined(__GNUC__) &&                                              \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+
+/*
+ * Use the SHA extensions of x86 processors when they are available.  The
+ * code is compiled with a per-function target attribute, and only called
+ * after checking CPUID, so the rest of the library does not depend on the
+ * instruction set.  Setting KRB5_NO_SHANI in the environment disables it, so
+ * that the portable code can be tested on the same machine.
+ */
+
+#define SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHANI __attribute__((target("sha,sse4.1")))
+
+static int
+sha_ni_available(void)
+{
+    static int available = -1;
+    unsigned int eax, ebx, ecx, edx;
+
+    if (available == -1) {
+        /* Require SSE4.1 (leaf 1, ECX bit 19) and SHA (leaf 7, EBX bit
+         * 29). */
+        available = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+            (ecx & (1U << 19)) && __get_cpuid_max(0, NULL) >= 7;
+        if (available) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            available = (ebx & (1U << 29)) &&
+                getenv("KRB5_NO_SHANI") == NULL;
+        }
+    }
+    return available;
+}
+
+/* Load four message words, with the first in the most significant lane as
+ * the SHA-1 instructions expect. */
+static inline SHANI __m128i
+load_words(const SHS_LONG *w)
+{
+    return _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)w), 0x1b);
+}
+
+/* SHSTransform using the SHA-1 instructions, after the Intel white paper
+ * "Intel SHA Extensions". */
+static SHANI void
+SHSTransform_ni(SHS_LONG *digest, const SHS_LONG *data)
+{
+    __m128i abcd, abcd_save, e0, e0_save, e1, m0, m1, m2, m3;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)digest), 0x1b);
+    e0 = _mm_set_epi32(digest[4], 0, 0, 0);
+    abcd_save = abcd;
+    e0_save = e0;
+
+    /* Rounds 0-3 */
+    m0 = load_words(data + 0);
+    e0 = _mm_add_epi32(e0, m0);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+    /* Rounds 4-7 */
+    m1 = load_words(data + 4);
+    e1 = _mm_sha1nexte_epu32(e1, m1);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    m0 = _mm_sha1msg1_epu32(m0, m1);
+
+    /* Rounds 8-11 */
+    m2 = load_words(data + 8);
+    e0 = _mm_sha1nexte_epu32(e0, m2);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    m1 = _mm_sha1msg1_epu32(m1, m2);
+    m0 = _mm_xor_si128(m0, m2);
+
+    /* Rounds 12-15 */
+    m3 = load_words(data + 12);
+    e1 = _mm_sha1nexte_epu32(e1, m3);
+    e0 = abcd;
+    m0 = _mm_sha1msg2_epu32(m0, m3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    m2 = _mm_sha1msg1_epu32(m2, m3);
+    m1 = _mm_xor_si128(m1, m3);
+
+    /* Rounds 16-19 */
+    e0 = _mm_sha1nexte_epu32(e0, m0);
+    e1 = abcd;
+    m1 = _mm_sha1msg2_epu32(m1, m0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    m3 = _mm_sha1msg1_epu32(m3, m0);
+    m2 = _mm_xor_si128(m2, m0);
+
+    /* Rounds 20-23 */
+    e1 = _mm_sha1nexte_epu32(e1, m1);
+    e0 = abcd;
+    m2 = _mm_sha1msg2_epu32(m2, m1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+    m0 = _mm_sha1msg1_epu32(m0, m1);
+    m3 = _mm_xor_si128(m3, m1);
+
+    /* Rounds 24-27 */
+    e0 = _mm_sha1nexte_epu32(e0, m2);
+    e1 = abcd;
+    m3 = _mm_sha1msg2_epu32(m3, m2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+    m1 = _mm_sha1msg1_epu32(m1, m2);
+    m0 = _mm_xor_si128(m0, m2);
+
+    /* Rounds 28-31 */
+    e1 = _mm_sha1nexte_epu32(e1, m3);
+    e0 = abcd;
+    m0 = _mm_sha1msg2_epu32(m0, m3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+    m2 = _mm_sha1msg1_epu32(m2, m3);
+    m1 = _mm_xor_si128(m1, m3);
+
+    /* Rounds 32-35 */
+    e0 = _mm_sha1nexte_epu32(e0, m0);
+    e1 = abcd;
+    m1 = _mm_sha1msg2_epu32(m1, m0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+    m3 = _mm_sha1msg1_epu32(m3, m0);
+    m2 = _mm_xor_si128(m2, m0);
+
+    /* Rounds 36-39 */
+    e1 = _mm_sha1nexte_epu32(e1, m1);
+    e0 = abcd;
+    m2 = _mm_sha1msg2_epu32(m2, m1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+    m0 = _mm_sha1msg1_epu32(m0, m1);
+    m3 = _mm_xor_si128(m3, m1);
+
+    /* Rounds 40-43 */
+    e0 = _mm_sha1nexte_epu32(e0, m2);
+    e1 = abcd;
+    m3 = _mm_sha1msg2_epu32(m3, m2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+    m1 = _mm_sha1msg1_epu32(m1, m2);
+    m0 = _mm_xor_si128(m0, m2);
+
+    /* Rounds 44-47 */
+    e1 = _mm_sha1nexte_epu32(e1, m3);
+    e0 = abcd;
+    m0 = _mm_sha1msg2_epu32(m0, m3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+    m2 = _mm_sha1msg1_epu32(m2, m3);
+    m1 = _mm_xor_si128(m1, m3);
+
+    /* Rounds 48-51 */
+    e0 = _mm_sha1nexte_epu32(e0, m0);
+    e1 = abcd;
+    m1 = _mm_sha1msg2_epu32(m1, m0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+    m3 = _mm_sha1msg1_epu32(m3, m0);
+    m2 = _mm_xor_si128(m2, m0);
+
+    /* Rounds 52-55 */
+    e1 = _mm_sha1nexte_epu32(e1, m1);
+    e0 = abcd;
+    m2 = _mm_sha1msg2_epu32(m2, m1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+    m0 = _mm_sha1msg1_epu32(m0, m1);
+    m3 = _mm_xor_si128(m3, m1);
+
+    /* Rounds 56-59 */
+    e0 = _mm_sha1nexte_epu32(e0, m2);
+    e1 = abcd;
+    m3 = _mm_sha1msg2_epu32(m3, m2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+    m1 = _mm_sha1msg1_epu32(m1, m2);
+    m0 = _mm_xor_si128(m0, m2);
+
+    /* Rounds 60-63 */
+    e1 = _mm_sha1nexte_epu32(e1, m3);
+    e0 = abcd;
+    m0 = _mm_sha1msg2_epu32(m0, m3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    m2 = _mm_sha1msg1_epu32(m2, m3);
+    m1 = _mm_xor_si128(m1, m3);
+
+    /* Rounds 64-67 */
+    e0 = _mm_sha1nexte_epu32(e0, m0);
+    e1 = abcd;
+    m1 = _mm_sha1msg2_epu32(m1, m0);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+    m3 = _mm_sha1msg1_epu32(m3, m0);
+    m2 = _mm_xor_si128(m2, m0);
+
+    /* Rounds 68-71 */
+    e1 = _mm_sha1nexte_epu32(e1, m1);
+    e0 = abcd;
+    m2 = _mm_sha1msg2_epu32(m2, m1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    m3 = _mm_xor_si128(m3, m1);
+
+    /* Rounds 72-75 */
+    e0 = _mm_sha1nexte_epu32(e0, m2);
+    e1 = abcd;
+    m3 = _mm_sha1msg2_epu32(m3, m2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+    /* Rounds 76-79 */
+    e1 = _mm_sha1nexte_epu32(e1, m3);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+    e0 = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+    _mm_storeu_si128((__m128i *)digest, _mm_shuffle_epi32(abcd, 0x1b));
+    digest[4] = _mm_extract_epi32(e0, 3);
+}
+
+#endif /* x86 with SHA extension support */
+
 /* Perform the SHS transformation.  Note that this code, like MD5, seems to
    break some optimizing compilers due to the complexity of the expressions
    and the size of the basic block.  It may be necessary to split it into
@@ -97,14 +317,18 @@ void shsInit(SHS_INFO *shsInfo)
 
    Note that this corrupts the shsInfo->data area */
 
-static void SHSTransform (SHS_LONG *digest, const SHS_LONG *data);
-
-static
 void SHSTransform(SHS_LONG *digest, const SHS_LONG *data)
 {
     SHS_LONG A, B, C, D, E;     /* Local vars */
     SHS_LONG eData[ 16 ];       /* Expanded data */
 
+#ifdef SHA_NI
+    if (sha_ni_available()) {
+        SHSTransform_ni(digest, data);
+        return;
+    }
+#endif
+
     /* Set up first buffer and local data buffer */
     A = digest[ 0 ];
     B = digest[ 1 ];
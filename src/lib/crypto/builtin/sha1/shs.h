@@ -31,6 +31,10 @@ void shsInit(SHS_INFO *shsInfo);
 void shsUpdate(SHS_INFO *shsInfo, const SHS_BYTE *buffer, unsigned int count);
 void shsFinal(SHS_INFO *shsInfo);
 
+/* Apply the compression function to one block of sixteen big-endian words
+ * (shs.c); used by the PBKDF2 implementation. */
+void SHSTransform(SHS_LONG *digest, const SHS_LONG *data);
+
 
 /* Keyed Message digest functions (hmac_sha.c) */
 krb5_error_code hmac_sha(krb5_octet *text,
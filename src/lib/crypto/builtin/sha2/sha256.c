@@ -117,6 +117,222 @@ k5_sha256_init(SHA256_CTX *m)
     H = 0x5be0cd19;
 }
 
+#if (defined(__x86_64__) || defined(__i386__)) &&                        \
+    (defined(__clang__) ||                                              \
+     (defined(__GNUC__) &&                                              \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+
+/*
+ * Use the SHA extensions of x86 processors when they are available, as in
+ * shs.c.  Setting KRB5_NO_SHANI in the environment disables them.
+ */
+
+#define SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHANI __attribute__((target("sha,sse4.1")))
+
+static int
+sha_ni_available(void)
+{
+    static int available = -1;
+    unsigned int eax, ebx, ecx, edx;
+
+    if (available == -1) {
+        /* Require SSE4.1 (leaf 1, ECX bit 19) and SHA (leaf 7, EBX bit
+         * 29). */
+        available = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+            (ecx & (1U << 19)) && __get_cpuid_max(0, NULL) >= 7;
+        if (available) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            available = (ebx & (1U << 29)) &&
+                getenv("KRB5_NO_SHANI") == NULL;
+        }
+    }
+    return available;
+}
+
+static inline SHANI __m128i
+load_k(int i)
+{
+    return _mm_loadu_si128((const __m128i *)(constant_256 + i));
+}
+
+/* calc() using the SHA-256 instructions, after the Intel white paper "Intel
+ * SHA Extensions".  The instructions keep the state as ABEF and CDGH. */
+static SHANI void
+calc_ni(SHA256_CTX *m, const uint32_t *in)
+{
+    __m128i abef, cdgh, abef_save, cdgh_save, msg, tmp, m0, m1, m2, m3;
+
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)&m->counter[0]), 0xb1);
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)&m->counter[4]), 0x1b);
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+    abef_save = abef;
+    cdgh_save = cdgh;
+
+    /* Rounds 0-3 */
+    m0 = _mm_loadu_si128((const __m128i *)(in + 0));
+    msg = _mm_add_epi32(m0, load_k(0));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+
+    /* Rounds 4-7 */
+    m1 = _mm_loadu_si128((const __m128i *)(in + 4));
+    msg = _mm_add_epi32(m1, load_k(4));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+
+    /* Rounds 8-11 */
+    m2 = _mm_loadu_si128((const __m128i *)(in + 8));
+    msg = _mm_add_epi32(m2, load_k(8));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m1 = _mm_sha256msg1_epu32(m1, m2);
+
+    /* Rounds 12-15 */
+    m3 = _mm_loadu_si128((const __m128i *)(in + 12));
+    msg = _mm_add_epi32(m3, load_k(12));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m3, m2, 4);
+    m0 = _mm_add_epi32(m0, tmp);
+    m0 = _mm_sha256msg2_epu32(m0, m3);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m2 = _mm_sha256msg1_epu32(m2, m3);
+
+    /* Rounds 16-19 */
+    msg = _mm_add_epi32(m0, load_k(16));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m0, m3, 4);
+    m1 = _mm_add_epi32(m1, tmp);
+    m1 = _mm_sha256msg2_epu32(m1, m0);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m3 = _mm_sha256msg1_epu32(m3, m0);
+
+    /* Rounds 20-23 */
+    msg = _mm_add_epi32(m1, load_k(20));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m1, m0, 4);
+    m2 = _mm_add_epi32(m2, tmp);
+    m2 = _mm_sha256msg2_epu32(m2, m1);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+
+    /* Rounds 24-27 */
+    msg = _mm_add_epi32(m2, load_k(24));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m2, m1, 4);
+    m3 = _mm_add_epi32(m3, tmp);
+    m3 = _mm_sha256msg2_epu32(m3, m2);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m1 = _mm_sha256msg1_epu32(m1, m2);
+
+    /* Rounds 28-31 */
+    msg = _mm_add_epi32(m3, load_k(28));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m3, m2, 4);
+    m0 = _mm_add_epi32(m0, tmp);
+    m0 = _mm_sha256msg2_epu32(m0, m3);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m2 = _mm_sha256msg1_epu32(m2, m3);
+
+    /* Rounds 32-35 */
+    msg = _mm_add_epi32(m0, load_k(32));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m0, m3, 4);
+    m1 = _mm_add_epi32(m1, tmp);
+    m1 = _mm_sha256msg2_epu32(m1, m0);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m3 = _mm_sha256msg1_epu32(m3, m0);
+
+    /* Rounds 36-39 */
+    msg = _mm_add_epi32(m1, load_k(36));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m1, m0, 4);
+    m2 = _mm_add_epi32(m2, tmp);
+    m2 = _mm_sha256msg2_epu32(m2, m1);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+
+    /* Rounds 40-43 */
+    msg = _mm_add_epi32(m2, load_k(40));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m2, m1, 4);
+    m3 = _mm_add_epi32(m3, tmp);
+    m3 = _mm_sha256msg2_epu32(m3, m2);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m1 = _mm_sha256msg1_epu32(m1, m2);
+
+    /* Rounds 44-47 */
+    msg = _mm_add_epi32(m3, load_k(44));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m3, m2, 4);
+    m0 = _mm_add_epi32(m0, tmp);
+    m0 = _mm_sha256msg2_epu32(m0, m3);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m2 = _mm_sha256msg1_epu32(m2, m3);
+
+    /* Rounds 48-51 */
+    msg = _mm_add_epi32(m0, load_k(48));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m0, m3, 4);
+    m1 = _mm_add_epi32(m1, tmp);
+    m1 = _mm_sha256msg2_epu32(m1, m0);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+    m3 = _mm_sha256msg1_epu32(m3, m0);
+
+    /* Rounds 52-55 */
+    msg = _mm_add_epi32(m1, load_k(52));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m1, m0, 4);
+    m2 = _mm_add_epi32(m2, tmp);
+    m2 = _mm_sha256msg2_epu32(m2, m1);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+
+    /* Rounds 56-59 */
+    msg = _mm_add_epi32(m2, load_k(56));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    tmp = _mm_alignr_epi8(m2, m1, 4);
+    m3 = _mm_add_epi32(m3, tmp);
+    m3 = _mm_sha256msg2_epu32(m3, m2);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+
+    /* Rounds 60-63 */
+    msg = _mm_add_epi32(m3, load_k(60));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+
+    abef = _mm_add_epi32(abef, abef_save);
+    cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    tmp = _mm_shuffle_epi32(abef, 0x1b);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128((__m128i *)&m->counter[0],
+                     _mm_blend_epi16(tmp, cdgh, 0xf0));
+    _mm_storeu_si128((__m128i *)&m->counter[4],
+                     _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+#endif /* x86 with SHA extension support */
+
 static void
 calc(SHA256_CTX *m, uint32_t *in)
 {
@@ -124,6 +340,13 @@ calc(SHA256_CTX *m, uint32_t *in)
     uint32_t data[64];
     int i;
 
+#ifdef SHA_NI
+    if (sha_ni_available()) {
+        calc_ni(m, in);
+        return;
+    }
+#endif
+
     AA = A;
     BB = B;
     CC = C;
@@ -28,7 +28,7 @@
  */
 
 #include <stdio.h>
-#include "k5-int.h"
+#include "crypto_int.h"
 
 #ifdef CAMELLIA
 
@@ -52,6 +52,9 @@ static void enc()
 
     iov.flags = KRB5_CRYPTO_TYPE_DATA;
     iov.data = make_data(plain, 16);
+    /* Set the enctype so that the key's cached schedule is freed. */
+    enc_key.enctype = (enc_key.length == 16) ? ENCTYPE_CAMELLIA128_CTS_CMAC :
+	ENCTYPE_CAMELLIA256_CTS_CMAC;
     krb5_k_create_key(NULL, &enc_key, &k);
     /* cbc-mac is the same as block encryption for a single block. */
     krb5int_camellia_cbc_mac(k, &iov, 1, &ivec, &cdata);
@@ -124,6 +127,60 @@ static void vt_test()
     vt_test_1(32);
 }
 
+/*
+ * Check that a CBC-MAC over a long message split across iovs, which the
+ * provider processes several blocks at a time, matches a chain of
+ * single-block CBC-MACs.  This produces no output unless it fails.
+ */
+static void cbc_mac_test_1(int len)
+{
+    krb5_keyblock kb;
+    krb5_key k;
+    krb5_crypto_iov iov[3];
+    unsigned char msg[1000], block[16], whole[16], chained[16];
+    krb5_data wdata = make_data(whole, 16), cdata = make_data(chained, 16);
+    int i;
+
+    for (i = 0; i < len; i++)
+	key[i] = i * 13 + 1;
+    for (i = 0; i < (int)sizeof(msg); i++)
+	msg[i] = i * 7 + 3;
+    kb.enctype = (len == 16) ? ENCTYPE_CAMELLIA128_CTS_CMAC :
+	ENCTYPE_CAMELLIA256_CTS_CMAC;
+    kb.contents = (unsigned char *)key;
+    kb.length = len;
+    if (krb5_k_create_key(NULL, &kb, &k) != 0)
+	abort();
+
+    iov[0].flags = KRB5_CRYPTO_TYPE_DATA;
+    iov[0].data = make_data(msg, 100);
+    iov[1].flags = KRB5_CRYPTO_TYPE_SIGN_ONLY;
+    iov[1].data = make_data(msg, 16);
+    iov[2].flags = KRB5_CRYPTO_TYPE_DATA;
+    iov[2].data = make_data(msg + 100, sizeof(msg) - 100);
+    if (krb5int_camellia_cbc_mac(k, iov, 3, NULL, &wdata) != 0)
+	abort();
+
+    memset(chained, 0, 16);
+    for (i = 0; i < (int)sizeof(msg); i += 16) {
+	memset(block, 0, 16);
+	memcpy(block, msg + i, (sizeof(msg) - i < 16) ? sizeof(msg) - i : 16);
+	iov[0].data = make_data(block, 16);
+	if (krb5int_camellia_cbc_mac(k, iov, 1, &cdata, &cdata) != 0)
+	    abort();
+    }
+    if (memcmp(whole, chained, 16) != 0) {
+	fprintf(stderr, "CBC-MAC mismatch for %d-bit key\n", len * 8);
+	exit(1);
+    }
+    krb5_k_free_key(NULL, k);
+}
+static void cbc_mac_test()
+{
+    cbc_mac_test_1(16);
+    cbc_mac_test_1(32);
+}
+
 #endif /* CAMELLIA */
 
 int main (int argc, char *argv[])
@@ -136,6 +193,7 @@ int main (int argc, char *argv[])
 		argv[0], argv[0]);
 	return 1;
     }
+    cbc_mac_test();
     init();
     if (argc == 2)
 	vk_test();
@@ -0,0 +1,212 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/crypto_tests/t_batch.c - Test batch encryption and decryption */
+/*
+ * Copyright (C) 2011 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Export of this software from the United States of America may
+ *   require a specific license from the United States Government.
+ *   It is the responsibility of any person or organization contemplating
+ *   export to obtain such a license before exporting.
+ *
+ * WITHIN THAT CONSTRAINT, permission to use, copy, modify, and
+ * distribute this software and its documentation for any purpose and
+ * without fee is hereby granted, provided that the above copyright
+ * notice appear in all copies and that both that copyright notice and
+ * this permission notice appear in supporting documentation, and that
+ * the name of M.I.T. not be used in advertising or publicity pertaining
+ * to distribution of the software without specific, written prior
+ * permission.  Furthermore if you modify this software you must label
+ * your software as modified software and not distribute it in such a
+ * fashion that it might be confused with the original M.I.T. software.
+ * M.I.T. makes no representations about the suitability of
+ * this software for any purpose.  It is provided "as is" without express
+ * or implied warranty.
+ */
+
+/*
+ * This harness checks that krb5_k_encrypt_iov_batch() and
+ * krb5_k_decrypt_iov_batch() interoperate with the single-message functions,
+ * for messages of assorted lengths, and that a corrupted message in a batch
+ * is reported without affecting the others.
+ */
+
+#include "k5-int.h"
+
+static krb5_enctype enctypes[] = {
+    ENCTYPE_DES3_CBC_SHA1,
+    ENCTYPE_ARCFOUR_HMAC,
+    ENCTYPE_AES128_CTS_HMAC_SHA1_96,
+    ENCTYPE_AES256_CTS_HMAC_SHA1_96
+};
+
+/* Plaintext lengths, chosen to cover one block, partial final blocks, and
+ * messages long enough to take several CBC batches. */
+static size_t lengths[] = {
+    0, 1, 15, 16, 17, 31, 32, 33, 100, 255, 256, 1000, 4099
+};
+
+#define NMSGS (sizeof(lengths) / sizeof(*lengths))
+
+struct msg {
+    krb5_crypto_iov iov[4];
+    char *plain;
+    size_t len;
+};
+
+static void
+check(krb5_error_code code)
+{
+    if (code != 0) {
+        com_err("t_batch", code, NULL);
+        abort();
+    }
+}
+
+/* Set up the iovs of m for a plaintext of m->len bytes, filling the data
+ * with plaintext. */
+static void
+init_msg(krb5_context context, krb5_enctype enctype, struct msg *m)
+{
+    unsigned int header, padding, trailer;
+
+    check(krb5_c_crypto_length(context, enctype, KRB5_CRYPTO_TYPE_HEADER,
+                               &header));
+    check(krb5_c_padding_length(context, enctype, m->len, &padding));
+    check(krb5_c_crypto_length(context, enctype, KRB5_CRYPTO_TYPE_TRAILER,
+                               &trailer));
+    m->iov[0].flags = KRB5_CRYPTO_TYPE_HEADER;
+    m->iov[0].data = make_data(malloc(header), header);
+    m->iov[1].flags = KRB5_CRYPTO_TYPE_DATA;
+    m->iov[1].data = make_data(malloc(m->len + 1), m->len);
+    m->iov[2].flags = KRB5_CRYPTO_TYPE_PADDING;
+    m->iov[2].data = make_data(malloc(padding + 1), padding);
+    m->iov[3].flags = KRB5_CRYPTO_TYPE_TRAILER;
+    m->iov[3].data = make_data(malloc(trailer), trailer);
+    assert(m->iov[0].data.data != NULL && m->iov[1].data.data != NULL);
+    assert(m->iov[2].data.data != NULL && m->iov[3].data.data != NULL);
+    memcpy(m->iov[1].data.data, m->plain, m->len);
+}
+
+static void
+free_msg(struct msg *m)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        free(m->iov[i].data.data);
+}
+
+static void
+check_plain(const struct msg *m)
+{
+    if (memcmp(m->iov[1].data.data, m->plain, m->len) != 0) {
+        fprintf(stderr, "Plaintext mismatch for length %lu\n",
+                (unsigned long)m->len);
+        abort();
+    }
+}
+
+static void
+test_enctype(krb5_context context, krb5_enctype enctype)
+{
+    krb5_keyblock kb;
+    krb5_key key;
+    struct msg msgs[NMSGS];
+    krb5_crypto_iov *data[NMSGS];
+    size_t num_data[NMSGS], i, j;
+    krb5_error_code results[NMSGS], ret;
+
+    check(krb5_c_make_random_key(context, enctype, &kb));
+    check(krb5_k_create_key(context, &kb, &key));
+
+    for (i = 0; i < NMSGS; i++) {
+        msgs[i].len = lengths[i];
+        msgs[i].plain = malloc(lengths[i] + 1);
+        assert(msgs[i].plain != NULL);
+        for (j = 0; j < lengths[i]; j++)
+            msgs[i].plain[j] = (char)(i * 7 + j);
+        data[i] = msgs[i].iov;
+        num_data[i] = 4;
+    }
+
+    /* Encrypt as a batch and decrypt one at a time. */
+    for (i = 0; i < NMSGS; i++)
+        init_msg(context, enctype, &msgs[i]);
+    check(krb5_k_encrypt_iov_batch(context, key, 3, data, num_data, NMSGS));
+    for (i = 0; i < NMSGS; i++) {
+        check(krb5_k_decrypt_iov(context, key, 3, NULL, data[i], 4));
+        check_plain(&msgs[i]);
+        free_msg(&msgs[i]);
+    }
+
+    /* Encrypt one at a time and decrypt as a batch. */
+    for (i = 0; i < NMSGS; i++) {
+        init_msg(context, enctype, &msgs[i]);
+        check(krb5_k_encrypt_iov(context, key, 4, NULL, data[i], 4));
+    }
+    check(krb5_k_decrypt_iov_batch(context, key, 4, data, num_data, NMSGS,
+                                   results));
+    for (i = 0; i < NMSGS; i++) {
+        assert(results[i] == 0);
+        check_plain(&msgs[i]);
+        free_msg(&msgs[i]);
+    }
+
+    /* Corrupt one message of a batch; the others must still decrypt. */
+    for (i = 0; i < NMSGS; i++)
+        init_msg(context, enctype, &msgs[i]);
+    check(krb5_k_encrypt_iov_batch(context, key, 5, data, num_data, NMSGS));
+    msgs[NMSGS / 2].iov[0].data.data[0] ^= 1;
+    ret = krb5_k_decrypt_iov_batch(context, key, 5, data, num_data, NMSGS,
+                                   results);
+    assert(ret == KRB5KRB_AP_ERR_BAD_INTEGRITY);
+    for (i = 0; i < NMSGS; i++) {
+        if (i == NMSGS / 2) {
+            assert(results[i] == KRB5KRB_AP_ERR_BAD_INTEGRITY);
+        } else {
+            assert(results[i] == 0);
+            check_plain(&msgs[i]);
+        }
+        free_msg(&msgs[i]);
+    }
+
+    /* A batch of one message, with no results array. */
+    init_msg(context, enctype, &msgs[NMSGS - 1]);
+    check(krb5_k_encrypt_iov_batch(context, key, 6, &data[NMSGS - 1],
+                                   &num_data[NMSGS - 1], 1));
+    check(krb5_k_decrypt_iov_batch(context, key, 6, &data[NMSGS - 1],
+                                   &num_data[NMSGS - 1], 1, NULL));
+    check_plain(&msgs[NMSGS - 1]);
+    free_msg(&msgs[NMSGS - 1]);
+
+    /* A malformed message fails the whole encryption batch, leaving the
+     * messages before it unencrypted. */
+    for (i = 0; i < NMSGS; i++)
+        init_msg(context, enctype, &msgs[i]);
+    msgs[NMSGS - 1].iov[0].data.length = 0;
+    ret = krb5_k_encrypt_iov_batch(context, key, 7, data, num_data, NMSGS);
+    assert(ret == KRB5_BAD_MSIZE);
+    for (i = 0; i < NMSGS - 1; i++)
+        check_plain(&msgs[i]);
+    for (i = 0; i < NMSGS; i++) {
+        free_msg(&msgs[i]);
+        free(msgs[i].plain);
+    }
+
+    krb5_k_free_key(context, key);
+    krb5_free_keyblock_contents(context, &kb);
+}
+
+int
+main(int argc, char **argv)
+{
+    krb5_context context;
+    size_t i;
+
+    check(krb5_init_context(&context));
+    for (i = 0; i < sizeof(enctypes) / sizeof(*enctypes); i++)
+        test_enctype(context, enctypes[i]);
+    krb5_free_context(context);
+    return 0;
+}
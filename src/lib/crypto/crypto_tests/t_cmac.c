@@ -84,6 +84,21 @@ static unsigned char cmac4[] = {
     0x93, 0x9a, 0x8a, 0x4e, 0x19, 0x46, 0x6e, 0xe9
 };
 
+/*
+ * Expected results of CMAC on the first 512 and 1000 bytes of a message whose
+ * byte i has the value (i * 7 + 3) mod 256.  These messages take several
+ * cbc_mac calls in krb5int_cmac_checksum, and were checked against another
+ * Camellia-CMAC implementation.
+ */
+static unsigned char cmac5[] = {
+    0x99, 0xc9, 0xf6, 0xf2, 0x3c, 0xbe, 0x4b, 0x5e,
+    0x60, 0xd8, 0x9b, 0x86, 0xe3, 0x7a, 0xf6, 0x55
+};
+static unsigned char cmac6[] = {
+    0x66, 0x29, 0x7b, 0x6b, 0xc0, 0x08, 0xe3, 0xf8,
+    0x75, 0xc7, 0xb5, 0xf2, 0x4b, 0x4d, 0x23, 0x6a
+};
+
 static void
 check_result(const char *name, const unsigned char *result,
              const unsigned char *expected)
@@ -108,9 +123,10 @@ main(int argc, char **argv)
     krb5_keyblock keyblock;
     krb5_key key;
     const struct krb5_enc_provider *enc = &krb5int_enc_camellia128;
-    krb5_crypto_iov iov;
-    unsigned char resultbuf[16];
+    krb5_crypto_iov iov, iovs[5];
+    unsigned char resultbuf[16], longinput[1000];
     krb5_data result = make_data(resultbuf, 16);
+    size_t i;
 
     /* Create the example key. */
     keyblock.magic = KV5M_KEYBLOCK;
@@ -140,6 +156,33 @@ main(int argc, char **argv)
     assert(krb5int_cmac_checksum(enc, key, &iov, 1, &result) == 0);
     check_result("example 4", resultbuf, cmac4);
 
+    /* Example 5: a long message whose last block is complete. */
+    for (i = 0; i < sizeof(longinput); i++)
+        longinput[i] = i * 7 + 3;
+    iov.data = make_data(longinput, 512);
+    assert(krb5int_cmac_checksum(enc, key, &iov, 1, &result) == 0);
+    check_result("example 5", resultbuf, cmac5);
+
+    /* Example 6: a long message ending in a partial block. */
+    iov.data.length = 1000;
+    assert(krb5int_cmac_checksum(enc, key, &iov, 1, &result) == 0);
+    check_result("example 6", resultbuf, cmac6);
+
+    /* Example 6 again, split across iovs of odd lengths.  The trailer must be
+     * ignored. */
+    iovs[0].flags = KRB5_CRYPTO_TYPE_SIGN_ONLY;
+    iovs[0].data = make_data(longinput, 5);
+    iovs[1].flags = KRB5_CRYPTO_TYPE_DATA;
+    iovs[1].data = make_data(longinput + 5, 300);
+    iovs[2].flags = KRB5_CRYPTO_TYPE_TRAILER;
+    iovs[2].data = make_data(input, 16);
+    iovs[3].flags = KRB5_CRYPTO_TYPE_SIGN_ONLY;
+    iovs[3].data = make_data(longinput + 305, 17);
+    iovs[4].flags = KRB5_CRYPTO_TYPE_DATA;
+    iovs[4].data = make_data(longinput + 322, 678);
+    assert(krb5int_cmac_checksum(enc, key, iovs, 5, &result) == 0);
+    check_result("example 6 with iovs", resultbuf, cmac6);
+
     printf("All CMAC tests passed.\n");
     krb5_k_free_key(context, key);
 #endif /* CAMELLIA */
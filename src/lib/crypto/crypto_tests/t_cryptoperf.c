@@ -0,0 +1,400 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/crypto_tests/t_cryptoperf.c - Benchmark of crypto operations */
+/*
+ * Copyright (C) 2011 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Export of this software from the United States of America may
+ *   require a specific license from the United States Government.
+ *   It is the responsibility of any person or organization contemplating
+ *   export to obtain such a license before exporting.
+ *
+ * WITHIN THAT CONSTRAINT, permission to use, copy, modify, and
+ * distribute this software and its documentation for any purpose and
+ * without fee is hereby granted, provided that the above copyright
+ * notice appear in all copies and that both that copyright notice and
+ * this permission notice appear in supporting documentation, and that
+ * the name of M.I.T. not be used in advertising or publicity pertaining
+ * to distribution of the software without specific, written prior
+ * permission.  Furthermore if you modify this software you must label
+ * your software as modified software and not distribute it in such a
+ * fashion that it might be confused with the original M.I.T. software.
+ * M.I.T. makes no representations about the suitability of
+ * this software for any purpose.  It is provided "as is" without express
+ * or implied warranty.
+ */
+
+/*
+ * This program measures the speed of the crypto operations of every
+ * supported enctype, at a range of message sizes, through both the krb5_c
+ * APIs (which take a keyblock and derive keys on every call) and the krb5_k
+ * APIs (which cache derived keys).  It uses only the public library
+ * interface, so it can be built against each crypto back end to compare
+ * them.  Usage:
+ *
+ *     ./t_cryptoperf [-e enctype] [-o op] [-s size,...] [-t msecs]
+ *
+ * Each operation is repeated until it has run for at least msecs
+ * milliseconds (default 200).  The results are printed as tab-separated
+ * lines with the fields enctype, op, api (c or k), size, ns/op, and MB/s.
+ * Operations which do not depend on a message size (string_to_key and
+ * derive, which uses KRB-FX-CF2) report a size of 0 and no throughput.
+ */
+
+#include "k5-int.h"
+#include <sys/time.h>
+
+#ifndef CRYPTO_IMPL
+#define CRYPTO_IMPL "unknown"
+#endif
+
+#define DEFAULT_SIZES "16,64,1024,8192,65536"
+#define DEFAULT_MSECS 200
+#define USAGE 1
+
+struct state {
+    krb5_enctype enctype;
+    krb5_cksumtype cktype;
+    krb5_keyblock kblock;
+    krb5_key key;
+    size_t size;
+    krb5_data plain;
+    krb5_data decrypted;
+    krb5_enc_data cipher;
+    krb5_crypto_iov iov[4];
+    krb5_checksum sum;
+    krb5_data prf_out;
+};
+
+typedef krb5_error_code (*op_fn)(struct state *st, int use_k);
+
+static krb5_error_code
+op_encrypt(struct state *st, int use_k)
+{
+    if (use_k)
+        return krb5_k_encrypt(NULL, st->key, 0, NULL, &st->plain, &st->cipher);
+    return krb5_c_encrypt(NULL, &st->kblock, 0, NULL, &st->plain, &st->cipher);
+}
+
+static krb5_error_code
+op_decrypt(struct state *st, int use_k)
+{
+    st->decrypted.length = st->cipher.ciphertext.length;
+    if (use_k) {
+        return krb5_k_decrypt(NULL, st->key, 0, NULL, &st->cipher,
+                              &st->decrypted);
+    }
+    return krb5_c_decrypt(NULL, &st->kblock, 0, NULL, &st->cipher,
+                          &st->decrypted);
+}
+
+static krb5_error_code
+op_encrypt_iov(struct state *st, int use_k)
+{
+    if (use_k)
+        return krb5_k_encrypt_iov(NULL, st->key, 0, NULL, st->iov, 4);
+    return krb5_c_encrypt_iov(NULL, &st->kblock, 0, NULL, st->iov, 4);
+}
+
+static krb5_error_code
+op_make_checksum(struct state *st, int use_k)
+{
+    krb5_error_code ret;
+    krb5_checksum sum;
+
+    if (use_k) {
+        ret = krb5_k_make_checksum(NULL, st->cktype, st->key, 0, &st->plain,
+                                   &sum);
+    } else {
+        ret = krb5_c_make_checksum(NULL, st->cktype, &st->kblock, 0,
+                                   &st->plain, &sum);
+    }
+    if (ret == 0)
+        krb5_free_checksum_contents(NULL, &sum);
+    return ret;
+}
+
+static krb5_error_code
+op_verify_checksum(struct state *st, int use_k)
+{
+    krb5_error_code ret;
+    krb5_boolean valid;
+
+    if (use_k) {
+        ret = krb5_k_verify_checksum(NULL, st->key, 0, &st->plain, &st->sum,
+                                     &valid);
+    } else {
+        ret = krb5_c_verify_checksum(NULL, &st->kblock, 0, &st->plain,
+                                     &st->sum, &valid);
+    }
+    if (ret == 0 && !valid)
+        ret = KRB5KRB_AP_ERR_BAD_INTEGRITY;
+    return ret;
+}
+
+static krb5_error_code
+op_prf(struct state *st, int use_k)
+{
+    if (use_k)
+        return krb5_k_prf(NULL, st->key, &st->plain, &st->prf_out);
+    return krb5_c_prf(NULL, &st->kblock, &st->plain, &st->prf_out);
+}
+
+static krb5_error_code
+op_string_to_key(struct state *st, int use_k)
+{
+    krb5_data pw = string2data("a password"), salt = string2data("SALT");
+    krb5_keyblock kb;
+    krb5_error_code ret;
+
+    ret = krb5_c_string_to_key(NULL, st->enctype, &pw, &salt, &kb);
+    if (ret == 0)
+        krb5_free_keyblock_contents(NULL, &kb);
+    return ret;
+}
+
+static krb5_error_code
+op_derive(struct state *st, int use_k)
+{
+    krb5_keyblock *out;
+    krb5_error_code ret;
+
+    ret = krb5_c_fx_cf2_simple(NULL, &st->kblock, "a", &st->kblock, "b",
+                               &out);
+    if (ret == 0)
+        krb5_free_keyblock(NULL, out);
+    return ret;
+}
+
+static const struct {
+    const char *name;
+    op_fn fn;
+    int sized;                  /* Depends on the message size */
+    int has_k;                  /* Has a krb5_k variant */
+} ops[] = {
+    { "encrypt", op_encrypt, 1, 1 },
+    { "decrypt", op_decrypt, 1, 1 },
+    { "encrypt_iov", op_encrypt_iov, 1, 1 },
+    { "make_checksum", op_make_checksum, 1, 1 },
+    { "verify_checksum", op_verify_checksum, 1, 1 },
+    { "prf", op_prf, 1, 1 },
+    { "string_to_key", op_string_to_key, 0, 0 },
+    { "derive", op_derive, 0, 0 }
+};
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Run fn until it has taken at least min_secs, and return the time per call
+ * in seconds, or a negative value if it fails. */
+static double
+time_op(op_fn fn, struct state *st, int use_k, double min_secs)
+{
+    unsigned long n = 1, i;
+    double start, elapsed;
+
+    if (fn(st, use_k) != 0)
+        return -1;
+    for (;;) {
+        start = now();
+        for (i = 0; i < n; i++) {
+            if (fn(st, use_k) != 0)
+                return -1;
+        }
+        elapsed = now() - start;
+        if (elapsed >= min_secs)
+            return elapsed / n;
+        /* Aim for the minimum time on the next round. */
+        if (elapsed < min_secs / 100)
+            n *= 100;
+        else
+            n = n * (min_secs * 1.2 / elapsed) + 1;
+    }
+}
+
+static void
+free_state(struct state *st)
+{
+    krb5_k_free_key(NULL, st->key);
+    krb5_free_keyblock_contents(NULL, &st->kblock);
+    free(st->plain.data);
+    free(st->decrypted.data);
+    free(st->cipher.ciphertext.data);
+    free(st->iov[0].data.data);
+    free(st->iov[1].data.data);
+    free(st->iov[2].data.data);
+    free(st->iov[3].data.data);
+    krb5_free_checksum_contents(NULL, &st->sum);
+    free(st->prf_out.data);
+    memset(st, 0, sizeof(*st));
+}
+
+/* Set up the keys and buffers for messages of the given size.  Operations
+ * which are not supported by the enctype will fail when timed. */
+static krb5_error_code
+init_state(struct state *st, krb5_enctype enctype, size_t size)
+{
+    krb5_error_code ret;
+    size_t len;
+    unsigned int hlen, plen, tlen;
+
+    memset(st, 0, sizeof(*st));
+    st->enctype = enctype;
+    st->size = size;
+    ret = krb5_c_make_random_key(NULL, enctype, &st->kblock);
+    if (ret)
+        return ret;
+    ret = krb5_k_create_key(NULL, &st->kblock, &st->key);
+    if (ret)
+        return ret;
+
+    ret = alloc_data(&st->plain, size);
+    if (ret)
+        return ret;
+    ret = krb5_c_encrypt_length(NULL, enctype, size, &len);
+    if (ret)
+        return ret;
+    st->cipher.enctype = enctype;
+    ret = alloc_data(&st->cipher.ciphertext, len);
+    if (!ret)
+        ret = alloc_data(&st->decrypted, len);
+    if (ret)
+        return ret;
+    (void)krb5_c_encrypt(NULL, &st->kblock, 0, NULL, &st->plain, &st->cipher);
+
+    if (krb5_c_crypto_length(NULL, enctype, KRB5_CRYPTO_TYPE_HEADER,
+                             &hlen) == 0 &&
+        krb5_c_padding_length(NULL, enctype, size, &plen) == 0 &&
+        krb5_c_crypto_length(NULL, enctype, KRB5_CRYPTO_TYPE_TRAILER,
+                             &tlen) == 0) {
+        st->iov[0].flags = KRB5_CRYPTO_TYPE_HEADER;
+        st->iov[1].flags = KRB5_CRYPTO_TYPE_DATA;
+        st->iov[2].flags = KRB5_CRYPTO_TYPE_PADDING;
+        st->iov[3].flags = KRB5_CRYPTO_TYPE_TRAILER;
+        if (alloc_data(&st->iov[0].data, hlen) ||
+            alloc_data(&st->iov[1].data, size) ||
+            alloc_data(&st->iov[2].data, plen) ||
+            alloc_data(&st->iov[3].data, tlen))
+            return ENOMEM;
+    }
+
+    if (krb5int_c_mandatory_cksumtype(NULL, enctype, &st->cktype) == 0) {
+        (void)krb5_c_make_checksum(NULL, st->cktype, &st->kblock, 0,
+                                   &st->plain, &st->sum);
+    }
+
+    if (krb5_c_prf_length(NULL, enctype, &len) == 0) {
+        ret = alloc_data(&st->prf_out, len);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+static void
+report(const char *ename, const char *opname, char api, size_t size,
+       double secs)
+{
+    printf("%s\t%s\t%c\t%lu\t%.1f\t", ename, opname, api,
+           (unsigned long)size, secs * 1e9);
+    if (size > 0)
+        printf("%.2f\n", size / secs / 1e6);
+    else
+        printf("-\n");
+}
+
+/* Run the selected operations for one enctype and message size. */
+static void
+run(krb5_enctype enctype, size_t size, const char *only_op, int sized,
+    double min_secs)
+{
+    struct state st;
+    char ename[64];
+    double secs;
+    unsigned int i;
+    int use_k;
+
+    if (krb5_enctype_to_name(enctype, FALSE, ename, sizeof(ename)) != 0)
+        snprintf(ename, sizeof(ename), "%d", (int)enctype);
+    if (init_state(&st, enctype, size) != 0) {
+        fprintf(stderr, "%s: could not set up state\n", ename);
+        free_state(&st);
+        return;
+    }
+    for (i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+        if (ops[i].sized != sized)
+            continue;
+        if (only_op != NULL && strcmp(only_op, ops[i].name) != 0)
+            continue;
+        for (use_k = 0; use_k <= ops[i].has_k; use_k++) {
+            secs = time_op(ops[i].fn, &st, use_k, min_secs);
+            if (secs >= 0) {
+                report(ename, ops[i].name, use_k ? 'k' : 'c',
+                       sized ? size : 0, secs);
+            }
+        }
+        fflush(stdout);
+    }
+    free_state(&st);
+}
+
+static int
+usage(void)
+{
+    fprintf(stderr, "Usage: t_cryptoperf [-e enctype] [-o op] "
+            "[-s size,...] [-t msecs]\n");
+    return USAGE;
+}
+
+int
+main(int argc, char **argv)
+{
+    krb5_enctype enctype, only_enctype = ENCTYPE_NULL;
+    const char *only_op = NULL, *sizes = DEFAULT_SIZES, *p;
+    double min_secs = DEFAULT_MSECS / 1000.0;
+    krb5_data seed = string2data("notrandom");
+    int c;
+
+    while ((c = getopt(argc, argv, "e:o:s:t:")) != -1) {
+        switch (c) {
+        case 'e':
+            if (krb5_string_to_enctype(optarg, &only_enctype) != 0)
+                return usage();
+            break;
+        case 'o':
+            only_op = optarg;
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        case 't':
+            min_secs = atoi(optarg) / 1000.0;
+            break;
+        default:
+            return usage();
+        }
+    }
+    if (optind != argc)
+        return usage();
+
+    krb5_c_random_seed(NULL, &seed);
+    printf("# backend: %s\n", CRYPTO_IMPL);
+    printf("# enctype\top\tapi\tsize\tns/op\tMB/s\n");
+    for (enctype = 1; enctype < 256; enctype++) {
+        if (!krb5_c_valid_enctype(enctype))
+            continue;
+        if (only_enctype != ENCTYPE_NULL && enctype != only_enctype)
+            continue;
+        for (p = sizes; *p != '\0'; p += strcspn(p, ","), p += (*p == ',')) {
+            run(enctype, strtoul(p, NULL, 10), only_op, 1, min_secs);
+        }
+        run(enctype, 0, only_op, 0, min_secs);
+    }
+    return 0;
+}
@@ -239,6 +239,67 @@ get_enc_provider(krb5_enctype enctype)
     abort();
 }
 
+/*
+ * Derive keys for more constants than the derived key cache holds, twice over,
+ * and check that the results match keys derived from a fresh key and that the
+ * cache's hit and eviction counts are consistent.
+ */
+static int
+test_cache(void)
+{
+    krb5_keyblock kb;
+    krb5_key inkey, freshkey, outkey, freshout;
+    const struct krb5_enc_provider *enc = &krb5int_enc_aes128;
+    unsigned char cbuf[5];
+    krb5_data constant = make_data(cbuf, sizeof(cbuf));
+    unsigned long hits, misses, evictions;
+    int pass, usage, status = 0;
+
+    kb.magic = KV5M_KEYBLOCK;
+    kb.enctype = ENCTYPE_AES128_CTS_HMAC_SHA1_96;
+    kb.length = 16;
+    kb.contents = (unsigned char *)"0123456789abcdef";
+    assert(krb5_k_create_key(NULL, &kb, &inkey) == 0);
+    for (pass = 0; pass < 2; pass++) {
+        for (usage = 0; usage < 2 * DERIVED_KEY_CACHE_SIZE; usage++) {
+            store_32_be(usage, cbuf);
+            cbuf[4] = 0x99;
+            assert(krb5int_derive_key(enc, inkey, &outkey, &constant,
+                                      DERIVE_RFC3961) == 0);
+            assert(krb5_k_create_key(NULL, &kb, &freshkey) == 0);
+            assert(krb5int_derive_key(enc, freshkey, &freshout, &constant,
+                                      DERIVE_RFC3961) == 0);
+            if (memcmp(outkey->keyblock.contents, freshout->keyblock.contents,
+                       freshout->keyblock.length) != 0) {
+                printf("cached derived key for usage %d differs\n", usage);
+                status = 1;
+            }
+            krb5_k_free_key(NULL, freshout);
+            krb5_k_free_key(NULL, freshkey);
+            krb5_k_free_key(NULL, outkey);
+
+            /* Derive again; this must be a cache hit. */
+            krb5int_c_derived_key_stats(inkey, &hits, &misses, &evictions);
+            assert(krb5int_derive_key(enc, inkey, &outkey, &constant,
+                                      DERIVE_RFC3961) == 0);
+            krb5_k_free_key(NULL, outkey);
+            if (inkey->derived->hits != hits + 1) {
+                printf("derived key for usage %d not cached\n", usage);
+                status = 1;
+            }
+        }
+    }
+    krb5int_c_derived_key_stats(inkey, &hits, &misses, &evictions);
+    if (hits + misses != 8 * DERIVED_KEY_CACHE_SIZE ||
+        misses - evictions > DERIVED_KEY_CACHE_SIZE) {
+        printf("derived key cache counts are wrong: %lu hits, %lu misses, "
+               "%lu evictions\n", hits, misses, evictions);
+        status = 1;
+    }
+    krb5_k_free_key(NULL, inkey);
+    return status;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -285,5 +346,7 @@ main(int argc, char **argv)
         krb5_k_free_key(context, inkey);
         krb5_k_free_key(context, outkey);
     }
+    if (test_cache() != 0)
+        status = 1;
     return status;
 }
@@ -95,6 +95,7 @@ main ()
 {
     krb5_context context = 0;
     krb5_data  in, in2, out, out2, check, check2, state, signdata;
+    krb5_data inplace, plain;
     krb5_crypto_iov iov[5];
     int i, j, pos;
     unsigned int dummy;
@@ -186,6 +187,31 @@ main ()
             test("Comparing results",
                  compare_results(&in, &iov[1].data));
 
+            /* Encrypt in place after room for the header and decrypt with
+             * the copying variant, then decrypt the earlier ciphertext in
+             * place. */
+            memset(out2.data, 0, out2.length);
+            memcpy(out2.data + dummy, in.data, in.length);
+            enc_out2.ciphertext = out2;
+            test("Encrypting in place",
+                 krb5_k_encrypt_inplace(context, key, 7, 0,
+                                        &enc_out2.ciphertext, in.length));
+            assert(enc_out2.ciphertext.length == len);
+            enc_out2.enctype = keyblock->enctype;
+            test("Decrypting",
+                 krb5_k_decrypt(context, key, 7, 0, &enc_out2, &check2));
+            test("Comparing", compare_results(&in, &check2));
+            check2.length = 2048;
+            memcpy(out2.data, enc_out.ciphertext.data,
+                   enc_out.ciphertext.length);
+            inplace = make_data(out2.data, enc_out.ciphertext.length);
+            test("Decrypting in place",
+                 krb5_k_decrypt_inplace(context, key, 7, 0, &inplace,
+                                        &plain));
+            test("Comparing", compare_results(&in, &plain));
+            assert(plain.data == out2.data + dummy);
+            enc_out2.ciphertext = out2;
+
             /* Set up iovecs for AEAD encryption. */
             signdata.magic = KV5M_DATA;
             signdata.data = (char *) "This should be signed";
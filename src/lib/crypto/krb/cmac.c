@@ -45,6 +45,9 @@
 
 #define BLOCK_SIZE 16
 
+/* The number of blocks gathered from the input for each cbc_mac call. */
+#define CMAC_BATCH 16
+
 static unsigned char const_Rb[BLOCK_SIZE] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x87
@@ -144,8 +147,8 @@ krb5int_cmac_checksum(const struct krb5_enc_provider *enc, krb5_key key,
 {
     unsigned char Y[BLOCK_SIZE], M_last[BLOCK_SIZE], padded[BLOCK_SIZE];
     unsigned char K1[BLOCK_SIZE], K2[BLOCK_SIZE];
-    unsigned char input[BLOCK_SIZE];
-    unsigned int n, i, flag;
+    unsigned char input[CMAC_BATCH * BLOCK_SIZE];
+    unsigned int n, i, nb, flag;
     krb5_error_code ret;
     struct iov_block_state iov_state;
     unsigned int length;
@@ -181,18 +184,21 @@ krb5int_cmac_checksum(const struct krb5_enc_provider *enc, krb5_key key,
     }
 
     iov[0].flags = KRB5_CRYPTO_TYPE_DATA;
-    iov[0].data = make_data(input, BLOCK_SIZE);
 
     /* Step 5 (we'll do step 4 in a bit). */
     memset(Y, 0, BLOCK_SIZE);
     d = make_data(Y, BLOCK_SIZE);
 
-    /* Step 6 (all but last block). */
+    /* Step 6 (all but last block), passing runs of up to CMAC_BATCH blocks
+     * to each cbc_mac call. */
     IOV_BLOCK_STATE_INIT(&iov_state);
     iov_state.include_sign_only = 1;
-    for (i = 0; i < n - 1; i++) {
-        krb5int_c_iov_get_block(input, BLOCK_SIZE, data, num_data, &iov_state);
+    for (i = 0; i < n - 1; i += nb) {
+        nb = (n - 1 - i < CMAC_BATCH) ? n - 1 - i : CMAC_BATCH;
+        krb5int_c_iov_get_block(input, nb * BLOCK_SIZE, data, num_data,
+                                &iov_state);
 
+        iov[0].data = make_data(input, nb * BLOCK_SIZE);
         ret = enc->cbc_mac(key, iov, 1, &d, &d);
         if (ret != 0)
             return ret;
@@ -58,6 +58,17 @@ struct krb5_enc_provider {
 
     /* May be NULL if there is no key-derived data cached.  */
     void (*key_cleanup)(krb5_key key);
+
+    /*
+     * May be NULL if the cipher cannot process several messages faster than
+     * one at a time.  Encrypt or decrypt count independent messages, the ith
+     * of which is the iov array data[i] of size num_data[i], as encrypt or
+     * decrypt would with a null cipher state.
+     */
+    krb5_error_code (*encrypt_batch)(krb5_key key, krb5_crypto_iov **data,
+                                     const size_t *num_data, size_t count);
+    krb5_error_code (*decrypt_batch)(krb5_key key, krb5_crypto_iov **data,
+                                     const size_t *num_data, size_t count);
 };
 
 struct krb5_hash_provider {
@@ -82,6 +93,16 @@ typedef krb5_error_code (*crypt_func)(const struct krb5_keytypes *ktp,
                                       const krb5_data *ivec,
                                       krb5_crypto_iov *data, size_t num_data);
 
+/* Encrypt or decrypt count independent messages with a null cipher state.
+ * When decrypting, the result for each message is stored in results. */
+typedef krb5_error_code (*crypt_batch_func)(const struct krb5_keytypes *ktp,
+                                            krb5_key key,
+                                            krb5_keyusage keyusage,
+                                            krb5_crypto_iov **data,
+                                            const size_t *num_data,
+                                            size_t count,
+                                            krb5_error_code *results);
+
 typedef krb5_error_code (*str2key_func)(const struct krb5_keytypes *ktp,
                                         const krb5_data *string,
                                         const krb5_data *salt,
@@ -111,6 +132,10 @@ struct krb5_keytypes {
     prf_func prf;
     krb5_cksumtype required_ctype;
     krb5_flags flags;
+
+    /* May be NULL, in which case messages are processed one at a time. */
+    crypt_batch_func encrypt_batch;
+    crypt_batch_func decrypt_batch;
 };
 
 #define ETYPE_WEAK 1
@@ -203,6 +228,11 @@ krb5_error_code krb5int_dk_encrypt(const struct krb5_keytypes *ktp,
                                    krb5_key key, krb5_keyusage usage,
                                    const krb5_data *ivec,
                                    krb5_crypto_iov *data, size_t num_data);
+krb5_error_code krb5int_dk_encrypt_batch(const struct krb5_keytypes *ktp,
+                                         krb5_key key, krb5_keyusage usage,
+                                         krb5_crypto_iov **data,
+                                         const size_t *num_data, size_t count,
+                                         krb5_error_code *results);
 krb5_error_code krb5int_dk_cmac_encrypt(const struct krb5_keytypes *ktp,
                                         krb5_key key, krb5_keyusage usage,
                                         const krb5_data *ivec,
@@ -227,6 +257,11 @@ krb5_error_code krb5int_dk_decrypt(const struct krb5_keytypes *ktp,
                                    krb5_key key, krb5_keyusage usage,
                                    const krb5_data *ivec,
                                    krb5_crypto_iov *data, size_t num_data);
+krb5_error_code krb5int_dk_decrypt_batch(const struct krb5_keytypes *ktp,
+                                         krb5_key key, krb5_keyusage usage,
+                                         krb5_crypto_iov **data,
+                                         const size_t *num_data, size_t count,
+                                         krb5_error_code *results);
 krb5_error_code krb5int_dk_cmac_decrypt(const struct krb5_keytypes *ktp,
                                         krb5_key key, krb5_keyusage usage,
                                         const krb5_data *ivec,
@@ -340,6 +375,7 @@ krb5_error_code krb5int_derive_random(const struct krb5_enc_provider *enc,
                                       krb5_key inkey, krb5_data *outrnd,
                                       const krb5_data *in_constant,
                                       enum deriv_alg alg);
+void krb5int_c_free_derived_keys(krb5_key key);
 
 /*** Miscellaneous prototypes ***/
 
@@ -84,6 +84,48 @@ krb5_k_decrypt(krb5_context context, krb5_key key,
     return ret;
 }
 
+krb5_error_code KRB5_CALLCONV
+krb5_k_decrypt_inplace(krb5_context context, krb5_key key,
+                       krb5_keyusage usage, const krb5_data *cipher_state,
+                       krb5_data *buffer, krb5_data *output)
+{
+    const struct krb5_keytypes *ktp;
+    krb5_crypto_iov iov[4];
+    krb5_error_code ret;
+    unsigned int header_len, trailer_len, plain_len;
+
+    ktp = find_enctype(key->keyblock.enctype);
+    if (ktp == NULL)
+        return KRB5_BAD_ENCTYPE;
+
+    header_len = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_HEADER);
+    trailer_len = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_TRAILER);
+    if (buffer->length < header_len + trailer_len)
+        return KRB5_BAD_MSIZE;
+    plain_len = buffer->length - header_len - trailer_len;
+
+    iov[0].flags = KRB5_CRYPTO_TYPE_HEADER;
+    iov[0].data = make_data(buffer->data, header_len);
+
+    iov[1].flags = KRB5_CRYPTO_TYPE_DATA;
+    iov[1].data = make_data(buffer->data + header_len, plain_len);
+
+    /* Use empty padding since tokens don't indicate the padding length. */
+    iov[2].flags = KRB5_CRYPTO_TYPE_PADDING;
+    iov[2].data = empty_data();
+
+    iov[3].flags = KRB5_CRYPTO_TYPE_TRAILER;
+    iov[3].data = make_data(buffer->data + header_len + plain_len,
+                            trailer_len);
+
+    ret = ktp->decrypt(ktp, key, usage, cipher_state, iov, 4);
+    if (ret != 0)
+        zap(iov[1].data.data, plain_len);
+    else
+        *output = iov[1].data;
+    return ret;
+}
+
 krb5_error_code KRB5_CALLCONV
 krb5_c_decrypt(krb5_context context, const krb5_keyblock *keyblock,
                krb5_keyusage usage, const krb5_data *cipher_state,
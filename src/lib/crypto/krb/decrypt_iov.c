@@ -46,6 +46,51 @@ krb5_k_decrypt_iov(krb5_context context, krb5_key key, krb5_keyusage usage,
     return ktp->decrypt(ktp, key, usage, cipher_state, data, num_data);
 }
 
+krb5_error_code KRB5_CALLCONV
+krb5_k_decrypt_iov_batch(krb5_context context, krb5_key key,
+                         krb5_keyusage usage, krb5_crypto_iov **data,
+                         const size_t *num_data, size_t count,
+                         krb5_error_code *results)
+{
+    const struct krb5_keytypes *ktp;
+    krb5_error_code ret, first = 0, *res = results;
+    krb5_boolean stream = FALSE;
+    size_t i;
+
+    ktp = find_enctype(key->keyblock.enctype);
+    if (ktp == NULL)
+        return KRB5_BAD_ENCTYPE;
+
+    for (i = 0; i < count; i++) {
+        if (krb5int_c_locate_iov(data[i], num_data[i],
+                                 KRB5_CRYPTO_TYPE_STREAM) != NULL)
+            stream = TRUE;
+    }
+
+    /* Decrypt one message at a time if the enctype cannot do better. */
+    if (ktp->decrypt_batch == NULL || stream) {
+        for (i = 0; i < count; i++) {
+            ret = krb5_k_decrypt_iov(context, key, usage, NULL, data[i],
+                                     num_data[i]);
+            if (results != NULL)
+                results[i] = ret;
+            if (first == 0)
+                first = ret;
+        }
+        return first;
+    }
+
+    if (res == NULL) {
+        res = k5alloc(count * sizeof(*res), &ret);
+        if (res == NULL)
+            return ret;
+    }
+    ret = ktp->decrypt_batch(ktp, key, usage, data, num_data, count, res);
+    if (res != results)
+        free(res);
+    return ret;
+}
+
 krb5_error_code KRB5_CALLCONV
 krb5_c_decrypt_iov(krb5_context context, const krb5_keyblock *keyblock,
                    krb5_keyusage usage, const krb5_data *cipher_state,
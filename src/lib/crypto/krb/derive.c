@@ -27,55 +27,123 @@
 
 #include "crypto_int.h"
 
+/* A derivation constant is cached in one of the PROBE_SLOTS slots starting at
+ * its hash position. */
+#define PROBE_SLOTS 4
+
+/* FNV-1a hash of a derivation constant. */
+static unsigned int
+hash_constant(const krb5_data *constant)
+{
+    unsigned int h = 2166136261U;
+    unsigned int i;
+
+    for (i = 0; i < constant->length; i++)
+        h = (h ^ (unsigned char)constant->data[i]) * 16777619U;
+    return h;
+}
+
+static struct derived_key *
+cache_slot(struct derived_key_cache *cache, unsigned int h, unsigned int i)
+{
+    return &cache->slots[(h + i) % DERIVED_KEY_CACHE_SIZE];
+}
+
 static krb5_key
-find_cached_dkey(struct derived_key *list, const krb5_data *constant)
+find_cached_dkey(struct derived_key_cache *cache, unsigned int h,
+                 const krb5_data *constant)
 {
-    for (; list; list = list->next) {
-        if (data_eq(list->constant, *constant)) {
-            krb5_k_reference_key(NULL, list->dkey);
-            return list->dkey;
+    struct derived_key *dk;
+    unsigned int i;
+
+    for (i = 0; i < PROBE_SLOTS; i++) {
+        dk = cache_slot(cache, h, i);
+        if (dk->constant.data != NULL && data_eq(dk->constant, *constant)) {
+            cache->hits++;
+            krb5_k_reference_key(NULL, dk->dkey);
+            return dk->dkey;
         }
     }
+    cache->misses++;
     return NULL;
 }
 
 static krb5_error_code
-add_cached_dkey(krb5_key key, const krb5_data *constant,
-                const krb5_keyblock *dkeyblock, krb5_key *cached_dkey)
+add_cached_dkey(struct derived_key_cache *cache, unsigned int h,
+                const krb5_data *constant, const krb5_keyblock *dkeyblock,
+                krb5_key *cached_dkey)
 {
     krb5_key dkey;
     krb5_error_code ret;
     struct derived_key *dkent = NULL;
-    char *data = NULL;
+    char *data;
+    unsigned int i;
 
     /* Allocate fields for the new entry. */
-    dkent = malloc(sizeof(*dkent));
-    if (dkent == NULL)
-        goto cleanup;
-    data = malloc(constant->length);
+    data = malloc(constant->length ? constant->length : 1);
     if (data == NULL)
-        goto cleanup;
+        return ENOMEM;
     ret = krb5_k_create_key(NULL, dkeyblock, &dkey);
-    if (ret != 0)
-        goto cleanup;
+    if (ret != 0) {
+        free(data);
+        return ret;
+    }
+
+    /* Use a free slot if there is one, or else evict the entries in the probe
+     * sequence in turn. */
+    for (i = 0; i < PROBE_SLOTS; i++) {
+        dkent = cache_slot(cache, h, i);
+        if (dkent->constant.data == NULL)
+            break;
+    }
+    if (i == PROBE_SLOTS) {
+        dkent = cache_slot(cache, h, cache->evictions % PROBE_SLOTS);
+        free(dkent->constant.data);
+        krb5_k_free_key(NULL, dkent->dkey);
+        cache->evictions++;
+    }
 
-    /* Add the new entry to the list. */
     memcpy(data, constant->data, constant->length);
     dkent->dkey = dkey;
     dkent->constant.data = data;
     dkent->constant.length = constant->length;
-    dkent->next = key->derived;
-    key->derived = dkent;
 
     /* Return a "copy" of the cached key. */
     krb5_k_reference_key(NULL, dkey);
     *cached_dkey = dkey;
     return 0;
+}
 
-cleanup:
-    free(dkent);
-    free(data);
-    return ENOMEM;
+/* Free the derived key cache of key.  Called by krb5_k_free_key(). */
+void
+krb5int_c_free_derived_keys(krb5_key key)
+{
+    struct derived_key_cache *cache = key->derived;
+    unsigned int i;
+
+    if (cache == NULL)
+        return;
+    for (i = 0; i < DERIVED_KEY_CACHE_SIZE; i++) {
+        if (cache->slots[i].constant.data != NULL) {
+            free(cache->slots[i].constant.data);
+            krb5_k_free_key(NULL, cache->slots[i].dkey);
+        }
+    }
+    free(cache);
+    key->derived = NULL;
+}
+
+/* Report the hit, miss, and eviction counts of the derived key cache of
+ * key. */
+void
+krb5int_c_derived_key_stats(krb5_key key, unsigned long *hits,
+                            unsigned long *misses, unsigned long *evictions)
+{
+    struct derived_key_cache *cache = key->derived;
+
+    *hits = (cache != NULL) ? cache->hits : 0;
+    *misses = (cache != NULL) ? cache->misses : 0;
+    *evictions = (cache != NULL) ? cache->evictions : 0;
 }
 
 static krb5_error_code
@@ -266,11 +334,19 @@ krb5int_derive_key(const struct krb5_enc_provider *enc,
     krb5_keyblock keyblock;
     krb5_error_code ret;
     krb5_key dkey;
+    unsigned int h;
 
     *outkey = NULL;
 
+    if (inkey->derived == NULL) {
+        inkey->derived = calloc(1, sizeof(*inkey->derived));
+        if (inkey->derived == NULL)
+            return ENOMEM;
+    }
+
     /* Check for a cached result. */
-    dkey = find_cached_dkey(inkey->derived, in_constant);
+    h = hash_constant(in_constant);
+    dkey = find_cached_dkey(inkey->derived, h, in_constant);
     if (dkey != NULL) {
         *outkey = dkey;
         return 0;
@@ -287,7 +363,7 @@ krb5int_derive_key(const struct krb5_enc_provider *enc,
         goto cleanup;
 
     /* Cache the derived key. */
-    ret = add_cached_dkey(inkey, in_constant, &keyblock, &dkey);
+    ret = add_cached_dkey(inkey->derived, h, in_constant, &keyblock, &dkey);
     if (ret != 0)
         goto cleanup;
 
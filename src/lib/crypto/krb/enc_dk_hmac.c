@@ -65,23 +65,52 @@ krb5int_aes_crypto_length(const struct krb5_keytypes *ktp,
     }
 }
 
-krb5_error_code
-krb5int_dk_encrypt(const struct krb5_keytypes *ktp, krb5_key key,
-                   krb5_keyusage usage, const krb5_data *ivec,
-                   krb5_crypto_iov *data, size_t num_data)
+/* Derive the encryption and integrity keys for usage. */
+static krb5_error_code
+derive_keys(const struct krb5_enc_provider *enc, krb5_key key,
+            krb5_keyusage usage, krb5_key *ke_out, krb5_key *ki_out)
 {
-    const struct krb5_enc_provider *enc = ktp->enc;
-    const struct krb5_hash_provider *hash = ktp->hash;
     krb5_error_code ret;
     unsigned char constantdata[K5CLENGTH];
-    krb5_data d1, d2;
-    krb5_crypto_iov *header, *trailer, *padding;
+    krb5_data d1;
     krb5_key ke = NULL, ki = NULL;
+
+    *ke_out = *ki_out = NULL;
+
+    d1.data = (char *)constantdata;
+    d1.length = K5CLENGTH;
+
+    store_32_be(usage, constantdata);
+
+    d1.data[4] = 0xAA;
+
+    ret = krb5int_derive_key(enc, key, &ke, &d1, DERIVE_RFC3961);
+    if (ret != 0)
+        return ret;
+
+    d1.data[4] = 0x55;
+
+    ret = krb5int_derive_key(enc, key, &ki, &d1, DERIVE_RFC3961);
+    if (ret != 0) {
+        krb5_k_free_key(NULL, ke);
+        return ret;
+    }
+
+    *ke_out = ke;
+    *ki_out = ki;
+    return 0;
+}
+
+/* Validate the header, trailer, and padding of a message to be encrypted, and
+ * set the padding. */
+static krb5_error_code
+check_encrypt_iov(const struct krb5_keytypes *ktp, krb5_crypto_iov *data,
+                  size_t num_data)
+{
+    const struct krb5_enc_provider *enc = ktp->enc;
+    krb5_crypto_iov *header, *trailer, *padding;
     size_t i;
     unsigned int blocksize, hmacsize, plainlen = 0, padsize = 0;
-    unsigned char *cksum = NULL;
-
-    /* E(Confounder | Plaintext | Pad) | Checksum */
 
     blocksize = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_PADDING);
     hmacsize = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_TRAILER);
@@ -118,55 +147,133 @@ krb5int_dk_encrypt(const struct krb5_keytypes *ktp, krb5_key key,
         padding->data.length = padsize;
     }
 
-    cksum = k5alloc(hash->hashsize, &ret);
-    if (ret != 0)
-        goto cleanup;
+    return 0;
+}
 
-    /* Derive the keys. */
+/*
+ * Generate the confounder of a checked message and place its truncated HMAC
+ * in the trailer, using cksum (of the hash size) as scratch space.  The
+ * trailer is not covered by the encryption, so this can be done before the
+ * message is encrypted.
+ */
+static krb5_error_code
+sign_plaintext(const struct krb5_keytypes *ktp, krb5_key ki,
+               krb5_crypto_iov *data, size_t num_data, unsigned char *cksum)
+{
+    krb5_error_code ret;
+    krb5_crypto_iov *header, *trailer;
+    unsigned int hmacsize;
+    krb5_data d2;
 
-    d1.data = (char *)constantdata;
-    d1.length = K5CLENGTH;
+    hmacsize = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_TRAILER);
+    header = krb5int_c_locate_iov(data, num_data, KRB5_CRYPTO_TYPE_HEADER);
+    trailer = krb5int_c_locate_iov(data, num_data, KRB5_CRYPTO_TYPE_TRAILER);
 
-    store_32_be(usage, constantdata);
+    /* Generate confounder. */
 
-    d1.data[4] = 0xAA;
+    header->data.length = ktp->enc->block_size;
 
-    ret = krb5int_derive_key(enc, key, &ke, &d1, DERIVE_RFC3961);
+    ret = krb5_c_random_make_octets(/* XXX */ NULL, &header->data);
     if (ret != 0)
-        goto cleanup;
+        return ret;
 
-    d1.data[4] = 0x55;
+    /* Hash the plaintext. */
+    d2.length = ktp->hash->hashsize;
+    d2.data = (char *)cksum;
 
-    ret = krb5int_derive_key(enc, key, &ki, &d1, DERIVE_RFC3961);
+    ret = krb5int_hmac(ktp->hash, ki, data, num_data, &d2);
     if (ret != 0)
-        goto cleanup;
+        return ret;
 
-    /* Generate confounder. */
+    /* Possibly truncate the hash */
+    assert(hmacsize <= d2.length);
 
-    header->data.length = enc->block_size;
+    memcpy(trailer->data.data, cksum, hmacsize);
+    trailer->data.length = hmacsize;
+    return 0;
+}
 
-    ret = krb5_c_random_make_octets(/* XXX */ NULL, &header->data);
+krb5_error_code
+krb5int_dk_encrypt(const struct krb5_keytypes *ktp, krb5_key key,
+                   krb5_keyusage usage, const krb5_data *ivec,
+                   krb5_crypto_iov *data, size_t num_data)
+{
+    const struct krb5_enc_provider *enc = ktp->enc;
+    krb5_error_code ret;
+    krb5_key ke = NULL, ki = NULL;
+    unsigned char *cksum = NULL;
+
+    /* E(Confounder | Plaintext | Pad) | Checksum */
+
+    ret = check_encrypt_iov(ktp, data, num_data);
+    if (ret != 0)
+        return ret;
+
+    cksum = k5alloc(ktp->hash->hashsize, &ret);
     if (ret != 0)
         goto cleanup;
 
-    /* Hash the plaintext. */
-    d2.length = hash->hashsize;
-    d2.data = (char *)cksum;
+    ret = derive_keys(enc, key, usage, &ke, &ki);
+    if (ret != 0)
+        goto cleanup;
 
-    ret = krb5int_hmac(hash, ki, data, num_data, &d2);
+    ret = sign_plaintext(ktp, ki, data, num_data, cksum);
     if (ret != 0)
         goto cleanup;
 
     /* Encrypt the plaintext (header | data | padding) */
     ret = enc->encrypt(ke, ivec, data, num_data);
+
+cleanup:
+    krb5_k_free_key(NULL, ke);
+    krb5_k_free_key(NULL, ki);
+    free(cksum);
+    return ret;
+}
+
+/*
+ * Encrypt count messages with the same key and usage.  The derived keys are
+ * looked up once, and the enc provider may encrypt the messages together.  If
+ * any message is malformed, no message is encrypted.
+ */
+krb5_error_code
+krb5int_dk_encrypt_batch(const struct krb5_keytypes *ktp, krb5_key key,
+                         krb5_keyusage usage, krb5_crypto_iov **data,
+                         const size_t *num_data, size_t count,
+                         krb5_error_code *results)
+{
+    const struct krb5_enc_provider *enc = ktp->enc;
+    krb5_error_code ret;
+    krb5_key ke = NULL, ki = NULL;
+    unsigned char *cksum = NULL;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        ret = check_encrypt_iov(ktp, data[i], num_data[i]);
+        if (ret != 0)
+            return ret;
+    }
+
+    cksum = k5alloc(ktp->hash->hashsize, &ret);
     if (ret != 0)
         goto cleanup;
 
-    /* Possibly truncate the hash */
-    assert(hmacsize <= d2.length);
+    ret = derive_keys(enc, key, usage, &ke, &ki);
+    if (ret != 0)
+        goto cleanup;
 
-    memcpy(trailer->data.data, cksum, hmacsize);
-    trailer->data.length = hmacsize;
+    for (i = 0; i < count; i++) {
+        ret = sign_plaintext(ktp, ki, data[i], num_data[i], cksum);
+        if (ret != 0)
+            goto cleanup;
+    }
+
+    if (count > 1 && enc->encrypt_batch != NULL) {
+        ret = enc->encrypt_batch(ke, data, num_data, count);
+    } else {
+        for (i = 0; i < count && ret == 0; i++)
+            ret = enc->encrypt(ke, NULL, data[i], num_data[i]);
+    }
 
 cleanup:
     krb5_k_free_key(NULL, ke);
@@ -175,22 +282,15 @@ cleanup:
     return ret;
 }
 
-krb5_error_code
-krb5int_dk_decrypt(const struct krb5_keytypes *ktp, krb5_key key,
-                   krb5_keyusage usage, const krb5_data *ivec,
-                   krb5_crypto_iov *data, size_t num_data)
+/* Validate the lengths of a message to be decrypted. */
+static krb5_error_code
+check_decrypt_iov(const struct krb5_keytypes *ktp, krb5_crypto_iov *data,
+                  size_t num_data)
 {
-    const struct krb5_enc_provider *enc = ktp->enc;
-    const struct krb5_hash_provider *hash = ktp->hash;
-    krb5_error_code ret;
-    unsigned char constantdata[K5CLENGTH];
-    krb5_data d1;
     krb5_crypto_iov *header, *trailer;
-    krb5_key ke = NULL, ki = NULL;
     size_t i;
     unsigned int blocksize; /* enc block size, not confounder len */
     unsigned int hmacsize, cipherlen = 0;
-    unsigned char *cksum = NULL;
 
     /* E(Confounder | Plaintext | Pad) | Checksum */
 
@@ -212,33 +312,63 @@ krb5int_dk_decrypt(const struct krb5_keytypes *ktp, krb5_key key,
     /* Validate header and trailer lengths */
 
     header = krb5int_c_locate_iov(data, num_data, KRB5_CRYPTO_TYPE_HEADER);
-    if (header == NULL || header->data.length != enc->block_size)
+    if (header == NULL || header->data.length != ktp->enc->block_size)
         return KRB5_BAD_MSIZE;
 
     trailer = krb5int_c_locate_iov(data, num_data, KRB5_CRYPTO_TYPE_TRAILER);
     if (trailer == NULL || trailer->data.length != hmacsize)
         return KRB5_BAD_MSIZE;
 
-    cksum = k5alloc(hash->hashsize, &ret);
+    return 0;
+}
+
+/* Verify the HMAC of a decrypted message, using cksum (of the hash size) as
+ * scratch space. */
+static krb5_error_code
+verify_plaintext(const struct krb5_keytypes *ktp, krb5_key ki,
+                 krb5_crypto_iov *data, size_t num_data, unsigned char *cksum)
+{
+    krb5_error_code ret;
+    krb5_crypto_iov *trailer;
+    unsigned int hmacsize;
+    krb5_data d1;
+
+    hmacsize = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_TRAILER);
+    trailer = krb5int_c_locate_iov(data, num_data, KRB5_CRYPTO_TYPE_TRAILER);
+
+    d1.length = ktp->hash->hashsize; /* non-truncated length */
+    d1.data = (char *)cksum;
+
+    ret = krb5int_hmac(ktp->hash, ki, data, num_data, &d1);
     if (ret != 0)
-        goto cleanup;
+        return ret;
 
-    /* Derive the keys. */
+    /* Compare only the possibly truncated length. */
+    if (memcmp(cksum, trailer->data.data, hmacsize) != 0)
+        return KRB5KRB_AP_ERR_BAD_INTEGRITY;
 
-    d1.data = (char *)constantdata;
-    d1.length = K5CLENGTH;
+    return 0;
+}
 
-    store_32_be(usage, constantdata);
+krb5_error_code
+krb5int_dk_decrypt(const struct krb5_keytypes *ktp, krb5_key key,
+                   krb5_keyusage usage, const krb5_data *ivec,
+                   krb5_crypto_iov *data, size_t num_data)
+{
+    const struct krb5_enc_provider *enc = ktp->enc;
+    krb5_error_code ret;
+    krb5_key ke = NULL, ki = NULL;
+    unsigned char *cksum = NULL;
 
-    d1.data[4] = 0xAA;
+    ret = check_decrypt_iov(ktp, data, num_data);
+    if (ret != 0)
+        return ret;
 
-    ret = krb5int_derive_key(enc, key, &ke, &d1, DERIVE_RFC3961);
+    cksum = k5alloc(ktp->hash->hashsize, &ret);
     if (ret != 0)
         goto cleanup;
 
-    d1.data[4] = 0x55;
-
-    ret = krb5int_derive_key(enc, key, &ki, &d1, DERIVE_RFC3961);
+    ret = derive_keys(enc, key, usage, &ke, &ki);
     if (ret != 0)
         goto cleanup;
 
@@ -248,22 +378,92 @@ krb5int_dk_decrypt(const struct krb5_keytypes *ktp, krb5_key key,
         goto cleanup;
 
     /* Verify the hash. */
-    d1.length = hash->hashsize; /* non-truncated length */
-    d1.data = (char *)cksum;
+    ret = verify_plaintext(ktp, ki, data, num_data, cksum);
 
-    ret = krb5int_hmac(hash, ki, data, num_data, &d1);
+cleanup:
+    krb5_k_free_key(NULL, ke);
+    krb5_k_free_key(NULL, ki);
+    free(cksum);
+    return ret;
+}
+
+/*
+ * Decrypt count messages with the same key and usage, storing the result for
+ * each message in results.  Malformed messages are left alone, and the others
+ * are decrypted together if the enc provider supports it.  Return the first
+ * error, or 0 if every message was decrypted and verified.
+ */
+krb5_error_code
+krb5int_dk_decrypt_batch(const struct krb5_keytypes *ktp, krb5_key key,
+                         krb5_keyusage usage, krb5_crypto_iov **data,
+                         const size_t *num_data, size_t count,
+                         krb5_error_code *results)
+{
+    const struct krb5_enc_provider *enc = ktp->enc;
+    krb5_error_code ret;
+    krb5_key ke = NULL, ki = NULL;
+    unsigned char *cksum = NULL;
+    krb5_crypto_iov **valid_data = NULL;
+    size_t *valid_num = NULL, i, nvalid;
+
+    for (i = 0; i < count; i++)
+        results[i] = check_decrypt_iov(ktp, data[i], num_data[i]);
+
+    cksum = k5alloc(ktp->hash->hashsize, &ret);
     if (ret != 0)
-        goto cleanup;
+        goto fail;
 
-    /* Compare only the possibly truncated length. */
-    if (memcmp(cksum, trailer->data.data, hmacsize) != 0) {
-        ret = KRB5KRB_AP_ERR_BAD_INTEGRITY;
-        goto cleanup;
+    ret = derive_keys(enc, key, usage, &ke, &ki);
+    if (ret != 0)
+        goto fail;
+
+    /* Decrypt the well-formed messages (header | data | padding). */
+    if (count > 1 && enc->decrypt_batch != NULL) {
+        valid_data = k5alloc(count * sizeof(*valid_data), &ret);
+        if (valid_data == NULL)
+            goto fail;
+        valid_num = k5alloc(count * sizeof(*valid_num), &ret);
+        if (valid_num == NULL)
+            goto fail;
+        for (i = nvalid = 0; i < count; i++) {
+            if (results[i] == 0) {
+                valid_data[nvalid] = data[i];
+                valid_num[nvalid++] = num_data[i];
+            }
+        }
+        ret = enc->decrypt_batch(ke, valid_data, valid_num, nvalid);
+        if (ret != 0)
+            goto fail;
+    } else {
+        for (i = 0; i < count; i++) {
+            if (results[i] == 0)
+                results[i] = enc->decrypt(ke, NULL, data[i], num_data[i]);
+        }
+    }
+
+    /* Verify the hashes. */
+    for (i = 0; i < count; i++) {
+        if (results[i] == 0)
+            results[i] = verify_plaintext(ktp, ki, data[i], num_data[i],
+                                          cksum);
+    }
+
+    ret = 0;
+    for (i = 0; i < count && ret == 0; i++)
+        ret = results[i];
+    goto cleanup;
+
+fail:
+    for (i = 0; i < count; i++) {
+        if (results[i] == 0)
+            results[i] = ret;
     }
 
 cleanup:
     krb5_k_free_key(NULL, ke);
     krb5_k_free_key(NULL, ki);
     free(cksum);
+    free(valid_data);
+    free(valid_num);
     return ret;
 }
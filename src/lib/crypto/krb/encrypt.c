@@ -27,13 +27,45 @@
 
 #include "crypto_int.h"
 
+/*
+ * Encrypt the plain_len bytes of plaintext at offset header_len in buf, which
+ * must be followed by room for the padding and trailer, leaving the
+ * ciphertext at the start of buf.  The plaintext is erased on failure.
+ */
+static krb5_error_code
+encrypt_buffer(const struct krb5_keytypes *ktp, krb5_key key,
+               krb5_keyusage usage, const krb5_data *cipher_state, char *buf,
+               unsigned int header_len, unsigned int plain_len,
+               unsigned int padding_len, unsigned int trailer_len)
+{
+    krb5_crypto_iov iov[4];
+    krb5_error_code ret;
+
+    /* Set up the iov structures for the token parts. */
+    iov[0].flags = KRB5_CRYPTO_TYPE_HEADER;
+    iov[0].data = make_data(buf, header_len);
+
+    iov[1].flags = KRB5_CRYPTO_TYPE_DATA;
+    iov[1].data = make_data(buf + header_len, plain_len);
+
+    iov[2].flags = KRB5_CRYPTO_TYPE_PADDING;
+    iov[2].data = make_data(iov[1].data.data + plain_len, padding_len);
+
+    iov[3].flags = KRB5_CRYPTO_TYPE_TRAILER;
+    iov[3].data = make_data(iov[2].data.data + padding_len, trailer_len);
+
+    ret = ktp->encrypt(ktp, key, usage, cipher_state, iov, 4);
+    if (ret != 0)
+        zap(iov[1].data.data, iov[1].data.length);
+    return ret;
+}
+
 krb5_error_code KRB5_CALLCONV
 krb5_k_encrypt(krb5_context context, krb5_key key,
                krb5_keyusage usage, const krb5_data *cipher_state,
                const krb5_data *input, krb5_enc_data *output)
 {
     const struct krb5_keytypes *ktp;
-    krb5_crypto_iov iov[4];
     krb5_error_code ret;
     unsigned int header_len, padding_len, trailer_len, total_len;
 
@@ -53,26 +85,39 @@ krb5_k_encrypt(krb5_context context, krb5_key key,
     if (output->ciphertext.length < total_len)
         return KRB5_BAD_MSIZE;
 
-    /* Set up the iov structures for the token parts. */
-    iov[0].flags = KRB5_CRYPTO_TYPE_HEADER;
-    iov[0].data = make_data(output->ciphertext.data, header_len);
+    memcpy(output->ciphertext.data + header_len, input->data, input->length);
+    ret = encrypt_buffer(ktp, key, usage, cipher_state,
+                         output->ciphertext.data, header_len, input->length,
+                         padding_len, trailer_len);
+    if (ret == 0)
+        output->ciphertext.length = total_len;
+    return ret;
+}
 
-    iov[1].flags = KRB5_CRYPTO_TYPE_DATA;
-    iov[1].data = make_data(output->ciphertext.data + header_len,
-                            input->length);
-    memcpy(iov[1].data.data, input->data, input->length);
+krb5_error_code KRB5_CALLCONV
+krb5_k_encrypt_inplace(krb5_context context, krb5_key key,
+                       krb5_keyusage usage, const krb5_data *cipher_state,
+                       krb5_data *buffer, unsigned int plain_len)
+{
+    const struct krb5_keytypes *ktp;
+    krb5_error_code ret;
+    unsigned int header_len, padding_len, trailer_len, total_len;
 
-    iov[2].flags = KRB5_CRYPTO_TYPE_PADDING;
-    iov[2].data = make_data(iov[1].data.data + input->length, padding_len);
+    ktp = find_enctype(key->keyblock.enctype);
+    if (ktp == NULL)
+        return KRB5_BAD_ENCTYPE;
 
-    iov[3].flags = KRB5_CRYPTO_TYPE_TRAILER;
-    iov[3].data = make_data(iov[2].data.data + padding_len, trailer_len);
+    header_len = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_HEADER);
+    padding_len = krb5int_c_padding_length(ktp, plain_len);
+    trailer_len = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_TRAILER);
+    total_len = header_len + plain_len + padding_len + trailer_len;
+    if (buffer->length < total_len)
+        return KRB5_BAD_MSIZE;
 
-    ret = ktp->encrypt(ktp, key, usage, cipher_state, iov, 4);
-    if (ret != 0)
-        zap(iov[1].data.data, iov[1].data.length);
-    else
-        output->ciphertext.length = total_len;
+    ret = encrypt_buffer(ktp, key, usage, cipher_state, buffer->data,
+                         header_len, plain_len, padding_len, trailer_len);
+    if (ret == 0)
+        buffer->length = total_len;
     return ret;
 }
 
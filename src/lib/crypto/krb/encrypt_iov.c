@@ -40,6 +40,72 @@ krb5_k_encrypt_iov(krb5_context context, krb5_key key, krb5_keyusage usage,
     return ktp->encrypt(ktp, key, usage, cipher_state, data, num_data);
 }
 
+/*
+ * Check that a message to be encrypted has room for the header, trailer and
+ * padding of its enctype, so that a malformed message can be found before
+ * any message of a batch is encrypted.
+ */
+static krb5_error_code
+check_iov_lengths(const struct krb5_keytypes *ktp, krb5_crypto_iov *data,
+                  size_t num_data)
+{
+    krb5_crypto_iov *iov;
+    unsigned int len;
+    size_t i, plainlen = 0;
+
+    for (i = 0; i < num_data; i++) {
+        if (data[i].flags == KRB5_CRYPTO_TYPE_DATA)
+            plainlen += data[i].data.length;
+    }
+
+    len = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_HEADER);
+    iov = krb5int_c_locate_iov(data, num_data, KRB5_CRYPTO_TYPE_HEADER);
+    if (len > 0 && (iov == NULL || iov->data.length < len))
+        return KRB5_BAD_MSIZE;
+
+    len = ktp->crypto_length(ktp, KRB5_CRYPTO_TYPE_TRAILER);
+    iov = krb5int_c_locate_iov(data, num_data, KRB5_CRYPTO_TYPE_TRAILER);
+    if (len > 0 && (iov == NULL || iov->data.length < len))
+        return KRB5_BAD_MSIZE;
+
+    len = krb5int_c_padding_length(ktp, plainlen);
+    iov = krb5int_c_locate_iov(data, num_data, KRB5_CRYPTO_TYPE_PADDING);
+    if (len > 0 && (iov == NULL || iov->data.length < len))
+        return KRB5_BAD_MSIZE;
+
+    return 0;
+}
+
+krb5_error_code KRB5_CALLCONV
+krb5_k_encrypt_iov_batch(krb5_context context, krb5_key key,
+                         krb5_keyusage usage, krb5_crypto_iov **data,
+                         const size_t *num_data, size_t count)
+{
+    const struct krb5_keytypes *ktp;
+    krb5_error_code ret;
+    size_t i;
+
+    ktp = find_enctype(key->keyblock.enctype);
+    if (ktp == NULL)
+        return KRB5_BAD_ENCTYPE;
+
+    if (ktp->encrypt_batch != NULL)
+        return ktp->encrypt_batch(ktp, key, usage, data, num_data, count,
+                                  NULL);
+
+    for (i = 0; i < count; i++) {
+        ret = check_iov_lengths(ktp, data[i], num_data[i]);
+        if (ret != 0)
+            return ret;
+    }
+    for (i = 0; i < count; i++) {
+        ret = ktp->encrypt(ktp, key, usage, NULL, data[i], num_data[i]);
+        if (ret != 0)
+            return ret;
+    }
+    return 0;
+}
+
 krb5_error_code KRB5_CALLCONV
 krb5_c_encrypt_iov(krb5_context context, const krb5_keyblock *keyblock,
                    krb5_keyusage usage, const krb5_data *cipher_state,
@@ -100,13 +100,22 @@
 /* SHA-256 result size in bytes. */
 #define SHA256_HASHSIZE (256/8)
 
-/* Genarator - block cipher in CTR mode */
-struct fortuna_state
+/* Reseed a thread's generator from the main generator after it has produced
+ * this many bytes. */
+#define THREAD_RESEED_BYTES (1 << 16)
+
+/* Generator - block cipher in CTR mode */
+struct fortuna_generator
 {
-    /* Generator state. */
     unsigned char counter[AES256_BLOCKSIZE];
     unsigned char key[AES256_KEYSIZE];
     aes_ctx ciph;
+};
+
+struct fortuna_state
+{
+    /* Generator state. */
+    struct fortuna_generator gen;
 
     /* Accumulator state. */
     SHA256_CTX pool[NUM_POOLS];
@@ -161,31 +170,31 @@ init_state(struct fortuna_state *st)
         shad256_init(&st->pool[i]);
 }
 
-/* Increment st->counter using least significant byte first. */
+/* Increment g->counter using least significant byte first. */
 static void
-inc_counter(struct fortuna_state *st)
+inc_counter(struct fortuna_generator *g)
 {
     UINT64_TYPE val;
 
-    val = load_64_le(st->counter) + 1;
-    store_64_le(val, st->counter);
+    val = load_64_le(g->counter) + 1;
+    store_64_le(val, g->counter);
     if (val == 0) {
-        val = load_64_le(st->counter + 8) + 1;
-        store_64_le(val, st->counter + 8);
+        val = load_64_le(g->counter + 8) + 1;
+        store_64_le(val, g->counter + 8);
     }
 }
 
-/* Encrypt and increment st->counter in the current cipher context. */
+/* Encrypt and increment g->counter in the current cipher context. */
 static void
-encrypt_counter(struct fortuna_state *st, unsigned char *dst)
+encrypt_counter(struct fortuna_generator *g, unsigned char *dst)
 {
-    krb5int_aes_enc_blk(st->counter, dst, &st->ciph);
-    inc_counter(st);
+    krb5int_aes_enc_blk(g->counter, dst, &g->ciph);
+    inc_counter(g);
 }
 
 /* Reseed the generator based on hopefully non-guessable input. */
 static void
-generator_reseed(struct fortuna_state *st, const unsigned char *data,
+generator_reseed(struct fortuna_generator *g, const unsigned char *data,
                  size_t len)
 {
     SHA256_CTX ctx;
@@ -193,35 +202,35 @@ generator_reseed(struct fortuna_state *st, const unsigned char *data,
     /* Calculate SHA[d]-256(key||s) and make that the new key.  Depend on the
      * SHA-256 hash size being the AES-256 key size. */
     shad256_init(&ctx);
-    shad256_update(&ctx, st->key, AES256_KEYSIZE);
+    shad256_update(&ctx, g->key, AES256_KEYSIZE);
     shad256_update(&ctx, data, len);
-    shad256_result(&ctx, st->key);
+    shad256_result(&ctx, g->key);
     zap(&ctx, sizeof(ctx));
-    krb5int_aes_enc_key(st->key, AES256_KEYSIZE, &st->ciph);
+    krb5int_aes_enc_key(g->key, AES256_KEYSIZE, &g->ciph);
 
     /* Increment counter. */
-    inc_counter(st);
+    inc_counter(g);
 }
 
 /* Generate two blocks in counter mode and replace the key with the result. */
 static void
-change_key(struct fortuna_state *st)
+change_key(struct fortuna_generator *g)
 {
-    encrypt_counter(st, st->key);
-    encrypt_counter(st, st->key + AES256_BLOCKSIZE);
-    krb5int_aes_enc_key(st->key, AES256_KEYSIZE, &st->ciph);
+    encrypt_counter(g, g->key);
+    encrypt_counter(g, g->key + AES256_BLOCKSIZE);
+    krb5int_aes_enc_key(g->key, AES256_KEYSIZE, &g->ciph);
 }
 
 /* Output pseudo-random data from the generator. */
 static void
-generator_output(struct fortuna_state *st, unsigned char *dst, size_t len)
+generator_output(struct fortuna_generator *g, unsigned char *dst, size_t len)
 {
     unsigned char result[AES256_BLOCKSIZE];
     size_t n, count = 0;
 
     while (len > 0) {
         /* Produce bytes and copy the result into dst. */
-        encrypt_counter(st, result);
+        encrypt_counter(g, result);
         n = (len < AES256_BLOCKSIZE) ? len : AES256_BLOCKSIZE;
         memcpy(dst, result, n);
         dst += n;
@@ -230,14 +239,14 @@ generator_output(struct fortuna_state *st, unsigned char *dst, size_t len)
         /* Each time we reach MAX_BYTES_PER_KEY bytes, change the key. */
         count += AES256_BLOCKSIZE;
         if (count >= MAX_BYTES_PER_KEY) {
-            change_key(st);
+            change_key(g);
             count = 0;
         }
     }
     zap(result, sizeof(result));
 
     /* Change the key after each request. */
-    change_key(st);
+    change_key(g);
 }
 
 /* Reseed the generator using the accumulator pools. */
@@ -266,7 +275,7 @@ accumulator_reseed(struct fortuna_state *st)
         shad256_update(&ctx, hash_result, SHA256_HASHSIZE);
     }
     shad256_result(&ctx, hash_result);
-    generator_reseed(st, hash_result, SHA256_HASHSIZE);
+    generator_reseed(&st->gen, hash_result, SHA256_HASHSIZE);
     zap(hash_result, SHA256_HASHSIZE);
     zap(&ctx, sizeof(ctx));
 
@@ -304,6 +313,43 @@ accumulator_add_event(struct fortuna_state *st, const unsigned char *data,
 /* Limit dependencies for test program. */
 #ifndef TEST
 
+#ifdef _WIN32
+typedef DWORD pid_type;
+#else
+typedef pid_t pid_type;
+#endif
+
+/*
+ * Each thread produces output from its own generator, so that callers do not
+ * contend for fortuna_lock on every request.  A thread generator is seeded
+ * from the output of the main generator, which is fed by the accumulator, and
+ * is reseeded the same way after THREAD_RESEED_BYTES bytes of output, after a
+ * fork, and whenever the main generator is reseeded.  Like the main
+ * generator, it changes its key after every request.  All thread generators
+ * are kept on a list so that k5_prng_cleanup() can free those of threads
+ * which are still running.
+ */
+struct thread_generator {
+    struct fortuna_generator gen;
+    krb5_boolean seeded;
+    pid_type pid;                   /* Process which last seeded gen */
+    unsigned int generation;        /* main_generation when last seeded */
+    size_t bytes;                   /* Output since gen was last seeded */
+    struct thread_generator *next;
+    struct thread_generator *prev;
+};
+
+static k5_mutex_t fortuna_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct fortuna_state main_state;
+static pid_type last_pid;
+static krb5_boolean have_entropy = FALSE;
+
+/* List of all thread generators, protected by fortuna_lock. */
+static struct thread_generator *thread_generators;
+
+/* Incremented whenever the main generator is reseeded. */
+static volatile unsigned int main_generation;
+
 /* Return true if RESEED_INTERVAL microseconds have passed since the last
  * reseed. */
 static krb5_boolean
@@ -335,20 +381,126 @@ accumulator_output(struct fortuna_state *st, unsigned char *dst, size_t len)
 {
     /* Reseed the generator with data from pools if we have accumulated enough
      * data and enough time has passed since the last accumulator reseed. */
-    if (st->pool0_bytes >= MIN_POOL_LEN && enough_time_passed(st))
+    if (st->pool0_bytes >= MIN_POOL_LEN && enough_time_passed(st)) {
         accumulator_reseed(st);
+        main_generation++;
+    }
 
-    generator_output(st, dst, len);
+    generator_output(&st->gen, dst, len);
 }
 
-static k5_mutex_t fortuna_lock = K5_MUTEX_PARTIAL_INITIALIZER;
-static struct fortuna_state main_state;
+/* Output data from the main generator, reseeding it first if the process has
+ * forked.  fortuna_lock must be held. */
+static krb5_error_code
+main_output(pid_type pid, unsigned char *dst, size_t len)
+{
+    unsigned char pidbuf[4];
+
+    if (!have_entropy)
+        return KRB5_CRYPTO_INTERNAL;
+
+    if (pid != last_pid) {
+        /* We forked; make sure child's PRNG stream differs from parent's. */
+        store_32_be(pid, pidbuf);
+        generator_reseed(&main_state.gen, pidbuf, 4);
+        last_pid = pid;
+        main_generation++;
+    }
+
+    accumulator_output(&main_state, dst, len);
+    return 0;
+}
+
+/* Reseed tg from the output of the main generator. */
+static krb5_error_code
+thread_reseed(struct thread_generator *tg, pid_type pid)
+{
+    krb5_error_code ret;
+    unsigned char seed[AES256_KEYSIZE];
+
+    ret = k5_mutex_lock(&fortuna_lock);
+    if (ret)
+        return ret;
+    ret = main_output(pid, seed, sizeof(seed));
+    tg->generation = main_generation;
+    k5_mutex_unlock(&fortuna_lock);
+    if (ret)
+        return ret;
+
+    generator_reseed(&tg->gen, seed, sizeof(seed));
+    zap(seed, sizeof(seed));
+    tg->seeded = TRUE;
+    tg->pid = pid;
+    tg->bytes = 0;
+    return 0;
+}
+
+/* Remove tg from the list of thread generators.  fortuna_lock must be
+ * held. */
+static void
+unlink_thread_generator(struct thread_generator *tg)
+{
+    if (tg->prev != NULL)
+        tg->prev->next = tg->next;
+    else
+        thread_generators = tg->next;
+    if (tg->next != NULL)
+        tg->next->prev = tg->prev;
+}
+
+/* Thread-specific data destructor, run when a thread exits. */
+static void
+free_thread_generator(void *ptr)
+{
+    struct thread_generator *tg = ptr;
+
+    /* If we cannot lock, leak tg rather than leave it on the list. */
+    if (k5_mutex_lock(&fortuna_lock) != 0)
+        return;
+    unlink_thread_generator(tg);
+    k5_mutex_unlock(&fortuna_lock);
+    zap(tg, sizeof(*tg));
+    free(tg);
+}
+
+/* Return the calling thread's generator, creating it if necessary.  Return
+ * NULL if it cannot be created. */
+static struct thread_generator *
+get_thread_generator(void)
+{
+    struct thread_generator *tg;
+
+    tg = k5_getspecific(K5_KEY_CRYPTO_PRNG);
+    if (tg != NULL)
+        return tg;
+    tg = calloc(1, sizeof(*tg));
+    if (tg == NULL)
+        return NULL;
+    if (k5_mutex_lock(&fortuna_lock) != 0) {
+        free(tg);
+        return NULL;
+    }
+    tg->next = thread_generators;
+    if (thread_generators != NULL)
+        thread_generators->prev = tg;
+    thread_generators = tg;
+    k5_mutex_unlock(&fortuna_lock);
+    if (k5_setspecific(K5_KEY_CRYPTO_PRNG, tg) != 0) {
+        free_thread_generator(tg);
+        return NULL;
+    }
+    return tg;
+}
+
+static pid_type
+current_pid(void)
+{
 #ifdef _WIN32
-static DWORD last_pid;
+    return GetCurrentProcessId();
 #else
-static pid_t last_pid;
+    return getpid();
 #endif
-static krb5_boolean have_entropy = FALSE;
+}
 
 int
 k5_prng_init(void)
@@ -357,17 +509,16 @@ k5_prng_init(void)
     unsigned char osbuf[64];
 
     ret = k5_mutex_finish_init(&fortuna_lock);
+    if (ret)
+        return ret;
+    ret = k5_key_register(K5_KEY_CRYPTO_PRNG, free_thread_generator);
     if (ret)
         return ret;
 
     init_state(&main_state);
-#ifdef _WIN32
-    last_pid = GetCurrentProcessId();
-#else
-    last_pid = getpid();
-#endif
+    last_pid = current_pid();
     if (k5_get_os_entropy(osbuf, sizeof(osbuf))) {
-        generator_reseed(&main_state, osbuf, sizeof(osbuf));
+        generator_reseed(&main_state.gen, osbuf, sizeof(osbuf));
         have_entropy = TRUE;
     }
 
@@ -377,7 +528,21 @@ k5_prng_init(void)
 void
 k5_prng_cleanup(void)
 {
+    struct thread_generator *tg;
+
+    if (k5_getspecific(K5_KEY_CRYPTO_PRNG) != NULL)
+        k5_setspecific(K5_KEY_CRYPTO_PRNG, NULL);
+    k5_key_delete(K5_KEY_CRYPTO_PRNG);
+
+    /* Deleting the key does not run its destructor for other threads, so
+     * free every thread's generator here. */
+    while ((tg = thread_generators) != NULL) {
+        thread_generators = tg->next;
+        zap(tg, sizeof(*tg));
+        free(tg);
+    }
     have_entropy = FALSE;
+    main_generation++;
     zap(&main_state, sizeof(main_state));
     k5_mutex_destroy(&fortuna_lock);
 }
@@ -397,10 +562,13 @@ krb5_c_random_add_entropy(krb5_context context, unsigned int randsource,
     if (randsource == KRB5_C_RANDSOURCE_OSRAND ||
         randsource == KRB5_C_RANDSOURCE_TRUSTEDPARTY) {
         /* These sources contain enough entropy that we should use them
-         * immediately, so that they benefit the next request. */
-        generator_reseed(&main_state, (unsigned char *)indata->data,
+         * immediately, so that they benefit the next request.  Changing
+         * main_generation makes each thread generator reseed before its next
+         * output. */
+        generator_reseed(&main_state.gen, (unsigned char *)indata->data,
                          indata->length);
         have_entropy = TRUE;
+        main_generation++;
     } else {
         /* Other sources should just go into the pools and be used according to
          * the accumulator logic. */
@@ -415,32 +583,36 @@ krb5_error_code KRB5_CALLCONV
 krb5_c_random_make_octets(krb5_context context, krb5_data *outdata)
 {
     krb5_error_code ret;
-#ifdef _WIN32
-    DWORD pid = GetCurrentProcessId();
-#else
-    pid_t pid = getpid();
-#endif
-    unsigned char pidbuf[4];
+    struct thread_generator *tg;
+    pid_type pid = current_pid();
 
-    ret = k5_mutex_lock(&fortuna_lock);
+    ret = krb5int_crypto_init();
     if (ret)
         return ret;
-
-    if (!have_entropy) {
+    tg = get_thread_generator();
+    if (tg == NULL) {
+        /* Fall back to producing output directly from the main generator. */
+        ret = k5_mutex_lock(&fortuna_lock);
+        if (ret)
+            return ret;
+        ret = main_output(pid, (unsigned char *)outdata->data,
+                          outdata->length);
         k5_mutex_unlock(&fortuna_lock);
-        return KRB5_CRYPTO_INTERNAL;
+        return ret;
     }
 
-    if (pid != last_pid) {
-        /* We forked; make sure child's PRNG stream differs from parent's. */
-        store_32_be(pid, pidbuf);
-        generator_reseed(&main_state, pidbuf, 4);
-        last_pid = pid;
+    /* main_generation is read without the lock; a stale value only delays
+     * the reseed until this thread's next request. */
+    if (!tg->seeded || tg->pid != pid || tg->generation != main_generation ||
+        tg->bytes >= THREAD_RESEED_BYTES) {
+        ret = thread_reseed(tg, pid);
+        if (ret)
+            return ret;
     }
 
-    accumulator_output(&main_state, (unsigned char *)outdata->data,
-                       outdata->length);
-    k5_mutex_unlock(&fortuna_lock);
+    generator_output(&tg->gen, (unsigned char *)outdata->data,
+                     outdata->length);
+    tg->bytes += outdata->length;
     return 0;
 }
 
@@ -91,7 +91,7 @@ head_tail_test(struct fortuna_state *st)
 
     memset(buffer, 0, len);
 
-    generator_output(st, buffer, len);
+    generator_output(&st->gen, buffer, len);
     for (i = 0; i < len; i++) {
         c = buffer[i];
         for (bit = 0; bit < 8 && c; bit++) {
@@ -122,22 +122,22 @@ main(int argc, char **argv)
 
     /* Seed the generator with a known state. */
     init_state(&test_state);
-    generator_reseed(st, (unsigned char *)"test", 4);
+    generator_reseed(&st->gen, (unsigned char *)"test", 4);
 
     /* Generate two pieces of output; key should change for each request. */
-    generator_output(st, buf, 32);
+    generator_output(&st->gen, buf, 32);
     display(buf, 32);
-    generator_output(st, buf, 32);
+    generator_output(&st->gen, buf, 32);
     display(buf, 32);
 
     /* Generate a lot of output to test key changes during request. */
-    generator_output(st, buf, sizeof(buf));
+    generator_output(&st->gen, buf, sizeof(buf));
     display(buf, 32);
     display(buf + sizeof(buf) - 32, 32);
 
     /* Reseed the generator and generate more output. */
-    generator_reseed(st, (unsigned char *)"retest", 6);
-    generator_output(st, buf, 32);
+    generator_reseed(&st->gen, (unsigned char *)"retest", 6);
+    generator_output(&st->gen, buf, 32);
     display(buf, 32);
 
     /* Add sample data to accumulator pools. */
@@ -150,18 +150,18 @@ main(int argc, char **argv)
 
     /* Exercise accumulator reseeds. */
     accumulator_reseed(st);
-    generator_output(st, buf, 32);
+    generator_output(&st->gen, buf, 32);
     display(buf, 32);
     accumulator_reseed(st);
-    generator_output(st, buf, 32);
+    generator_output(&st->gen, buf, 32);
     display(buf, 32);
     accumulator_reseed(st);
-    generator_output(st, buf, 32);
+    generator_output(&st->gen, buf, 32);
     display(buf, 32);
     for (i = 0; i < 1000; i++)
         accumulator_reseed(st);
     assert(st->reseed_count == 1003);
-    generator_output(st, buf, 32);
+    generator_output(&st->gen, buf, 32);
     display(buf, 32);
 
     head_tail_test(st);
@@ -37,10 +37,10 @@ static krb5_error_code
 cbc_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
          size_t num_data);
 static krb5_error_code
-cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+cts_encr(const AES_KEY *enck, const krb5_data *ivec, krb5_crypto_iov *data,
          size_t num_data, size_t dlen);
 static krb5_error_code
-cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+cts_decr(const AES_KEY *deck, const krb5_data *ivec, krb5_crypto_iov *data,
          size_t num_data, size_t dlen);
 
 #define BLOCK_SIZE 16
@@ -122,8 +122,10 @@ cbc_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     return (ret == 1) ? 0 : KRB5_CRYPTO_INTERNAL;
 }
 
+/* Encrypt a message of more than one block using CTS, with the expanded key
+ * enck. */
 static krb5_error_code
-cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+cts_encr(const AES_KEY *enck, const krb5_data *ivec, krb5_crypto_iov *data,
          size_t num_data, size_t dlen)
 {
     int                    ret = 0;
@@ -131,7 +133,6 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     unsigned char         *oblock = NULL, *dbuf = NULL;
     unsigned char          iv_cts[IV_CTS_BUF_SIZE];
     struct iov_block_state input_pos, output_pos;
-    AES_KEY                enck;
 
     memset(iv_cts,0,sizeof(iv_cts));
     if (ivec && ivec->data){
@@ -155,10 +156,7 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
 
     krb5int_c_iov_get_block(dbuf, dlen, data, num_data, &input_pos);
 
-    AES_set_encrypt_key(key->keyblock.contents,
-                        NUM_BITS * key->keyblock.length, &enck);
-
-    size = CRYPTO_cts128_encrypt((unsigned char *)dbuf, oblock, dlen, &enck,
+    size = CRYPTO_cts128_encrypt((unsigned char *)dbuf, oblock, dlen, enck,
                                  iv_cts, (cbc128_f)AES_cbc_encrypt);
     if (size <= 0) {
         ret = KRB5_CRYPTO_INTERNAL;
@@ -178,8 +176,10 @@ cts_encr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     return ret;
 }
 
+/* Decrypt a message of more than one block using CTS, with the expanded key
+ * deck. */
 static krb5_error_code
-cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
+cts_decr(const AES_KEY *deck, const krb5_data *ivec, krb5_crypto_iov *data,
          size_t num_data, size_t dlen)
 {
     int                    ret = 0;
@@ -188,7 +188,6 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
     unsigned char         *dbuf = NULL;
     unsigned char          iv_cts[IV_CTS_BUF_SIZE];
     struct iov_block_state input_pos, output_pos;
-    AES_KEY                deck;
 
     memset(iv_cts,0,sizeof(iv_cts));
     if (ivec && ivec->data){
@@ -209,13 +208,10 @@ cts_decr(krb5_key key, const krb5_data *ivec, krb5_crypto_iov *data,
         return ENOMEM;
     }
 
-    AES_set_decrypt_key(key->keyblock.contents,
-                        NUM_BITS * key->keyblock.length, &deck);
-
     krb5int_c_iov_get_block(dbuf, dlen, data, num_data, &input_pos);
 
     size = CRYPTO_cts128_decrypt((unsigned char *)dbuf, oblock,
-                                 dlen, &deck,
+                                 dlen, deck,
                                  iv_cts, (cbc128_f)AES_cbc_encrypt);
     if (size <= 0)
         ret = KRB5_CRYPTO_INTERNAL;
@@ -255,7 +251,12 @@ krb5int_aes_encrypt(krb5_key key, const krb5_data *ivec,
             return KRB5_BAD_MSIZE;
         ret = cbc_enc(key, ivec, data, num_data);
     } else if (nblocks > 1) {
-        ret = cts_encr(key, ivec, data, num_data, input_length);
+        AES_KEY enck;
+
+        AES_set_encrypt_key(key->keyblock.contents,
+                            NUM_BITS * key->keyblock.length, &enck);
+        ret = cts_encr(&enck, ivec, data, num_data, input_length);
+        zap(&enck, sizeof(enck));
     }
 
     return ret;
@@ -282,12 +283,84 @@ krb5int_aes_decrypt(krb5_key key, const krb5_data *ivec,
             return KRB5_BAD_MSIZE;
         ret = cbc_decr(key, ivec, data, num_data);
     } else if (nblocks > 1) {
-        ret = cts_decr(key, ivec, data, num_data, input_length);
+        AES_KEY deck;
+
+        AES_set_decrypt_key(key->keyblock.contents,
+                            NUM_BITS * key->keyblock.length, &deck);
+        ret = cts_decr(&deck, ivec, data, num_data, input_length);
+        zap(&deck, sizeof(deck));
+    }
+
+    return ret;
+}
+
+/*
+ * Encrypt or decrypt count messages with a null cipher state, expanding the
+ * key only once.  With a zero IV, CBC mode on a single block is the same as
+ * the raw block cipher.
+ */
+static krb5_error_code
+crypt_batch(krb5_key key, krb5_crypto_iov **data, const size_t *num_data,
+            size_t count, int encrypt)
+{
+    krb5_error_code ret = 0;
+    unsigned char block[BLOCK_SIZE];
+    struct iov_block_state input_pos, output_pos;
+    size_t input_length, i, j;
+    AES_KEY aeskey;
+
+    if (encrypt) {
+        AES_set_encrypt_key(key->keyblock.contents,
+                            NUM_BITS * key->keyblock.length, &aeskey);
+    } else {
+        AES_set_decrypt_key(key->keyblock.contents,
+                            NUM_BITS * key->keyblock.length, &aeskey);
+    }
+
+    for (i = 0; i < count && ret == 0; i++) {
+        for (j = 0, input_length = 0; j < num_data[i]; j++) {
+            if (ENCRYPT_IOV(&data[i][j]))
+                input_length += data[i][j].data.length;
+        }
+        if (input_length == BLOCK_SIZE) {
+            IOV_BLOCK_STATE_INIT(&input_pos);
+            IOV_BLOCK_STATE_INIT(&output_pos);
+            krb5int_c_iov_get_block(block, BLOCK_SIZE, data[i], num_data[i],
+                                    &input_pos);
+            if (encrypt)
+                AES_encrypt(block, block, &aeskey);
+            else
+                AES_decrypt(block, block, &aeskey);
+            krb5int_c_iov_put_block(data[i], num_data[i], block, BLOCK_SIZE,
+                                    &output_pos);
+        } else if (input_length < BLOCK_SIZE) {
+            ret = (input_length == 0) ? 0 : KRB5_BAD_MSIZE;
+        } else if (encrypt) {
+            ret = cts_encr(&aeskey, NULL, data[i], num_data[i], input_length);
+        } else {
+            ret = cts_decr(&aeskey, NULL, data[i], num_data[i], input_length);
+        }
     }
 
+    zap(block, sizeof(block));
+    zap(&aeskey, sizeof(aeskey));
     return ret;
 }
 
+static krb5_error_code
+aes_encrypt_batch(krb5_key key, krb5_crypto_iov **data,
+                  const size_t *num_data, size_t count)
+{
+    return crypt_batch(key, data, num_data, count, 1);
+}
+
+static krb5_error_code
+aes_decrypt_batch(krb5_key key, krb5_crypto_iov **data,
+                  const size_t *num_data, size_t count)
+{
+    return crypt_batch(key, data, num_data, count, 0);
+}
+
 static krb5_error_code
 krb5int_aes_init_state (const krb5_keyblock *key, krb5_keyusage usage,
                         krb5_data *state)
@@ -306,7 +379,10 @@ const struct krb5_enc_provider krb5int_enc_aes128 = {
     krb5int_aes_decrypt,
     NULL,
     krb5int_aes_init_state,
-    krb5int_default_free_state
+    krb5int_default_free_state,
+    NULL,
+    aes_encrypt_batch,
+    aes_decrypt_batch
 };
 
 const struct krb5_enc_provider krb5int_enc_aes256 = {
@@ -316,5 +392,8 @@ const struct krb5_enc_provider krb5int_enc_aes256 = {
     krb5int_aes_decrypt,
     NULL,
     krb5int_aes_init_state,
-    krb5int_default_free_state
+    krb5int_default_free_state,
+    NULL,
+    aes_encrypt_batch,
+    aes_decrypt_batch
 };
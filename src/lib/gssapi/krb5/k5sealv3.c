@@ -112,9 +112,10 @@ gss_krb5int_make_seal_token_v3 (krb5_context context,
 #endif
 
     if (toktype == KG_TOK_WRAP_MSG && conf_req_flag) {
-        krb5_data plain;
-        krb5_enc_data cipher;
+        krb5_data cipher;
         size_t ec_max;
+        unsigned int header_len, plain_len;
+        unsigned char *plain;
 
         /* 300: Adds some slop.  */
         if (SIZE_MAX - 300 < message->length)
@@ -128,19 +129,19 @@ gss_krb5int_make_seal_token_v3 (krb5_context context,
 #else
         ec = 0;
 #endif
-        plain.length = message->length + 16 + ec;
-        plain.data = malloc(message->length + 16 + ec);
-        if (plain.data == NULL)
-            return ENOMEM;
+        plain_len = message->length + 16 + ec;
+
+        err = krb5_c_crypto_length(context, key->keyblock.enctype,
+                                   KRB5_CRYPTO_TYPE_HEADER, &header_len);
+        if (err)
+            return err;
 
         /* Get size of ciphertext.  */
-        bufsize = 16 + krb5_encrypt_size (plain.length, key->keyblock.enctype);
+        bufsize = 16 + krb5_encrypt_size(plain_len, key->keyblock.enctype);
         /* Allocate space for header plus encrypted data.  */
         outbuf = gssalloc_malloc(bufsize);
-        if (outbuf == NULL) {
-            free(plain.data);
+        if (outbuf == NULL)
             return ENOMEM;
-        }
 
         /* TOK_ID */
         store_16_be(KG2_TOK_WRAP_MSG, outbuf);
@@ -156,18 +157,17 @@ gss_krb5int_make_seal_token_v3 (krb5_context context,
         store_16_be(0, outbuf+6);
         store_64_be(ctx->seq_send, outbuf+8);
 
-        memcpy(plain.data, message->value, message->length);
+        /* Build the plaintext directly in the token, after room for the
+         * encryption header, and encrypt it in place. */
+        plain = outbuf + 16 + header_len;
+        memcpy(plain, message->value, message->length);
         if (ec != 0)
-            memset(plain.data + message->length, 'x', ec);
-        memcpy(plain.data + message->length + ec, outbuf, 16);
+            memset(plain + message->length, 'x', ec);
+        memcpy(plain + message->length + ec, outbuf, 16);
 
-        cipher.ciphertext.data = (char *)outbuf + 16;
-        cipher.ciphertext.length = bufsize - 16;
-        cipher.enctype = key->keyblock.enctype;
-        err = krb5_k_encrypt(context, key, key_usage, 0, &plain, &cipher);
-        zap(plain.data, plain.length);
-        free(plain.data);
-        plain.data = 0;
+        cipher = make_data(outbuf + 16, bufsize - 16);
+        err = krb5_k_encrypt_inplace(context, key, key_usage, 0, &cipher,
+                                     plain_len);
         if (err)
             goto error;
 
@@ -159,6 +159,7 @@ typedef long            kadm5_ret_t;
 #define KADM5_CONFIG_IPROP_LOGFILE      0x08000000
 #define KADM5_CONFIG_IPROP_PORT         0x10000000
 #define KADM5_CONFIG_KVNO               0x20000000
+#define KADM5_CONFIG_ULOG_SYNC_WINDOW   0x40000000
 /*
  * permission bits
  */
@@ -260,6 +261,7 @@ typedef struct _kadm5_config_params {
     char *              iprop_logfile;
 /*    char *            iprop_server;*/
     int                 iprop_port;
+    uint32_t            iprop_ulog_sync_window;
 } kadm5_config_params;
 
 /***********************************************************************
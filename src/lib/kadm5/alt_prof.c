@@ -823,6 +823,19 @@ krb5_error_code kadm5_get_config_params(context, use_kdc_config,
         }
     }
 
+    hierarchy[2] = KRB5_CONF_IPROP_ULOG_SYNC_WINDOW;
+
+    params.iprop_ulog_sync_window = 0;
+    params.mask |= KADM5_CONFIG_ULOG_SYNC_WINDOW;
+
+    if (params_in->mask & KADM5_CONFIG_ULOG_SYNC_WINDOW) {
+        params.iprop_ulog_sync_window = params_in->iprop_ulog_sync_window;
+    } else {
+        if (aprofile && !krb5_aprof_get_int32(aprofile, hierarchy,
+                                              TRUE, &ivalue) && ivalue > 0)
+            params.iprop_ulog_sync_window = ivalue;
+    }
+
     GET_DELTAT_PARAM(iprop_poll_time, KADM5_CONFIG_POLL_TIME,
                      KRB5_CONF_IPROP_SLAVE_POLL, 2 * 60); /* 2m */
 
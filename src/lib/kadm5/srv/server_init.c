@@ -436,6 +436,10 @@ kadm5_init_iprop(void *handle, char **db_args)
                                iprop_h->params.iprop_ulogsize,
                                FKCOMMAND, db_args)) != 0)
             return (retval);
+        retval = ulog_set_sync_window(iprop_h->context,
+                                      iprop_h->params.iprop_ulog_sync_window);
+        if (retval)
+            return (retval);
     }
     return (0);
 }
@@ -199,6 +199,15 @@ struct kdb_last_t {
 	kdbe_time_t	last_time;
 };
 
+/*
+ * Long-poll request: the slave's last entry, and the number of seconds
+ * the master may hold the call waiting for new updates.
+ */
+struct kdb_incr_wait_t {
+	kdb_last_t	last;
+	uint32_t	timeout;
+};
+
 struct kdb_incr_result_t {
 	kdb_last_t		lastentry;
 	kdb_ulog_t		updates;
@@ -239,5 +248,21 @@ program KRB5_IPROP_PROG {
 		 */
 		kdb_fullresync_result_t
 		IPROP_FULL_RESYNC_EXT(uint32_t) = 3;
+
+		/*
+		 * Like IPROP_GET_UPDATES, but if there are no new
+		 * updates, hold the call until the update log advances
+		 * or the timeout expires.
+		 */
+		kdb_incr_result_t
+		IPROP_GET_UPDATES_WAIT(kdb_incr_wait_t) = 4;
+
+		/*
+		 * Like IPROP_FULL_RESYNC_EXT, but the master streams
+		 * the dump to the slave as it is generated, using the
+		 * kprop streaming protocol.
+		 */
+		kdb_fullresync_result_t
+		IPROP_FULL_RESYNC_STREAM(uint32_t) = 5;
 	} = 1;
 } = 100423;
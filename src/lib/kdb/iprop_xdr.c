@@ -327,6 +327,18 @@ xdr_kdb_last_t (XDR *xdrs, kdb_last_t *objp)
     return TRUE;
 }
 
+bool_t
+xdr_kdb_incr_wait_t (XDR *xdrs, kdb_incr_wait_t *objp)
+{
+    register int32_t *buf;
+
+    if (!xdr_kdb_last_t (xdrs, &objp->last))
+        return FALSE;
+    if (!xdr_uint32_t (xdrs, &objp->timeout))
+        return FALSE;
+    return TRUE;
+}
+
 bool_t
 xdr_kdb_incr_result_t (XDR *xdrs, kdb_incr_result_t *objp)
 {
@@ -666,6 +666,9 @@ krb5_db_fini(krb5_context kcontext)
     if (kcontext->dal_handle == NULL)
         return 0;
 
+    /* Sync any update log entries left pending by group commit. */
+    (void) ulog_sync_pending(kcontext);
+
     v = &kcontext->dal_handle->lib_handle->vftabl;
     status = v->fini_module(kcontext);
 
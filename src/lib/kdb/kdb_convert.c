@@ -574,23 +574,20 @@ ulog_conv_2logentry(krb5_context context, krb5_db_entry *entry,
     return (0);
 }
 
-/* Convert an update log (ulog) entry into a kerberos record. */
-krb5_error_code
-ulog_conv_2dbentry(krb5_context context, krb5_db_entry **entry,
-                   kdb_incr_update_t *update)
+/*
+ * Apply the attributes changed by an update log (ulog) entry to ent.  is_add
+ * indicates that ent is a newly allocated record.
+ */
+static krb5_error_code
+apply_update(krb5_context context, krb5_db_entry *ent, krb5_boolean is_add,
+             kdb_incr_update_t *update)
 {
-    krb5_db_entry *ent;
     int slave;
     krb5_principal mod_princ = NULL;
     int i, j, cnt = 0, mod_time = 0, nattrs;
-    krb5_principal dbprinc;
-    char *dbprincstr = NULL;
     krb5_tl_data newtl;
     krb5_error_code ret;
     unsigned int prev_n_keys = 0;
-    krb5_boolean is_add;
-
-    *entry = NULL;
 
     slave = (context->kdblog_context != NULL) &&
         (context->kdblog_context->iproprole == IPROP_SLAVE);
@@ -600,36 +597,6 @@ ulog_conv_2dbentry(krb5_context context, krb5_db_entry **entry,
      */
     nattrs = update->kdb_update.kdbe_t_len;
 
-    dbprincstr = malloc((update->kdb_princ_name.utf8str_t_len + 1)
-                        * sizeof (char));
-    if (dbprincstr == NULL)
-        return (ENOMEM);
-    strncpy(dbprincstr, (char *)update->kdb_princ_name.utf8str_t_val,
-            update->kdb_princ_name.utf8str_t_len);
-    dbprincstr[update->kdb_princ_name.utf8str_t_len] = 0;
-
-    ret = krb5_parse_name(context, dbprincstr, &dbprinc);
-    free(dbprincstr);
-    if (ret)
-        return (ret);
-
-    ret = krb5_db_get_principal(context, dbprinc, 0, &ent);
-    krb5_free_principal(context, dbprinc);
-    if (ret && ret != KRB5_KDB_NOENTRY)
-        return (ret);
-    is_add = (ret == KRB5_KDB_NOENTRY);
-
-    /*
-     * Set ent->n_tl_data = 0 initially, if this is an ADD update
-     */
-    if (is_add) {
-        ent = krb5_db_alloc(context, NULL, sizeof(*ent));
-        if (ent == NULL)
-            return (ENOMEM);
-        memset(ent, 0, sizeof(*ent));
-        ent->n_tl_data = 0;
-    }
-
     for (i = 0; i < nattrs; i++) {
         krb5_principal tmpprinc = NULL;
 
@@ -782,10 +749,72 @@ ulog_conv_2dbentry(krb5_context context, krb5_db_entry **entry,
             return (ret);
     }
 
+    return (0);
+}
+
+/* Convert an update log (ulog) entry into a kerberos record. */
+krb5_error_code
+ulog_conv_2dbentry(krb5_context context, krb5_db_entry **entry,
+                   kdb_incr_update_t *update)
+{
+    krb5_db_entry *ent;
+    krb5_principal dbprinc;
+    char *dbprincstr = NULL;
+    krb5_error_code ret;
+    krb5_boolean is_add;
+
+    *entry = NULL;
+
+    dbprincstr = malloc((update->kdb_princ_name.utf8str_t_len + 1)
+                        * sizeof (char));
+    if (dbprincstr == NULL)
+        return (ENOMEM);
+    strncpy(dbprincstr, (char *)update->kdb_princ_name.utf8str_t_val,
+            update->kdb_princ_name.utf8str_t_len);
+    dbprincstr[update->kdb_princ_name.utf8str_t_len] = 0;
+
+    ret = krb5_parse_name(context, dbprincstr, &dbprinc);
+    free(dbprincstr);
+    if (ret)
+        return (ret);
+
+    ret = krb5_db_get_principal(context, dbprinc, 0, &ent);
+    krb5_free_principal(context, dbprinc);
+    if (ret && ret != KRB5_KDB_NOENTRY)
+        return (ret);
+    is_add = (ret == KRB5_KDB_NOENTRY);
+
+    /*
+     * Set ent->n_tl_data = 0 initially, if this is an ADD update
+     */
+    if (is_add) {
+        ent = krb5_db_alloc(context, NULL, sizeof(*ent));
+        if (ent == NULL)
+            return (ENOMEM);
+        memset(ent, 0, sizeof(*ent));
+        ent->n_tl_data = 0;
+    }
+
+    ret = apply_update(context, ent, is_add, update);
+    if (ret)
+        return (ret);
+
     *entry = ent;
     return (0);
 }
 
+/*
+ * Apply a later update log (ulog) entry for the same principal to an entry
+ * produced by ulog_conv_2dbentry(), so that several updates to a principal
+ * can be written to the database at once.
+ */
+krb5_error_code
+ulog_conv_merge(krb5_context context, krb5_db_entry *entry,
+                kdb_incr_update_t *update)
+{
+    return apply_update(context, entry, FALSE, update);
+}
+
 
 
 /*
@@ -370,6 +370,160 @@ make_random_salt(krb5_context context, krb5_keysalt *salt_out)
     return 0;
 }
 
+/* The most threads used to compute the keys of one password change. */
+#define MAX_S2K_THREADS 4
+
+#if defined(ENABLE_THREADS) && HAVE_PTHREAD
+#define USE_S2K_THREADS
+/* Like libkrb5support, don't force the thread library on applications; use
+ * the serial path unless it has been loaded. */
+#ifdef HAVE_PRAGMA_WEAK_REF
+# pragma weak pthread_create
+# pragma weak pthread_join
+#endif
+#endif
+
+/* One string-to-key computation of a password change. */
+struct s2k_job {
+    krb5_enctype enctype;
+    krb5_keysalt salt;
+    const krb5_data *params;
+    krb5_keyblock key;
+    krb5_error_code ret;
+};
+
+struct s2k_queue {
+    k5_mutex_t lock;
+    const krb5_data *pwd;
+    struct s2k_job *jobs;
+    int njobs;
+    int next;
+};
+
+/* Run jobs from the queue until none are left. */
+static void *
+s2k_worker(void *arg)
+{
+    struct s2k_queue *q = arg;
+    struct s2k_job *job;
+    int i;
+
+    for (;;) {
+        if (k5_mutex_lock(&q->lock) != 0)
+            return NULL;
+        i = q->next++;
+        k5_mutex_unlock(&q->lock);
+        if (i >= q->njobs)
+            return NULL;
+        job = &q->jobs[i];
+        /* The crypto library does not use the context for string-to-key. */
+        job->ret = krb5_c_string_to_key_with_params(NULL, job->enctype,
+                                                    q->pwd, &job->salt.data,
+                                                    job->params, &job->key);
+    }
+}
+
+/*
+ * Compute the keys of njobs jobs from pwd.  The computations are independent
+ * and, for enctypes with high iteration counts, slow, so they are spread over
+ * a few threads where possible.  The calling thread works through the queue
+ * as well, so the jobs are done even if no thread can be created.
+ */
+static void
+run_s2k_jobs(const krb5_data *pwd, struct s2k_job *jobs, int njobs)
+{
+    struct s2k_queue q;
+#ifdef USE_S2K_THREADS
+    pthread_t threads[MAX_S2K_THREADS - 1];
+    int nthreads = 0;
+#endif
+    int i;
+
+    q.pwd = pwd;
+    q.jobs = jobs;
+    q.njobs = njobs;
+    q.next = 0;
+    if (k5_mutex_init(&q.lock) != 0) {
+        for (i = 0; i < njobs; i++)
+            jobs[i].ret = ENOMEM;
+        return;
+    }
+
+#ifdef USE_S2K_THREADS
+    if (K5_PTHREADS_LOADED) {
+        for (i = 1; i < njobs && i < MAX_S2K_THREADS; i++) {
+            if (pthread_create(&threads[nthreads], NULL, s2k_worker, &q) != 0)
+                break;
+            nthreads++;
+        }
+    }
+#endif
+
+    (void)s2k_worker(&q);
+
+#ifdef USE_S2K_THREADS
+    for (i = 0; i < nthreads; i++)
+        (void)pthread_join(threads[i], NULL);
+#endif
+    k5_mutex_destroy(&q.lock);
+}
+
+/* Compute the salt for tuple in job. */
+static krb5_error_code
+make_job_salt(krb5_context context, krb5_key_salt_tuple *tuple,
+              krb5_db_entry *db_entry, struct s2k_job *job)
+{
+    static const krb5_data afs_params = { KV5M_DATA, 1, "\1" };
+    krb5_error_code retval;
+    krb5_keysalt *key_salt = &job->salt;
+
+    job->enctype = tuple->ks_enctype;
+    job->params = NULL;
+
+    switch (key_salt->type = tuple->ks_salttype) {
+    case KRB5_KDB_SALTTYPE_ONLYREALM: {
+        krb5_data * saltdata;
+        if ((retval = krb5_copy_data(context, krb5_princ_realm(context,
+                                                               db_entry->princ), &saltdata)))
+            return(retval);
+
+        key_salt->data = *saltdata;
+        free(saltdata);
+    }
+        break;
+    case KRB5_KDB_SALTTYPE_NOREALM:
+        if ((retval=krb5_principal2salt_norealm(context, db_entry->princ,
+                                                &key_salt->data)))
+            return(retval);
+        break;
+    case KRB5_KDB_SALTTYPE_NORMAL:
+        if ((retval = krb5_principal2salt(context, db_entry->princ,
+                                          &key_salt->data)))
+            return(retval);
+        break;
+    case KRB5_KDB_SALTTYPE_V4:
+        key_salt->data.length = 0;
+        key_salt->data.data = 0;
+        break;
+    case KRB5_KDB_SALTTYPE_AFS3:
+        retval = krb5int_copy_data_contents(context,
+                                            &db_entry->princ->realm,
+                                            &key_salt->data);
+        if (retval)
+            return retval;
+        job->params = &afs_params;
+        break;
+    case KRB5_KDB_SALTTYPE_SPECIAL:
+        retval = make_random_salt(context, key_salt);
+        if (retval)
+            return retval;
+        break;
+    default:
+        return(KRB5_KDB_BAD_SALTTYPE);
+    }
+    return 0;
+}
+
 /*
  * Add key_data for a krb5_db_entry
  * If passwd is NULL the assumes that the caller wants a random password.
@@ -386,18 +540,23 @@ add_key_pwd(context, master_key, ks_tuple, ks_tuple_count, passwd,
     int                   kvno;
 {
     krb5_error_code       retval;
-    krb5_keysalt          key_salt;
-    krb5_keyblock         key;
     krb5_data             pwd;
-    krb5_data             afs_params = string2data("\1"), *s2k_params = NULL;
-    int                   i, j, k;
+    int                   i, j, k, njobs = 0;
     krb5_key_data         tmp_key_data;
     krb5_key_data        *tptr;
+    struct s2k_job       *jobs = NULL, *job;
 
     memset( &tmp_key_data, 0, sizeof(tmp_key_data));
 
     retval = 0;
 
+    if (ks_tuple_count <= 0)
+        return 0;
+    jobs = calloc(ks_tuple_count, sizeof(*jobs));
+    if (jobs == NULL)
+        return ENOMEM;
+
+    /* Compute the salts, in order, for each distinct enctype and salt. */
     for (i = 0; i < ks_tuple_count; i++) {
         krb5_boolean similar;
 
@@ -413,7 +572,7 @@ add_key_pwd(context, master_key, ks_tuple, ks_tuple_count, passwd,
                                                  ks_tuple[i].ks_enctype,
                                                  ks_tuple[j].ks_enctype,
                                                  &similar)))
-                return(retval);
+                goto add_key_pwd_err;
 
             if (similar &&
                 (ks_tuple[j].ks_salttype == ks_tuple[i].ks_salttype))
@@ -423,75 +582,35 @@ add_key_pwd(context, master_key, ks_tuple, ks_tuple_count, passwd,
         if (j < i)
             continue;
 
-        if ((retval = krb5_dbe_create_key_data(context, db_entry)))
-            return(retval);
-
-        /* Convert password string to key using appropriate salt */
-        switch (key_salt.type = ks_tuple[i].ks_salttype) {
-        case KRB5_KDB_SALTTYPE_ONLYREALM: {
-            krb5_data * saltdata;
-            if ((retval = krb5_copy_data(context, krb5_princ_realm(context,
-                                                                   db_entry->princ), &saltdata)))
-                return(retval);
+        retval = make_job_salt(context, &ks_tuple[i], db_entry, &jobs[njobs]);
+        if (retval)
+            goto add_key_pwd_err;
+        njobs++;
+    }
 
-            key_salt.data = *saltdata;
-            free(saltdata);
-        }
-            break;
-        case KRB5_KDB_SALTTYPE_NOREALM:
-            if ((retval=krb5_principal2salt_norealm(context, db_entry->princ,
-                                                    &key_salt.data)))
-                return(retval);
-            break;
-        case KRB5_KDB_SALTTYPE_NORMAL:
-            if ((retval = krb5_principal2salt(context, db_entry->princ,
-                                              &key_salt.data)))
-                return(retval);
-            break;
-        case KRB5_KDB_SALTTYPE_V4:
-            key_salt.data.length = 0;
-            key_salt.data.data = 0;
-            break;
-        case KRB5_KDB_SALTTYPE_AFS3:
-            retval = krb5int_copy_data_contents(context,
-                                                &db_entry->princ->realm,
-                                                &key_salt.data);
-            if (retval)
-                return retval;
-            s2k_params = &afs_params;
-            break;
-        case KRB5_KDB_SALTTYPE_SPECIAL:
-            retval = make_random_salt(context, &key_salt);
-            if (retval)
-                return retval;
-            break;
-        default:
-            return(KRB5_KDB_BAD_SALTTYPE);
-        }
+    /* Convert password string to keys using the salts. */
+    pwd.data = passwd;
+    pwd.length = strlen(passwd);
+    run_s2k_jobs(&pwd, jobs, njobs);
 
-        pwd.data = passwd;
-        pwd.length = strlen(passwd);
+    /* Add the keys in tuple order, so the result does not depend on which
+     * computation finished first. */
+    for (i = 0; i < njobs; i++) {
+        job = &jobs[i];
+        retval = job->ret;
+        if (retval)
+            goto add_key_pwd_err;
 
-        retval = krb5_c_string_to_key_with_params(context,
-                                                  ks_tuple[i].ks_enctype,
-                                                  &pwd, &key_salt.data,
-                                                  s2k_params, &key);
-        if (retval) {
-            free(key_salt.data.data);
-            return retval;
-        }
+        if ((retval = krb5_dbe_create_key_data(context, db_entry)))
+            goto add_key_pwd_err;
 
         /* memory allocation to be done by db. So, use temporary block and later copy
            it to the memory allocated by db */
-        retval = krb5_dbe_encrypt_key_data(context, master_key, &key,
-                                           (const krb5_keysalt *)&key_salt,
+        retval = krb5_dbe_encrypt_key_data(context, master_key, &job->key,
+                                           (const krb5_keysalt *)&job->salt,
                                            kvno, &tmp_key_data);
-        if (key_salt.data.data)
-            free(key_salt.data.data);
-        free(key.contents);
-
         if( retval )
-            return retval;
+            goto add_key_pwd_err;
 
         tptr = &db_entry->key_data[db_entry->n_key_data-1];
 
@@ -530,6 +649,11 @@ add_key_pwd_err:
             free( tmp_key_data.key_data_contents[i] );
         }
     }
+    for (i = 0; i < njobs; i++) {
+        free(jobs[i].salt.data.data);
+        krb5_free_keyblock_contents(context, &jobs[i].key);
+    }
+    free(jobs);
 
     return(retval);
 }
@@ -58,32 +58,68 @@ ulog_lock(krb5_context ctx, int mode)
     return krb5_lock_file(ctx, log_ctx->ulogfd, mode);
 }
 
+/* Sync the pages of the mapped log containing addr through addr + len - 1 to
+ * disk. */
+static krb5_error_code
+sync_mapped(void *addr, size_t len)
+{
+    ulong_t             start, end;
+
+    if (!pagesize)
+        pagesize = getpagesize();
+
+    start = ((ulong_t)addr) & (~(pagesize-1));
+
+    end = (((ulong_t)addr) + len + (pagesize-1)) & (~(pagesize-1));
+
+    if (msync((caddr_t)start, end - start, MS_SYNC))
+        return (errno);
+
+    return (0);
+}
+
 /*
  * Sync update entry to disk.
  */
 static krb5_error_code
 ulog_sync_update(kdb_hlog_t *ulog, kdb_ent_header_t *upd)
 {
-    ulong_t             start, end, size;
+    if (ulog == NULL)
+        return (KRB5_LOG_ERROR);
+
+    return (sync_mapped(upd, ulog->kdb_block));
+}
+
+/*
+ * Sync the update entries with serial numbers first_sno through last_sno to
+ * disk, using at most two msync() calls.
+ */
+static krb5_error_code
+ulog_sync_range(kdb_hlog_t *ulog, uint32_t ulogentries, kdb_sno_t first_sno,
+                kdb_sno_t last_sno)
+{
     krb5_error_code     retval;
+    uint_t              i, j;
 
     if (ulog == NULL)
         return (KRB5_LOG_ERROR);
 
-    if (!pagesize)
-        pagesize = getpagesize();
+    if (last_sno < first_sno || last_sno - first_sno >= ulogentries)
+        return (sync_mapped((void *)INDEX(ulog, 0),
+                            ulogentries * ulog->kdb_block));
 
-    start = ((ulong_t)upd) & (~(pagesize-1));
+    i = (first_sno - 1) % ulogentries;
+    j = (last_sno - 1) % ulogentries;
+    if (i <= j)
+        return (sync_mapped((void *)INDEX(ulog, i),
+                            (j - i + 1) * ulog->kdb_block));
 
-    end = (((ulong_t)upd) + ulog->kdb_block +
-           (pagesize-1)) & (~(pagesize-1));
-
-    size = end - start;
-    if ((retval = msync((caddr_t)start, size, MS_SYNC))) {
+    /* The range wraps around the end of the circular log. */
+    retval = sync_mapped((void *)INDEX(ulog, i),
+                         (ulogentries - i) * ulog->kdb_block);
+    if (retval)
         return (retval);
-    }
-
-    return (0);
+    return (sync_mapped((void *)INDEX(ulog, 0), (j + 1) * ulog->kdb_block));
 }
 
 /*
@@ -154,6 +190,81 @@ ulog_resize(kdb_hlog_t *ulog, uint32_t ulogentries, int ulogfd, uint_t recsize)
     return (0);
 }
 
+/*
+ * Sync any updates that were committed to the log under group commit but not
+ * yet synced, along with the log header.
+ */
+krb5_error_code
+ulog_sync_pending(krb5_context context)
+{
+    krb5_error_code     retval;
+    kdb_log_context     *log_ctx;
+    kdb_hlog_t          *ulog;
+
+    log_ctx = context->kdblog_context;
+    if (log_ctx == NULL || log_ctx->ulog == NULL || log_ctx->pending == 0)
+        return (0);
+    ulog = log_ctx->ulog;
+
+    retval = ulog_sync_range(ulog, log_ctx->ulogentries,
+                             log_ctx->pending_sno, ulog->kdb_last_sno);
+    if (retval)
+        return (retval);
+    ulog_sync_header(ulog);
+
+    log_ctx->pending = 0;
+    return (0);
+}
+
+/*
+ * Set the group commit window of the update log in milliseconds.  With a
+ * window of 0 (the default), each update is synced to disk as it is added and
+ * again as it is committed.  Otherwise committed updates are synced together,
+ * once the window has passed since the first of them, when a slave asks for
+ * them, or when ulog_sync_pending() is called.
+ */
+krb5_error_code
+ulog_set_sync_window(krb5_context context, uint32_t window)
+{
+    kdb_log_context     *log_ctx;
+    krb5_error_code     retval;
+
+    log_ctx = context->kdblog_context;
+    if (log_ctx == NULL)
+        return (KRB5_LOG_ERROR);
+
+    if (window == 0 && (retval = ulog_sync_pending(context)))
+        return (retval);
+    log_ctx->sync_window = window;
+    return (0);
+}
+
+/*
+ * Record that the update with serial number sno was committed without being
+ * synced, and sync all pending updates if the group commit window has passed.
+ */
+static krb5_error_code
+ulog_defer_sync(krb5_context context, kdb_sno_t sno)
+{
+    kdb_log_context     *log_ctx = context->kdblog_context;
+    struct timeval      now;
+    long                elapsed;
+
+    (void) gettimeofday(&now, NULL);
+    if (log_ctx->pending++ == 0) {
+        log_ctx->pending_sno = sno;
+        log_ctx->pending_time.seconds = now.tv_sec;
+        log_ctx->pending_time.useconds = now.tv_usec;
+        return (0);
+    }
+
+    elapsed = (now.tv_sec - (long)log_ctx->pending_time.seconds) * 1000 +
+        (now.tv_usec - (long)log_ctx->pending_time.useconds) / 1000;
+    if (elapsed >= 0 && (unsigned long)elapsed < log_ctx->sync_window)
+        return (0);
+    return (ulog_sync_pending(context));
+}
+
 /*
  * Adds an entry to the update log.
  * The layout of the update log looks like:
@@ -233,7 +344,9 @@ ulog_add_update(krb5_context context, kdb_incr_update_t *upd)
     if (!xdr_kdb_incr_update_t(&xdrs, upd))
         return (KRB5_LOG_CONV);
 
-    if ((retval = ulog_sync_update(ulog, indx_log)))
+    /* Under group commit, the entry is synced once it is committed. */
+    if (!log_ctx->sync_window &&
+        (retval = ulog_sync_update(ulog, indx_log)))
         return (retval);
 
     if (ulog->kdb_num < ulogentries)
@@ -256,7 +369,8 @@ ulog_add_update(krb5_context context, kdb_incr_update_t *upd)
         ulog->kdb_first_time = indx_log->kdb_time;
     }
 
-    ulog_sync_header(ulog);
+    if (!log_ctx->sync_window)
+        ulog_sync_header(ulog);
 
     return (0);
 }
@@ -286,6 +400,9 @@ ulog_finish_update(krb5_context context, kdb_incr_update_t *upd)
 
     ulog->kdb_state = KDB_STABLE;
 
+    if (log_ctx->sync_window)
+        return (ulog_defer_sync(context, upd->kdb_entry_sno));
+
     if ((retval = ulog_sync_update(ulog, indx_log)))
         return (retval);
 
@@ -319,30 +436,124 @@ ulog_delete_update(krb5_context context, kdb_incr_update_t *upd)
     return (ulog_add_update(context, upd));
 }
 
+/* Order updates by principal name, and by log order within a principal. */
+static int
+cmp_update(const void *a, const void *b)
+{
+    const kdb_incr_update_t *ua = *(kdb_incr_update_t *const *)a;
+    const kdb_incr_update_t *ub = *(kdb_incr_update_t *const *)b;
+    unsigned int la = ua->kdb_princ_name.utf8str_t_len;
+    unsigned int lb = ub->kdb_princ_name.utf8str_t_len;
+    int cmp;
+
+    cmp = memcmp(ua->kdb_princ_name.utf8str_t_val,
+                 ub->kdb_princ_name.utf8str_t_val, (la < lb) ? la : lb);
+    if (cmp != 0)
+        return cmp;
+    if (la != lb)
+        return (la < lb) ? -1 : 1;
+    return (ua < ub) ? -1 : (ua > ub);
+}
+
+static krb5_boolean
+same_princ(kdb_incr_update_t *ua, kdb_incr_update_t *ub)
+{
+    return (ua->kdb_princ_name.utf8str_t_len ==
+            ub->kdb_princ_name.utf8str_t_len &&
+            memcmp(ua->kdb_princ_name.utf8str_t_val,
+                   ub->kdb_princ_name.utf8str_t_val,
+                   ua->kdb_princ_name.utf8str_t_len) == 0);
+}
+
+/*
+ * Delete the principal named by upd.  If superseded is set, earlier updates
+ * to the principal were skipped in favor of this one, so it may not exist.
+ */
+static krb5_error_code
+replay_delete(krb5_context context, kdb_incr_update_t *upd,
+              krb5_boolean superseded)
+{
+    krb5_principal dbprinc;
+    char *dbprincstr;
+    krb5_error_code retval;
+
+    dbprincstr = k5alloc(upd->kdb_princ_name.utf8str_t_len + 1, &retval);
+    if (dbprincstr == NULL)
+        return retval;
+    memcpy(dbprincstr, upd->kdb_princ_name.utf8str_t_val,
+           upd->kdb_princ_name.utf8str_t_len);
+
+    retval = krb5_parse_name(context, dbprincstr, &dbprinc);
+    free(dbprincstr);
+    if (retval)
+        return retval;
+
+    retval = krb5int_delete_principal_no_log(context, dbprinc);
+    krb5_free_principal(context, dbprinc);
+    if (retval == KRB5_KDB_NOENTRY && superseded)
+        retval = 0;
+    return retval;
+}
+
+/*
+ * Apply the updates for one principal, ups[0] to ups[n - 1] in log order.
+ * Updates before the last deletion have no effect on the result and are
+ * skipped; the updates after it are merged and written once.
+ */
+static krb5_error_code
+replay_princ(krb5_context context, kdb_incr_update_t **ups, int n)
+{
+    krb5_db_entry *entry = NULL;
+    krb5_error_code retval;
+    int i, first = 0;
+
+    for (i = n - 1; i >= 0; i--) {
+        if (ups[i]->kdb_deleted) {
+            retval = replay_delete(context, ups[i], i > 0);
+            if (retval)
+                return retval;
+            first = i + 1;
+            break;
+        }
+    }
+
+    for (i = first; i < n; i++) {
+        if (entry == NULL)
+            retval = ulog_conv_2dbentry(context, &entry, ups[i]);
+        else
+            retval = ulog_conv_merge(context, entry, ups[i]);
+        if (retval)
+            goto cleanup;
+    }
+    retval = (entry != NULL) ? krb5int_put_principal_no_log(context, entry) : 0;
+
+cleanup:
+    krb5_db_free_principal(context, entry);
+    return retval;
+}
+
 /*
  * Used by the slave or master (during ulog_check) to update it's hash db from
- * the incr update log.
+ * the incr update log.  The updates are applied under one database lock, and
+ * repeated updates to a principal are combined into one write.
  *
  * Must be called with lock held.
  */
 krb5_error_code
 ulog_replay(krb5_context context, kdb_incr_result_t *incr_ret, char **db_args)
 {
-    krb5_db_entry       *entry = NULL;
-    kdb_incr_update_t   *upd = NULL, *fupd;
-    int                 i, no_of_updates;
+    kdb_incr_update_t   **ups = NULL, *fupd;
+    int                 i, j, n, no_of_updates;
     krb5_error_code     retval;
-    krb5_principal      dbprinc = NULL;
     kdb_last_t          errlast;
-    char                *dbprincstr = NULL;
     kdb_log_context     *log_ctx;
     kdb_hlog_t          *ulog = NULL;
+    krb5_boolean        db_locked = FALSE;
 
     INIT_ULOG(context);
 
     no_of_updates = incr_ret->updates.kdb_ulog_t_len;
-    upd = incr_ret->updates.kdb_ulog_t_val;
-    fupd = upd;
+    fupd = incr_ret->updates.kdb_ulog_t_val;
 
     /*
      * We reset last_sno and last_time to 0, if krb5_db2_db_put_principal
@@ -356,67 +567,39 @@ ulog_replay(krb5_context context, kdb_incr_result_t *incr_ret, char **db_args)
                                KRB5_KDB_OPEN_RW|KRB5_KDB_SRV_TYPE_ADMIN)))
         goto cleanup;
 
-    for (i = 0; i < no_of_updates; i++) {
-        if (!upd->kdb_commit)
-            continue;
-
-        if (upd->kdb_deleted) {
-            dbprincstr = malloc((upd->kdb_princ_name.utf8str_t_len
-                                 + 1) * sizeof (char));
-
-            if (dbprincstr == NULL) {
-                retval = ENOMEM;
-                goto cleanup;
-            }
-
-            (void) strncpy(dbprincstr,
-                           (char *)upd->kdb_princ_name.utf8str_t_val,
-                           (upd->kdb_princ_name.utf8str_t_len + 1));
-            dbprincstr[upd->kdb_princ_name.utf8str_t_len] = 0;
-
-            if ((retval = krb5_parse_name(context, dbprincstr,
-                                          &dbprinc))) {
-                goto cleanup;
-            }
-
-            free(dbprincstr);
-
-            retval = krb5int_delete_principal_no_log(context, dbprinc);
-
-            if (dbprinc) {
-                krb5_free_principal(context, dbprinc);
-                dbprinc = NULL;
-            }
-
-            if (retval)
-                goto cleanup;
-        } else {
-            entry = (krb5_db_entry *)malloc(sizeof (krb5_db_entry));
-
-            if (!entry) {
-                retval = errno;
-                goto cleanup;
-            }
-
-            (void) memset(entry, 0, sizeof (krb5_db_entry));
-
-            if ((retval = ulog_conv_2dbentry(context, &entry, upd)))
-                goto cleanup;
-
-            retval = krb5int_put_principal_no_log(context, entry);
+    /* Group the committed updates by principal, keeping their log order. */
+    ups = k5alloc((no_of_updates + 1) * sizeof(*ups), &retval);
+    if (ups == NULL)
+        goto cleanup;
+    for (i = n = 0; i < no_of_updates; i++) {
+        if (fupd[i].kdb_commit)
+            ups[n++] = &fupd[i];
+    }
+    qsort(ups, n, sizeof(*ups), cmp_update);
 
-            if (entry) {
-                krb5_db_free_principal(context, entry);
-                entry = NULL;
-            }
-            if (retval)
-                goto cleanup;
-        }
+    /*
+     * Hold the database lock across the batch, so that the database is
+     * opened and flushed once rather than once per update.  A module
+     * without locking support locks each write itself.
+     */
+    retval = krb5_db_lock(context, KRB5_DB_LOCKMODE_EXCLUSIVE);
+    if (retval == 0)
+        db_locked = TRUE;
+    else if (retval != KRB5_PLUGIN_OP_NOTSUPP)
+        goto cleanup;
 
-        upd++;
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && same_princ(ups[i], ups[j]); j++);
+        retval = replay_princ(context, &ups[i], j - i);
+        if (retval)
+            goto cleanup;
     }
+    retval = 0;
 
 cleanup:
+    if (db_locked)
+        (void) krb5_db_unlock(context);
+    free(ups);
     if (fupd)
         ulog_free_entries(fupd, no_of_updates);
 
@@ -716,12 +899,13 @@ ulog_map(krb5_context context, const char *logname, uint32_t ulogentries,
 }
 
 /*
- * Get the last set of updates seen, (last+1) to n is returned.
+ * Get the last set of updates seen, (last+1) to n is returned.  If
+ * check_idle is set, return UPDATE_BUSY while the log has been updated
+ * within the last ULOG_IDLE_TIME seconds.
  */
-krb5_error_code
-ulog_get_entries(krb5_context context,          /* input - krb5 lib config */
-                 kdb_last_t last,               /* input - slave's last sno */
-                 kdb_incr_result_t *ulog_handle) /* output - incr result for slave */
+static krb5_error_code
+get_entries(krb5_context context, kdb_last_t last,
+            kdb_incr_result_t *ulog_handle, krb5_boolean check_idle)
 {
     XDR                 xdrs;
     kdb_ent_header_t    *indx_log;
@@ -753,7 +937,7 @@ ulog_get_entries(krb5_context context,          /* input - krb5 lib config */
     gettimeofday(&timestamp, NULL);
 
     tdiff = timestamp.tv_sec - ulog->kdb_last_time.seconds;
-    if (tdiff <= ULOG_IDLE_TIME) {
+    if (check_idle && tdiff <= ULOG_IDLE_TIME) {
         ulog_handle->ret = UPDATE_BUSY;
         (void) ulog_lock(context, KRB5_LOCKMODE_UNLOCK);
         return (0);
@@ -850,6 +1034,22 @@ ulog_get_entries(krb5_context context,          /* input - krb5 lib config */
 
             ulog_handle->updates.kdb_ulog_t_len = count;
 
+            /*
+             * The updates may have been committed under group commit and
+             * not be on disk yet.  Sync them before handing them out, so
+             * that a slave never sees a serial number which the master
+             * could lose in a crash.
+             */
+            retval = ulog_sync_range(ulog, ulogentries, last.last_sno + 1,
+                                     ulog->kdb_last_sno);
+            if (retval) {
+                (void) ulog_lock(context, KRB5_LOCKMODE_UNLOCK);
+                (void) krb5_db_unlock(context);
+                ulog_handle->ret = UPDATE_ERROR;
+                return (retval);
+            }
+            ulog_sync_header(ulog);
+
             ulog_handle->lastentry.last_sno = ulog->kdb_last_sno;
             ulog_handle->lastentry.last_time.seconds =
                 ulog->kdb_last_time.seconds;
@@ -882,6 +1082,27 @@ ulog_get_entries(krb5_context context,          /* input - krb5 lib config */
     return (KRB5_LOG_ERROR);
 }
 
+krb5_error_code
+ulog_get_entries(krb5_context context,          /* input - krb5 lib config */
+                 kdb_last_t last,               /* input - slave's last sno */
+                 kdb_incr_result_t *ulog_handle) /* output - incr result for slave */
+{
+    return get_entries(context, last, ulog_handle, TRUE);
+}
+
+/*
+ * As ulog_get_entries, but never return UPDATE_BUSY.  Writers hold the
+ * ulog lock exclusively from ulog_add_update to ulog_finish_update, so
+ * the entries are complete; this is used to answer long-poll requests
+ * as soon as the log advances.
+ */
+krb5_error_code
+ulog_get_entries_immediate(krb5_context context, kdb_last_t last,
+                           kdb_incr_result_t *ulog_handle)
+{
+    return get_entries(context, last, ulog_handle, FALSE);
+}
+
 krb5_error_code
 ulog_set_role(krb5_context ctx, iprop_role role)
 {
@@ -1589,6 +1589,14 @@ k5_asn1_decode_atype(const taginfo *t, const unsigned char *asn1,
 krb5_error_code
 k5_asn1_full_encode(const void *rep, const struct atype_info *a,
                     krb5_data **code_out)
+{
+    return k5_asn1_full_encode_room(rep, a, 0, 0, code_out);
+}
+
+krb5_error_code
+k5_asn1_full_encode_room(const void *rep, const struct atype_info *a,
+                         unsigned int headroom, unsigned int tailroom,
+                         krb5_data **code_out)
 {
     size_t len;
     asn1_error_code ret;
@@ -1605,7 +1613,7 @@ k5_asn1_full_encode(const void *rep, const struct atype_info *a,
     ret = encode_atype_and_tag(buf, rep, a, &len);
     if (ret)
         goto cleanup;
-    ret = asn12krb5_buf(buf, &d);
+    ret = asn12krb5_buf_room(buf, headroom, tailroom, &d);
     if (ret)
         goto cleanup;
     *code_out = d;
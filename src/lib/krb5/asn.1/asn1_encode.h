@@ -547,6 +547,13 @@ k5_asn1_decode_atype(const taginfo *t, const unsigned char *asn1,
 extern krb5_error_code
 k5_asn1_full_encode(const void *rep, const struct atype_info *a,
                     krb5_data **code_out);
+
+/* Like k5_asn1_full_encode, but leaves headroom bytes before the encoding and
+ * tailroom bytes after it, included in the length of the result. */
+extern krb5_error_code
+k5_asn1_full_encode_room(const void *rep, const struct atype_info *a,
+                         unsigned int headroom, unsigned int tailroom,
+                         krb5_data **code_out);
 asn1_error_code
 k5_asn1_full_decode(const krb5_data *code, const struct atype_info *a,
                     void **rep_out);
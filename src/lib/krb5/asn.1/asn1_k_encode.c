@@ -1227,6 +1227,15 @@ decode_krb5_safe_with_body(const krb5_data *code, krb5_safe **rep_out,
 
 MAKE_CODEC(krb5_priv, priv);
 MAKE_CODEC(krb5_enc_priv_part, priv_enc_part);
+
+krb5_error_code
+encode_krb5_enc_priv_part_room(const krb5_priv_enc_part *rep,
+                               unsigned int headroom, unsigned int tailroom,
+                               krb5_data **code_out)
+{
+    return k5_asn1_full_encode_room(rep, &k5_atype_priv_enc_part, headroom,
+                                    tailroom, code_out);
+}
 MAKE_CODEC(krb5_checksum, checksum);
 
 MAKE_CODEC(krb5_cred, krb5_cred);
@@ -131,22 +131,32 @@ asn1buf_insert_bytestring(asn1buf *buf, const unsigned int len, const void *sv)
 asn1_error_code
 asn12krb5_buf(const asn1buf *buf, krb5_data **code)
 {
-    unsigned int i;
+    return asn12krb5_buf_room(buf, 0, 0, code);
+}
+
+asn1_error_code
+asn12krb5_buf_room(const asn1buf *buf, unsigned int headroom,
+                   unsigned int tailroom, krb5_data **code)
+{
+    unsigned int i, len;
     krb5_data *d;
+    char *p;
 
     *code = NULL;
 
     d = calloc(1, sizeof(krb5_data));
     if (d == NULL)
         return ENOMEM;
-    d->length = asn1buf_len(buf);
+    len = asn1buf_len(buf);
+    d->length = headroom + len + tailroom;
     d->data = malloc(d->length + 1);
     if (d->data == NULL) {
         free(d);
         return ENOMEM;
     }
-    for (i=0; i < d->length; i++)
-        d->data[i] = buf->base[d->length - i - 1];
+    p = d->data + headroom;
+    for (i=0; i < len; i++)
+        p[i] = buf->base[len - i - 1];
     d->data[d->length] = '\0';
     d->magic = KV5M_DATA;
     *code = d;
@@ -84,6 +84,7 @@ int asn1buf_len(const asn1buf *buf);
  *  asn1buf_unparse
  *  asn1buf_hex_unparse
  *  asn12krb5_buf
+ *  asn12krb5_buf_room
  *  asn1buf_remains
  *
  *  (asn1buf_size)
@@ -142,4 +143,13 @@ asn1_error_code asn12krb5_buf(const asn1buf *buf, krb5_data **code);
  * effects   Instantiates **code with the krb5_data representation of **buf.
  */
 
+asn1_error_code asn12krb5_buf_room(const asn1buf *buf, unsigned int headroom,
+                                   unsigned int tailroom, krb5_data **code);
+/*
+ * modifies  *code
+ * effects   Like asn12krb5_buf, but leaves headroom uninitialized bytes
+ *            before the encoding and tailroom after it, all included in
+ *            (*code)->length.
+ */
+
 #endif
@@ -71,3 +71,35 @@ krb5_decrypt_tkt_part(krb5_context context, const krb5_keyblock *srv_key, regist
     clean_scratch();
     return retval;
 }
+
+/* As krb5_decrypt_tkt_part(), but using a krb5_key, so that derived keys are
+ * cached across calls. */
+krb5_error_code KRB5_CALLCONV
+krb5_decrypt_tkt_part_k(krb5_context context, krb5_key srv_key,
+                        krb5_ticket *ticket)
+{
+    krb5_enc_tkt_part *dec_tkt_part;
+    krb5_data scratch;
+    krb5_error_code retval;
+
+    if (!krb5_c_valid_enctype(ticket->enc_part.enctype))
+        return KRB5_PROG_ETYPE_NOSUPP;
+
+    if (!krb5_is_permitted_enctype(context, ticket->enc_part.enctype))
+        return KRB5_NOPERM_ETYPE;
+
+    scratch.length = ticket->enc_part.ciphertext.length;
+    scratch.data = malloc(scratch.length);
+    if (scratch.data == NULL)
+        return ENOMEM;
+
+    retval = krb5_k_decrypt(context, srv_key, KRB5_KEYUSAGE_KDC_REP_TICKET, 0,
+                            &ticket->enc_part, &scratch);
+    if (retval == 0) {
+        retval = decode_krb5_enc_tkt_part(&scratch, &dec_tkt_part);
+        if (retval == 0)
+            ticket->enc_part2 = dec_tkt_part;
+    }
+    zapfree(scratch.data, scratch.length);
+    return retval;
+}
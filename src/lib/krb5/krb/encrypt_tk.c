@@ -62,3 +62,23 @@ krb5_encrypt_tkt_part(krb5_context context, const krb5_keyblock *srv_key, regist
 
     return(retval);
 }
+
+/* As krb5_encrypt_tkt_part(), but using a krb5_key, so that derived keys are
+ * cached across calls. */
+krb5_error_code KRB5_CALLCONV
+krb5_encrypt_tkt_part_k(krb5_context context, krb5_key srv_key,
+                        krb5_ticket *dec_ticket)
+{
+    krb5_data *scratch;
+    krb5_error_code retval;
+
+    retval = encode_krb5_enc_tkt_part(dec_ticket->enc_part2, &scratch);
+    if (retval)
+        return retval;
+    retval = krb5_encrypt_keyhelper(context, srv_key,
+                                    KRB5_KEYUSAGE_KDC_REP_TICKET, scratch,
+                                    &dec_ticket->enc_part);
+    zapfree(scratch->data, scratch->length);
+    free(scratch);
+    return retval;
+}
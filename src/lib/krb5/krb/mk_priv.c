@@ -39,7 +39,8 @@ mk_priv_basic(krb5_context context, const krb5_data *userdata,
     krb5_priv           privmsg;
     krb5_priv_enc_part  privmsg_enc_part;
     krb5_data           *scratch1, *scratch2, ivdata;
-    size_t              blocksize, enclen;
+    size_t              blocksize;
+    unsigned int        header_len, padding_len, trailer_len, tailroom;
 
     privmsg.enc_part.kvno = 0;  /* XXX allow user-set? */
     privmsg.enc_part.enctype = enctype;
@@ -53,50 +54,56 @@ mk_priv_basic(krb5_context context, const krb5_data *userdata,
     privmsg_enc_part.usec       = replaydata->usec;
     privmsg_enc_part.seq_number = replaydata->seq;
 
-    /* start by encoding to-be-encrypted part of the message */
-    if ((retval = encode_krb5_enc_priv_part(&privmsg_enc_part, &scratch1)))
+    /*
+     * Encode the to-be-encrypted part of the message with room for the
+     * encryption header before it and the padding and trailer after it, so
+     * that it can be encrypted in place.  The padding is less than the
+     * padding block size.
+     */
+    if ((retval = krb5_c_crypto_length(context, enctype,
+                                       KRB5_CRYPTO_TYPE_HEADER, &header_len)))
+        return retval;
+    if ((retval = krb5_c_crypto_length(context, enctype,
+                                       KRB5_CRYPTO_TYPE_PADDING,
+                                       &padding_len)))
+        return retval;
+    if ((retval = krb5_c_crypto_length(context, enctype,
+                                       KRB5_CRYPTO_TYPE_TRAILER,
+                                       &trailer_len)))
+        return retval;
+    tailroom = padding_len + trailer_len;
+    if ((retval = encode_krb5_enc_priv_part_room(&privmsg_enc_part,
+                                                 header_len, tailroom,
+                                                 &scratch1)))
         return retval;
-
-    /* put together an eblock for this encryption */
-    if ((retval = krb5_c_encrypt_length(context, enctype,
-                                        scratch1->length, &enclen)))
-        goto clean_scratch;
-
-    privmsg.enc_part.ciphertext.length = enclen;
-    if (!(privmsg.enc_part.ciphertext.data =
-          malloc(privmsg.enc_part.ciphertext.length))) {
-        retval = ENOMEM;
-        goto clean_scratch;
-    }
 
     /* call the encryption routine */
     if (i_vector) {
         if ((retval = krb5_c_block_size(context, enctype, &blocksize)))
-            goto clean_encpart;
+            goto clean_scratch;
 
         ivdata.length = blocksize;
         ivdata.data = i_vector;
     }
 
-    if ((retval = krb5_k_encrypt(context, key,
-                                 KRB5_KEYUSAGE_KRB_PRIV_ENCPART,
-                                 i_vector?&ivdata:0,
-                                 scratch1, &privmsg.enc_part)))
-        goto clean_encpart;
+    privmsg.enc_part.ciphertext = *scratch1;
+    if ((retval = krb5_k_encrypt_inplace(context, key,
+                                         KRB5_KEYUSAGE_KRB_PRIV_ENCPART,
+                                         i_vector?&ivdata:0,
+                                         &privmsg.enc_part.ciphertext,
+                                         scratch1->length - header_len -
+                                         tailroom)))
+        goto clean_scratch;
 
-    if ((retval = encode_krb5_priv(&privmsg, &scratch2)))
-        goto clean_encpart;
+    /* scratch1 now holds only ciphertext. */
+    retval = encode_krb5_priv(&privmsg, &scratch2);
+    krb5_free_data(context, scratch1);
+    if (retval)
+        return retval;
 
     *outbuf = *scratch2;
     free(scratch2);
-    retval = 0;
-
-clean_encpart:
-    memset(privmsg.enc_part.ciphertext.data, 0,
-           privmsg.enc_part.ciphertext.length);
-    free(privmsg.enc_part.ciphertext.data);
-    privmsg.enc_part.ciphertext.length = 0;
-    privmsg.enc_part.ciphertext.data = 0;
+    return 0;
 
 clean_scratch:
     memset(scratch1->data, 0, scratch1->length);
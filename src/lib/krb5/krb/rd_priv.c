@@ -53,7 +53,7 @@ rd_priv_basic(krb5_context context, krb5_auth_context ac,
     krb5_priv_enc_part  * privmsg_enc_part;
     size_t                blocksize;
     krb5_data             ivdata, *iv = NULL;
-    krb5_enctype          enctype;
+    krb5_enctype          enctype = krb5_k_key_enctype(context, key);
 
     if (!krb5_is_krb_priv(inbuf))
         return KRB5KRB_AP_ERR_MSG_TYPE;
@@ -62,28 +62,29 @@ rd_priv_basic(krb5_context context, krb5_auth_context ac,
     if ((retval = decode_krb5_priv(inbuf, &privmsg)))
         return retval;
 
+    if (privmsg->enc_part.enctype != ENCTYPE_UNKNOWN &&
+        privmsg->enc_part.enctype != enctype) {
+        retval = KRB5_BAD_ENCTYPE;
+        goto cleanup_privmsg;
+    }
+
     if (ac->i_vector != NULL) {
-        enctype = krb5_k_key_enctype(context, key);
         if ((retval = krb5_c_block_size(context, enctype, &blocksize)))
             goto cleanup_privmsg;
         ivdata = make_data(ac->i_vector, blocksize);
         iv = &ivdata;
     }
 
-    scratch.length = privmsg->enc_part.ciphertext.length;
-    if (!(scratch.data = malloc(scratch.length))) {
-        retval = ENOMEM;
+    /* The decoded ciphertext is our own copy, so decrypt it in place. */
+    if ((retval = krb5_k_decrypt_inplace(context, key,
+                                         KRB5_KEYUSAGE_KRB_PRIV_ENCPART, iv,
+                                         &privmsg->enc_part.ciphertext,
+                                         &scratch)))
         goto cleanup_privmsg;
-    }
-
-    if ((retval = krb5_k_decrypt(context, key,
-                                 KRB5_KEYUSAGE_KRB_PRIV_ENCPART, iv,
-                                 &privmsg->enc_part, &scratch)))
-        goto cleanup_scratch;
 
     /*  now decode the decrypted stuff */
     if ((retval = decode_krb5_enc_priv_part(&scratch, &privmsg_enc_part)))
-        goto cleanup_scratch;
+        goto cleanup_plaintext;
 
     retval = k5_privsafe_check_addrs(context, ac, privmsg_enc_part->s_address,
                                      privmsg_enc_part->r_address);
@@ -103,9 +104,8 @@ cleanup_data:;
         privmsg_enc_part->user_data.data = 0;
     krb5_free_priv_enc_part(context, privmsg_enc_part);
 
-cleanup_scratch:;
+cleanup_plaintext:;
     memset(scratch.data, 0, scratch.length);
-    free(scratch.data);
 
 cleanup_privmsg:;
     free(privmsg->enc_part.ciphertext.data);
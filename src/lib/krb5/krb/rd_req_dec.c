@@ -267,13 +267,16 @@ rd_req_decoded_opt(krb5_context context, krb5_auth_context *auth_context,
 
     /* decrypt the ticket */
     if ((*auth_context)->key) { /* User to User authentication */
-        if ((retval = krb5_decrypt_tkt_part(context,
-                                            &(*auth_context)->key->keyblock,
-                                            req->ticket)))
+        if ((retval = krb5_decrypt_tkt_part_k(context, (*auth_context)->key,
+                                              req->ticket)))
             goto cleanup;
         if (check_valid_flag) {
-            decrypt_key = (*auth_context)->key->keyblock;
-            (*auth_context)->key->keyblock.contents = NULL;
+            /* The key may be shared, so copy its contents. */
+            krb5_keyblock *kb = &(*auth_context)->key->keyblock;
+
+            retval = krb5_copy_keyblock_contents(context, kb, &decrypt_key);
+            if (retval)
+                goto cleanup;
         }
         krb5_k_free_key(context, (*auth_context)->key);
         (*auth_context)->key = NULL;
@@ -512,6 +512,10 @@ cleanup:
 static void
 ctx_fini(krb5_db2_context *dbc)
 {
+    /* A temporary DB stays open for its whole lifetime; close it so that
+     * it is flushed and can be destroyed if the load failed. */
+    if (dbc->db != NULL)
+        (void) dbc->db->close(dbc->db);
     if (dbc->db_lf_file != -1)
         (void) close(dbc->db_lf_file);
     if (dbc->policy_db)
@@ -38,6 +38,7 @@
 #include <sys/param.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 
 #include "k5-int.h"
 #include "com_err.h"
@@ -56,6 +57,9 @@ char    *srvtab = 0;
 char    *slave_host;
 char    *realm = 0;
 char    *file = KPROP_DEFAULT_FILE;
+int     stream = 0;             /* Stream a binary dump from kdb5_util (-D) */
+char    *iprop_vers = NULL;     /* Make an iprop dump of this version */
+char    *kdb5_util = KPROPD_DEFAULT_KDB5_UTIL;
 
 krb5_principal  my_principal;           /* The Kerberos principal we'll be */
 /* running under, initialized in */
@@ -76,13 +80,21 @@ int     open_database(krb5_context, char *, int *);
 void    close_database(krb5_context, int);
 void    xmit_database(krb5_context, krb5_auth_context, krb5_creds *,
                       int, int, int);
+int     start_dump(krb5_context, pid_t *);
+void    stream_database(krb5_context, krb5_auth_context, krb5_creds *,
+                        int, int, pid_t);
+static void send_block(krb5_context, krb5_auth_context, krb5_creds *,
+                       int, char *, int, krb5_ui_4);
+static void recv_confirmation(krb5_context, krb5_auth_context, int,
+                              krb5_ui_4);
 void    send_error(krb5_context, krb5_creds *, int, char *, krb5_error_code);
 void    update_last_prop_file(char *, char *);
 
 static void usage()
 {
-    fprintf(stderr, _("\nUsage: %s [-r realm] [-f file] [-d] [-P port] "
-                      "[-s srvtab] slave_host\n\n"), progname);
+    fprintf(stderr, _("\nUsage: %s [-r realm] [-f file] [-D [-i] "
+                      "[-p kdb5_util]] [-d] [-P port]\n"
+                      "\t[-s srvtab] slave_host\n\n"), progname);
     exit(1);
 }
 
@@ -91,11 +103,12 @@ main(argc, argv)
     int     argc;
     char    **argv;
 {
-    int     fd, database_fd, database_size;
+    int     fd, database_fd = -1, database_size = 0;
     krb5_error_code retval;
     krb5_context context;
     krb5_creds *my_creds;
     krb5_auth_context auth_context;
+    pid_t dump_pid;
 
     setlocale(LC_MESSAGES, "");
     retval = krb5_init_context(&context);
@@ -106,16 +119,25 @@ main(argc, argv)
     PRS(argc, argv);
     get_tickets(context);
 
-    database_fd = open_database(context, file, &database_size);
+    if (!stream)
+        database_fd = open_database(context, file, &database_size);
     open_connection(context, slave_host, &fd);
     kerberos_authenticate(context, &auth_context, fd, my_principal,
                           &my_creds);
-    xmit_database(context, auth_context, my_creds, fd, database_fd,
-                  database_size);
+    if (stream) {
+        database_fd = start_dump(context, &dump_pid);
+        stream_database(context, auth_context, my_creds, fd, database_fd,
+                        dump_pid);
+        (void)close(database_fd);
+    } else {
+        xmit_database(context, auth_context, my_creds, fd, database_fd,
+                      database_size);
+    }
     update_last_prop_file(slave_host, file);
     printf(_("Database propagation to %s: SUCCEEDED\n"), slave_host);
     krb5_free_cred_contents(context, my_creds);
-    close_database(context, database_fd);
+    if (!stream)
+        close_database(context, database_fd);
     exit(0);
 }
 
@@ -152,6 +174,24 @@ void PRS(argc, argv)
                 case 'd':
                     debug++;
                     break;
+                case 'D':
+                    stream = 1;
+                    kprop_version = KPROP_STREAM_PROT_VERSION;
+                    break;
+                case 'i':
+                    /* Pass any version number on to kdb5_util dump. */
+                    iprop_vers = word;
+                    word = 0;
+                    break;
+                case 'p':
+                    if (*word)
+                        kdb5_util = word;
+                    else
+                        kdb5_util = *argv++;
+                    if (!kdb5_util)
+                        usage();
+                    word = 0;
+                    break;
                 case 'P':
                     port = (*word != '\0') ? word : *argv++;
                     if (port == NULL)
@@ -181,6 +221,8 @@ void PRS(argc, argv)
     }
     if (!slave_host)
         usage();
+    if (iprop_vers != NULL && !stream)
+        usage();
 }
 
 void get_tickets(context)
@@ -535,7 +577,6 @@ xmit_database(context, auth_context, my_creds, fd, database_fd,
     krb5_data       inbuf, outbuf;
     char            buf[KPROP_BUFSIZ];
     krb5_error_code retval;
-    krb5_error      *error;
     /* These must be 4 bytes */
     krb5_ui_4       database_size = in_database_size;
     krb5_ui_4       send_size;
@@ -577,30 +618,9 @@ xmit_database(context, auth_context, my_creds, fd, database_fd,
     /*
      * Send over the file, block by block....
      */
-    inbuf.data = buf;
     sent_size = 0;
     while ((n = read(database_fd, buf, sizeof(buf)))) {
-        inbuf.length = n;
-        retval = krb5_mk_priv(context, auth_context, &inbuf,
-                              &outbuf, NULL);
-        if (retval) {
-            snprintf(buf, sizeof(buf),
-                     "while encoding database block starting at %d",
-                     sent_size);
-            com_err(progname, retval, "%s", buf);
-            send_error(context, my_creds, fd, buf, retval);
-            exit(1);
-        }
-
-        retval = krb5_write_message(context, (void *)&fd,&outbuf);
-        if (retval) {
-            krb5_free_data_contents(context, &outbuf);
-            com_err(progname, retval,
-                    _("while sending database block starting at %d"),
-                    sent_size);
-            exit(1);
-        }
-        krb5_free_data_contents(context, &outbuf);
+        send_block(context, auth_context, my_creds, fd, buf, n, sent_size);
         sent_size += n;
         if (debug)
             printf("%d bytes sent.\n", sent_size);
@@ -616,6 +636,243 @@ xmit_database(context, auth_context, my_creds, fd, database_fd,
      * OK, we've sent the database; now let's wait for a success
      * indication from the remote end.
      */
+    recv_confirmation(context, auth_context, fd, database_size);
+}
+
+/*
+ * Start kdb5_util dumping the database to a spool file next to file.
+ * Returns a descriptor for reading the spool file, which has already been
+ * unlinked, and fills in the process ID of kdb5_util.  The dump is always
+ * in binary format: its end record lets the slave tell a complete stream
+ * from one cut short, which a text dump cannot.
+ *
+ * kdb5_util holds the database lock until it has dumped every record, so
+ * it writes to a file rather than a pipe; it is then never held up by the
+ * network or the slave, and the lock is released as soon as the dump is
+ * made.  stream_database() sends the spool file as it grows.
+ */
+int
+start_dump(context, pid_out)
+    krb5_context context;
+    pid_t *pid_out;
+{
+    char    *av[8], *iprop_arg = NULL, *spool_name = NULL;
+    int     count, spool_fd, read_fd;
+    pid_t   pid;
+
+    count = 0;
+    av[count++] = kdb5_util;
+    if (realm) {
+        av[count++] = "-r";
+        av[count++] = realm;
+    }
+    av[count++] = "dump";
+    av[count++] = "-b";
+    if (iprop_vers) {
+        if (asprintf(&iprop_arg, "-i%s", iprop_vers) < 0) {
+            com_err(progname, ENOMEM, _("while constructing dump arguments"));
+            exit(1);
+        }
+        av[count++] = iprop_arg;
+    }
+    av[count++] = NULL;
+
+    if (asprintf(&spool_name, "%s.XXXXXX", file) < 0) {
+        com_err(progname, ENOMEM, _("while constructing spool file name"));
+        exit(1);
+    }
+    spool_fd = mkstemp(spool_name);
+    if (spool_fd < 0) {
+        com_err(progname, errno, _("while creating spool file %s"),
+                spool_name);
+        exit(1);
+    }
+    read_fd = open(spool_name, O_RDONLY);
+    if (read_fd < 0) {
+        com_err(progname, errno, _("while opening spool file %s"),
+                spool_name);
+        (void)unlink(spool_name);
+        exit(1);
+    }
+    (void)unlink(spool_name);
+
+    switch (pid = fork()) {
+    case -1:
+        com_err(progname, errno, _("while trying to fork %s"), kdb5_util);
+        exit(1);
+    case 0:
+        (void)close(read_fd);
+        if (spool_fd != 1) {
+            (void)dup2(spool_fd, 1);
+            (void)close(spool_fd);
+        }
+        execv(kdb5_util, av);
+        com_err(progname, errno, _("while trying to exec %s"), kdb5_util);
+        _exit(1);
+        /*NOTREACHED*/
+    default:
+        if (debug)
+            printf("Child PID is %d\n", (int)pid);
+    }
+    (void)close(spool_fd);
+    free(spool_name);
+    free(iprop_arg);
+    *pid_out = pid;
+    return read_fd;
+}
+
+/*
+ * Send the database as kdb5_util dumps it, without waiting for a
+ * complete dump file.  After the authentication exchange, which uses
+ * KPROP_STREAM_PROT_VERSION, we send over the dump in blocks of up to
+ * KPROP_BUFSIZ, encrypted using KRB_PRIV, reading them from the spool
+ * file as kdb5_util writes it.  Once kdb5_util has exited successfully
+ * and the rest of the spool file is sent, we send a zero-length block to
+ * mark the end of the dump.  Then we expect to see a KRB_SAFE message
+ * with the number of bytes received, modulo 2^32.
+ *
+ * If the dump fails, we send a KRB_ERROR message instead of the final
+ * block, so that the slave discards what it has loaded.
+ */
+void
+stream_database(context, auth_context, my_creds, fd, dump_fd, dump_pid)
+    krb5_context context;
+    krb5_auth_context auth_context;
+    krb5_creds *my_creds;
+    int fd;
+    int dump_fd;
+    pid_t dump_pid;
+{
+    krb5_ui_4       sent_size;
+    int             n, len, status, done;
+    pid_t           pid;
+    char            buf[KPROP_BUFSIZ];
+    struct timeval  tv;
+    krb5_error_code retval;
+
+    retval = krb5_auth_con_initivector(context, auth_context);
+    if (retval) {
+        send_error(context, my_creds, fd,
+                   "failed while initializing i_vector", retval);
+        com_err(progname, retval, _("while allocating i_vector"));
+        exit(1);
+    }
+
+    sent_size = 0;
+    len = 0;
+    done = 0;
+    status = 0;
+    for (;;) {
+        n = read(dump_fd, buf + len, sizeof(buf) - len);
+        if (n < 0) {
+            com_err(progname, errno, _("while reading database dump"));
+            send_error(context, my_creds, fd, "while reading database dump",
+                       errno);
+            exit(1);
+        }
+        len += n;
+
+        /* Send full blocks, or whatever we have once we catch up. */
+        if (len == sizeof(buf) || (n == 0 && len > 0)) {
+            send_block(context, auth_context, my_creds, fd, buf, len,
+                       sent_size);
+            sent_size += len;
+            len = 0;
+            if (debug)
+                printf("%lu bytes sent.\n", (unsigned long)sent_size);
+        }
+        if (n > 0)
+            continue;
+
+        /* We have sent everything kdb5_util has written so far. */
+        if (done)
+            break;
+        pid = waitpid(dump_pid, &status, WNOHANG);
+        if (pid < 0) {
+            com_err(progname, errno, _("while waiting for %s"), kdb5_util);
+            send_error(context, my_creds, fd, "Database dump failed",
+                       KRB5KRB_ERR_GENERIC);
+            exit(1);
+        } else if (pid == dump_pid) {
+            /* Go round once more to send the last of the dump. */
+            done = 1;
+        } else {
+            tv.tv_sec = 0;
+            tv.tv_usec = 100000;
+            (void)select(0, NULL, NULL, NULL, &tv);
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        com_err(progname, 0, _("%s failed to dump the database"),
+                kdb5_util);
+        send_error(context, my_creds, fd, "Database dump failed",
+                   KRB5KRB_ERR_GENERIC);
+        exit(1);
+    }
+    send_block(context, auth_context, my_creds, fd, buf, 0, sent_size);
+
+    recv_confirmation(context, auth_context, fd, sent_size);
+}
+
+/*
+ * Encrypt a block of the database using KRB_PRIV and send it.  offset
+ * is only used in error messages.
+ */
+static void
+send_block(context, auth_context, my_creds, fd, data, len, offset)
+    krb5_context context;
+    krb5_auth_context auth_context;
+    krb5_creds *my_creds;
+    int fd;
+    char *data;
+    int len;
+    krb5_ui_4 offset;
+{
+    krb5_data       inbuf, outbuf;
+    char            msg[128];
+    krb5_error_code retval;
+
+    inbuf.data = data;
+    inbuf.length = len;
+    retval = krb5_mk_priv(context, auth_context, &inbuf,
+                          &outbuf, NULL);
+    if (retval) {
+        snprintf(msg, sizeof(msg),
+                 "while encoding database block starting at %lu",
+                 (unsigned long)offset);
+        com_err(progname, retval, "%s", msg);
+        send_error(context, my_creds, fd, msg, retval);
+        exit(1);
+    }
+
+    retval = krb5_write_message(context, (void *)&fd,&outbuf);
+    if (retval) {
+        krb5_free_data_contents(context, &outbuf);
+        com_err(progname, retval,
+                _("while sending database block starting at %lu"),
+                (unsigned long)offset);
+        exit(1);
+    }
+    krb5_free_data_contents(context, &outbuf);
+}
+
+/*
+ * Wait for a success indication from the remote end, which is a
+ * KRB_SAFE message with the size it received, and check that size.
+ */
+static void
+recv_confirmation(context, auth_context, fd, database_size)
+    krb5_context context;
+    krb5_auth_context auth_context;
+    int fd;
+    krb5_ui_4 database_size;
+{
+    krb5_data       inbuf, outbuf;
+    krb5_error_code retval;
+    krb5_error      *error;
+    /* This must be 4 bytes */
+    krb5_ui_4       send_size;
+
     retval = krb5_read_message(context, (void *) &fd, &inbuf);
     if (retval) {
         com_err(progname, retval, _("while reading response from server"));
@@ -31,6 +31,13 @@
 
 #define KPROP_PROT_VERSION "kprop5_01"
 
+/*
+ * Protocol version for a dump which is streamed from kdb5_util as it is
+ * generated.  The size is not sent ahead of the data; a zero-length
+ * block marks the end of a complete dump.
+ */
+#define KPROP_STREAM_PROT_VERSION "kprop5_02"
+
 #define KPROP_BUFSIZ 32768
 
 /* pathnames are in osconf.h, included via k5-int.h */
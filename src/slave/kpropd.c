@@ -130,11 +130,14 @@ typedef struct _kadm5_iprop_handle_t {
 
 
 static char *kprop_version = KPROP_PROT_VERSION;
+static char *kprop_stream_version = KPROP_STREAM_PROT_VERSION;
 
 char    *progname;
 int     debug = 0;
 char    *srvtab = 0;
 int     standalone = 0;
+int     stream = 0;             /* Master is streaming its dump */
+static pid_t load_pid = -1;     /* kdb5_util loading a streamed dump */
 
 krb5_principal  server;         /* This is our server principal name */
 krb5_principal  client;         /* This is who we're talking to */
@@ -163,6 +166,8 @@ void    kerberos_authenticate(krb5_context, int, krb5_principal *,
 krb5_boolean authorized_principal(krb5_context, krb5_principal, krb5_enctype);
 void    recv_database(krb5_context, int, int, krb5_data *);
 void    load_database(krb5_context, char *, char *);
+int     start_load(krb5_context, char *, char *);
+void    finish_load(krb5_context, char *);
 void    send_error(krb5_context, int, krb5_error_code, char *);
 void    recv_error(krb5_context, krb5_data *);
 unsigned int backoff_from_master(int *);
@@ -523,25 +528,38 @@ void doit(fd)
                 temp_file_name);
         exit(1);
     }
-    if ((database_fd = open(temp_file_name,
-                            O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
-        com_err(progname, errno, _("while opening database file, '%s'"),
-                temp_file_name);
-        exit(1);
-    }
-    recv_database(kpropd_context, fd, database_fd, &confmsg);
-    if (rename(temp_file_name, file)) {
-        com_err(progname, errno, _("while renaming %s to %s"),
-                temp_file_name, file);
-        exit(1);
-    }
-    retval = krb5_lock_file(kpropd_context, lock_fd, KRB5_LOCKMODE_SHARED);
-    if (retval) {
-        com_err(progname, retval, _("while downgrading lock on '%s'"),
-                temp_file_name);
-        exit(1);
+    if (stream) {
+        /*
+         * Feed the dump to kdb5_util as it arrives.  kdb5_util loads it
+         * into a temporary database, which it only makes live when it
+         * reaches the end of the dump.
+         */
+        database_fd = start_load(kpropd_context, kdb5_util, NULL);
+        recv_database(kpropd_context, fd, database_fd, &confmsg);
+        (void)close(database_fd);
+        finish_load(kpropd_context, kdb5_util);
+    } else {
+        if ((database_fd = open(temp_file_name,
+                                O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
+            com_err(progname, errno, _("while opening database file, '%s'"),
+                    temp_file_name);
+            exit(1);
+        }
+        recv_database(kpropd_context, fd, database_fd, &confmsg);
+        if (rename(temp_file_name, file)) {
+            com_err(progname, errno, _("while renaming %s to %s"),
+                    temp_file_name, file);
+            exit(1);
+        }
+        retval = krb5_lock_file(kpropd_context, lock_fd,
+                                KRB5_LOCKMODE_SHARED);
+        if (retval) {
+            com_err(progname, retval, _("while downgrading lock on '%s'"),
+                    temp_file_name);
+            exit(1);
+        }
+        load_database(kpropd_context, kdb5_util, file);
     }
-    load_database(kpropd_context, kdb5_util, file);
     retval = krb5_lock_file(kpropd_context, lock_fd, KRB5_LOCKMODE_UNLOCK);
     if (retval) {
         com_err(progname, retval, _("while unlocking '%s'"), temp_file_name);
@@ -581,12 +599,21 @@ full_resync(CLIENT *clnt)
 
     memset(&clnt_res, 0, sizeof(clnt_res));
 
-    status = clnt_call (clnt, IPROP_FULL_RESYNC_EXT,
+    /* Ask for a streamed dump first, falling back to a dump file. */
+    status = clnt_call (clnt, IPROP_FULL_RESYNC_STREAM,
                         (xdrproc_t) xdr_u_int32,
                         (caddr_t) &vers,
                         (xdrproc_t) xdr_kdb_fullresync_result_t,
                         (caddr_t) &clnt_res,
                         full_resync_timeout);
+    if (status == RPC_PROCUNAVAIL) {
+        status = clnt_call (clnt, IPROP_FULL_RESYNC_EXT,
+                            (xdrproc_t) xdr_u_int32,
+                            (caddr_t) &vers,
+                            (xdrproc_t) xdr_kdb_fullresync_result_t,
+                            (caddr_t) &clnt_res,
+                            full_resync_timeout);
+    }
     if (status == RPC_PROCUNAVAIL) {
         status = clnt_call (clnt, IPROP_FULL_RESYNC,
                             (xdrproc_t) xdr_void,
@@ -599,6 +626,33 @@ full_resync(CLIENT *clnt)
     return (status == RPC_SUCCESS) ? &clnt_res : NULL;
 }
 
+/*
+ * Ask the master for updates since last.  If *wait is set, use the
+ * long-poll procedure so that the master holds the call for up to
+ * timeout seconds until there are new updates; if the master does not
+ * support it, clear *wait and fall back to a plain request.
+ */
+static kdb_incr_result_t *
+get_updates(CLIENT *clnt, kdb_last_t *last, unsigned int timeout, int *wait)
+{
+    kdb_incr_result_t *res;
+    kdb_incr_wait_t arg;
+    struct rpc_err err;
+
+    if (*wait) {
+        arg.last = *last;
+        arg.timeout = timeout;
+        res = iprop_get_updates_wait_1(&arg, clnt);
+        if (res != NULL)
+            return res;
+        clnt_geterr(clnt, &err);
+        if (err.re_status != RPC_PROCUNAVAIL)
+            return NULL;
+        *wait = 0;
+    }
+    return iprop_get_updates_1(last, clnt);
+}
+
 /*
  * Routine to handle incremental update transfer(s) from master KDC
  */
@@ -616,6 +670,7 @@ krb5_error_code do_iprop(kdb_log_context *log_ctx)
     int reinit_cnt = 0;
     int ret;
     int frdone = 0;
+    int wait, again;
 
     kdb_incr_result_t *incr_ret;
     static kdb_last_t mylast;
@@ -759,9 +814,13 @@ reinit:
      */
     handle = server_handle;
 
+    /* Try the long-poll procedure again after reconnecting. */
+    wait = !runonce;
+
     for (;;) {
         incr_ret = NULL;
         full_ret = NULL;
+        again = 0;
 
         /*
          * Get the most recent ulog entry sno + ts, which
@@ -771,12 +830,13 @@ reinit:
         mylast.last_time = ulog->kdb_last_time;
 
         /*
-         * Loop continuously on an iprop_get_updates_1(),
-         * so that we can keep probing the master for updates
-         * or (if needed) do a full resync of the krb5 db.
+         * Loop continuously on a get_updates(), so that we can keep
+         * probing the master for updates or (if needed) do a full
+         * resync of the krb5 db.  If the master supports it, the
+         * request waits for up to the poll interval for new updates.
          */
 
-        incr_ret = iprop_get_updates_1(&mylast, handle->clnt);
+        incr_ret = get_updates(handle->clnt, &mylast, pollin, &wait);
         if (incr_ret == (kdb_incr_result_t *)NULL) {
             clnt_perror(handle->clnt,
                         _("iprop_get_updates call failed"));
@@ -892,6 +952,7 @@ reinit:
             if (debug)
                 fprintf(stderr, _("Update transfer "
                                   "from master was OK\n"));
+            again = wait;
             break;
 
         case UPDATE_PERM_DENIED:
@@ -920,6 +981,7 @@ reinit:
                                   "are in-sync, no updates\n"));
             backoff_cnt = 0;
             frdone = 0;
+            again = wait;
             break;
 
         default:
@@ -935,7 +997,9 @@ reinit:
         /*
          * Sleep for the specified poll interval (Default is 2 mts),
          * or do a binary exponential backoff if we get an
-         * UPDATE_BUSY signal
+         * UPDATE_BUSY signal.  A long-poll request which got new
+         * updates or none has already waited on the master, so ask
+         * again straight away.
          */
         if (backoff_cnt > 0) {
             backoff_time = backoff_from_master(&backoff_cnt);
@@ -945,7 +1009,7 @@ reinit:
                         backoff_time);
             (void) sleep(backoff_time);
         }
-        else
+        else if (!again)
             (void) sleep(pollin);
 
     }
@@ -1222,6 +1286,7 @@ kerberos_authenticate(context, fd, clientp, etype, my_sin)
     struct sockaddr_storage  r_sin;
     GETSOCKNAME_ARG3_TYPE sin_length;
     krb5_keytab           keytab = NULL;
+    krb5_data             version;
 
     /*
      * Set recv_addr and send_addr
@@ -1282,14 +1347,25 @@ kerberos_authenticate(context, fd, clientp, etype, my_sin)
         }
     }
 
-    retval = krb5_recvauth(context, &auth_context, (void *) &fd,
-                           kprop_version, server, 0, keytab, &ticket);
+    retval = krb5_recvauth_version(context, &auth_context, (void *) &fd,
+                                   server, 0, keytab, &ticket, &version);
     if (retval) {
         syslog(LOG_ERR, _("Error in krb5_recvauth: %s"),
                error_message(retval));
         exit(1);
     }
 
+    /* The version string is sent with its terminator. */
+    if (version.length == strlen(kprop_stream_version) + 1 &&
+        memcmp(version.data, kprop_stream_version, version.length) == 0) {
+        stream = 1;
+    } else if (version.length != strlen(kprop_version) + 1 ||
+               memcmp(version.data, kprop_version, version.length) != 0) {
+        syslog(LOG_ERR, _("Unsupported kprop protocol version"));
+        exit(1);
+    }
+    krb5_free_data_contents(context, &version);
+
     retval = krb5_copy_principal(context, ticket->enc_part2->client, clientp);
     if (retval) {
         syslog(LOG_ERR, _("Error in krb5_copy_prinicpal: %s"),
@@ -1387,37 +1463,41 @@ recv_database(context, fd, database_fd, confmsg)
     int database_fd;
     krb5_data *confmsg;
 {
-    krb5_ui_4       database_size; /* This must be 4 bytes */
-    int     received_size, n;
+    krb5_ui_4       database_size = 0; /* This must be 4 bytes */
+    krb5_ui_4       received_size;
+    int             n;
     char            buf[1024];
     krb5_data       inbuf, outbuf;
     krb5_error_code retval;
 
     /*
-     * Receive and decode size from client
+     * Receive and decode size from client.  A streamed dump has no size;
+     * it ends with a zero-length block instead.
      */
-    retval = krb5_read_message(context, (void *) &fd, &inbuf);
-    if (retval) {
-        send_error(context, fd, retval, "while reading database size");
-        com_err(progname, retval,
-                _("while reading size of database from client"));
-        exit(1);
-    }
-    if (krb5_is_krb_error(&inbuf))
-        recv_error(context, &inbuf);
-    retval = krb5_rd_safe(context,auth_context,&inbuf,&outbuf,NULL);
-    if (retval) {
-        send_error(context, fd, retval,
-                   "while decoding database size");
+    if (!stream) {
+        retval = krb5_read_message(context, (void *) &fd, &inbuf);
+        if (retval) {
+            send_error(context, fd, retval, "while reading database size");
+            com_err(progname, retval,
+                    _("while reading size of database from client"));
+            exit(1);
+        }
+        if (krb5_is_krb_error(&inbuf))
+            recv_error(context, &inbuf);
+        retval = krb5_rd_safe(context,auth_context,&inbuf,&outbuf,NULL);
+        if (retval) {
+            send_error(context, fd, retval,
+                       "while decoding database size");
+            krb5_free_data_contents(context, &inbuf);
+            com_err(progname, retval,
+                    _("while decoding database size from client"));
+            exit(1);
+        }
+        memcpy(&database_size, outbuf.data, sizeof(database_size));
         krb5_free_data_contents(context, &inbuf);
-        com_err(progname, retval,
-                _("while decoding database size from client"));
-        exit(1);
+        krb5_free_data_contents(context, &outbuf);
+        database_size = ntohl(database_size);
     }
-    memcpy(&database_size, outbuf.data, sizeof(database_size));
-    krb5_free_data_contents(context, &inbuf);
-    krb5_free_data_contents(context, &outbuf);
-    database_size = ntohl(database_size);
 
     /*
      * Initialize the initial vector.
@@ -1434,11 +1514,11 @@ recv_database(context, fd, database_fd, confmsg)
      * Now start receiving the database from the net
      */
     received_size = 0;
-    while (received_size < database_size) {
+    while (stream || received_size < database_size) {
         retval = krb5_read_message(context, (void *) &fd, &inbuf);
         if (retval) {
             snprintf(buf, sizeof(buf),
-                     "while reading database block starting at offset %d",
+                     "while reading database block starting at offset %u",
                      received_size);
             com_err(progname, retval, "%s", buf);
             send_error(context, fd, retval, buf);
@@ -1450,35 +1530,44 @@ recv_database(context, fd, database_fd, confmsg)
                               &outbuf, NULL);
         if (retval) {
             snprintf(buf, sizeof(buf),
-                     "while decoding database block starting at offset %d",
+                     "while decoding database block starting at offset %u",
                      received_size);
             com_err(progname, retval, "%s", buf);
             send_error(context, fd, retval, buf);
             krb5_free_data_contents(context, &inbuf);
             exit(1);
         }
+        if (stream && outbuf.length == 0) {
+            krb5_free_data_contents(context, &inbuf);
+            krb5_free_data_contents(context, &outbuf);
+            break;
+        }
         n = write(database_fd, outbuf.data, outbuf.length);
         krb5_free_data_contents(context, &inbuf);
         krb5_free_data_contents(context, &outbuf);
         if (n < 0) {
             snprintf(buf, sizeof(buf),
-                     "while writing database block starting at offset %d",
+                     "while writing database block starting at offset %u",
                      received_size);
             send_error(context, fd, errno, buf);
+            exit(1);
         } else if (n != outbuf.length) {
             snprintf(buf, sizeof(buf),
-                     "incomplete write while writing database block starting at \noffset %d (%d written, %d expected)",
+                     "incomplete write while writing database block starting at \noffset %u (%d written, %d expected)",
                      received_size, n, outbuf.length);
             send_error(context, fd, KRB5KRB_ERR_GENERIC, buf);
+            exit(1);
         }
         received_size += outbuf.length;
     }
     /*
      * OK, we've seen the entire file.  Did we get too many bytes?
      */
-    if (received_size > database_size) {
+    if (stream) {
+        database_size = received_size;
+    } else if (received_size > database_size) {
         snprintf(buf, sizeof(buf),
-                 "Received %d bytes, expected %d bytes for database file",
+                 "Received %u bytes, expected %u bytes for database file",
                  received_size, database_size);
         send_error(context, fd, KRB5KRB_ERR_GENERIC, buf);
     }
@@ -1577,22 +1666,38 @@ load_database(context, kdb_util, database_file_name)
     krb5_context context;
     char *kdb_util;
     char *database_file_name;
+{
+    (void) start_load(context, kdb_util, database_file_name);
+    finish_load(context, kdb_util);
+}
+
+/*
+ * If we exit before the end of a streamed dump, kill kdb5_util rather than
+ * leave it to find the dump truncated.  This is only a shortcut; the end
+ * record of the binary dump keeps kdb5_util from making a partial database
+ * live even if we are killed before this runs.
+ */
+static void
+kill_load(void)
+{
+    if (load_pid > 0)
+        (void) kill(load_pid, SIGKILL);
+}
+
+/*
+ * Start kdb5_util loading database_file_name, or if it is NULL, loading
+ * from a pipe.  Returns the write end of the pipe, or -1.
+ */
+int
+start_load(context, kdb_util, database_file_name)
+    krb5_context context;
+    char *kdb_util;
+    char *database_file_name;
 {
     static char     *edit_av[10];
-    int     error_ret, save_stderr = -1;
+    int     save_stderr = -1, null_fd;
     int     child_pid;
-    int     count;
-
-    /* <sys/param.h> has been included, so BSD will be defined on
-       BSD systems */
-#if BSD > 0 && BSD <= 43
-#ifndef WEXITSTATUS
-#define WEXITSTATUS(w) (w).w_retcode
-#endif
-    union wait      waitb;
-#else
-    int     waitb;
-#endif
+    int     count, fds[2];
     krb5_error_code retval;
     kdb_log_context *log_ctx;
 
@@ -1615,22 +1720,35 @@ load_database(context, kdb_util, database_file_name)
     if (log_ctx && log_ctx->iproprole == IPROP_SLAVE) {
         edit_av[count++] = "-i";
     }
-    edit_av[count++] = database_file_name;
+    edit_av[count++] = (database_file_name != NULL) ? database_file_name : "-";
     edit_av[count++] = NULL;
 
+    if (database_file_name == NULL && pipe(fds) < 0) {
+        com_err(progname, errno, _("while creating pipe for %s"), kdb_util);
+        exit(1);
+    }
+
     switch(child_pid = fork()) {
     case -1:
         com_err(progname, errno, _("while trying to fork %s"), kdb_util);
         exit(1);
     case 0:
+        if (database_file_name == NULL) {
+            (void) close(fds[1]);
+            if (fds[0] != 0) {
+                (void) dup2(fds[0], 0);
+                (void) close(fds[0]);
+            }
+        }
         if (!debug) {
             save_stderr = dup(2);
-            close(0);
-            close(1);
-            close(2);
-            open("/dev/null", O_RDWR);
-            dup(0);
-            dup(0);
+            null_fd = open("/dev/null", O_RDWR);
+            if (database_file_name != NULL)
+                (void) dup2(null_fd, 0);
+            (void) dup2(null_fd, 1);
+            (void) dup2(null_fd, 2);
+            if (null_fd > 2)
+                (void) close(null_fd);
         }
 
         if (execv(kdb_util, edit_av) < 0)
@@ -1645,12 +1763,41 @@ load_database(context, kdb_util, database_file_name)
     default:
         if (debug)
             printf("Child PID is %d\n", child_pid);
-        if (wait(&waitb) < 0) {
-            com_err(progname, errno, _("while waiting for %s"), kdb_util);
-            exit(1);
-        }
     }
 
+    load_pid = child_pid;
+    if (database_file_name != NULL)
+        return -1;
+    (void) close(fds[0]);
+    atexit(kill_load);
+    return fds[1];
+}
+
+/* Wait for the kdb5_util started by start_load() to finish loading. */
+void
+finish_load(context, kdb_util)
+    krb5_context context;
+    char *kdb_util;
+{
+    int     error_ret;
+
+    /* <sys/param.h> has been included, so BSD will be defined on
+       BSD systems */
+#if BSD > 0 && BSD <= 43
+#ifndef WEXITSTATUS
+#define WEXITSTATUS(w) (w).w_retcode
+#endif
+    union wait      waitb;
+#else
+    int     waitb;
+#endif
+
+    if (wait(&waitb) < 0) {
+        com_err(progname, errno, _("while waiting for %s"), kdb_util);
+        exit(1);
+    }
+    load_pid = -1;
+
     error_ret = WEXITSTATUS(waitb);
     if (error_ret) {
         com_err(progname, 0, _("%s returned a bad exit status (%d)"),
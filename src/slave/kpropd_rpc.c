@@ -59,3 +59,23 @@ iprop_full_resync_1(void *argp, CLIENT *clnt)
 	}
 	return (&clnt_res);
 }
+
+kdb_incr_result_t *
+iprop_get_updates_wait_1(kdb_incr_wait_t *argp, CLIENT *clnt)
+{
+	static kdb_incr_result_t clnt_res;
+	struct timeval timeout;
+
+	/* Allow for the time the master may hold the call. */
+	timeout = TIMEOUT;
+	timeout.tv_sec += argp->timeout;
+
+	memset(&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, IPROP_GET_UPDATES_WAIT,
+		(xdrproc_t) xdr_kdb_incr_wait_t, (caddr_t) argp,
+		(xdrproc_t) xdr_kdb_incr_result_t, (caddr_t) &clnt_res,
+		timeout) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
@@ -1,6 +1,7 @@
-/* tests/hammer/kdc5_hammer.c */
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* tests/hammer/kdc5_hammer.c - Open-loop KDC load generator */
 /*
- * Copyright 1990,1991 by the Massachusetts Institute of Technology.
+ * Copyright 1990,1991,2011 by the Massachusetts Institute of Technology.
  * All Rights Reserved.
  *
  * Export of this software from the United States of America may
@@ -23,493 +24,525 @@
  * or implied warranty.
  */
 
-#include <stdio.h>
-#include <sys/time.h>
+/*
+ * kdc5_hammer offers a fixed request rate to a KDC and reports the achieved
+ * throughput and the latency distribution of each kind of request.
+ *
+ * Requests are scheduled open-loop: request k is due at k/rate seconds after
+ * the start, whether or not earlier requests have been answered, and its
+ * latency is measured from the time it was due.  A KDC which falls behind
+ * therefore shows up as growing latency, rather than as a lower request rate
+ * hidden from the measurement.  The requests are spread over a number of
+ * threads, each with its own krb5 context, which take turns in the schedule.
+ *
+ * The mix of request kinds is a fixed weighted rotation, so two runs with
+ * the same options send the same sequence of requests:
+ *
+ *   as    AS request for the client principal, with its password
+ *   tgs   TGS request for the service, using the client's TGT
+ *   s4u   S4U2Self request by the service on behalf of the client
+ *   fast  AS request for the client, armored with the service's TGT
+ *
+ * The tgs, s4u, and fast kinds need a TGT fetched at startup; s4u and fast
+ * need the service key in a keytab.
+ */
 
 #include "k5-int.h"
 #include "com_err.h"
+#include <pthread.h>
+#include <sys/time.h>
 
-#define KRB5_DEFAULT_OPTIONS 0
-#define KRB5_DEFAULT_LIFE 60*60*8 /* 8 hours */
-#define KRB5_RENEWABLE_LIFE 60*60*2 /* 2 hours */
-
-struct h_timer {
-    float	ht_cumulative;
-    float	ht_min;
-    float	ht_max;
-    krb5_int32	ht_observations;
-};
+enum req_kind { REQ_AS, REQ_TGS, REQ_S4U, REQ_FAST, NKINDS };
 
-extern int optind;
-extern char *optarg;
-char *prog;
+static const char *const kind_names[NKINDS] = { "as", "tgs", "s4u", "fast" };
 
-static int brief;
-static char *cur_realm = 0;
-static int do_timer = 0;
+/* Latency samples in microseconds. */
+struct samples {
+    unsigned long *vals;
+    size_t count;
+    size_t alloc;
+};
 
-krb5_data tgtname = {
-    0,
-    KRB5_TGS_NAME_SIZE,
-    KRB5_TGS_NAME
+struct thread_state {
+    pthread_t tid;
+    int index;
+    krb5_context ctx;
+    krb5_ccache client_cc;      /* Client TGT, for tgs */
+    krb5_ccache service_cc;     /* Service TGT, for s4u and fast armor */
+    struct samples lat[NKINDS];
+    unsigned long errors[NKINDS];
+    unsigned long late;         /* Requests sent after their due time */
+    krb5_error_code last_err;
 };
 
-int verify_cs_pair
-	(krb5_context,
-		   char *,
-		   krb5_principal,
-		   char *,
-		   char *,
-		   int, int, int,
-		   krb5_ccache);
-
-int get_tgt
-	(krb5_context,
-		   char *,
-		   krb5_principal *,
-		   krb5_ccache);
+static const char *prog;
+static const char *client_name, *password, *service_name, *keytab_name;
+static double rate = 100.0, duration = 5.0;
+static int nthreads = 4, use_tcp = 0, verbose = 0;
+static int weights[NKINDS] = { 1, 4, 0, 0 };
+static int total_weight;
+static double max_p99_ms = 0.0;
+static unsigned long max_errors = 0;
+static unsigned long nrequests;
+static double start_time;
+static krb5_principal client_princ, service_princ;
 
 static void
-usage(who, status)
-char *who;
-int status;
+usage(void)
 {
     fprintf(stderr,
-	    "usage: %s -p prefix -n num_to_check [-c cachename] [-r realmname]\n",
-	    who);
-    fprintf(stderr, "\t [-D depth]\n");
-    fprintf(stderr, "\t [-P preauth type] [-R repeat_count] [-t] [-b] [-v] \n");
-
-    exit(status);
+            "usage: %s -c client -w password -s service [-k keytab]\n"
+            "\t[-r rate] [-d seconds] [-t threads] [-m as=N,tgs=N,s4u=N,"
+            "fast=N]\n"
+            "\t[-T] [-l max_p99_ms] [-e max_errors] [-v]\n", prog);
+    exit(1);
 }
 
-static krb5_preauthtype * patype = NULL, patypedata[2] = { 0, -1 };
-static krb5_context test_context;
+static double
+now(void)
+{
+    struct timeval tv;
 
-struct timeval	tstart_time, tend_time;
-struct timezone	dontcare;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
 
-struct h_timer in_tkt_times = { 0.0, 1000000.0, -1.0, 0 };
-struct h_timer tgs_req_times = { 0.0, 1000000.0, -1.0, 0 };
-/*
- * Timer macros.
- */
-#define	swatch_on()	((void) gettimeofday(&tstart_time, &dontcare))
-#define	swatch_eltime()	((gettimeofday(&tend_time, &dontcare)) ? -1.0 :	\
-			 (((float) (tend_time.tv_sec -			\
-				    tstart_time.tv_sec)) +		\
-			  (((float) (tend_time.tv_usec -		\
-				     tstart_time.tv_usec))/1000000.0)))
+static void
+sleep_until(double when)
+{
+    double delta = when - now();
+    struct timespec ts;
+
+    if (delta <= 0)
+        return;
+    ts.tv_sec = (time_t)delta;
+    ts.tv_nsec = (long)((delta - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
 
-int
-main(argc, argv)
-    int argc;
-    char **argv;
+static void
+add_sample(struct samples *s, unsigned long val)
 {
-    krb5_ccache ccache = NULL;
-    char *cache_name = NULL;		/* -f option */
-    int option;
-    int errflg = 0;
-    krb5_error_code code;
-    int num_to_check, n, i, j, repeat_count, counter;
-    int n_tried, errors;
-    char prefix[BUFSIZ], client[4096], server[4096];
-    int depth;
-    char ctmp[4096], ctmp2[BUFSIZ], stmp[4096], stmp2[BUFSIZ];
-    krb5_principal client_princ;
-    krb5_error_code retval;
-
-    krb5_init_context(&test_context);
-
-    if (strrchr(argv[0], '/'))
-	prog = strrchr(argv[0], '/')+1;
-    else
-	prog = argv[0];
-
-    num_to_check = 0;
-    depth = 1;
-    repeat_count = 1;
-    brief = 0;
-    n_tried = 0;
-    errors = 0;
-
-    while ((option = getopt(argc, argv, "D:p:n:c:R:P:e:bvr:t")) != -1) {
-	switch (option) {
-	case 't':
-	    do_timer = 1;
-	    break;
-	case 'b':
-	    brief = 1;
-	    break;
-	case 'v':
-	    brief = 0;
-	    break;
-	case 'R':
-	    repeat_count = atoi(optarg); /* how many times? */
-	    break;
-	case 'r':
-	    cur_realm = optarg;
-	    break;
-	case 'D':
-	    depth = atoi(optarg);       /* how deep to go */
-	    break;
-	case 'p':                       /* prefix name to check */
-	    strncpy(prefix, optarg, sizeof(prefix) - 1);
-	    prefix[sizeof(prefix) - 1] = '\0';
-	    break;
-       case 'n':                        /* how many to check */
-	    num_to_check = atoi(optarg);
-	    break;
-	case 'P':
-	    patypedata[0] = atoi(optarg);
-	    patype = patypedata;
-	    break;
-	case 'c':
-	    if (ccache == NULL) {
-		cache_name = optarg;
-
-		code = krb5_cc_resolve (test_context, cache_name, &ccache);
-		if (code != 0) {
-		    com_err (prog, code, "resolving %s", cache_name);
-		    errflg++;
-		}
-	    } else {
-		fprintf(stderr, "Only one -c option allowed\n");
-		errflg++;
-	    }
-	    break;
-	case '?':
-	default:
-	    errflg++;
-	    break;
-	}
+    unsigned long *nvals;
+    size_t nalloc;
+
+    if (s->count == s->alloc) {
+        nalloc = s->alloc ? s->alloc * 2 : 1024;
+        nvals = realloc(s->vals, nalloc * sizeof(*nvals));
+        if (nvals == NULL)
+            return;
+        s->vals = nvals;
+        s->alloc = nalloc;
     }
+    s->vals[s->count++] = val;
+}
 
-    if (!(num_to_check && prefix[0])) usage(prog, 1);
-
-    if (!cur_realm) {
-	if ((retval = krb5_get_default_realm(test_context, &cur_realm))) {
-	    com_err(prog, retval, "while retrieving default realm name");
-	    exit(1);
-	}
+/* Parse a mix specification such as "as=1,tgs=4". */
+static void
+parse_mix(const char *spec)
+{
+    char *copy, *tok, *save = NULL, *eq;
+    int i;
+
+    for (i = 0; i < NKINDS; i++)
+        weights[i] = 0;
+    copy = strdup(spec);
+    if (copy == NULL)
+        exit(1);
+    for (tok = strtok_r(copy, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save)) {
+        eq = strchr(tok, '=');
+        if (eq == NULL)
+            usage();
+        *eq = '\0';
+        for (i = 0; i < NKINDS; i++) {
+            if (strcmp(tok, kind_names[i]) == 0)
+                break;
+        }
+        if (i == NKINDS)
+            usage();
+        weights[i] = atoi(eq + 1);
+        if (weights[i] < 0)
+            usage();
     }
+    free(copy);
+}
 
-    if (ccache == NULL) {
-	if ((code = krb5_cc_default(test_context, &ccache))) {
-	    com_err(prog, code, "while getting default ccache");
-	    exit(1);
-	}
-    }
+/* Return the kind of the k-th request in the schedule. */
+static enum req_kind
+kind_of_request(unsigned long k)
+{
+    int pos = k % total_weight, i;
 
-    memset(ctmp, 0, sizeof(ctmp));
-    memset(stmp, 0, sizeof(stmp));
-
-    for (counter = 0; counter < repeat_count; counter++) {
-      fprintf(stderr, "\nRound %d\n", counter);
-
-      for (n = 1; n <= num_to_check; n++) {
-	/* build the new principal name */
-	/* we can't pick random names because we need to generate all the names
-	   again given a prefix and count to test the db lib and kdb */
-	ctmp[0] = '\0';
-	for (i = 1; i <= depth; i++) {
-	  (void) snprintf(ctmp2, sizeof(ctmp2), "%s%s%d-DEPTH-%d",
-			  (i != 1) ? "/" : "", prefix, n, i);
-	  ctmp2[sizeof(ctmp2) - 1] = '\0';
-	  strncat(ctmp, ctmp2, sizeof(ctmp) - 1 - strlen(ctmp));
-	  ctmp[sizeof(ctmp) - 1] = '\0';
-	  snprintf(client, sizeof(client), "%s@%s", ctmp, cur_realm);
-
-	  if (get_tgt (test_context, client, &client_princ, ccache)) {
-	    errors++;
-	    n_tried++;
-	    continue;
-	  }
-	  n_tried++;
-
-	  stmp[0] = '\0';
-	  for (j = 1; j <= depth; j++) {
-	    (void) snprintf(stmp2, sizeof(stmp2), "%s%s%d-DEPTH-%d",
-			    (j != 1) ? "/" : "", prefix, n, j);
-	    stmp2[sizeof (stmp2) - 1] = '\0';
-	    strncat(stmp, stmp2, sizeof(stmp) - 1 - strlen(stmp));
-	    stmp[sizeof(stmp) - 1] = '\0';
-	    snprintf(server, sizeof(server), "%s@%s", stmp, cur_realm);
-	    if (verify_cs_pair(test_context, client, client_princ,
-			       stmp, cur_realm, n, i, j, ccache))
-	      errors++;
-	    n_tried++;
-	  }
-	  krb5_free_principal(test_context, client_princ);
-	}
-      }
+    for (i = 0; i < NKINDS - 1; i++) {
+        if (pos < weights[i])
+            break;
+        pos -= weights[i];
     }
-    fprintf (stderr, "\nTried %d.  Got %d errors.\n", n_tried, errors);
-    if (do_timer) {
-	if (in_tkt_times.ht_observations)
-	    fprintf(stderr,
-		    "%8d  AS_REQ requests: %9.6f average (min: %9.6f, max:%9.6f)\n",
-		    in_tkt_times.ht_observations,
-		    in_tkt_times.ht_cumulative /
-		    (float) in_tkt_times.ht_observations,
-		    in_tkt_times.ht_min,
-		    in_tkt_times.ht_max);
-	if (tgs_req_times.ht_observations)
-	    fprintf(stderr,
-		    "%8d TGS_REQ requests: %9.6f average (min: %9.6f, max:%9.6f)\n",
-		    tgs_req_times.ht_observations,
-		    tgs_req_times.ht_cumulative /
-		    (float) tgs_req_times.ht_observations,
-		    tgs_req_times.ht_min,
-		    tgs_req_times.ht_max);
-    }
-
-    (void) krb5_cc_close(test_context, ccache);
-
-    krb5_free_context(test_context);
-
-    exit(errors);
-  }
-
+    return i;
+}
 
 static krb5_error_code
-get_server_key(context, server, enctype, key)
-    krb5_context context;
-    krb5_principal server;
-    krb5_enctype enctype;
-    krb5_keyblock ** key;
+do_as(struct thread_state *ts, krb5_ccache armor_cc)
 {
-    krb5_error_code retval;
-    krb5_encrypt_block eblock;
-    char * string;
-    krb5_data salt;
-    krb5_data pwd;
+    krb5_error_code ret;
+    krb5_get_init_creds_opt *opt;
+    krb5_creds creds;
+
+    ret = krb5_get_init_creds_opt_alloc(ts->ctx, &opt);
+    if (ret)
+        return ret;
+    if (armor_cc != NULL) {
+        ret = krb5_get_init_creds_opt_set_fast_ccache(ts->ctx, opt, armor_cc);
+        if (!ret) {
+            ret = krb5_get_init_creds_opt_set_fast_flags(ts->ctx, opt,
+                                                         KRB5_FAST_REQUIRED);
+        }
+        if (ret)
+            goto cleanup;
+    }
+    ret = krb5_get_init_creds_password(ts->ctx, &creds, client_princ,
+                                       password, NULL, NULL, 0, NULL, opt);
+    if (!ret)
+        krb5_free_cred_contents(ts->ctx, &creds);
 
-    if ((retval = krb5_principal2salt(context, server, &salt)))
-	return retval;
+cleanup:
+    krb5_get_init_creds_opt_free(ts->ctx, opt);
+    return ret;
+}
 
-    if ((retval = krb5_unparse_name(context, server, &string)))
-	goto cleanup_salt;
+static krb5_error_code
+do_tgs(struct thread_state *ts)
+{
+    krb5_error_code ret;
+    krb5_creds in_creds, *out_creds;
+
+    memset(&in_creds, 0, sizeof(in_creds));
+    in_creds.client = client_princ;
+    in_creds.server = service_princ;
+    ret = krb5_get_credentials(ts->ctx, KRB5_GC_NO_STORE, ts->client_cc,
+                               &in_creds, &out_creds);
+    if (!ret)
+        krb5_free_creds(ts->ctx, out_creds);
+    return ret;
+}
 
-    pwd.data = string;
-    pwd.length = strlen(string);
+static krb5_error_code
+do_s4u(struct thread_state *ts)
+{
+    krb5_error_code ret;
+    krb5_creds in_creds, *out_creds;
+
+    memset(&in_creds, 0, sizeof(in_creds));
+    in_creds.client = client_princ;
+    in_creds.server = service_princ;
+    ret = krb5_get_credentials_for_user(ts->ctx, KRB5_GC_NO_STORE,
+                                        ts->service_cc, &in_creds, NULL,
+                                        &out_creds);
+    if (!ret)
+        krb5_free_creds(ts->ctx, out_creds);
+    return ret;
+}
 
-    if ((*key = (krb5_keyblock *)malloc(sizeof(krb5_keyblock)))) {
-    	krb5_use_enctype(context, &eblock, enctype);
-    	if ((retval = krb5_string_to_key(context, &eblock, *key, &pwd, &salt)))
-	    free(*key);
-    } else
-        retval = ENOMEM;
+/* Store a TGT for princ in a new memory ccache, using the password if one is
+ * given or the keytab otherwise. */
+static krb5_error_code
+get_tgt(krb5_context ctx, krb5_principal princ, const char *pw,
+        krb5_ccache *cc_out)
+{
+    krb5_error_code ret;
+    krb5_creds creds;
+    krb5_keytab kt = NULL;
+    krb5_ccache cc = NULL;
 
-    free(string);
+    memset(&creds, 0, sizeof(creds));
+    ret = krb5_cc_new_unique(ctx, "MEMORY", NULL, &cc);
+    if (ret)
+        return ret;
+    ret = krb5_cc_initialize(ctx, cc, princ);
+    if (ret)
+        goto cleanup;
+    if (pw != NULL) {
+        ret = krb5_get_init_creds_password(ctx, &creds, princ, pw, NULL, NULL,
+                                           0, NULL, NULL);
+    } else {
+        ret = (keytab_name != NULL) ? krb5_kt_resolve(ctx, keytab_name, &kt) :
+            krb5_kt_default(ctx, &kt);
+        if (ret)
+            goto cleanup;
+        ret = krb5_get_init_creds_keytab(ctx, &creds, princ, kt, 0, NULL,
+                                         NULL);
+    }
+    if (ret)
+        goto cleanup;
+    ret = krb5_cc_store_cred(ctx, cc, &creds);
+    if (ret)
+        goto cleanup;
+    *cc_out = cc;
+    cc = NULL;
 
-cleanup_salt:
-    free(salt.data);
-    return retval;
+cleanup:
+    krb5_free_cred_contents(ctx, &creds);
+    if (kt != NULL)
+        krb5_kt_close(ctx, kt);
+    if (cc != NULL)
+        krb5_cc_destroy(ctx, cc);
+    return ret;
 }
 
-int verify_cs_pair(context, p_client_str, p_client, service, hostname,
-		   p_num, c_depth, s_depth, ccache)
-    krb5_context context;
-    char *p_client_str;
-    krb5_principal p_client;
-    char * service;
-    char * hostname;
-    int p_num, c_depth, s_depth;
-    krb5_ccache ccache;
+static krb5_error_code
+init_thread(struct thread_state *ts)
 {
-    krb5_error_code 	  retval;
-    krb5_creds 	 	  creds;
-    krb5_creds 		* credsp = NULL;
-    krb5_ticket 	* ticket = NULL;
-    krb5_keyblock 	* keyblock = NULL;
-    krb5_auth_context 	  auth_context = NULL;
-    krb5_data		  request_data = empty_data();
-    char		* sname;
-    float		  dt;
-
-    if (brief)
-      fprintf(stderr, "\tprinc (%d) client (%d) for server (%d)\n",
-	      p_num, c_depth, s_depth);
-    else
-      fprintf(stderr, "\tclient %s for server %s\n", p_client_str,
-	      service);
-
-    /* Initialize variables */
-    memset(&creds, 0, sizeof(creds));
-
-    /* Do client side */
-    if (asprintf(&sname, "%s@%s", service, hostname) >= 0) {
-	retval = krb5_parse_name(context, sname, &creds.server);
-	free(sname);
+    krb5_error_code ret;
+
+    ret = krb5_init_context(&ts->ctx);
+    if (ret)
+        return ret;
+    /* A UDP preference limit of 1 byte sends every request over TCP. */
+    if (use_tcp)
+        ts->ctx->udp_pref_limit = 1;
+    if (weights[REQ_TGS] > 0) {
+        ret = get_tgt(ts->ctx, client_princ, password, &ts->client_cc);
+        if (ret)
+            return ret;
     }
-    else
-	retval = ENOMEM;
-    if (retval)
-	return(retval);
-
-    /* obtain ticket & session key */
-    if ((retval = krb5_cc_get_principal(context, ccache, &creds.client))) {
-	com_err(prog, retval, "while getting client princ for %s", hostname);
-	return retval;
-    }
-
-    if ((retval = krb5_get_credentials(context, 0,
-                                      ccache, &creds, &credsp))) {
-	com_err(prog, retval, "while getting creds for %s", hostname);
-	return retval;
+    if (weights[REQ_S4U] > 0 || weights[REQ_FAST] > 0) {
+        ret = get_tgt(ts->ctx, service_princ, NULL, &ts->service_cc);
+        if (ret)
+            return ret;
     }
+    return 0;
+}
 
-    if (do_timer)
-	swatch_on();
-
-    if ((retval = krb5_mk_req_extended(context, &auth_context, 0, NULL,
-			            credsp, &request_data))) {
-	com_err(prog, retval, "while preparing AP_REQ for %s", hostname);
-	goto cleanup;
+static void *
+run_thread(void *arg)
+{
+    struct thread_state *ts = arg;
+    krb5_error_code ret;
+    enum req_kind kind;
+    unsigned long k;
+    double due, done;
+
+    for (k = ts->index; k < nrequests; k += nthreads) {
+        due = start_time + k / rate;
+        if (now() > due + 0.001)
+            ts->late++;
+        else
+            sleep_until(due);
+
+        kind = kind_of_request(k);
+        switch (kind) {
+        case REQ_AS:
+            ret = do_as(ts, NULL);
+            break;
+        case REQ_TGS:
+            ret = do_tgs(ts);
+            break;
+        case REQ_S4U:
+            ret = do_s4u(ts);
+            break;
+        default:
+            ret = do_as(ts, ts->service_cc);
+            break;
+        }
+        done = now();
+
+        if (ret) {
+            ts->errors[kind]++;
+            if (verbose && ret != ts->last_err)
+                com_err(prog, ret, "in %s request", kind_names[kind]);
+            ts->last_err = ret;
+            continue;
+        }
+        add_sample(&ts->lat[kind], (unsigned long)((done - due) * 1e6));
     }
+    return NULL;
+}
 
-    krb5_auth_con_free(context, auth_context);
-    auth_context = NULL;
+static int
+compare_ulong(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
 
-    /* Do server side now */
-    if ((retval = get_server_key(context, credsp->server,
-				credsp->keyblock.enctype, &keyblock))) {
-	com_err(prog, retval, "while getting server key for %s", hostname);
-	goto cleanup;
-    }
+    return (x > y) - (x < y);
+}
 
-    if (krb5_auth_con_init(context, &auth_context)) {
-	com_err(prog, retval, "while creating auth_context for %s", hostname);
-	goto cleanup;
-    }
+static double
+percentile_ms(const struct samples *s, double pct)
+{
+    size_t i;
 
-    if (krb5_auth_con_setuseruserkey(context, auth_context, keyblock)) {
-	com_err(prog, retval, "while setting auth_context key %s", hostname);
-	goto cleanup;
-    }
+    if (s->count == 0)
+        return 0.0;
+    i = (size_t)(pct / 100.0 * (s->count - 1) + 0.5);
+    return s->vals[i] / 1000.0;
+}
 
-    if ((retval = krb5_rd_req(context, &auth_context, &request_data,
-			     NULL /* server */, 0, NULL, &ticket))) {
-	com_err(prog, retval, "while decoding AP_REQ for %s", hostname);
-	goto cleanup;
+/* Merge the samples of all threads into ts[0] and print a report.  Return
+ * true if the run met the latency and error limits. */
+static int
+report(struct thread_state *ts, double elapsed)
+{
+    struct samples *all;
+    unsigned long ok = 0, errors = 0, late = 0, kerrs;
+    double p99;
+    int i, t, pass = 1;
+    size_t j;
+
+    for (i = 0; i < NKINDS; i++) {
+        all = &ts[0].lat[i];
+        for (t = 1; t < nthreads; t++) {
+            for (j = 0; j < ts[t].lat[i].count; j++)
+                add_sample(all, ts[t].lat[i].vals[j]);
+            ts[0].errors[i] += ts[t].errors[i];
+        }
+        qsort(all->vals, all->count, sizeof(*all->vals), compare_ulong);
+        ok += all->count;
+        errors += ts[0].errors[i];
     }
-
-    if (do_timer) {
-	dt = swatch_eltime();
-	tgs_req_times.ht_cumulative += dt;
-	tgs_req_times.ht_observations++;
-	if (dt > tgs_req_times.ht_max)
-	    tgs_req_times.ht_max = dt;
-	if (dt < tgs_req_times.ht_min)
-	    tgs_req_times.ht_min = dt;
+    for (t = 0; t < nthreads; t++)
+        late += ts[t].late;
+
+    printf("offered %.1f requests/s for %.1f s over %s with %d threads\n",
+           rate, duration, use_tcp ? "TCP" : "UDP", nthreads);
+    printf("%lu requests, %lu ok, %lu errors, %lu late, "
+           "%.1f requests/s achieved\n", nrequests, ok, errors, late,
+           (ok + errors) / elapsed);
+    for (i = 0; i < NKINDS; i++) {
+        all = &ts[0].lat[i];
+        kerrs = ts[0].errors[i];
+        if (all->count == 0 && kerrs == 0)
+            continue;
+        p99 = percentile_ms(all, 99);
+        printf("%-4s %8lu ok %6lu errors  latency ms: p50 %.3f p90 %.3f "
+               "p99 %.3f max %.3f\n", kind_names[i],
+               (unsigned long)all->count, kerrs, percentile_ms(all, 50),
+               percentile_ms(all, 90), p99,
+               all->count ? all->vals[all->count - 1] / 1000.0 : 0.0);
+        if (max_p99_ms > 0 && p99 > max_p99_ms) {
+            printf("%s p99 latency %.3f ms exceeds limit %.3f ms\n",
+                   kind_names[i], p99, max_p99_ms);
+            pass = 0;
+        }
     }
-
-    if (!(krb5_principal_compare(context,ticket->enc_part2->client,p_client))){
-    	char *returned_client;
-        if ((retval = krb5_unparse_name(context, ticket->enc_part2->client,
-			       	       &returned_client)))
-	    com_err (prog, retval,
-		     "Client not as expected, but cannot unparse client name");
-      	else
-	    com_err (prog, 0, "Client not as expected (%s).", returned_client);
-	retval = KRB5_PRINC_NOMATCH;
-      	free(returned_client);
-    } else {
-	retval = 0;
+    if (errors > max_errors) {
+        printf("%lu errors exceed limit %lu\n", errors, max_errors);
+        pass = 0;
     }
-
-cleanup:
-    krb5_free_cred_contents(context, &creds);
-    krb5_free_ticket(context, ticket);
-    krb5_auth_con_free(context, auth_context);
-    krb5_free_keyblock(context, keyblock);
-    krb5_free_data_contents(context, &request_data);
-    krb5_free_creds(context, credsp);
-
-    return retval;
+    return pass;
 }
 
-int get_tgt (context, p_client_str, p_client, ccache)
-    krb5_context context;
-    char *p_client_str;
-    krb5_principal *p_client;
-    krb5_ccache ccache;
+int
+main(int argc, char **argv)
 {
-    char *cache_name = NULL;		/* -f option */
-    long lifetime = KRB5_DEFAULT_LIFE;	/* -l option */
-    int options = KRB5_DEFAULT_OPTIONS;
-    krb5_error_code code;
-    krb5_creds my_creds;
-    krb5_timestamp start;
-    krb5_principal tgt_server;
-    float dt;
-
-    if (!brief)
-      fprintf(stderr, "\tgetting TGT for %s\n", p_client_str);
-
-    if ((code = krb5_timeofday(context, &start))) {
-	com_err(prog, code, "while getting time of day");
-	return(-1);
+    krb5_error_code ret;
+    krb5_context ctx;
+    struct thread_state *ts;
+    double elapsed;
+    int c, i, pass;
+
+    prog = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+    while ((c = getopt(argc, argv, "c:w:s:k:r:d:t:m:Tl:e:v")) != -1) {
+        switch (c) {
+        case 'c':
+            client_name = optarg;
+            break;
+        case 'w':
+            password = optarg;
+            break;
+        case 's':
+            service_name = optarg;
+            break;
+        case 'k':
+            keytab_name = optarg;
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'm':
+            parse_mix(optarg);
+            break;
+        case 'T':
+            use_tcp = 1;
+            break;
+        case 'l':
+            max_p99_ms = atof(optarg);
+            break;
+        case 'e':
+            max_errors = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage();
+        }
     }
-
-    memset(&my_creds, 0, sizeof(my_creds));
-
-    if ((code = krb5_parse_name (context, p_client_str, p_client))) {
-	com_err (prog, code, "when parsing name %s", p_client_str);
-	return(-1);
+    total_weight = 0;
+    for (i = 0; i < NKINDS; i++)
+        total_weight += weights[i];
+    if (client_name == NULL || password == NULL || service_name == NULL ||
+        optind != argc || rate <= 0 || duration <= 0 || nthreads <= 0 ||
+        total_weight <= 0)
+        usage();
+    nrequests = (unsigned long)(rate * duration);
+
+    ret = krb5_init_context(&ctx);
+    if (ret) {
+        com_err(prog, ret, "while initializing krb5");
+        exit(1);
     }
-
-
-    if ((code = krb5_build_principal_ext(context, &tgt_server,
-				krb5_princ_realm(context, *p_client)->length,
-				krb5_princ_realm(context, *p_client)->data,
-				tgtname.length,
-				tgtname.data,
-				krb5_princ_realm(context, *p_client)->length,
-				krb5_princ_realm(context, *p_client)->data,
-				0))) {
-	com_err(prog, code, "when setting up tgt principal");
-	return(-1);
+    ret = krb5_parse_name(ctx, client_name, &client_princ);
+    if (!ret)
+        ret = krb5_parse_name(ctx, service_name, &service_princ);
+    if (ret) {
+        com_err(prog, ret, "while parsing principal names");
+        exit(1);
     }
 
-    my_creds.client = *p_client;
-    my_creds.server = tgt_server;
-
-    code = krb5_cc_initialize (context, ccache, *p_client);
-    if (code != 0) {
-	com_err (prog, code, "when initializing cache %s",
-		 cache_name?cache_name:"");
-	return(-1);
+    ts = calloc(nthreads, sizeof(*ts));
+    if (ts == NULL)
+        exit(1);
+    for (i = 0; i < nthreads; i++) {
+        ts[i].index = i;
+        ret = init_thread(&ts[i]);
+        if (ret) {
+            com_err(prog, ret, "while setting up thread %d", i);
+            exit(1);
+        }
     }
 
-    my_creds.times.starttime = 0;	/* start timer when request
-					   gets to KDC */
-    my_creds.times.endtime = start + lifetime;
-    my_creds.times.renew_till = 0;
-
-    if (do_timer)
-	swatch_on();
-
-    code = krb5_get_in_tkt_with_password(context, options, 0,
-					 NULL, patype, p_client_str, ccache,
-					 &my_creds, 0);
-    if (do_timer) {
-	dt = swatch_eltime();
-	in_tkt_times.ht_cumulative += dt;
-	in_tkt_times.ht_observations++;
-	if (dt > in_tkt_times.ht_max)
-	    in_tkt_times.ht_max = dt;
-	if (dt < in_tkt_times.ht_min)
-	    in_tkt_times.ht_min = dt;
+    start_time = now() + 0.1;
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&ts[i].tid, NULL, run_thread, &ts[i]) != 0) {
+            fprintf(stderr, "%s: cannot create thread\n", prog);
+            exit(1);
+        }
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(ts[i].tid, NULL);
+    elapsed = now() - start_time;
+
+    pass = report(ts, elapsed);
+
+    for (i = 0; i < nthreads; i++) {
+        if (ts[i].client_cc != NULL)
+            krb5_cc_destroy(ts[i].ctx, ts[i].client_cc);
+        if (ts[i].service_cc != NULL)
+            krb5_cc_destroy(ts[i].ctx, ts[i].service_cc);
+        for (c = 0; c < NKINDS; c++)
+            free(ts[i].lat[c].vals);
+        krb5_free_context(ts[i].ctx);
     }
-    my_creds.server = my_creds.client = 0;
-    krb5_free_principal(context, tgt_server);
-    krb5_free_cred_contents(context, &my_creds);
-    if (code != 0) {
-	com_err (prog, code, "while getting initial credentials");
-	return(-1);
-      }
-
-    return(0);
+    free(ts);
+    krb5_free_principal(ctx, client_princ);
+    krb5_free_principal(ctx, service_princ);
+    krb5_free_context(ctx);
+    return pass ? 0 : 1;
 }
@@ -0,0 +1,22 @@
+#!/usr/bin/python
+from k5test import *
+import re
+
+hammer = os.path.join(buildtop, 'tests', 'hammer', 'kdc5_hammer')
+realm = K5Realm(get_creds=False)
+
+# Offer a modest load of every request kind over both transports.  The
+# latency limit is generous; it only catches gross regressions such as a
+# KDC which stops keeping up with the offered rate.
+args = [hammer, '-c', realm.user_princ, '-w', password('user'),
+        '-s', realm.host_princ, '-k', realm.keytab, '-r', '100', '-d', '2',
+        '-t', '4', '-m', 'as=2,tgs=4,s4u=1,fast=1', '-l', '500']
+for extra in ([], ['-T']):
+    output = realm.run_as_client(args + extra)
+    if ', 0 errors,' not in output:
+        fail('kdc5_hammer reported errors')
+    for kind in ('as', 'tgs', 's4u', 'fast'):
+        if not re.search(r'^%s +\d+ ok +0 errors' % kind, output, re.M):
+            fail('kdc5_hammer did not report %s requests' % kind)
+
+success('KDC load generator')
@@ -0,0 +1,131 @@
+#!/usr/bin/python
+from k5test import *
+import re
+import select
+import shutil
+
+# Check the header and entries of the update log against a list of the
+# principal names which should have been logged, in order.
+def check_ulog(realm, princs):
+    output = realm.run_as_master([kproplog])
+    m = re.search(r'Last serial # : (\d+)', output)
+    if not m or int(m.group(1)) != len(princs):
+        fail('Unexpected last serial number in update log')
+    snos = [int(s) for s in re.findall(r'Update serial # : (\d+)', output)]
+    if snos != range(1, len(princs) + 1):
+        fail('Update log serial numbers are not contiguous')
+    names = re.findall(r'Update principal : (\S+)', output)
+    if names != [p if '@' in p else '%s@%s' % (p, realm.realm)
+                 for p in princs]:
+        fail('Unexpected principals in update log')
+    if 'Update committed : False' in output:
+        fail('Uncommitted entry in update log')
+    if 'Log state : Stable' not in output:
+        fail('Update log is not stable')
+
+# Wait for kpropd to report that it applied updates from the master.
+# The slave poll interval is long, so this only happens in time if the
+# master answers the slave's held request when the log advances.
+def wait_for_update(kpropd_proc):
+    while True:
+        r, w, x = select.select([kpropd_proc.stdout], [], [], 10)
+        if not r:
+            fail('Timed out waiting for kpropd to receive updates')
+        line = kpropd_proc.stdout.readline()
+        if line == '':
+            fail('kpropd exited unexpectedly')
+        output(line)
+        if 'Update transfer from master was OK' in line:
+            return
+
+def check_slave_princ(realm, princ):
+    output = realm.run_as_slave([kadmin_local, '-q', 'getprinc ' + princ])
+    if ('Principal: %s@%s' % (princ, realm.realm)) not in output:
+        fail('Principal %s did not reach the slave' % princ)
+
+# Check that a principal's record on the slave matches the master's.
+def compare_princ(realm, princ):
+    query = ['-q', 'getprinc ' + princ]
+    if (realm.run_as_slave([kadmin_local] + query) !=
+        realm.run_as_master([kadmin_local] + query)):
+        fail('Principal %s differs between master and slave' % princ)
+
+# Log updates with a group commit window, from kadmin.local and from
+# kadmind.  Updates left pending must reach the log when the database is
+# closed, and each update must still get its own serial number.
+conf = {'master': {'realms': {'$realm': {
+                'iprop_enable': 'true',
+                'iprop_port': '$port4',
+                'iprop_logfile': '$testdir/master-db.ulog',
+                'iprop_ulog_sync_window': '1000'}}},
+        'slave': {'realms': {'$realm': {
+                'iprop_enable': 'true',
+                'iprop_port': '$port4',
+                'iprop_logfile': '$testdir/slave-db.ulog',
+                'iprop_slave_poll': '600'}}}}
+realm = K5Realm(kdc_conf=conf, create_user=False, create_host=False,
+                get_creds=False)
+princs = []
+for i in range(3):
+    realm.addprinc('lp%d' % i)
+    princs.append('lp%d' % i)
+realm.run_kadminl('delprinc -force lp1')
+princs.append('lp1')
+check_ulog(realm, princs)
+
+realm.addprinc(realm.admin_princ, password('admin'))
+princs.append(realm.admin_princ)
+realm.start_kadmind()
+realm.prep_kadmin()
+for i in range(5):
+    realm.run_kadmin('addprinc -randkey rp%d' % i)
+    princs.append('rp%d' % i)
+realm.run_kadmin('cpw -randkey rp0')
+princs.append('rp0')
+realm.stop_kadmind()
+check_ulog(realm, princs)
+
+# Start a slave from an iprop dump of the master, and check that
+# updates made through kadmin.local and kadmind reach it promptly.
+kiprop = 'kiprop/%s' % hostname
+realm.addprinc(kiprop)
+realm.extract_keytab(kiprop, realm.keytab)
+dumpfile = os.path.join(realm.testdir, 'dump')
+realm.run_as_master([kdb5_util, 'dump', '-i', dumpfile])
+realm.run_as_slave([kdb5_util, 'load', '-i', dumpfile])
+shutil.copyfile(os.path.join(realm.testdir, 'stash'),
+                os.path.join(realm.testdir, 'slave-stash'))
+realm.addprinc('sp0')
+realm.start_kadmind()
+kpropd_proc = realm.start_kpropd(['-d', '-s', realm.keytab],
+                                 'Update transfer from master was OK')
+check_slave_princ(realm, 'sp0')
+realm.addprinc('sp1')
+wait_for_update(kpropd_proc)
+check_slave_princ(realm, 'sp1')
+realm.run_kadmin('addprinc -randkey sp2')
+wait_for_update(kpropd_proc)
+check_slave_princ(realm, 'sp2')
+stop_daemon(kpropd_proc)
+
+# Make changes while the slave is down, so that it replays them as one
+# batch: several updates to one principal, a principal which is added
+# and deleted, and one which is deleted and added again.
+realm.run_kadminl('modprinc -maxlife "1 hour" sp1')
+realm.run_kadminl('cpw -randkey sp1')
+realm.run_kadminl('modprinc -maxrenewlife "2 hours" sp1')
+realm.addprinc('sp3')
+realm.run_kadminl('delprinc -force sp3')
+realm.run_kadminl('delprinc -force sp0')
+realm.addprinc('sp0')
+realm.run_kadminl('modprinc -allow_tix sp0')
+kpropd_proc = realm.start_kpropd(['-d', '-s', realm.keytab],
+                                 'Update transfer from master was OK')
+compare_princ(realm, 'sp0')
+compare_princ(realm, 'sp1')
+output = realm.run_as_slave([kadmin_local, '-q', 'listprincs'])
+if 'sp3@' in output:
+    fail('Deleted principal sp3 present on slave')
+stop_daemon(kpropd_proc)
+
+success('Update log group commit and incremental propagation')
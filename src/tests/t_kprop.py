@@ -0,0 +1,190 @@
+#!/usr/bin/python
+from k5test import *
+import re
+import shutil
+
+# Start a one-shot kpropd for the slave, loading with our kdb5_util.
+def start_kpropd(realm):
+    args = ['-d', '-S', '-P', str(realm.portbase + 5), '-f', slave_dump,
+            '-p', kdb5_util, '-a', acl_file, '-s', realm.keytab]
+    return realm.start_kpropd(args, 'waiting for a kprop connection')
+
+def run_kprop(realm, args, expected_code=0):
+    return realm.run_as_master([kprop, '-P', str(realm.portbase + 5),
+                                '-s', realm.keytab] + args + [hostname],
+                               expected_code=expected_code)
+
+def check_slave_princs(realm, present, absent):
+    output = realm.run_as_slave([kadmin_local, '-q', 'listprincs'])
+    for princ in present:
+        if ('%s@%s' % (princ, realm.realm)) not in output:
+            fail('Principal %s missing from slave' % princ)
+    for princ in absent:
+        if ('%s@%s' % (princ, realm.realm)) in output:
+            fail('Principal %s unexpectedly present on slave' % princ)
+
+# The master keeps an update log, so that dumps can carry its serial
+# number.  The slave's kpropd must not run in iprop mode, so the slave
+# only gets an update log for the last tests.
+conf = {'master': {'realms': {'$realm': {
+                'iprop_enable': 'true',
+                'iprop_port': '$port4',
+                'iprop_logfile': '$testdir/master-db.ulog'}}}}
+realm = K5Realm(create_user=False, get_creds=False, kdc_conf=conf)
+slave_dump = os.path.join(realm.testdir, 'slave-datatrans')
+acl_file = os.path.join(realm.testdir, 'kpropd-acl')
+f = open(acl_file, 'w')
+f.write('%s\n' % realm.host_princ)
+f.close()
+shutil.copyfile(os.path.join(realm.testdir, 'stash'),
+                os.path.join(realm.testdir, 'slave-stash'))
+
+# Propagate a dump file, using the original protocol.
+realm.addprinc('fileprinc')
+dumpfile = os.path.join(realm.testdir, 'dump')
+realm.run_as_master([kdb5_util, 'dump', dumpfile])
+kpropd_proc = start_kpropd(realm)
+run_kprop(realm, ['-f', dumpfile])
+if await_daemon_exit(kpropd_proc) != 0:
+    fail('kpropd failed')
+check_slave_princs(realm, ['fileprinc'], [])
+
+# Stream a dump from kdb5_util straight to the slave's kdb5_util load.
+realm.addprinc('streamprinc')
+for i in range(100):
+    realm.run_kadminl('addprinc -randkey bulk%d' % i)
+kpropd_proc = start_kpropd(realm)
+run_kprop(realm, ['-D', '-f', dumpfile, '-p', kdb5_util])
+if await_daemon_exit(kpropd_proc) != 0:
+    fail('kpropd failed')
+check_slave_princs(realm, ['fileprinc', 'streamprinc', 'bulk0', 'bulk99'],
+                   [])
+master_dump = realm.run_as_master([kdb5_util, 'dump'])
+slave_load = realm.run_as_slave([kdb5_util, 'dump'])
+if master_dump != slave_load:
+    fail('Slave database differs from master after streamed propagation')
+
+# Stream a dump with a policy and principals using it.
+realm.run_kadminl('addpol -minlength 6 -maxfailure 3 binpol')
+realm.run_kadminl('addprinc -randkey -policy binpol binprinc')
+kpropd_proc = start_kpropd(realm)
+run_kprop(realm, ['-D', '-f', dumpfile, '-p', kdb5_util])
+if await_daemon_exit(kpropd_proc) != 0:
+    fail('kpropd failed')
+master_dump = realm.run_as_master([kdb5_util, 'dump'])
+slave_load = realm.run_as_slave([kdb5_util, 'dump'])
+if master_dump != slave_load:
+    fail('Slave database differs from master after binary propagation')
+
+# Load a binary dump file, which kdb5_util maps rather than reads, and
+# check that a truncated or altered one is rejected without loading any
+# of it.
+realm.addprinc('fileprinc2')
+bdump = os.path.join(realm.testdir, 'bdump')
+realm.run_as_master([kdb5_util, 'dump', '-b', bdump])
+f = open(bdump, 'rb')
+bdata = f.read()
+f.close()
+if not bdata.startswith('kdb5_util binary_dump version 1\n'):
+    fail('Unexpected binary dump header')
+bad_dumps = [bdata[:-20], bdata[:-10] + chr(ord(bdata[-10]) ^ 1) + bdata[-9:]]
+for bad in bad_dumps:
+    f = open(bdump + '.bad', 'wb')
+    f.write(bad)
+    f.close()
+    output = realm.run_as_slave([kdb5_util, 'load', '-update', bdump + '.bad'],
+                                expected_code=1)
+    if 'truncated or damaged' not in output:
+        fail('Unexpected error loading a bad binary dump')
+    check_slave_princs(realm, ['binprinc'], ['fileprinc2'])
+
+# A dump read from standard input must be a binary one, checked as it
+# is loaded, since a text dump cut short would look complete.
+realm.run_as_master([kdb5_util, 'dump', '-b', bdump + '.1', 'fileprinc2'])
+f = open(bdump + '.1', 'rb')
+bdata1 = f.read()
+f.close()
+output = realm.run_as_slave([kdb5_util, 'load', '-'], input=bdata1[:-20],
+                            expected_code=1)
+if 'truncated or damaged' not in output:
+    fail('Unexpected error loading a truncated binary dump from stdin')
+check_slave_princs(realm, ['binprinc'], ['fileprinc2'])
+f = open(dumpfile, 'r')
+tdata = f.read()
+f.close()
+output = realm.run_as_slave([kdb5_util, 'load', '-'], input=tdata,
+                            expected_code=1)
+if 'only a binary dump' not in output:
+    fail('Unexpected error loading a text dump from stdin')
+check_slave_princs(realm, ['binprinc'], ['fileprinc2'])
+
+realm.run_as_slave([kdb5_util, 'load', bdump])
+master_dump = realm.run_as_master([kdb5_util, 'dump'])
+slave_load = realm.run_as_slave([kdb5_util, 'dump'])
+if master_dump != slave_load:
+    fail('Slave database differs from master after binary load')
+
+# If the dump fails partway through, the slave must keep its old
+# database rather than loading the records it has already received.
+realm.addprinc('failprinc')
+partial_dump = os.path.join(realm.testdir, 'partial-dump')
+f = open(partial_dump, 'w')
+f.write('#!/bin/sh\n%s "$@" | head -5\nexit 1\n' % kdb5_util)
+f.close()
+os.chmod(partial_dump, 0755)
+kpropd_proc = start_kpropd(realm)
+run_kprop(realm, ['-D', '-i1', '-f', dumpfile, '-p', partial_dump],
+          expected_code=1)
+if await_daemon_exit(kpropd_proc) == 0:
+    fail('kpropd succeeded after a failed dump')
+check_slave_princs(realm, ['streamprinc'], ['failprinc'])
+
+# On an iprop slave, a streamed iprop load cut short must also leave
+# the update log with the serial number of the old database; otherwise
+# the slave would never ask for the updates it missed.
+def slave_serial(realm):
+    output = realm.run_as_slave([kproplog, '-h'])
+    m = re.search(r'Last serial # : (\d+)', output)
+    if not m:
+        fail('No serial number in slave update log header')
+    return int(m.group(1))
+
+def master_iprop_dump(realm):
+    realm.run_as_master([kdb5_util, 'dump', '-b', '-i1', bdump])
+    f = open(bdump, 'rb')
+    data = f.read()
+    f.close()
+    return data
+
+f = open(realm.env_slave['KRB5_KDC_PROFILE'], 'r')
+profile = f.read()
+f.close()
+iprop_relations = ('\t\tiprop_enable = true\n\t\tiprop_port = %d\n'
+                   '\t\tiprop_logfile = %s\n' %
+                   (realm.portbase + 4,
+                    os.path.join(realm.testdir, 'slave-db.ulog')))
+profile = profile.replace('%s = {\n' % realm.realm,
+                          '%s = {\n%s' % (realm.realm, iprop_relations))
+slave_iprop_profile = os.path.join(realm.testdir, 'kdc.slave-iprop.conf')
+f = open(slave_iprop_profile, 'w')
+f.write(profile)
+f.close()
+realm.env_slave['KRB5_KDC_PROFILE'] = slave_iprop_profile
+realm.run_as_slave([kdb5_util, 'load', '-i', '-'],
+                   input=master_iprop_dump(realm))
+old_serial = slave_serial(realm)
+realm.addprinc('missedprinc')
+bdata = master_iprop_dump(realm)
+output = realm.run_as_slave([kdb5_util, 'load', '-i', '-'],
+                            input=bdata[:-20], expected_code=1)
+if 'truncated or damaged' not in output:
+    fail('Unexpected error loading a truncated iprop dump')
+check_slave_princs(realm, ['failprinc'], ['missedprinc'])
+if slave_serial(realm) != old_serial:
+    fail('Slave serial number advanced after a failed iprop load')
+realm.run_as_slave([kdb5_util, 'load', '-i', '-'], input=bdata)
+check_slave_princs(realm, ['missedprinc'], [])
+if slave_serial(realm) <= old_serial:
+    fail('Slave serial number not advanced after an iprop load')
+
+success('kprop database propagation')
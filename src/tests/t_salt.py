@@ -0,0 +1,36 @@
+#!/usr/bin/python
+from k5test import *
+import re
+
+# The keys of a password change are computed concurrently, but must be
+# stored in the order of the key/salt list, without duplicates.
+keysalts = ('aes256-cts:normal,aes128-cts:normal,des3-cbc-sha1:normal,'
+            'arcfour-hmac:normal,aes256-cts:special,aes128-cts:normal')
+expected = ['aes256-cts-hmac-sha1-96, no salt',
+            'aes128-cts-hmac-sha1-96, no salt',
+            'des3-cbc-sha1, no salt',
+            'arcfour-hmac, no salt',
+            'aes256-cts-hmac-sha1-96, Special']
+
+def check_keys(realm, princ, kvno):
+    output = realm.run_kadminl('getprinc ' + princ)
+    keys = re.findall(r'Key: vno (\d+), (.*)', output)
+    if [k for v, k in keys if int(v) == kvno] != expected:
+        fail('Unexpected keys for %s:\n%s' % (princ, output))
+
+realm = K5Realm(create_host=False, get_creds=False)
+realm.run_kadminl('ank -e %s -pw pw salty' % keysalts)
+check_keys(realm, 'salty', 1)
+realm.kinit('salty', 'pw')
+
+for kvno in range(2, 5):
+    realm.run_kadminl('cpw -e %s -pw pw%d salty' % (keysalts, kvno))
+    check_keys(realm, 'salty', kvno)
+realm.kinit('salty', 'pw4')
+
+# With -keepold, the new keys come first, in order.
+realm.run_kadminl('cpw -keepold -e %s -pw pw5 salty' % keysalts)
+check_keys(realm, 'salty', 5)
+realm.kinit('salty', 'pw5')
+
+success('Password change with multiple key/salt types')
@@ -40,6 +40,9 @@
 /* Avoids using clock_gettime; we probably shouldn't have to do this. */
 #define EV_USE_REALTIME 0
 #define EV_FEATURES 0x5f        /* Everything but back ends */
+#ifdef HAVE_SYS_EPOLL_H
+#define EV_USE_EPOLL 1
+#endif
 #ifdef HAVE_POLL_H
 #define EV_USE_POLL 1
 #endif
@@ -187,3 +190,18 @@ verto_convert_k5ev(struct ev_loop* loop)
 {
     return verto_convert(k5ev, 0, loop);
 }
+
+const char *
+verto_k5ev_default_backend(void)
+{
+    switch (ev_backend(EV_DEFAULT)) {
+    case EVBACKEND_EPOLL:
+        return "epoll";
+    case EVBACKEND_POLL:
+        return "poll";
+    case EVBACKEND_SELECT:
+        return "select";
+    default:
+        return "unknown";
+    }
+}
@@ -30,4 +30,7 @@
 verto_ctx *verto_new_k5ev(void);
 verto_ctx *verto_default_k5ev(void);
 
+/* Return the name of the libev back end used by the default loop. */
+const char *verto_k5ev_default_backend(void);
+
 #endif /* VERTO_K5EV_H_ */
@@ -146,6 +146,10 @@ Scripts may use the following functions and variables:
   the port needs to be reused; daemon processes will be stopped
   automatically when the script exits.
 
+* await_daemon_exit(proc): Wait for a daemon process started with
+  realm.start_server() or realm.start_kpropd() to exit by itself, and
+  return its exit status.
+
 * multipass_realms(**keywords): This is an iterator function.  Yields
   a realm for each of the standard test passes, each of which alters
   the default configuration in some way to exercise different parts of
@@ -250,6 +254,10 @@ Scripts may use the following realm methods and attributes:
 * realm.stop_kadmind(): Stop the kadmind process.  Errors if no
   kadmind is running.
 
+* realm.start_kpropd(args, sentinel): Start a kpropd in the slave KDC
+  environment, in the manner of realm.start_server().  Returns a
+  process object which can be passed to stop_daemon() to stop it.
+
 * realm.stop(): Stop any KDC and kadmind processes running on behalf
   of the realm.
 
@@ -686,6 +694,12 @@ def stop_daemon(proc):
     _daemons.remove(proc)
 
 
+def await_daemon_exit(proc):
+    code = proc.wait()
+    _daemons.remove(proc)
+    return code
+
+
 class K5Realm(object):
     """An object representing a functional krb5 test realm."""
 
@@ -887,6 +901,10 @@ class K5Realm(object):
         stop_daemon(self._kadmind_proc)
         self._kadmind_proc = None
 
+    def start_kpropd(self, args, sentinel):
+        global kpropd
+        return _start_daemon([kpropd] + args, self.env_slave, sentinel)
+
     def stop(self):
         if self._kdc_proc:
             self.stop_kdc()